@@ -175,7 +175,7 @@ let openfile ?(perm=0o644) ~mode fln : file result =
 
 
 external read:
-  file -> 'a -> int -> int ->
+  file -> 'a -> int -> int -> int64 ->
   loop -> Req.t -> unit ->
   Int_result.int =
   "uwt_fs_read_byte" "uwt_fs_read_native"
@@ -194,7 +194,7 @@ let read_write_common ~req (x: Int_result.int) =
   else
     Ok x'
 
-let read ?(pos=0) ?len t ~buf ~dim =
+let read ?(pos=0) ?len ~fd_offset t ~buf ~dim =
   let len =  match len with
   | None -> dim - pos
   | Some x -> x
@@ -203,24 +203,38 @@ let read ?(pos=0) ?len t ~buf ~dim =
     invalid_arg "Uwt_sync.Fs.read"
   else
     let req = Req.create loop typ in
-    read t buf pos len loop req () |>
+    read t buf pos len fd_offset loop req () |>
     read_write_common ~req
 
+let pread ?pos ?len t ~fd_offset ~buf ~dim =
+  if Int64.compare fd_offset 0L < 0 then
+    invalid_arg "Uwt_sync.Fs.pread"
+  else
+    read ?pos ?len ~fd_offset ~dim ~buf t
+
+let pread_ba ?pos ?len t ~fd_offset ~(buf:buf) =
+  let dim = Bigarray.Array1.dim buf in
+  pread ?pos ?len ~fd_offset ~dim ~buf t
+
+let pread ?pos ?len t ~fd_offset ~buf =
+  let dim = Bytes.length buf in
+  pread ?pos ?len ~fd_offset ~dim ~buf t
+
 let read_ba ?pos ?len t ~(buf:buf) =
   let dim = Bigarray.Array1.dim buf in
-  read ?pos ?len ~dim ~buf t
+  read ?pos ?len ~fd_offset:(-1L) ~dim ~buf t
 
 let read ?pos ?len t ~buf =
   let dim = Bytes.length buf in
-  read ?pos ?len ~dim ~buf t
+  read ?pos ?len ~fd_offset:(-1L) ~dim ~buf t
 
 external write:
-  file -> 'a -> int -> int ->
+  file -> 'a -> int -> int -> int64 ->
   loop -> Req.t -> unit ->
   Int_result.int =
   "uwt_fs_write_byte" "uwt_fs_write_native"
 
-let write ?(pos=0) ?len ~dim t ~buf =
+let write ?(pos=0) ?len ~fd_offset ~dim t ~buf =
   let len =  match len with
   | None -> dim - pos
   | Some x -> x
@@ -229,20 +243,81 @@ let write ?(pos=0) ?len ~dim t ~buf =
     invalid_arg "Uwt_sync.Fs.write"
   else
     let req = Req.create loop typ in
-    write t buf pos len loop req () |>
+    write t buf pos len fd_offset loop req () |>
     read_write_common ~req
 
+let pwrite ?pos ?len ~fd_offset ~dim t ~buf =
+  if Int64.compare fd_offset 0L < 0 then
+    invalid_arg "Uwt_sync.Fs.pwrite"
+  else
+    write ~fd_offset ~dim ?pos ?len t ~buf
+
+let pwrite_ba ?pos ?len t ~fd_offset ~(buf:buf) =
+  let dim = Bigarray.Array1.dim buf in
+  pwrite ~fd_offset ~dim ?pos ?len t ~buf
+
+let pwrite_string ?pos ?len t ~fd_offset ~buf =
+  let dim = String.length buf in
+  pwrite ~fd_offset ~dim ?pos ?len t ~buf
+
+let pwrite ?pos ?len t ~fd_offset ~buf =
+  let dim = Bytes.length buf in
+  pwrite ~fd_offset ~dim ?pos ?len t ~buf
+
 let write_ba ?pos ?len t ~(buf:buf) =
   let dim = Bigarray.Array1.dim buf in
-  write ~dim ?pos ?len t ~buf
+  write ~fd_offset:(-1L) ~dim ?pos ?len t ~buf
 
 let write_string ?pos ?len t ~buf =
   let dim = String.length buf in
-  write ~dim ?pos ?len t ~buf
+  write ~fd_offset:(-1L) ~dim ?pos ?len t ~buf
 
 let write ?pos ?len t ~buf =
   let dim = Bytes.length buf in
-  write ~dim ?pos ?len t ~buf
+  write ~fd_offset:(-1L) ~dim ?pos ?len t ~buf
+
+let iovec_valid ~readv iov =
+  let ok pos len dim = pos >= 0 && len >= 0 && pos <= dim - len in
+  let rec iter i =
+    i < 0 ||
+    match Array.unsafe_get iov i with
+    | Iovec_bytes(b,pos,len) -> ok pos len (Bytes.length b) && iter (pred i)
+    | Iovec_string(s,pos,len) ->
+      readv = false && ok pos len (String.length s) && iter (pred i)
+    | Iovec_ba(b,pos,len) ->
+      ok pos len (Bigarray.Array1.dim b) && iter (pred i)
+  in
+  iter (Array.length iov - 1)
+
+external readv:
+  file -> iovec array -> int64 -> loop -> Req.t -> unit ->
+  Int_result.int = "uwt_fs_readv_byte" "uwt_fs_readv_native"
+
+let readv ?(fd_offset=(-1L)) t iov =
+  if Int64.compare fd_offset (-1L) < 0 ||
+     iovec_valid ~readv:true iov = false then
+    invalid_arg "Uwt_sync.Fs.readv"
+  else if Array.length iov = 0 then
+    Ok 0
+  else
+    let req = Req.create loop typ in
+    readv t iov fd_offset loop req () |>
+    read_write_common ~req
+
+external writev:
+  file -> iovec array -> int64 -> loop -> Req.t -> unit ->
+  Int_result.int = "uwt_fs_writev_byte" "uwt_fs_writev_native"
+
+let writev ?(fd_offset=(-1L)) t iov =
+  if Int64.compare fd_offset (-1L) < 0 ||
+     iovec_valid ~readv:false iov = false then
+    invalid_arg "Uwt_sync.Fs.writev"
+  else if Array.length iov = 0 then
+    Ok 0
+  else
+    let req = Req.create loop typ in
+    writev t iov fd_offset loop req () |>
+    read_write_common ~req
 
 external sendfile:
   file -> file -> int64 -> nativeint -> loop -> Req.t -> unit ->
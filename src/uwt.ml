@@ -90,6 +90,27 @@ end
    nor canceled *)
 let () = Callback.register "uwt.wakeup" Lwt.wakeup
 
+(* Stream.read_start_batched: all chunks received during one loop iteration
+   are passed at once. Returns true, if a callback has raised an exception.
+   A previous callback might have stopped reading or closed the stream,
+   read_batch_valid checks the entry first. *)
+external read_batch_valid: int -> bool = "uwt_read_batch_valid_na" "noalloc"
+
+let read_batch (a: ((Bytes.t result -> unit) * Bytes.t result * int) array) n =
+  let exn = ref false in
+  for i = 0 to n - 1 do
+    let (cb,x,idx) = Array.unsafe_get a i in
+    if read_batch_valid idx then
+      try cb x with e -> exn := true; Exception.add_exception e
+  done;
+  !exn
+
+let () = Callback.register "uwt.read_batch" read_batch
+
+(* Stream.write: creates the sleeping thread, if the data couldn't be
+   written instantly *)
+let () = Callback.register "uwt.wait" Lwt.wait
+
 (* external uv_loop_close: loop -> Int_result.unit = "uwt_loop_close" *)
 external uv_run_loop: loop -> uv_run_mode -> Int_result.int = "uwt_run_loop"
 
@@ -216,10 +237,26 @@ let qsu4 ~f ~name a b c d =
   let (x: Int_result.unit) = f a b c d waker in
   qsu_common ~name sleeper x
 
-let qsu5 ~f ~name a b c d e =
+(*let qsu5 ~f ~name a b c d e =
   let sleeper,waker = Lwt.wait () in
   let (x: Int_result.unit) = f a b c d e waker in
-  qsu_common ~name sleeper x
+  qsu_common ~name sleeper x *)
+
+let iovec_ok (v: iovec) =
+  let ok pos len dim = pos >= 0 && len >= 0 && pos <= dim - len in
+  match v with
+  | Iovec_bytes(b,pos,len) -> ok pos len (Bytes.length b)
+  | Iovec_string(s,pos,len) -> ok pos len (String.length s)
+  | Iovec_ba(b,pos,len) -> ok pos len (Bigarray.Array1.dim b)
+
+let iovec_valid (iov: iovec array) =
+  let rec iter i =
+    if i < 0 then
+      true
+    else
+      iovec_ok (Array.unsafe_get iov i) && iter (pred i)
+  in
+  iter (Array.length iov - 1)
 
 let to_exn n = function
 | Ok x -> x
@@ -288,6 +325,44 @@ module Handle_fileno = struct
   let fileno_exn s = fileno s |> to_exn "uv_fileno"
 end
 
+module C_worker = struct
+  type t = unit Int_result.t
+  type 'a u = loop * Req.t * 'a result Lwt.u
+
+  let call_internal ?(param="") ?(name="") (f: 'a -> 'b u -> t) (a:'a) : 'b Lwt.t =
+    let sleeper,waker = Lwt.task ()
+    and wait_sleeper,wait_waker = Lwt.wait ()
+    and req = Req.create loop Req.Work in
+    match f a (loop,req,wait_waker) with
+    | exception x ->
+      Req.finalize req;
+      Lwt.fail x
+    | x ->
+      if Int_result.is_error x then
+        LInt_result.mfail ~name ~param x
+      else
+        let t = wait_sleeper >>= fun x ->
+          Req.finalize req;
+          if Lwt.is_sleeping sleeper then (
+            (match x with
+            | Ok x -> Lwt.wakeup waker x
+            | Error x -> Lwt.wakeup_exn waker (Uwt_error(x,name,param)));
+            Req.canceled)
+          else
+            match x with
+            | Ok x -> Lwt.return x
+            | Error ECANCELED -> Req.canceled
+            | Error x -> efail ~param name x
+        in
+        Lwt.catch (fun () -> sleeper) (function
+          | Lwt.Canceled ->
+            Req.cancel_noerr req;
+            t
+          | x -> Lwt.fail x)
+
+  let call a b = call_internal a b
+end
+
 module Stream = struct
   type t = u
   include (Handle: (module type of Handle) with type t := t )
@@ -299,14 +374,112 @@ module Stream = struct
     t  -> cb:(Bytes.t result -> unit) -> Int_result.unit = "uwt_read_start"
   let read_start_exn a ~cb = read_start a ~cb |> to_exnu "uv_read_start"
 
+  external read_start_batched:
+    t  -> cb:(Bytes.t result -> unit) -> Int_result.unit =
+    "uwt_read_start_batched"
+  let read_start_batched_exn a ~cb =
+    read_start_batched a ~cb |> to_exnu "uv_read_start"
+
+  external read_start_ba:
+    t  -> cb:(buf result -> unit) -> Int_result.unit = "uwt_read_start_ba"
+  let read_start_ba_exn a ~cb =
+    read_start_ba a ~cb |> to_exnu "uv_read_start"
+
+  external release_ba: buf -> bool = "uwt_ba_release_na" "noalloc"
+
+  external set_read_size_policy:
+    t -> bool -> int -> int -> Int_result.unit =
+    "uwt_set_read_size_policy_na" "noalloc"
+
+  let set_read_size_policy t = function
+  | `Fixed x -> set_read_size_policy t false x x
+  | `Adaptive(min,max) -> set_read_size_policy t true min max
+
+  let set_read_size_policy_exn t p =
+    set_read_size_policy t p |> to_exnu "set_read_size_policy"
+
+  external read_size: t -> int = "uwt_read_size_na" "noalloc"
+
   external iread_stop: t -> bool -> Int_result.unit = "uwt_read_stop"
   let read_stop a = iread_stop a false
   let read_stop_exn a = iread_stop a false |> to_exnu "read_stop"
 
+  external drain_wait:
+    t -> (unit Lwt.t * unit Lwt.u) -> (unit Lwt.t * unit Lwt.u) option =
+    "uwt_write_drain_wait"
+
+  let wait_drained t =
+    match drain_wait t (Lwt.wait ()) with
+    | None -> Lwt.return_unit
+    | Some(sleeper,_) -> sleeper
+
+  external set_write_watermarks:
+    t -> int -> int -> int -> Int_result.unit =
+    "uwt_write_watermarks_na" "noalloc"
+
+  let set_write_watermarks ?(policy=`Block) t ~low ~high =
+    let policy = match policy with
+    | `Block -> 0
+    | `Fail -> 1 in
+    set_write_watermarks t low high policy
+
+  let set_write_watermarks_exn ?policy t ~low ~high =
+    set_write_watermarks ?policy t ~low ~high
+    |> to_exnu "set_write_watermarks"
+
+  external write_limit: int -> int = "uwt_write_limit_na" "noalloc"
+  let set_write_limit x =
+    if x < 0 then
+      invalid_arg "Uwt.Stream.set_write_limit"
+    else
+      ignore (write_limit x)
+  let write_bytes_total () = write_limit (-1)
+
+  external block_enter: t -> unit Lwt.t -> unit Lwt.t option =
+    "uwt_write_block_enter"
+  external block_leave: t -> unit Lwt.t -> unit =
+    "uwt_write_block_leave_na" "noalloc"
+  external bypass: t -> bool -> unit = "uwt_write_bypass_na" "noalloc"
+
+  (* The write stubs return EAGAIN, if the high watermark is exceeded
+     (policy [`Block]) or other writers are already waiting. The waiting
+     writers are chained: each one waits for its predecessor, before it
+     retries with [bypass t true]. Otherwise a small write could
+     overtake a large one that is blocked. *)
+  let qsu_block ~f ~name t a =
+    let sleeper,waker = Lwt.wait () in
+    let (x: Int_result.unit) = f t a waker in
+    if (x :> int) <> Int_result.eagain then
+      qsu_common ~name sleeper x
+    else
+      let turn,turn_waker = Lwt.wait () in
+      let prev = match block_enter t turn with
+      | None -> Lwt.return_unit
+      | Some p -> p in
+      let rec iter () =
+        wait_drained t >>= fun () ->
+        let sleeper,waker = Lwt.wait () in
+        bypass t true;
+        let (x: Int_result.unit) =
+          try f t a waker with exn -> bypass t false; raise exn in
+        bypass t false;
+        if (x :> int) = Int_result.eagain then
+          iter ()
+        else
+          Lwt.return (sleeper,x)
+      in
+      Lwt.finalize (fun () -> prev >>= iter) (fun () ->
+          block_leave t turn;
+          Lwt.wakeup turn_waker ();
+          Lwt.return_unit)
+      >>= fun (sleeper,x) -> qsu_common ~name sleeper x
+
   external write:
     t -> 'a -> int -> int -> unit_cb -> Int_result.unit =
     "uwt_write"
 
+  let write t (buf,pos,len) waker = write t buf pos len waker
+
   let write_raw ?(pos=0) ?len s ~buf ~dim =
     let len =
       match len with
@@ -317,7 +490,7 @@ module Stream = struct
     if pos < 0 || len < 0 || pos > dim - len then
       Lwt.fail (Invalid_argument "Uwt.Stream.write_raw")
     else
-      qsu4 ~name ~f:write s buf pos len
+      qsu_block ~name ~f:write s (buf,pos,len)
 
   let write_raw_ba ?pos ?len t ~(buf:buf) =
     let dim = Bigarray.Array1.dim buf in
@@ -345,6 +518,14 @@ module Stream = struct
     else
       try_write s buf pos len
 
+  type write_eager =
+    | Eager_done
+    | Eager_pending of Int_result.unit Lwt.t
+    | Eager_error of Int_result.unit
+
+  external write_eager:
+    t -> 'a -> int -> int -> write_eager = "uwt_write_eager"
+
   let write ?(pos=0) ?len s ~buf ~dim =
     let len =
       match len with
@@ -354,26 +535,22 @@ module Stream = struct
     let name = "write" in
     if pos < 0 || len < 0 || pos > dim - len then
       Lwt.fail (Invalid_argument "Uwt.Stream.write")
-    else if len > 131072 then
-      qsu4 ~name ~f:write s buf pos len
     else
-      (* always us try_write first, perhaps we don't need to create
+      (* uv_try_write is called first, perhaps we don't need to create
          a sleeping thread at all. It's faster for small write requests *)
-      let x' = try_write ~pos ~len s ~buf ~dim in
-      let x = ( x' :> int ) in
-      if x < 0 then
-        if x' = Int_result.eagain then
-          qsu4 ~name ~f:write s buf pos len
+      match write_eager s buf pos len with
+      | Eager_done -> Lwt.return_unit
+      | Eager_pending sleeper ->
+        sleeper >>= fun x ->
+        if (x :> int) < 0 then
+          LInt_result.mfail ~name ~param x
         else
-          LInt_result.mfail ~name ~param x'
-      else if x = len then
-        Lwt.return_unit
-      else if x > len then
-        efail name UWT_EFATAL
-      else
-        let pos = pos + x
-        and len = len - x in
-        qsu4 ~name ~f:write s buf pos len
+          Lwt.return_unit
+      | Eager_error x ->
+        if (x :> int) = Int_result.eagain then
+          qsu_block ~name ~f:write s (buf,pos,len)
+        else
+          LInt_result.mfail ~name ~param x
 
   let write_ba ?pos ?len t ~(buf:buf) =
     let dim = Bigarray.Array1.dim buf in
@@ -399,6 +576,65 @@ module Stream = struct
     let dim = Bytes.length buf in
     try_write ~dim ?pos ?len t ~buf
 
+  external writev:
+    t -> iovec array -> unit_cb -> Int_result.unit = "uwt_writev"
+
+  let writev t iov =
+    if iovec_valid iov = false then
+      Lwt.fail (Invalid_argument "Uwt.Stream.writev")
+    else if Array.length iov = 0 then
+      Lwt.return_unit
+    else
+      qsu_block ~name:"writev" ~f:writev t iov
+
+  external sendfile:
+    t -> file -> int64 -> int64 -> int64 result Lwt.u -> Int_result.unit =
+    "uwt_stream_sendfile"
+
+  let sendfile ?(offset=0L) ~len t file =
+    let rec start () =
+      let sleeper,waker = Lwt.wait () in
+      let x = sendfile t file offset len waker in
+      if (x :> int) = Int_result.eagain then
+        (* previous write requests must be written first *)
+        write_raw_string t ~buf:"" >>= start
+      else if Int_result.is_error x then
+        LInt_result.mfail ~name:"sendfile" ~param x
+      else
+        sleeper >>= function
+        | Ok x -> Lwt.return x
+        | Error x -> efail "sendfile" x
+    in
+    start ()
+
+  external forward:
+    t -> t -> int -> int64 result Lwt.u -> Int_result.unit = "uwt_forward"
+
+  let forward ~src ~dst ?(max_buffered=262_144) () =
+    let sleeper,waker = Lwt.wait () in
+    let x = forward src dst max_buffered waker in
+    if Int_result.is_error x then
+      LInt_result.mfail ~name:"forward" ~param x
+    else
+      sleeper >>= function
+      | Ok x -> Lwt.return x
+      | Error x -> efail "forward" x
+
+  external cork: t -> bool -> int -> Int_result.unit = "uwt_cork"
+  let cork ?(limit=0) t = cork t true limit
+  let cork_exn ?limit t = cork ?limit t |> to_exnu "cork"
+  let uncork t = cork t false 0
+  let uncork_exn t = uncork t |> to_exnu "uncork"
+
+  external try_writev:
+    t -> iovec array -> Int_result.int = "uwt_try_writev_na" "noalloc"
+
+  let try_writev t iov =
+    if iovec_valid iov = false then
+      Int_result.uwt_einval
+    else
+      try_writev t iov
+
   external read:
     t -> 'a -> int -> int -> int_cb -> Int_result.unit = "uwt_read_own"
 
@@ -434,6 +670,30 @@ module Stream = struct
     let dim = Bytes.length buf in
     read ?pos ?len ~dim ~buf t
 
+  external attach_ring: t -> buf -> Int_result.unit = "uwt_ring_attach"
+  let attach_ring_exn t buf = attach_ring t buf |> to_exnu "uv_read_start"
+  external detach_ring: t -> Int_result.unit = "uwt_ring_detach_na" "noalloc"
+  external ring_available: t -> int = "uwt_ring_available_na" "noalloc"
+  external ring_pos: t -> int = "uwt_ring_pos_na" "noalloc"
+  external ring_consume:
+    t -> int -> Int_result.unit = "uwt_ring_consume_na" "noalloc"
+  let ring_consume_exn t n = ring_consume t n |> to_exnu "uv_read_start"
+
+  external ring_wait: t -> int_cb -> Int_result.int = "uwt_ring_wait"
+  let ring_wait t =
+    let sleeper,waker = Lwt.wait () in
+    let (x: Int_result.int) = ring_wait t waker in
+    if (x :> int) = Int_result.eagain then
+      sleeper >>= fun ( x: Int_result.int ) ->
+      if Int_result.is_error x then
+        LInt_result.fail ~name:"uwt_ring_wait" ~param x
+      else
+        Lwt.return ( x :> int )
+    else if Int_result.is_error x then
+      LInt_result.fail ~name:"uwt_ring_wait" ~param x
+    else
+      Lwt.return ( x :> int )
+
   external write2:
     t -> t -> 'a -> int -> int -> unit_cb -> Int_result.unit =
     "uwt_write2_byte" "uwt_write2_native"
@@ -447,7 +707,8 @@ module Stream = struct
     if pos < 0 || len < 0 || pos > dim - len then
       Lwt.fail (Invalid_argument "Uwt.Stream.write2")
     else
-      qsu5 ~name:"write2" ~f:write2 s send buf pos len
+      let f t (send,buf,pos,len) waker = write2 t send buf pos len waker in
+      qsu_block ~name:"write2" ~f s (send,buf,pos,len)
 
   let write2_ba ?pos ?len ~(buf:buf) ~send t =
     let dim = Bigarray.Array1.dim buf in
@@ -470,7 +731,17 @@ module Stream = struct
   let listen_exn a ~max ~cb = listen a ~max ~cb |> to_exnu "listen"
 
   external shutdown: t -> unit_cb -> Int_result.unit = "uwt_shutdown"
-  let shutdown s = qsu1 ~name:"shutdown" ~f:shutdown s
+  let shutdown s =
+    let rec iter () =
+      let sleeper,waker = Lwt.wait () in
+      let (x: Int_result.unit) = shutdown s waker in
+      if (x :> int) = Int_result.eagain then
+        (* Stream.sendfile is still writing *)
+        wait_drained s >>= iter
+      else
+        qsu_common ~name:"shutdown" sleeper x
+    in
+    iter ()
 
   external accept_raw:
     server:t -> client:t -> Int_result.unit = "uwt_accept_raw_na" "noalloc"
@@ -698,6 +969,35 @@ module Udp = struct
   external send_queue_size: t -> int = "uwt_udp_send_queue_size_na" "noalloc"
   external send_queue_count: t -> int = "uwt_udp_send_queue_count_na" "noalloc"
 
+  external drain_wait:
+    t -> (unit Lwt.t * unit Lwt.u) -> (unit Lwt.t * unit Lwt.u) option =
+    "uwt_write_drain_wait"
+
+  let wait_drained t =
+    match drain_wait t (Lwt.wait ()) with
+    | None -> Lwt.return_unit
+    | Some(sleeper,_) -> sleeper
+
+  external set_send_queue_limit:
+    t -> int -> int -> int -> Int_result.unit =
+    "uwt_udp_send_queue_limit_na" "noalloc"
+
+  let set_send_queue_limit ?(policy=`Block) t ~bytes ~count =
+    let policy = match policy with
+    | `Block -> 0
+    | `Fail -> 1
+    | `Drop -> 2 in
+    set_send_queue_limit t bytes count policy
+
+  let set_send_queue_limit_exn ?policy t ~bytes ~count =
+    set_send_queue_limit ?policy t ~bytes ~count
+    |> to_exnu "udp_set_send_queue_limit"
+
+  external send_queue_dropped:
+    t -> bool -> int = "uwt_udp_send_queue_dropped_na" "noalloc"
+  let send_queue_dropped_bytes t = send_queue_dropped t true
+  let send_queue_dropped t = send_queue_dropped t false
+
   external init_raw: loop -> t result = "uwt_udp_init"
   let init () =
     match init_raw loop with
@@ -728,6 +1028,10 @@ module Udp = struct
   let bind_exn ?(mode=[]) t ~addr () = bind t addr mode |> to_exnu "udp_bind"
   let bind ?(mode=[]) t ~addr () = bind t addr mode
 
+  external connect:
+    t -> addr:sockaddr -> Int_result.unit = "uwt_udp_connect_na" "noalloc"
+  let connect_exn t ~addr = connect t ~addr |> to_exnu "udp_connect"
+
   external getsockname: t -> sockaddr result = "uwt_udp_getsockname"
   let getsockname_exn t = getsockname t |> to_exn "udp_getsockname"
 
@@ -783,10 +1087,112 @@ module Udp = struct
     else
       try_send t buf pos len s
 
+  external send_many:
+    t -> (iovec * sockaddr) array -> int array -> unit_cb -> Int_result.int =
+    "uwt_udp_send_many"
+
+  external to_results: int array -> 'a Int_result.t array = "%identity"
+
+  let send_many t msgs =
+    let rec valid i =
+      if i < 0 then
+        true
+      else
+        iovec_ok (fst (Array.unsafe_get msgs i)) && valid (pred i)
+    in
+    if valid (Array.length msgs - 1) = false then
+      Lwt.fail (Invalid_argument "Uwt.Udp.send_many")
+    else
+      let results = Array.make (Array.length msgs) 0 in
+      let sleeper,waker = Lwt.wait () in
+      let x = send_many t msgs results waker in
+      let x' = (x :> int) in
+      if x' < 0 then
+        LInt_result.mfail ~name:"udp_send_many" ~param x
+      else if x' = 0 then
+        Lwt.return (to_results results)
+      else
+        sleeper >>= fun (_: Int_result.unit) ->
+        Lwt.return (to_results results)
+
+  external try_send_gso:
+    t -> 'a -> int -> int -> int -> sockaddr -> Int_result.int =
+    "uwt_udp_try_send_gso_byte" "uwt_udp_try_send_gso_native"
+
+  let send_gso ?(pos=0) ?len ~buf ~dim ~iovec ~segment_size t addr =
+    let name = "udp_send_gso" in
+    let len =
+      match len with
+      | None -> dim - pos
+      | Some x -> x
+    in
+    if pos < 0 || len < 0 || pos > dim - len ||
+       segment_size <= 0 || segment_size > 65_507 then
+      Lwt.fail (Invalid_argument "Uwt.Udp.send_gso")
+    else
+      let x = try_send_gso t buf pos len segment_size addr in
+      let x' = (x :> int) in
+      if x' = len then
+        Lwt.return_unit
+      else if x' < 0 && x' <> Int_result.eagain &&
+              x' <> Int_result.enosys then
+        LInt_result.mfail ~name ~param x
+      else
+        (* no offload or queued datagrams: one datagram per segment *)
+        let pos = pos + (max 0 x') in
+        let fin = pos + len - (max 0 x') in
+        let n = (fin - pos + segment_size - 1) / segment_size in
+        let msgs = Array.init n ( fun i ->
+            let p = pos + i * segment_size in
+            iovec buf p (min segment_size (fin - p)), addr )
+        in
+        send_many t msgs >>= fun res ->
+        let rec check i =
+          if i = Array.length res then
+            Lwt.return_unit
+          else
+            let r = Array.unsafe_get res i in
+            if Int_result.is_error r then
+              LInt_result.mfail ~name ~param r
+            else
+              check (succ i)
+        in
+        check 0
+
+  let send_gso_ba ?pos ?len ~(buf:buf) ~segment_size t addr =
+    let dim = Bigarray.Array1.dim buf in
+    let iovec b p l = Iovec_ba(b,p,l) in
+    send_gso ~dim ~iovec ?pos ?len ~buf ~segment_size t addr
+
+  let send_gso_string ?pos ?len ~buf ~segment_size t addr =
+    let dim = String.length buf in
+    let iovec b p l = Iovec_string(b,p,l) in
+    send_gso ~dim ~iovec ?pos ?len ~buf ~segment_size t addr
+
+  let send_gso ?pos ?len ~buf ~segment_size t addr =
+    let dim = Bytes.length buf in
+    let iovec b p l = Iovec_bytes(b,p,l) in
+    send_gso ~dim ~iovec ?pos ?len ~buf ~segment_size t addr
+
   external send:
     t -> 'a -> int -> int -> sockaddr -> unit_cb -> Int_result.unit =
     "uwt_udp_send_byte" "uwt_udp_send_native"
 
+  (* send returns EAGAIN, if the queue limit is exceeded (policy [`Block]),
+     and 1, if the datagram was dropped (policy [`Drop]) *)
+  let qsu_send ~name s buf pos len addr =
+    let rec iter () =
+      let sleeper,waker = Lwt.wait () in
+      let x = send s buf pos len addr waker in
+      if (x :> int) = 1 then
+        Lwt.return_unit
+      else if (x :> int) = Int_result.eagain then
+        wait_drained s >>= iter
+      else
+        qsu_common ~name sleeper x
+    in
+    iter ()
+
   let send_raw ?(pos=0) ?len ~buf ~dim s addr =
     let name = "udp_send" in
     let len =
@@ -797,7 +1203,7 @@ module Udp = struct
     if pos < 0 || len < 0 || pos > dim - len then
       Lwt.fail (Invalid_argument "Uwt.Udp.send_raw")
     else
-      qsu5 ~name ~f:send s buf pos len addr
+      qsu_send ~name s buf pos len addr
 
   let send_raw_ba ?pos ?len ~(buf:buf) t addr =
     let dim = Bigarray.Array1.dim buf in
@@ -822,14 +1228,14 @@ module Udp = struct
       Lwt.fail (Invalid_argument "Uwt.Udp.send")
 #if HAVE_WINDOWS <> 0
     else (* windows doesn't support try_send *)
-      qsu5 ~name ~f:send s buf pos len addr
+      qsu_send ~name s buf pos len addr
 #else
     else
       let x' = try_send ~pos ~len ~buf ~dim s addr in
       let x = ( x' :> int ) in
       if x < 0 then
         if x' = Int_result.eagain || x' = Int_result.enosys then
-          qsu5 ~name ~f:send s buf pos len addr
+          qsu_send ~name s buf pos len addr
         else
           LInt_result.mfail ~name ~param x'
       else if x = len then
@@ -839,7 +1245,7 @@ module Udp = struct
       else
         let pos = pos + x
         and len = len - x in
-        qsu5 ~name ~f:send s buf pos len addr
+        qsu_send ~name s buf pos len addr
 #endif
 
   let send_ba ?pos ?len ~(buf:buf) t addr =
@@ -854,6 +1260,50 @@ module Udp = struct
     let dim = Bytes.length buf in
     send ~dim ?pos ?len ~buf t addr
 
+  external send_connected:
+    t -> 'a -> int -> int -> unit_cb -> Int_result.int =
+    "uwt_udp_send_connected"
+
+  let send_connected ?(pos=0) ?len ~buf ~dim t =
+    let name = "udp_send_connected" in
+    let len =
+      match len with
+      | None -> dim - pos
+      | Some x -> x
+    in
+    if pos < 0 || len < 0 || pos > dim - len then
+      Lwt.fail (Invalid_argument "Uwt.Udp.send_connected")
+    else
+      let rec iter () =
+        let sleeper,waker = Lwt.wait () in
+        let x = send_connected t buf pos len waker in
+        if (x :> int) = 1 then
+          Lwt.return_unit
+        else if (x :> int) = Int_result.eagain then
+          wait_drained t >>= iter
+        else if (x :> int) < 0 then
+          LInt_result.mfail ~name ~param x
+        else
+          sleeper >>= fun (x: Int_result.unit) ->
+          if (x :> int) < 0 then
+            LInt_result.mfail ~name ~param x
+          else
+            Lwt.return_unit
+      in
+      iter ()
+
+  let send_connected_ba ?pos ?len ~(buf:buf) t =
+    let dim = Bigarray.Array1.dim buf in
+    send_connected ~dim ?pos ?len ~buf t
+
+  let send_connected_string ?pos ?len ~buf t =
+    let dim = String.length buf in
+    send_connected ~dim ?pos ?len ~buf t
+
+  let send_connected ?pos ?len ~buf t =
+    let dim = Bytes.length buf in
+    send_connected ~dim ?pos ?len ~buf t
+
   let try_send_string ?pos ?len ~buf t s =
     let dim = String.length buf in
     try_send ?pos ?len ~buf t s ~dim
@@ -876,6 +1326,39 @@ module Udp = struct
     t -> cb:(recv_result -> unit) -> Int_result.unit = "uwt_udp_recv_start"
   let recv_start_exn a ~cb = recv_start a ~cb |> to_exnu "udp_recv_start"
 
+  type recv_batch = {
+    rb_buf: buf;
+    rb_slot_size: int;
+    rb_lens: Int_result.int array;
+    rb_flags: int array;
+    rb_addrs: sockaddr array;
+    rb_segs: int array;
+  }
+
+  let rb_partial = 1
+
+  external recv_batch_start:
+    t -> recv_batch -> bool -> (int -> unit) -> Int_result.unit =
+    "uwt_udp_recv_batch_start"
+
+  let recv_batch_start ?(slots=32) ?(slot_size=65_536) ?(gro=false) t ~cb =
+    if slots <= 0 || slot_size <= 0 || slots > max_int / slot_size then
+      Int_result.uwt_einval
+    else
+      let rb = {
+        rb_buf = Bigarray.(Array1.create char c_layout (slots * slot_size));
+        rb_slot_size = slot_size;
+        rb_lens = to_results (Array.make slots 0);
+        rb_flags = Array.make slots 0;
+        rb_addrs = Array.init slots (fun _ -> Misc.ip4_addr_exn "0.0.0.0" 0);
+        rb_segs = Array.make slots 0;
+      } in
+      recv_batch_start t rb gro (fun n -> cb rb n)
+
+  let recv_batch_start_exn ?slots ?slot_size ?gro t ~cb =
+    recv_batch_start ?slots ?slot_size ?gro t ~cb
+    |> to_exnu "udp_recv_batch_start"
+
   external irecv_stop: t -> bool -> Int_result.unit = "uwt_udp_recv_stop"
   let recv_stop a = irecv_stop a false
   let recv_stop_exn a = irecv_stop a false |> to_exnu "udp_recv_stop"
@@ -919,6 +1402,39 @@ module Udp = struct
     let dim = Bytes.length buf in
     recv ~dim ?pos ?len ~buf t
 
+  external recv_connected:
+    t -> 'a -> int -> int -> recv cb
+    -> Int_result.unit = "uwt_udp_recv_connected"
+
+  let recv_connected ?(pos=0) ?len ~buf ~dim t =
+    let name = "uwt_udp_recv_connected" in
+    let len = match len with
+    | None -> dim - pos
+    | Some x -> x
+    in
+    if pos < 0 || len < 0 || pos > dim - len then
+      Lwt.fail (Invalid_argument "Uwt.Udp.recv_connected")
+    else if len = 0 then
+      Lwt.return ({ recv_len = 0; is_partial = false ; sockaddr = None })
+    else
+      let sleeper,waker = Lwt.task () in
+      let x = recv_connected t buf pos len waker in
+      if Int_result.is_error x then
+        LInt_result.fail ~name ~param x
+      else
+        let () = Lwt.on_cancel sleeper (fun () -> ignore (irecv_stop t true)) in
+        sleeper >>= function
+        | Ok x -> Lwt.return x
+        | Error x -> efail ~param name x
+
+  let recv_connected_ba ?pos ?len ~(buf:buf) t =
+    let dim = Bigarray.Array1.dim buf in
+    recv_connected ~dim ?pos ?len ~buf t
+
+  let recv_connected ?pos ?len ~buf t =
+    let dim = Bytes.length buf in
+    recv_connected ~dim ?pos ?len ~buf t
+
 end
 
 module Timer = struct
@@ -1148,44 +1664,6 @@ module Async = struct
   external send: t -> Int_result.unit = "uwt_async_send_na" "noalloc"
 end
 
-module C_worker = struct
-  type t = unit Int_result.t
-  type 'a u = loop * Req.t * 'a result Lwt.u
-
-  let call_internal ?(param="") ?(name="") (f: 'a -> 'b u -> t) (a:'a) : 'b Lwt.t =
-    let sleeper,waker = Lwt.task ()
-    and wait_sleeper,wait_waker = Lwt.wait ()
-    and req = Req.create loop Req.Work in
-    match f a (loop,req,wait_waker) with
-    | exception x ->
-      Req.finalize req;
-      Lwt.fail x
-    | x ->
-      if Int_result.is_error x then
-        LInt_result.mfail ~name ~param x
-      else
-        let t = wait_sleeper >>= fun x ->
-          Req.finalize req;
-          if Lwt.is_sleeping sleeper then (
-            (match x with
-            | Ok x -> Lwt.wakeup waker x
-            | Error x -> Lwt.wakeup_exn waker (Uwt_error(x,name,param)));
-            Req.canceled)
-          else
-            match x with
-            | Ok x -> Lwt.return x
-            | Error ECANCELED -> Req.canceled
-            | Error x -> efail ~param name x
-        in
-        Lwt.catch (fun () -> sleeper) (function
-          | Lwt.Canceled ->
-            Req.cancel_noerr req;
-            t
-          | x -> Lwt.fail x)
-
-  let call a b = call_internal a b
-end
-
 module Unix = struct
   type seek_command = Unix.seek_command = SEEK_SET | SEEK_CUR | SEEK_END
   external lseek:
@@ -1411,12 +1889,12 @@ module Fs = struct
     Req.ql ~typ ~name:"uv_fs_open" ~param:fln ~f:(openfile fln mode perm)
 
   external read:
-    file -> 'a -> int -> int ->
+    file -> 'a -> int -> int -> int64 ->
     loop -> Req.t -> int_cb ->
     Int_result.unit =
     "uwt_fs_read_byte" "uwt_fs_read_native"
 
-  let read ?(pos=0) ?len t ~buf ~dim =
+  let read ?(pos=0) ?len ~fd_offset t ~buf ~dim =
     let len =
       match len with
       | None -> dim - pos
@@ -1425,23 +1903,37 @@ module Fs = struct
     if pos < 0 || len < 0 || pos > dim - len then
       Lwt.fail (Invalid_argument "Uwt.Fs.read")
     else
-      Req.qli ~typ ~name:"uv_fs_read" ~param ~f:(read t buf pos len)
+      Req.qli ~typ ~name:"uv_fs_read" ~param ~f:(read t buf pos len fd_offset)
+
+  let pread ?pos ?len t ~fd_offset ~buf ~dim =
+    if Int64.compare fd_offset 0L < 0 then
+      Lwt.fail (Invalid_argument "Uwt.Fs.pread")
+    else
+      read ?pos ?len ~fd_offset ~dim ~buf t
+
+  let pread_ba ?pos ?len t ~fd_offset ~(buf:buf) =
+    let dim = Bigarray.Array1.dim buf in
+    pread ?pos ?len ~fd_offset ~dim ~buf t
+
+  let pread ?pos ?len t ~fd_offset ~buf =
+    let dim = Bytes.length buf in
+    pread ?pos ?len ~fd_offset ~dim ~buf t
 
   let read_ba ?pos ?len t ~(buf:buf) =
     let dim = Bigarray.Array1.dim buf in
-    read ?pos ?len ~dim ~buf t
+    read ?pos ?len ~fd_offset:(-1L) ~dim ~buf t
 
   let read ?pos ?len t ~buf =
     let dim = Bytes.length buf in
-    read ?pos ?len ~dim ~buf t
+    read ?pos ?len ~fd_offset:(-1L) ~dim ~buf t
 
   external write:
-    file -> 'a -> int -> int ->
+    file -> 'a -> int -> int -> int64 ->
     loop -> Req.t -> int_cb ->
     Int_result.unit =
     "uwt_fs_write_byte" "uwt_fs_write_native"
 
-  let write ?(pos=0) ?len ~dim t ~buf =
+  let write ?(pos=0) ?len ~fd_offset ~dim t ~buf =
     let len =
       match len with
       | None -> dim - pos
@@ -1450,19 +1942,69 @@ module Fs = struct
     if pos < 0 || len < 0 || pos > dim - len then
       Lwt.fail (Invalid_argument "Uwt.Fs.write")
     else
-      Req.qli ~typ ~name:"uv_fs_write" ~param ~f:(write t buf pos len)
+      Req.qli ~typ ~name:"uv_fs_write" ~param
+        ~f:(write t buf pos len fd_offset)
+
+  let pwrite ?pos ?len ~fd_offset ~dim t ~buf =
+    if Int64.compare fd_offset 0L < 0 then
+      Lwt.fail (Invalid_argument "Uwt.Fs.pwrite")
+    else
+      write ~fd_offset ~dim ?pos ?len t ~buf
+
+  let pwrite_ba ?pos ?len t ~fd_offset ~(buf:buf) =
+    let dim = Bigarray.Array1.dim buf in
+    pwrite ~fd_offset ~dim ?pos ?len t ~buf
+
+  let pwrite_string ?pos ?len t ~fd_offset ~buf =
+    let dim = String.length buf in
+    pwrite ~fd_offset ~dim ?pos ?len t ~buf
+
+  let pwrite ?pos ?len t ~fd_offset ~buf =
+    let dim = Bytes.length buf in
+    pwrite ~fd_offset ~dim ?pos ?len t ~buf
 
   let write_ba ?pos ?len t ~(buf:buf) =
     let dim = Bigarray.Array1.dim buf in
-    write ~dim ?pos ?len t ~buf
+    write ~fd_offset:(-1L) ~dim ?pos ?len t ~buf
 
   let write_string ?pos ?len t ~buf =
     let dim = String.length buf in
-    write ~dim ?pos ?len t ~buf
+    write ~fd_offset:(-1L) ~dim ?pos ?len t ~buf
 
   let write ?pos ?len t ~buf =
     let dim = Bytes.length buf in
-    write ~dim ?pos ?len t ~buf
+    write ~fd_offset:(-1L) ~dim ?pos ?len t ~buf
+
+  let rec no_string_iovec iov i =
+    i < 0 ||
+    match Array.unsafe_get iov i with
+    | Iovec_string _ -> false
+    | Iovec_bytes _ | Iovec_ba _ -> no_string_iovec iov (pred i)
+
+  external readv:
+    file -> iovec array -> int64 -> loop -> Req.t -> int_cb ->
+    Int_result.unit = "uwt_fs_readv_byte" "uwt_fs_readv_native"
+
+  let readv ?(fd_offset=(-1L)) t iov =
+    if Int64.compare fd_offset (-1L) < 0 || iovec_valid iov = false ||
+       no_string_iovec iov (Array.length iov - 1) = false then
+      Lwt.fail (Invalid_argument "Uwt.Fs.readv")
+    else if Array.length iov = 0 then
+      Lwt.return 0
+    else
+      Req.qli ~typ ~name:"uv_fs_read" ~param ~f:(readv t iov fd_offset)
+
+  external writev:
+    file -> iovec array -> int64 -> loop -> Req.t -> int_cb ->
+    Int_result.unit = "uwt_fs_writev_byte" "uwt_fs_writev_native"
+
+  let writev ?(fd_offset=(-1L)) t iov =
+    if Int64.compare fd_offset (-1L) < 0 || iovec_valid iov = false then
+      Lwt.fail (Invalid_argument "Uwt.Fs.writev")
+    else if Array.length iov = 0 then
+      Lwt.return 0
+    else
+      Req.qli ~typ ~name:"uv_fs_write" ~param ~f:(writev t iov fd_offset)
 
   external close:
     file -> loop -> Req.t -> unit_cb -> Int_result.unit =
@@ -1594,6 +2136,426 @@ module Fs = struct
     Req.ql ~typ ~f:(scandir param) ~name:"scandir" ~param
 
   let realpath = Unix.realpath
+
+  external copy_file:
+    file -> file -> int64 -> int64 C_worker.u -> C_worker.t = "uwt_fs_copy_file"
+
+  let copy_chunks ~chunk ~parallelism ~src ~dst size =
+    let next = ref 0L
+    and copied = ref 0L in
+    let worker () =
+      let buf = Bigarray.Array1.create Bigarray.char Bigarray.c_layout chunk in
+      let rec fill off pos len =
+        if pos = len then
+          Lwt.return pos
+        else
+          let fd_offset = Int64.add off (Int64.of_int pos) in
+          pread_ba ~pos ~len:(len - pos) src ~fd_offset ~buf >>= fun n ->
+          if n = 0 then
+            Lwt.return pos
+          else
+            fill off (pos + n) len
+      in
+      let rec flush off pos len =
+        if pos = len then
+          Lwt.return_unit
+        else
+          let fd_offset = Int64.add off (Int64.of_int pos) in
+          pwrite_ba ~pos ~len:(len - pos) dst ~fd_offset ~buf >>= fun n ->
+          flush off (pos + n) len
+      in
+      let rec iter () =
+        let off = !next in
+        let rest = Int64.sub size off in
+        if Int64.compare rest 0L <= 0 then
+          Lwt.return_unit
+        else
+          let len =
+            if Int64.compare rest (Int64.of_int chunk) < 0 then
+              Int64.to_int rest
+            else
+              chunk
+          in
+          next := Int64.add off (Int64.of_int len);
+          fill off 0 len >>= fun n ->
+          flush off 0 n >>= fun () ->
+          copied := Int64.add !copied (Int64.of_int n);
+          if n < len then
+            Lwt.return_unit
+          else
+            iter ()
+      in
+      iter ()
+    in
+    let rec start accu i =
+      if i = 0 then
+        accu
+      else
+        start (worker () :: accu) (pred i)
+    in
+    Lwt.join (start [] parallelism) >>= fun () ->
+    Lwt.return !copied
+
+  let copy_file ?(chunk=1_048_576) ?(parallelism=4) ?(in_kernel=true)
+      ~src ~dst () =
+    if chunk <= 0 || parallelism <= 0 then
+      Lwt.fail (Invalid_argument "Uwt.Fs.copy_file")
+    else
+      openfile ~mode:[O_RDONLY] src >>= fun fsrc ->
+      Lwt.finalize ( fun () ->
+          fstat fsrc >>= fun st ->
+          (* dst is truncated after the check below, O_TRUNC would
+             destroy src, if dst is the same file or a hard link *)
+          let mode = [O_WRONLY; O_CREAT] in
+          openfile ~perm:st.st_perm ~mode dst >>= fun fdst ->
+          Lwt.finalize ( fun () ->
+              fstat fdst >>= fun dst_st ->
+              if dst_st.st_dev = st.st_dev && dst_st.st_ino = st.st_ino then
+                efail ~param:dst "copy_file" EINVAL
+              else
+              let size = st.st_size in
+              ftruncate fdst ~len:0L >>= fun () ->
+              ftruncate fdst ~len:size >>= fun () ->
+              let fallback () =
+                copy_chunks ~chunk ~parallelism ~src:fsrc ~dst:fdst size
+              in
+              if in_kernel = false then
+                fallback ()
+              else
+              Lwt.catch ( fun () ->
+                  C_worker.call_internal ~name:"copy_file" ~param:src
+                    (copy_file fsrc fdst) size )
+                (function
+                | Uwt_error(ENOSYS,_,_) -> fallback ()
+                | x -> Lwt.fail x) )
+            ( fun () -> close fdst ) )
+        ( fun () -> close fsrc )
+
+  type dir = file
+
+  module Dirents = struct
+    type t = {
+      buf: string;
+      offsets: int array;
+    }
+
+    let kinds = [| S_REG; S_DIR; S_CHR; S_BLK; S_LNK; S_FIFO; S_SOCK;
+                   S_UNKNOWN |]
+
+    let length t = Array.length t.offsets
+
+    let name t i =
+      let start = t.offsets.(i) + 9 in
+      let stop = String.index_from t.buf start '\000' in
+      String.sub t.buf start (stop - start)
+
+    let kind t i =
+      Array.unsafe_get kinds (Char.code t.buf.[t.offsets.(i) + 8])
+
+    let ino t i =
+      let off = t.offsets.(i) in
+      let rec iter accu j =
+        if j < 0 then
+          accu
+        else
+          let c = Int64.of_int (Char.code (String.unsafe_get t.buf (off + j))) in
+          iter (Int64.logor (Int64.shift_left accu 8) c) (pred j)
+      in
+      iter 0L 7
+
+    let to_array t = Array.init (length t) ( fun i -> kind t i, name t i )
+  end
+
+  let opendir param = openfile ~mode:[O_RDONLY] param
+
+  let closedir d = close d
+
+  external readdir:
+    dir -> int -> Dirents.t C_worker.u -> C_worker.t = "uwt_fs_readdir"
+
+  let readdir ?(batch=1024) d =
+    if batch <= 0 then
+      Lwt.fail (Invalid_argument "Uwt.Fs.readdir")
+    else
+      C_worker.call_internal ~name:"readdir" (readdir d) batch
+  type entry = {
+    e_path: string;
+    e_kind: file_kind;
+    e_ino: int64;
+    e_stats: stats option;
+  }
+
+  module Stats_array = struct
+    type t = (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array1.t
+
+    let slots = 22
+
+    let length (t:t) = Bigarray.Array1.dim t / slots
+
+    let get_int64 (t:t) i j =
+      if i < 0 || i >= length t then
+        invalid_arg "Uwt.Fs.Stats_array: index out of bounds";
+      Bigarray.Array1.unsafe_get t (i * slots + j)
+
+    let get_int t i j = Int64.to_int (get_int64 t i j)
+
+    (* the first slot contains the Int_result.unit of the stat call *)
+    external int_result : int -> Int_result.unit = "%identity"
+
+    let error t i =
+      let x = get_int t i 0 in
+      if x = 0 then
+        None
+      else
+        Some (Int_result.to_error (int_result x))
+
+    let is_ok t i = get_int t i 0 = 0
+
+    let kinds = [| S_REG; S_DIR; S_CHR; S_BLK; S_LNK; S_FIFO; S_SOCK;
+                   S_UNKNOWN |]
+
+    let dev t i = get_int t i 1
+    let kind t i = Array.unsafe_get kinds (get_int t i 2)
+    let perm t i = get_int t i 3
+    let nlink t i = get_int t i 4
+    let uid t i = get_int t i 5
+    let gid t i = get_int t i 6
+    let rdev t i = get_int t i 7
+    let ino t i = get_int t i 8
+    let size t i = get_int64 t i 9
+    let blksize t i = get_int t i 10
+    let blocks t i = get_int t i 11
+    let flags t i = get_int t i 12
+    let gen t i = get_int t i 13
+    let atime t i = get_int64 t i 14
+    let atime_nsec t i = get_int t i 15
+    let mtime t i = get_int64 t i 16
+    let mtime_nsec t i = get_int t i 17
+    let ctime t i = get_int64 t i 18
+    let ctime_nsec t i = get_int t i 19
+    let birthtime t i = get_int64 t i 20
+    let birthtime_nsec t i = get_int t i 21
+
+    let get t i =
+      match error t i with
+      | Some x -> Error x
+      | None ->
+        Ok {
+          st_dev = dev t i;
+          st_kind = kind t i;
+          st_perm = perm t i;
+          st_nlink = nlink t i;
+          st_uid = uid t i;
+          st_gid = gid t i;
+          st_rdev = rdev t i;
+          st_ino = ino t i;
+          st_size = size t i;
+          st_blksize = blksize t i;
+          st_blocks = blocks t i;
+          st_flags = flags t i;
+          st_gen = gen t i;
+          st_atime = atime t i;
+          st_atime_nsec = atime_nsec t i;
+          st_mtime = mtime t i;
+          st_mtime_nsec = mtime_nsec t i;
+          st_ctime = ctime t i;
+          st_ctime_nsec = ctime_nsec t i;
+          st_birthtime = birthtime t i;
+          st_birthtime_nsec = birthtime_nsec t i;
+        }
+  end
+
+  external stat_many:
+    string array -> bool -> Stats_array.t C_worker.u -> C_worker.t =
+    "uwt_fs_stat_many"
+
+  let stat_many ?(lstat=false) paths =
+    C_worker.call_internal ~name:"stat_many" (stat_many paths) lstat
+
+  let walk ?(max_parallel=4) ?(follow_symlinks=false) ?(with_stat=false)
+      root f =
+    if max_parallel <= 0 then
+      Lwt.fail (Invalid_argument "Uwt.Fs.walk")
+    else
+      let dirs = Queue.create ()
+      and idle = Queue.create ()
+      and tokens = ref max_parallel
+      and token_waiters = Queue.create ()
+      and busy = ref 0
+      and error = ref None
+      and visited = Hashtbl.create 64 in
+      (* every threadpool request needs a token *)
+      let with_token g =
+        (if !tokens > 0 then (
+            decr tokens;
+            Lwt.return_unit )
+         else
+           let sleeper,waker = Lwt.wait () in
+           Queue.push waker token_waiters;
+           sleeper) >>= fun () ->
+        Lwt.finalize g ( fun () ->
+            if Queue.is_empty token_waiters then
+              incr tokens
+            else
+              Lwt.wakeup (Queue.pop token_waiters) ();
+            Lwt.return_unit )
+      in
+      let wake_all () =
+        while not (Queue.is_empty idle) do
+          Lwt.wakeup (Queue.pop idle) ()
+        done
+      in
+      let fail_walk exn =
+        if !error = None then
+          error := Some exn;
+        wake_all ()
+      in
+      let new_dir (st:stats option) path =
+        let fresh =
+          match st with
+          | Some st when follow_symlinks ->
+            let key = st.st_dev, st.st_ino in
+            if Hashtbl.mem visited key then
+              false
+            else (
+              Hashtbl.add visited key ();
+              true )
+          | Some _ | None -> true
+        in
+        if fresh then (
+          Queue.push path dirs;
+          if not (Queue.is_empty idle) then
+            Lwt.wakeup (Queue.pop idle) () )
+      in
+      let need_stat kind =
+        with_stat || kind = S_UNKNOWN ||
+        (follow_symlinks && (kind = S_LNK || kind = S_DIR))
+      in
+      (* one stat_many request for all entries of a batch, that need
+         it. [res.(i)] is set for the indices in [sel] *)
+      let stat_sel ~lstat res paths sel ~ok =
+        let name = if lstat then "lstat" else "stat" in
+        with_token ( fun () ->
+            stat_many ~lstat (Array.map (Array.unsafe_get paths) sel) )
+        >|= fun sa ->
+        let rest = ref [] in
+        Array.iteri ( fun j i ->
+            match Stats_array.get sa j with
+            | Ok st -> res.(i) <- Some st
+            | Error x when ok i x -> rest := i :: !rest
+            | Error x -> raise (Uwt_error(x,name,paths.(i))) ) sel;
+        Array.of_list (List.rev !rest)
+      in
+      let stat_batch kinds paths =
+        let res = Array.make (Array.length paths) None in
+        let sel = ref [] in
+        for i = Array.length kinds - 1 downto 0 do
+          if need_stat kinds.(i) then
+            sel := i :: !sel
+        done;
+        match !sel with
+        | [] -> Lwt.return res
+        | l ->
+          let sel = Array.of_list l in
+          if follow_symlinks = false then
+            stat_sel ~lstat:true res paths sel ~ok:(fun _ _ -> false)
+            >|= fun _ -> res
+          else
+            (* dangling symlinks are reported with lstat *)
+            let dangling i x = x = ENOENT && kinds.(i) = S_LNK in
+            stat_sel ~lstat:false res paths sel ~ok:dangling >>= fun sel ->
+            if Array.length sel = 0 then
+              Lwt.return res
+            else
+              stat_sel ~lstat:true res paths sel ~ok:(fun _ _ -> false)
+              >|= fun _ -> res
+      in
+      let visit path kind ino st =
+        if !error <> None then
+          Lwt.return_unit
+        else
+          let e_kind,e_ino =
+            match st with
+            | None -> kind, ino
+            | Some s when ino = 0L -> s.st_kind, Int64.of_int s.st_ino
+            | Some s -> s.st_kind, ino
+          in
+          let e_stats = if with_stat then st else None in
+          f { e_path = path; e_kind; e_ino; e_stats } >|= fun () ->
+          if e_kind = S_DIR then
+            new_dir st path
+      in
+      let visit_batch dir kinds names inos =
+        let paths = Array.map (Filename.concat dir) names in
+        stat_batch kinds paths >>= fun st ->
+        let rec start accu i =
+          if i < 0 then
+            accu
+          else
+            let t = visit paths.(i) kinds.(i) inos.(i) st.(i) in
+            start (t :: accu) (pred i)
+        in
+        Lwt.join (start [] (Array.length paths - 1))
+      in
+      let list_dir dir =
+        with_token ( fun () -> opendir dir ) >>= fun d ->
+        Lwt.finalize ( fun () ->
+            let rec iter () =
+              if !error <> None then
+                Lwt.return_unit
+              else
+                with_token ( fun () -> readdir d ) >>= fun b ->
+                let len = Dirents.length b in
+                if len = 0 then
+                  Lwt.return_unit
+                else
+                  let kinds = Array.init len (Dirents.kind b)
+                  and names = Array.init len (Dirents.name b)
+                  and inos = Array.init len (Dirents.ino b) in
+                  visit_batch dir kinds names inos >>= iter
+            in
+            Lwt.catch iter (function
+              | Uwt_error(ENOSYS,_,_) ->
+                with_token ( fun () -> scandir dir ) >>= fun a ->
+                visit_batch dir (Array.map fst a) (Array.map snd a)
+                  (Array.make (Array.length a) 0L)
+              | x -> Lwt.fail x ) )
+          ( fun () -> closedir d )
+      in
+      let rec worker () =
+        if !error <> None then
+          Lwt.return_unit
+        else if Queue.is_empty dirs = false then (
+          let dir = Queue.pop dirs in
+          incr busy;
+          Lwt.catch ( fun () -> list_dir dir ) ( fun exn ->
+              fail_walk exn;
+              Lwt.return_unit ) >>= fun () ->
+          decr busy;
+          worker () )
+        else if !busy = 0 then (
+          wake_all ();
+          Lwt.return_unit )
+        else
+          let sleeper,waker = Lwt.wait () in
+          Queue.push waker idle;
+          sleeper >>= worker
+      in
+      let rec start accu i =
+        if i = 0 then
+          accu
+        else
+          start (worker () :: accu) (pred i)
+      in
+      (if follow_symlinks then
+         stat root >|= fun st -> new_dir (Some st) root
+       else (
+         new_dir None root;
+         Lwt.return_unit )) >>= fun () ->
+      Lwt.join (start [] max_parallel) >>= fun () ->
+      match !error with
+      | None -> Lwt.return_unit
+      | Some x -> Lwt.fail x
 end
 
 module Fs_poll = struct
@@ -1692,6 +2654,62 @@ module Main = struct
 
   external cleanup: unit -> unit = "uwt_cleanup_na" "noalloc"
 
+  type pool_stats = {
+    pool_id: int;
+    pool_name: string;
+    elt_size: int;
+    created: int;
+    cached: int;
+    min_cached: int;
+    hits: int;
+    misses: int;
+    low_watermark: int;
+    high_watermark: int;
+  }
+
+  external pool_stats: unit -> pool_stats array = "uwt_pool_stats"
+
+  type root_stats = {
+    roots_live: int;
+    roots_peak: int;
+    roots_capacity: int;
+  }
+
+  external root_stats: unit -> root_stats = "uwt_root_stats"
+
+  external trim_pools: int -> unit = "uwt_trim_pools_na" "noalloc"
+  let trim_pools ?(target_bytes=0) () = trim_pools target_bytes
+
+  external pool_config:
+    int -> int -> int -> bool = "uwt_pool_config_na" "noalloc"
+  let set_pool_policy ?trim_interval ?rss_limit ?huge_pages () =
+    let f s = function
+    | None -> -1
+    | Some x when x < 0 -> invalid_arg ("Uwt.Main.set_pool_policy: " ^ s)
+    | Some x -> x
+    in
+    let huge_pages = match huge_pages with
+    | None -> -1
+    | Some false -> 0
+    | Some true -> 1
+    in
+    let trim_interval = f "trim_interval" trim_interval in
+    if pool_config trim_interval (f "rss_limit" rss_limit) huge_pages = false
+    then
+      invalid_arg "Uwt.Main.set_pool_policy: trim_interval"
+
+  external set_pool_watermarks:
+    int -> int -> int -> Int_result.unit =
+    "uwt_pool_set_watermarks_na" "noalloc"
+  let set_pool_watermarks ?low ?high id =
+    let f = function
+    | None -> -1
+    | Some x when x < 0 -> invalid_arg "Uwt.Main.set_pool_watermarks"
+    | Some x -> x
+    in
+    if Int_result.is_error (set_pool_watermarks id (f low) (f high)) then
+      invalid_arg "Uwt.Main.set_pool_watermarks"
+
   let run (t:'a Lwt.t) : 'a =
     if !fatal_found then
       failwith "uwt loop unusuable";
@@ -74,6 +74,7 @@ include module type of Uwt_base
   with type 'a result = 'a Uwt_base.result
   with type file = Uwt_base.file
   with type sockaddr = Uwt_base.sockaddr
+  with type iovec = Uwt_base.iovec
   with type 'a Int_result.t = 'a Uwt_base.Int_result.t
   with type Fs_types.uv_open_flag = Uwt_base.Fs_types.uv_open_flag
   with type Fs_types.file_kind = Uwt_base.Fs_types.file_kind
@@ -159,10 +160,205 @@ module Main : sig
       call {!run} again any time soon. It will free some internally used
       memory, but not all. *)
   val cleanup : unit -> unit
+
+  (** Statistics about the internal free lists. uwt caches requests
+      and handles (one pool per libuv request and handle type, the
+      libuv struct is stored together with uwt's own bookkeeping) and
+      buffers (one pool per power of two, 256 byte - 4MB, buffers above
+      128KB are directly backed by pages). The buffers of the
+      synchronous functions ({!Uv_fs_sync}, pools named [buf_sync_*]) are
+      pooled separately. *)
+  type pool_stats = {
+    pool_id: int; (** stable id, see {!set_pool_watermarks} *)
+    pool_name: string;
+    elt_size: int; (** size of one element in bytes *)
+    created: int; (** elements currently allocated (cached or in use) *)
+    cached: int; (** idle elements in the free list *)
+    min_cached: int; (** minimal number of idle elements in the
+                         current trim window *)
+    hits: int; (** allocations served from the free list *)
+    misses: int; (** allocations served by malloc *)
+    low_watermark: int; (** the periodic trimming never releases
+                            elements below this mark *)
+    high_watermark: int; (** elements beyond this mark are not cached,
+                             but released immediately. 0: unlimited *)
+  }
+
+  val pool_stats : unit -> pool_stats array
+
+  (** OCaml values, that are referenced by pending requests and active
+      handles (callbacks, buffers, ...), are stored in a table of
+      global roots. The table grows in chunks, empty chunks are
+      released by {!trim_pools}, {!cleanup} and the periodic trimming. *)
+  type root_stats = {
+    roots_live: int; (** currently registered values *)
+    roots_peak: int; (** maximal number of registered values so far *)
+    roots_capacity: int; (** allocated slots *)
+  }
+
+  val root_stats : unit -> root_stats
+
+  (** Release cached memory until the free lists hold at most
+      [target_bytes] (default: 0). The watermarks are ignored. *)
+  val trim_pools : ?target_bytes:int -> unit -> unit
+
+  (** The free lists are trimmed periodically (default: every 90
+      seconds). Elements, that were not needed during two trim windows
+      in a row, are released gradually. If the resident set size of the
+      process exceeds [rss_limit] (bytes, 0: disabled, the default), all
+      idle elements above the low watermarks are released at once.
+      [trim_interval] is in milliseconds, 0 disables periodic trimming.
+      If [huge_pages] is true (default: false), buffers of 2MB or more
+      are backed by transparent huge pages, if supported by the OS.
+      @raise Invalid_argument if a value is negative or [trim_interval]
+      doesn't fit into an unsigned int *)
+  val set_pool_policy :
+    ?trim_interval:int -> ?rss_limit:int -> ?huge_pages:bool -> unit -> unit
+
+  (** Change the watermarks of the pool with the given [pool_id].
+      @raise Invalid_argument if the id is unknown or [low] would be
+      larger than a non-zero [high] *)
+  val set_pool_watermarks : ?low:int -> ?high:int -> int -> unit
 end
 
 module Fs : sig
   include Fs_functions with type 'a t := 'a Lwt.t
+
+  val copy_file :
+    ?chunk:int -> ?parallelism:int -> ?in_kernel:bool -> src:string ->
+    dst:string -> unit -> int64 Lwt.t
+  (** [copy_file ~src ~dst ()] copies the content of [src] to [dst]. [dst]
+      is created with the permissions of [src] or truncated, if it already
+      exists. The number of copied bytes (the size of [dst], holes
+      included) is returned. The thread fails with [EINVAL], if [src]
+      and [dst] are the same file (e.g. hard links).
+
+      On Linux, the file is first cloned with [FICLONE] (reflink). If the
+      filesystem doesn't support it, only the data extents of [src] are
+      copied with [copy_file_range], holes are preserved and the
+      destination is preallocated extent by extent. The copy happens
+      inside the threadpool without passing the data through user space.
+
+      On other systems (or if the kernel refuses the request before the
+      first byte was copied) the file is copied with {!pread_ba} and
+      {!pwrite_ba}: [parallelism] (default 4) requests are kept in flight,
+      each one copying a block of [chunk] bytes (default 1 MiB).
+      [in_kernel:false] (default: true) skips the kernel copy and always
+      uses this fallback. *)
+
+  type dir
+  (** An open directory, see {!opendir} *)
+
+  (** A batch of directory entries returned by {!readdir}. The entries
+      are stored inside a single string, the whole batch can be dropped
+      as soon as it was processed. Indices start at [0]. *)
+  module Dirents : sig
+    type t
+
+    val length : t -> int
+
+    val name : t -> int -> string
+
+    val kind : t -> int -> file_kind
+    (** [S_UNKNOWN] is returned, if the filesystem doesn't report the
+        type. Use {!lstat} in this case. *)
+
+    val ino : t -> int -> int64
+    (** inode number *)
+
+    val to_array : t -> (file_kind * string) array
+    (** same format as {!scandir} *)
+  end
+
+  val opendir : string -> dir Lwt.t
+
+  val readdir : ?batch:int -> dir -> Dirents.t Lwt.t
+  (** [readdir d] returns the next (at most [batch], default 1024) entries
+      of the directory. ["."] and [".."] are omitted, an empty batch
+      signals the end of the directory. Unlike {!scandir}, huge
+      directories can be processed in constant memory.
+
+      The entries are read with [getdents64] inside the threadpool. Other
+      systems fail with [ENOSYS]. Don't call [readdir] concurrently on
+      the same [dir]. *)
+
+  val closedir : dir -> unit Lwt.t
+
+  type entry = {
+    e_path: string; (** the root directory concatenated with the
+                        relative path of the entry *)
+    e_kind: file_kind; (** the kind of the symlink target, if
+                           [follow_symlinks] is set *)
+    e_ino: int64; (** [0L], if it is unknown *)
+    e_stats: stats option; (** only set, if [with_stat] was [true] *)
+  }
+
+  val walk :
+    ?max_parallel:int -> ?follow_symlinks:bool -> ?with_stat:bool ->
+    string -> (entry -> unit Lwt.t) -> unit Lwt.t
+  (** [walk root f] calls [f] for every entry below [root] (but not for
+      [root] itself). Directories are listed in batches with {!readdir}
+      ({!scandir} on systems without [readdir]), [stat]/[lstat] is only
+      called, if [with_stat] is set or the filesystem doesn't report the
+      kind of an entry. The entries of a batch are passed to a single
+      {!stat_many} request.
+
+      At most [max_parallel] (default 4) requests are submitted to the
+      threadpool at once, the remaining slots are left to other work. [f]
+      is called concurrently for the entries of a batch.
+
+      If [follow_symlinks] is set (default [false]), symlinks to
+      directories are traversed. Every directory is only visited once.
+
+      The first error (including exceptions of [f]) stops the traversal,
+      [walk] fails with it after all pending requests have finished. *)
+
+  (** Compact results of {!stat_many}: all results are stored inside one
+      int64 bigarray. The getters don't allocate (with the exception of
+      the int64 getters, if the value isn't unboxed by the compiler). The
+      getters of a failed entry return garbage, check {!is_ok} or {!error}
+      first. *)
+  module Stats_array : sig
+    type t
+
+    val length : t -> int
+
+    val is_ok : t -> int -> bool
+
+    val error : t -> int -> error option
+
+    val get : t -> int -> stats result
+    (** allocates a regular {!stats} record *)
+
+    val dev : t -> int -> int
+    val kind : t -> int -> file_kind
+    val perm : t -> int -> int
+    val nlink : t -> int -> int
+    val uid : t -> int -> int
+    val gid : t -> int -> int
+    val rdev : t -> int -> int
+    val ino : t -> int -> int
+    val size : t -> int -> int64
+    val blksize : t -> int -> int
+    val blocks : t -> int -> int
+    val flags : t -> int -> int
+    val gen : t -> int -> int
+    val atime : t -> int -> int64
+    val atime_nsec : t -> int -> int
+    val mtime : t -> int -> int64
+    val mtime_nsec : t -> int -> int
+    val ctime : t -> int -> int64
+    val ctime_nsec : t -> int -> int
+    val birthtime : t -> int -> int64
+    val birthtime_nsec : t -> int -> int
+  end
+
+  val stat_many : ?lstat:bool -> string array -> Stats_array.t Lwt.t
+  (** [stat_many paths] calls [stat] (or [lstat], if [lstat] is [true])
+      for all paths inside a single threadpool request. The result at
+      index [i] belongs to [paths.(i)]. Errors are reported per entry,
+      the promise itself only fails, if the request couldn't be started
+      at all (e.g. a path containing a null byte). *)
 end
 
 module Handle : sig
@@ -260,6 +456,53 @@ module Stream : sig
   val read_start : t -> cb:(Bytes.t result -> unit) -> Int_result.unit
   val read_start_exn : t -> cb:(Bytes.t result -> unit) -> unit
 
+  (** Like {!read_start}, but the callbacks are not called immediately.
+      The data received by all streams in one iteration of the event loop
+      is collected and passed to OCaml at once, at the end of the
+      iteration. This reduces the overhead for servers with many busy
+      connections. If the stream is closed or reading is stopped before
+      the end of the iteration, the data queued for it is discarded. *)
+  val read_start_batched :
+    t -> cb:(Bytes.t result -> unit) -> Int_result.unit
+  val read_start_batched_exn : t -> cb:(Bytes.t result -> unit) -> unit
+
+  (** Like {!read_start}, but the data is not copied. The callback
+      receives a slice of an internal buffer. The buffer is owned by you
+      after the callback was called. Pass it to {!release_ba}, if you no
+      longer need it. Otherwise the memory is freed, when the bigarray is
+      garbage collected. *)
+  val read_start_ba : t -> cb:(buf result -> unit) -> Int_result.unit
+  val read_start_ba_exn : t -> cb:(buf result -> unit) -> unit
+
+  (** Returns a buffer received by {!read_start_ba} to the internal
+      cache. The bigarray is empty afterwards (dimension 0) and must not
+      be used any longer. [release_ba] returns [false] and does nothing,
+      if the buffer wasn't created by {!read_start_ba}, if it was already
+      released or if sub arrays of the buffer (Bigarray.Array1.sub) are
+      still reachable.
+
+      Must be called from the main thread. *)
+  val release_ba : buf -> bool
+
+  (** The buffer size used by {!read_start} and {!read_start_ba}.
+
+      - [`Fixed n] (default: [`Fixed 65536]): [n] bytes are requested
+        for every read.
+      - [`Adaptive(min,max)]: the size starts with [min]. It is doubled
+        after a read that filled the whole buffer and halved after two
+        short reads in a row, but it always stays between [min] and
+        [max].
+
+      [max] must not be larger than 4MB. The policy is not used by
+      {!read}, which always reads into the buffer you supply. *)
+  val set_read_size_policy :
+    t -> [ `Fixed of int | `Adaptive of int * int ] -> Int_result.unit
+  val set_read_size_policy_exn :
+    t -> [ `Fixed of int | `Adaptive of int * int ] -> unit
+
+  (** The buffer size currently used by {!read_start}. *)
+  val read_size : t -> int
+
   val read_stop : t -> Int_result.unit
   val read_stop_exn : t -> unit
 
@@ -275,12 +518,132 @@ module Stream : sig
   val read : ?pos:int -> ?len:int -> t -> buf:bytes -> int Lwt.t
   val read_ba : ?pos:int -> ?len:int -> t -> buf:buf -> int Lwt.t
 
+  (** [attach_ring t buf] reads continuously into [buf], which is used
+      as a ring buffer. Reading is only paused, if the ring is full.
+      Unlike {!read}, the kernel interest set is not changed for every
+      read.
+
+      - {!ring_pos} is the position of the first unread byte inside
+        [buf], {!ring_available} the number of unread bytes. The data
+        can wrap around the end of [buf].
+      - {!ring_consume} [t n] marks [n] bytes as read. The space can be
+        reused by the stream.
+      - {!ring_wait} returns the number of unread bytes. If there are
+        none, it waits until new data arrives. [0] indicates EOF.
+
+      Don't modify [buf] or use other read functions, until you've called
+      {!detach_ring}. *)
+  val attach_ring : t -> buf -> Int_result.unit
+  val attach_ring_exn : t -> buf -> unit
+  val detach_ring : t -> Int_result.unit
+  val ring_available : t -> int
+  val ring_pos : t -> int
+  val ring_consume : t -> int -> Int_result.unit
+  val ring_consume_exn : t -> int -> unit
+  val ring_wait : t -> int Lwt.t
+
   val write_queue_size : t -> int
 
   val try_write : ?pos:int -> ?len:int -> t -> buf:bytes -> Int_result.int
   val try_write_ba: ?pos:int -> ?len:int -> t -> buf:buf -> Int_result.int
   val try_write_string: ?pos:int -> ?len:int -> t -> buf:string -> Int_result.int
 
+  (** [writev t iov] writes all segments of [iov] with a single write
+      request. Bigarray segments must not be modified until the
+      returned thread has finished, strings are copied.
+      The returned thread fails with [Invalid_argument], if a segment is
+      invalid. *)
+  val writev : t -> iovec array -> unit Lwt.t
+
+  (** [sendfile ~len t file] writes [len] bytes of [file], starting at
+      [offset] (default: 0), to the stream without copying the data into
+      the OCaml heap. The returned thread finishes with the number of
+      bytes written, which is smaller than [len] at the end of the file.
+      sendfile(2) is called in a worker thread, it waits until the
+      previous write requests have been written. The worker thread
+      returns to the pool, whenever the socket is full, the transfer
+      continues when it's writable again. If sendfile(2) is not
+      available or refuses the descriptors, pread and write are used
+      instead. Other write requests fail with [EBUSY] until the
+      thread has finished. Not supported on Windows ([ENOSYS]). *)
+  val sendfile : ?offset:int64 -> len:int64 -> t -> file -> int64 Lwt.t
+
+  (** [forward ~src ~dst ()] writes everything, that is read from [src],
+      to [dst] until [src] reaches EOF. The data is not passed to OCaml,
+      the read buffers are written directly. Reading is paused, while
+      the buffers of the pending write requests occupy more than
+      [max_buffered] bytes (default: 256KB). The returned thread
+      finishes with the number of bytes forwarded; it fails, if one of
+      the streams is closed or an error occurs. [dst] is not shut down.
+
+      [src] can't be used for reading, while [forward] is active. It
+      fails with [EBUSY], if {!sendfile} is writing to [dst].
+
+      On Linux, TCP and pipe handles are connected with splice(2) and
+      the data doesn't leave the kernel, if nothing is queued for
+      writing to [dst]. [max_buffered] is then limited by the size of
+      the kernel's pipe buffer, and [dst] is exclusively owned by
+      [forward]: other writes fail with [EBUSY] and {!shutdown} waits
+      until [forward] has finished. *)
+  val forward : src:t -> dst:t -> ?max_buffered:int -> unit -> int64 Lwt.t
+
+  (** [cork t] enables cork mode: the data of small write requests
+      ({!write}, {!write_string}, {!write_ba}, ...) is copied into a
+      batch of [limit] bytes (default: 64KB, at most 4MB). The batch is
+      written, if it's full, before any other write request that can't
+      be corked ({!writev}, {!Pipe.write2}, larger writes), on {!shutdown} or
+      {!close} - or at the latest before the event loop waits for I/O.
+      The threads returned by the write functions finish as usual, when
+      the batch has been written.
+
+      {!try_write} and {!try_writev} always fail with [EAGAIN] while
+      the stream is corked. {!uncork} writes the current batch
+      immediately. *)
+  val cork : ?limit:int -> t -> Int_result.unit
+  val cork_exn : ?limit:int -> t -> unit
+  val uncork : t -> Int_result.unit
+  val uncork_exn : t -> unit
+
+  (** Like {!try_write}, but for several segments. It returns the number
+      of bytes written. *)
+  val try_writev : t -> iovec array -> Int_result.int
+
+  (** [set_write_watermarks t ~low ~high] limits the number of bytes,
+      that are queued for writing ({!write_queue_size} and the current
+      {!cork} batch). A write request, that would exceed [high], is
+      handled according to [policy]:
+
+      - [`Block] (default): the write functions wait until the queue
+        is drained below [low].
+      - [`Fail]: they fail with [ENOBUFS].
+
+      Blocked writes are admitted in FIFO order. As long as a write is
+      blocked, later writes (including {!try_write}) must queue up
+      behind it, so the byte order of the stream is preserved.
+
+      Writes are always accepted, as long as the queue is not larger
+      than [low]. [high = 0] disables the limits. *)
+  val set_write_watermarks :
+    ?policy:[ `Block | `Fail ] -> t -> low:int -> high:int ->
+    Int_result.unit
+  val set_write_watermarks_exn :
+    ?policy:[ `Block | `Fail ] -> t -> low:int -> high:int ->
+    unit
+
+  (** [wait_drained t] finishes, when the write queue of [t] is not
+      larger than the low watermark (see {!set_write_watermarks}) and
+      no {!sendfile} is running, or the stream was closed. *)
+  val wait_drained : t -> unit Lwt.t
+
+  (** [set_write_limit n] limits the bytes queued for writing by all
+      streams together. Writes, that would exceed the limit, fail
+      immediately with [ENOBUFS] regardless of the stream's policy.
+      [0] (default) disables the limit. *)
+  val set_write_limit : int -> unit
+
+  (** bytes currently queued for writing by all streams *)
+  val write_bytes_total : unit -> int
+
   val write : ?pos:int -> ?len:int -> t -> buf:bytes -> unit Lwt.t
   val write_string : ?pos:int -> ?len:int -> t -> buf:string -> unit Lwt.t
   val write_ba : ?pos:int -> ?len:int -> t -> buf:buf -> unit Lwt.t
@@ -309,6 +672,8 @@ module Stream : sig
   val accept_raw: server:t -> client:t -> Int_result.unit
   val accept_raw_exn: server:t -> client:t -> unit
 
+  (** [shutdown t] is delayed until a running {!sendfile} on [t] has
+      finished *)
   val shutdown: t -> unit Lwt.t
 end
 
@@ -430,6 +795,35 @@ module Udp : sig
   val send_queue_size: t -> int
   val send_queue_count: t -> int
 
+  (** [set_send_queue_limit t ~bytes ~count] limits the send queue of
+      [t] to [bytes] bytes and [count] datagrams ([0]: no limit). If a
+      datagram doesn't fit into the queue:
+
+      - [`Block] (default): the send functions wait until the queue is
+        drained below the half of both limits.
+      - [`Fail]: they fail with [ENOBUFS].
+      - [`Drop]: the datagram is discarded silently and counted, see
+        {!send_queue_dropped}. Queued datagrams can't be removed, only
+        new ones are dropped.
+
+      A datagram is always accepted, if the queue is empty. {!send_many}
+      never waits, its datagrams fail with [ENOBUFS] instead of
+      blocking. {!try_send} is not affected. *)
+  val set_send_queue_limit :
+    ?policy:[ `Block | `Fail | `Drop ] -> t -> bytes:int -> count:int ->
+    Int_result.unit
+  val set_send_queue_limit_exn :
+    ?policy:[ `Block | `Fail | `Drop ] -> t -> bytes:int -> count:int -> unit
+
+  (** [wait_drained t] finishes, when the send queue of [t] is below
+      the half of its limits (see {!set_send_queue_limit}) or [t] was
+      closed. *)
+  val wait_drained : t -> unit Lwt.t
+
+  (** Number of datagrams and bytes discarded by the policy [`Drop] *)
+  val send_queue_dropped : t -> int
+  val send_queue_dropped_bytes : t -> int
+
   (** See comment to {!Pipe.init} *)
   val init : unit -> t
 
@@ -445,6 +839,16 @@ module Udp : sig
   val bind : ?mode:mode list -> t -> addr:sockaddr -> unit -> Int_result.unit
   val bind_exn : ?mode:mode list -> t -> addr:sockaddr -> unit -> unit
 
+  (** [connect t ~addr] calls connect(2) on the socket (it's bound to
+      a random port first, if necessary). The kernel then only
+      delivers datagrams from [addr] and doesn't look up the route for
+      every datagram. Use {!send_connected} and {!recv_connected}
+      afterwards. {!recv_start} doesn't report the sender of a
+      connected handle ([Data (_,None)]). Only supported on Linux
+      ([ENOSYS] elsewhere). *)
+  val connect : t -> addr:sockaddr -> Int_result.unit
+  val connect_exn : t -> addr:sockaddr -> unit
+
   val getsockname : t -> sockaddr result
   val getsockname_exn : t -> sockaddr
 
@@ -478,6 +882,14 @@ module Udp : sig
   val send_string :
     ?pos:int -> ?len:int -> buf:string -> t -> sockaddr -> unit Lwt.t
 
+  (** Like {!send}, but to the address passed to {!connect}. The
+      datagram is written with send(2) immediately, if nothing else is
+      queued. Fails with [ENOTCONN], if {!connect} wasn't called. *)
+  val send_connected : ?pos:int -> ?len:int -> buf:bytes -> t -> unit Lwt.t
+  val send_connected_ba : ?pos:int -> ?len:int -> buf:buf -> t -> unit Lwt.t
+  val send_connected_string :
+    ?pos:int -> ?len:int -> buf:string -> t -> unit Lwt.t
+
   (** See comment to {!Stream.write_raw} *)
   val send_raw :
     ?pos:int -> ?len:int -> buf:bytes -> t -> sockaddr -> unit Lwt.t
@@ -486,6 +898,33 @@ module Udp : sig
   val send_raw_string :
     ?pos:int -> ?len:int -> buf:string -> t -> sockaddr -> unit Lwt.t
 
+  (** [send_many t msgs] sends every datagram of [msgs]. Strings are
+      copied, bigarrays must not be modified until the thread has
+      finished. If nothing else is queued, the datagrams are written
+      with as few sendmmsg(2) calls as possible (Linux), only the rest
+      is queued. The result contains the status of every message (in
+      the same order), the thread itself only fails, if the arguments
+      are invalid or the handle is closed. *)
+  val send_many :
+    t -> (iovec * sockaddr) array -> Int_result.unit array Lwt.t
+
+  (** [send_gso ~buf ~segment_size t addr] sends [buf] as a series of
+      datagrams of [segment_size] bytes (the last one may be shorter).
+      On Linux the kernel splits the buffer (UDP_SEGMENT, generic
+      segmentation offload), one syscall instead of one per datagram.
+      Elsewhere, or if the kernel doesn't support it, the datagrams are
+      sent with {!send_many}. The thread fails with the first error.
+      See [~gro] of {!recv_batch_start} for the receiving side. *)
+  val send_gso :
+    ?pos:int -> ?len:int -> buf:bytes -> segment_size:int -> t ->
+    sockaddr -> unit Lwt.t
+  val send_gso_ba :
+    ?pos:int -> ?len:int -> buf:buf -> segment_size:int -> t ->
+    sockaddr -> unit Lwt.t
+  val send_gso_string :
+    ?pos:int -> ?len:int -> buf:string -> segment_size:int -> t ->
+    sockaddr -> unit Lwt.t
+
   val try_send :
     ?pos:int -> ?len:int -> buf:bytes -> t -> sockaddr -> Int_result.int
   val try_send_ba :
@@ -504,6 +943,43 @@ module Udp : sig
   val recv_start : t -> cb:(recv_result -> unit) -> Int_result.unit
   val recv_start_exn : t -> cb:(recv_result -> unit) -> unit
 
+  (** Received datagrams of {!recv_batch_start}. Datagram [i] is stored
+      in [rb_buf] at offset [i * rb_slot_size], [rb_lens.(i)] is its
+      length (or an error code) and [rb_addrs.(i)] the sender.
+      [rb_flags.(i) land rb_partial <> 0], if the datagram was
+      truncated. If [rb_segs.(i) > 0], the kernel has coalesced several
+      datagrams of the same sender into slot [i] (see [gro] below):
+      they are [rb_segs.(i)] bytes long, the last one may be shorter. *)
+  type recv_batch = {
+    rb_buf: buf;
+    rb_slot_size: int;
+    rb_lens: Int_result.int array;
+    rb_flags: int array;
+    rb_addrs: sockaddr array;
+    rb_segs: int array;
+  }
+
+  val rb_partial : int
+
+  (** Like {!recv_start}, but [cb rb n] is called at most once per loop
+      iteration with the first [n] slots of [rb] (or earlier, if all
+      [slots] are used). The slots, including the sockaddr values, are
+      reused after [cb] has returned; no memory is allocated per
+      datagram. On Linux, the free slots are filled with a single
+      recvmmsg(2) call, when the socket becomes readable.
+      {!recv_stop} stops receiving.
+
+      [gro] (default: [false]) enables UDP generic receive offload, the
+      receive counterpart of {!send_gso}. [slot_size] should then be at
+      least 65536 (the default), larger coalesced reads are truncated.
+      It requires Linux 5.0 or newer ([ENOSYS] otherwise). *)
+  val recv_batch_start :
+    ?slots:int -> ?slot_size:int -> ?gro:bool -> t ->
+    cb:(recv_batch -> int -> unit) -> Int_result.unit
+  val recv_batch_start_exn :
+    ?slots:int -> ?slot_size:int -> ?gro:bool -> t ->
+    cb:(recv_batch -> int -> unit) -> unit
+
   val recv_stop : t -> Int_result.unit
   val recv_stop_exn : t -> unit
 
@@ -518,6 +994,11 @@ module Udp : sig
   val recv : ?pos:int -> ?len:int -> buf:bytes -> t -> recv Lwt.t
   val recv_ba : ?pos:int -> ?len:int -> buf:buf -> t -> recv Lwt.t
 
+  (** Like {!recv}, but no sockaddr is allocated, [sockaddr] is always
+      [None]. Intended for handles passed to {!connect}. *)
+  val recv_connected : ?pos:int -> ?len:int -> buf:bytes -> t -> recv Lwt.t
+  val recv_connected_ba : ?pos:int -> ?len:int -> buf:buf -> t -> recv Lwt.t
+
 end
 
 module Tty : sig
@@ -90,6 +90,11 @@ type file = Unix.file_descr
 type buf =
   (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
 
+type iovec =
+  | Iovec_bytes of bytes * int * int
+  | Iovec_string of string * int * int
+  | Iovec_ba of buf * int * int
+
 type sockaddr
 
 let stdin : file = Unix.stdin
@@ -175,6 +180,14 @@ module type Fs_functions = sig
   val write : ?pos:int -> ?len:int -> file -> buf:bytes -> int t
   val write_string : ?pos:int -> ?len:int -> file -> buf:string -> int t
   val write_ba : ?pos:int -> ?len:int -> file -> buf:buf -> int t
+  val pread : ?pos:int -> ?len:int -> file -> fd_offset:int64 -> buf:bytes -> int t
+  val pread_ba : ?pos:int -> ?len:int -> file -> fd_offset:int64 -> buf:buf -> int t
+  val pwrite : ?pos:int -> ?len:int -> file -> fd_offset:int64 -> buf:bytes -> int t
+  val pwrite_string :
+    ?pos:int -> ?len:int -> file -> fd_offset:int64 -> buf:string -> int t
+  val pwrite_ba : ?pos:int -> ?len:int -> file -> fd_offset:int64 -> buf:buf -> int t
+  val readv : ?fd_offset:int64 -> file -> iovec array -> int t
+  val writev : ?fd_offset:int64 -> file -> iovec array -> int t
   val close : file -> unit t
   val unlink : string -> unit t
   val mkdir : ?perm:int -> string -> unit t
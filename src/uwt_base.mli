@@ -278,6 +278,14 @@ type sockaddr
 type buf =
   (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
 
+(** A segment [(buf,pos,len)] of a vectored write, e.g.
+    {!Uwt.Stream.writev}. Only [Iovec_ba] segments are not copied by
+    the asynchronous functions. *)
+type iovec =
+  | Iovec_bytes of bytes * int * int
+  | Iovec_string of string * int * int
+  | Iovec_ba of buf * int * int
+
 val stdin : file
 val stdout : file
 val stderr : file
@@ -376,6 +384,36 @@ module type Fs_functions = sig
   val write_string : ?pos:int -> ?len:int -> file -> buf:string -> int t
   val write_ba : ?pos:int -> ?len:int -> file -> buf:buf -> int t
 
+  (** [pread t ~fd_offset ~buf] reads from the position [fd_offset] of
+      the file, the file position of [t] is not changed (pread(2)).
+      Several reads of the same file can be in progress in parallel,
+      without {!Uwt.Unix.lseek}.
+      @raise Invalid_argument if [fd_offset] is negative *)
+  val pread :
+    ?pos:int -> ?len:int -> file -> fd_offset:int64 -> buf:bytes -> int t
+  val pread_ba :
+    ?pos:int -> ?len:int -> file -> fd_offset:int64 -> buf:buf -> int t
+
+  (** Like {!pread}, but for writing (pwrite(2)) *)
+  val pwrite :
+    ?pos:int -> ?len:int -> file -> fd_offset:int64 -> buf:bytes -> int t
+  val pwrite_string :
+    ?pos:int -> ?len:int -> file -> fd_offset:int64 -> buf:string -> int t
+  val pwrite_ba :
+    ?pos:int -> ?len:int -> file -> fd_offset:int64 -> buf:buf -> int t
+
+  (** [readv t iov] reads into all segments of [iov] with a single
+      request. [fd_offset] is the file position ([-1], the default:
+      the current position of [t]). Only [Iovec_bytes] and [Iovec_ba]
+      segments are allowed. Like {!read}, it can read less than
+      requested. *)
+  val readv : ?fd_offset:int64 -> file -> iovec array -> int t
+
+  (** Like {!readv}, but for writing. The segments are written with a
+      single request (e.g. header, payload and checksum without
+      concatenating them first). *)
+  val writev : ?fd_offset:int64 -> file -> iovec array -> int t
+
   val close : file -> unit t
 
   val unlink : string -> unit t
@@ -69,6 +69,27 @@
 #ifdef HAVE_NETDB_H
 #include <netdb.h>
 #endif
+#if !defined(_WIN32) && defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#endif
+#if defined(__linux__) && defined(HAVE_SYS_SENDFILE_H)
+#include <sys/sendfile.h>
+#endif
+#if defined(__linux__) && defined(HAVE_STATX)
+#include <sys/sysmacros.h>
+#endif
+#if defined(__linux__) && defined(HAVE_SYS_IOCTL_H)
+#include <sys/ioctl.h>
+#endif
+#if defined(__linux__) && defined(HAVE_LINUX_FS_H)
+#include <linux/fs.h>
+#endif
+#if defined(__linux__) && defined(HAVE_SYS_SYSCALL_H)
+#include <sys/syscall.h>
+#endif
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
 
 #define CAML_NAME_SPACE 1
 #include <caml/mlvalues.h>
@@ -168,14 +189,45 @@ static struct loop uwt_global_def_loop[CB_MAX];
 static value *uwt_global_exception_fun = NULL;
 static bool uwt_global_runtime_released = false;
 
-static value uwt_global_caml_root = Val_unit;
-static unsigned int uwt_global_caml_root_size = 0;
-static unsigned int uwt_global_caml_root_n = 0;
-static unsigned int * uwt_global_caml_root_free_pos = NULL;
+/*
+  OCaml values referenced from C (callbacks, buffers, ...) are stored
+  in chunks of GR_CHUNK_SIZE fields. Every chunk is a separate OCaml
+  block, registered as generational global root. Chunks are allocated
+  on demand and empty chunks are released by the cache cleaner (one
+  chunk of free slots is kept), so the major GC only scans (roughly) the
+  live roots and nothing is copied when the table grows.
+  A root is identified by a cb_t: index of the chunk in gr_dir (upper
+  bits) and position inside the chunk (lower GR_CHUNK_SHIFT bits).
+  Free slots contain the position of the next free slot of the same
+  chunk, as OCaml int. Chunks with free slots are linked in gr_partial.
+*/
+#define GR_CHUNK_SHIFT 10u
+#define GR_CHUNK_SIZE (1u << GR_CHUNK_SHIFT)
+#define GR_CHUNK_MASK (GR_CHUNK_SIZE - 1u)
+
+struct gr_chunk {
+    value block;
+    struct gr_chunk * next;
+    struct gr_chunk * prev;
+    unsigned int id;        /* index in gr_dir */
+    unsigned int n_live;
+    unsigned int free_head; /* GR_CHUNK_SIZE: chunk is full */
+};
+
+static struct gr_chunk ** gr_dir = NULL;
+static unsigned int * gr_dir_free = NULL; /* unused indices in gr_dir */
+static unsigned int gr_dir_free_n = 0;
+static unsigned int gr_dir_n = 0;    /* used entries in gr_dir */
+static unsigned int gr_dir_size = 0; /* allocated entries in gr_dir */
+static struct gr_chunk * gr_partial = NULL;
+static unsigned int gr_chunks = 0;
+static unsigned int gr_live = 0;
+static unsigned int gr_peak = 0;
 
-#define GR_ROOT_INIT_SIZE 128
 #define UWT_WAKEUP_STRING "uwt.wakeup"
 #define UWT_ADD_EXCEPTION_STRING "uwt.add_exception"
+#define UWT_READ_BATCH_STRING "uwt.read_batch"
+#define UWT_WAIT_STRING "uwt.wait"
 
 #define GET_RUNTIME()                             \
   do {                                            \
@@ -191,80 +243,148 @@ typedef unsigned int cb_t;
 #define CAML_CALLBACK1(_wp,_ct,_val)                              \
   ( assert((_wp)->cb_type == CB_LWT),                             \
     (caml_callback2_exn(*uwt_global_wakeup,                       \
-                        Field(uwt_global_caml_root,((_wp)->_ct)), \
+                        GET_CB_VAL((_wp)->_ct),                   \
                         (_val))) )
 
 #if 0
 #define CAML_CALLBACK1(_wp,_ct,_exn)                                    \
   ((_wp)->cb_type == CB_LWT) ?                                          \
   (caml_callback2_exn(*uwt_global_wakeup,                               \
-                      Field(uwt_global_caml_root,((_wp)->_ct)),         \
+                      GET_CB_VAL((_wp)->_ct),                           \
                       (_exn))) :                                        \
-  (caml_callback_exn(Field(uwt_global_caml_root,((_wp)->_ct)),(_exn)))
+  (caml_callback_exn(GET_CB_VAL((_wp)->_ct),(_exn)))
 #endif
 
-#define GET_CB_VAL(cb) Field(uwt_global_caml_root,(cb))
+#define GET_CB_VAL(cb)                                          \
+  Field(gr_dir[(cb) >> GR_CHUNK_SHIFT]->block,(cb) & GR_CHUNK_MASK)
 
 static void
-gr_root_enlarge__(void)
+gr_partial_link(struct gr_chunk * c)
 {
-  CAMLparam0();
-  CAMLlocal1(nroot);
-  unsigned int nsize;
-  unsigned int osize;
-  unsigned int i;
-  unsigned int * t;
-  if ( uwt_global_caml_root == Val_unit ){
-    osize = 0;
-    nsize = GR_ROOT_INIT_SIZE;
+  c->prev = NULL;
+  c->next = gr_partial;
+  if ( gr_partial ){
+    gr_partial->prev = c;
+  }
+  gr_partial = c;
+}
+
+static void
+gr_partial_unlink(struct gr_chunk * c)
+{
+  if ( c->prev ){
+    c->prev->next = c->next;
   }
   else {
-    assert( Wosize_val(uwt_global_caml_root) == uwt_global_caml_root_size );
-    osize = uwt_global_caml_root_size;
-    nsize = osize*2;
+    gr_partial = c->next;
   }
-  nroot = caml_alloc(nsize,0);
-  for ( i = 0; i< nsize; ++i ){
-    Field(nroot,i) = Val_unit;
+  if ( c->next ){
+    c->next->prev = c->prev;
   }
-  t = malloc(nsize * sizeof(*t));
-  if ( t == NULL ){
+  c->next = NULL;
+  c->prev = NULL;
+}
+
+static void
+gr_root_enlarge__(void)
+{
+  CAMLparam0();
+  CAMLlocal1(nblock);
+  struct gr_chunk * c;
+  unsigned int i;
+  unsigned int id;
+  if ( gr_dir_free_n == 0 && gr_dir_n == gr_dir_size ){
+    const unsigned int nsize = gr_dir_size == 0 ? 16 : gr_dir_size * 2;
+    struct gr_chunk ** ndir;
+    unsigned int * nfree;
+    if ( nsize > (CB_INVALID >> GR_CHUNK_SHIFT) ){
+      caml_raise_out_of_memory();
+    }
+    ndir = realloc(gr_dir,nsize * sizeof(*ndir));
+    if ( ndir == NULL ){
+      caml_raise_out_of_memory();
+    }
+    gr_dir = ndir;
+    nfree = realloc(gr_dir_free,nsize * sizeof(*nfree));
+    if ( nfree == NULL ){
+      caml_raise_out_of_memory();
+    }
+    gr_dir_free = nfree;
+    gr_dir_size = nsize;
+  }
+  nblock = caml_alloc(GR_CHUNK_SIZE,0);
+  for ( i = 0; i < GR_CHUNK_SIZE; ++i ){
+    Field(nblock,i) = Val_long(i+1);
+  }
+  c = malloc(sizeof *c);
+  if ( c == NULL ){
     caml_raise_out_of_memory();
   }
-  if ( uwt_global_caml_root == Val_unit ){
-    uwt_global_caml_root = nroot;
-    caml_register_generational_global_root(&uwt_global_caml_root);
+  if ( gr_dir_free_n > 0 ){
+    --gr_dir_free_n;
+    id = gr_dir_free[gr_dir_free_n];
   }
   else {
-    for ( i = 0; i < osize; ++i ){
-      value tmp = Field(uwt_global_caml_root,i);
-      if ( tmp != Val_unit ){
-        Store_field(nroot,i,tmp);
-      }
-    }
-    caml_modify_generational_global_root(&uwt_global_caml_root,nroot);
-    memcpy(t,uwt_global_caml_root_free_pos,osize*sizeof(*t));
-    free(uwt_global_caml_root_free_pos);
-  }
-  uwt_global_caml_root_free_pos = t;
-  for ( i = osize; i < nsize; ++i ){
-    uwt_global_caml_root_free_pos[i] = i;
-  }
-  uwt_global_caml_root_size = nsize;
+    id = gr_dir_n;
+    ++gr_dir_n;
+  }
+  gr_dir[id] = c;
+  c->block = nblock;
+  caml_register_generational_global_root(&c->block);
+  c->id = id;
+  c->n_live = 0;
+  c->free_head = 0;
+  gr_partial_link(c);
+  ++gr_chunks;
   CAMLreturn0;
 }
 
+static void
+gr_chunk_release(struct gr_chunk * c)
+{
+  assert(c->n_live == 0);
+  gr_partial_unlink(c);
+  caml_remove_generational_global_root(&c->block);
+  gr_dir[c->id] = NULL;
+  gr_dir_free[gr_dir_free_n] = c->id;
+  ++gr_dir_free_n;
+  --gr_chunks;
+  free(c);
+}
+
+static void gr_root_register_slow(unsigned int *a,value x);
+
 static void
 gr_root_register__(unsigned int *a,value x)
 {
-  if ( uwt_global_caml_root_n >= uwt_global_caml_root_size ){
-    gr_root_enlarge__();
+  struct gr_chunk * c = gr_partial;
+  unsigned int pos;
+  if (unlikely( c == NULL )){
+    gr_root_register_slow(a,x);
+    return;
   }
-  const unsigned pos = uwt_global_caml_root_free_pos[uwt_global_caml_root_n];
-  uwt_global_caml_root_n++;
-  assert(Field(uwt_global_caml_root,pos) == Val_unit);
-  Store_field(uwt_global_caml_root,pos,x);
-  *a = pos;
+  pos = c->free_head;
+  assert(pos < GR_CHUNK_SIZE);
+  c->free_head = Long_val(Field(c->block,pos));
+  Store_field(c->block,pos,x);
+  ++c->n_live;
+  if ( c->free_head == GR_CHUNK_SIZE ){
+    gr_partial_unlink(c);
+  }
+  ++gr_live;
+  if ( gr_live > gr_peak ){
+    gr_peak = gr_live;
+  }
+  *a = (c->id << GR_CHUNK_SHIFT) | pos;
+}
+
+static void
+gr_root_register_slow(unsigned int *a,value x)
+{
+  CAMLparam1(x);
+  gr_root_enlarge__();
+  gr_root_register__(a,x);
+  CAMLreturn0;
 }
 
 #define GR_ROOT_ENLARGE()                                               \
@@ -272,8 +392,7 @@ gr_root_register__(unsigned int *a,value x)
   void (* const gr_root_register)(unsigned int *a,value x) =            \
     gr_root_register__;                                                 \
   do {                                                                  \
-    if (unlikely( uwt_global_caml_root_n + 4 >=                         \
-                  uwt_global_caml_root_size )){                         \
+    if (unlikely( gr_live + 4 >= gr_chunks * GR_CHUNK_SIZE )){          \
       gr_root_enlarge__();                                              \
     }                                                                   \
   } while(0)
@@ -283,14 +402,37 @@ gr_root_unregister(unsigned int *a)
 {
   const unsigned int n = *a;
   if ( n != CB_INVALID ){
-    Store_field(uwt_global_caml_root,n,Val_unit);
-    assert(uwt_global_caml_root_n);
-    --uwt_global_caml_root_n;
-    uwt_global_caml_root_free_pos[uwt_global_caml_root_n] = n;
+    struct gr_chunk * c = gr_dir[n >> GR_CHUNK_SHIFT];
+    const unsigned int pos = n & GR_CHUNK_MASK;
+    if ( c->free_head == GR_CHUNK_SIZE ){
+      gr_partial_link(c);
+    }
+    Store_field(c->block,pos,Val_long(c->free_head));
+    c->free_head = pos;
+    assert(c->n_live);
+    --c->n_live;
+    assert(gr_live);
+    --gr_live;
     *a = CB_INVALID;
   }
 }
 
+/* gr_root_unregister is also called by finalizers, therefore empty
+   chunks are released later. One chunk of free slots is always kept. */
+static void
+gr_root_trim(void)
+{
+  struct gr_chunk * c = gr_partial;
+  while ( c != NULL &&
+          (gr_chunks - 1) * GR_CHUNK_SIZE - gr_live >= GR_CHUNK_SIZE ){
+    struct gr_chunk * next = c->next;
+    if ( c->n_live == 0 ){
+      gr_chunk_release(c);
+    }
+    c = next;
+  }
+}
+
 #define STACK_START_SIZE 256
 struct stack {
     void ** s;
@@ -299,10 +441,296 @@ struct stack {
     unsigned int malloc_size; /* how large the elements are */
 
     unsigned int created;     /* how many elements were created at all */
-    unsigned int pos_min;    /* statistic. Unneeded elements are deleted */
-    unsigned int gc_n;      /* from time to time */
+    unsigned int pos_min;    /* minimal cache size in the current window */
+    unsigned int gc_n;      /* windows in a row with idle elements */
+
+    unsigned int low_wm;   /* the cleaner never trims below low_wm */
+    unsigned int high_wm;  /* never cache more than high_wm, 0: no limit */
+    uint64_t hits;         /* requests served from the cache */
+    uint64_t misses;       /* requests served by malloc */
+    const char * name;
+    struct slab_cache * slab; /* if not NULL, elements are taken from
+                                 slab instead of malloc */
+    uv_mutex_t * mutex; /* if not NULL, the stack is shared between
+                           threads. Use POOL_LOCK/POOL_UNLOCK */
+    unsigned int pages: 1; /* elements are allocated with pages_alloc */
+};
+
+#define POOL_LOCK(s)                            \
+  do {                                          \
+    if ( (s)->mutex ){                          \
+      uv_mutex_lock((s)->mutex);                \
+    }                                           \
+  } while (0)
+
+#define POOL_UNLOCK(s)                          \
+  do {                                          \
+    if ( (s)->mutex ){                          \
+      uv_mutex_unlock((s)->mutex);              \
+    }                                           \
+  } while (0)
+
+#if defined(_WIN32) || defined(HAVE_SYS_MMAN_H)
+#define HAVE_PAGE_ALLOC 1
+/* if true, buffers larger than HUGE_PAGE_SIZE are backed by transparent
+   huge pages (if supported by the OS) */
+static bool pool_huge_pages = false;
+#define HUGE_PAGE_SIZE (1u << 21)
+
+static void *
+pages_alloc(size_t size)
+{
+  void * p;
+#ifdef _WIN32
+  p = VirtualAlloc(NULL,size,MEM_RESERVE|MEM_COMMIT,PAGE_READWRITE);
+#else
+  p = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANON,-1,0);
+  if ( p == MAP_FAILED ){
+    return NULL;
+  }
+#if defined(MADV_HUGEPAGE)
+  if ( pool_huge_pages == true && size >= HUGE_PAGE_SIZE ){
+    madvise(p,size,MADV_HUGEPAGE);
+  }
+#endif
+#endif
+  return p;
+}
+
+static void
+pages_free(void * p, size_t size)
+{
+#ifdef _WIN32
+  (void) size;
+  VirtualFree(p,0,MEM_RELEASE);
+#else
+  munmap(p,size);
+#endif
+}
+#endif /* HAVE_PAGE_ALLOC */
+
+/*
+  Slabs are page-backed blocks of SLAB_SIZE bytes, aligned to SLAB_SIZE.
+  The header of a slab is stored at the beginning of the block, so the
+  slab of an object can be found by masking its address. There are no
+  per-object malloc headers and objects of the same type are located
+  next to each other. Slabs without free objects are not linked. An
+  empty slab is released, but one spare slab is kept per cache.
+  The free lists (struct stack) are still used as a cache on top of the
+  slabs, the slab allocator is only called for stack misses and trims.
+*/
+#define MAX_ALIGN 16u
+#define ALIGN_UP(x) (((x) + (MAX_ALIGN - 1u)) & ~((size_t)MAX_ALIGN - 1u))
+
+#ifdef HAVE_PAGE_ALLOC
+#define HAVE_SLAB 1
+/* 64KB is the allocation granularity of VirtualAlloc */
+#define SLAB_SIZE (1u << 16)
+
+struct slab {
+    struct slab * next;
+    struct slab * prev;
+    struct slab_cache * cache;
+    void * free;            /* released objects of this slab */
+    unsigned int n_used;    /* objects currently handed out */
+    unsigned int n_carved;  /* objects ever handed out */
+};
+
+struct slab_cache {
+    struct slab * head;   /* slabs with at least one free object */
+    struct slab * spare;  /* an empty slab, not linked */
+    unsigned int obj_size;
+    unsigned int per_slab;
+    unsigned int n_slabs;
 };
 
+#define SLAB_OBJ_START ALIGN_UP(sizeof(struct slab))
+#define SLAB_OF(p) ((struct slab *)((uintptr_t)(p) & ~(uintptr_t)(SLAB_SIZE - 1u)))
+
+static void
+slab_cache_init(struct slab_cache * c, size_t size)
+{
+  c->head = NULL;
+  c->spare = NULL;
+  c->obj_size = ALIGN_UP(size);
+  c->per_slab = (SLAB_SIZE - SLAB_OBJ_START) / c->obj_size;
+  c->n_slabs = 0;
+  assert(c->per_slab > 0);
+}
+
+static struct slab *
+slab_page_alloc(void)
+{
+  void * p;
+#ifdef _WIN32
+  p = VirtualAlloc(NULL,SLAB_SIZE,MEM_RESERVE|MEM_COMMIT,PAGE_READWRITE);
+  assert( p == NULL || p == SLAB_OF(p) );
+#else
+  char * x;
+  uintptr_t ofs;
+  x = pages_alloc(2 * SLAB_SIZE);
+  if ( x == NULL ){
+    return NULL;
+  }
+  ofs = (uintptr_t)x & (SLAB_SIZE - 1u);
+  if ( ofs == 0 ){
+    munmap(x + SLAB_SIZE,SLAB_SIZE);
+    p = x;
+  }
+  else {
+    p = x + (SLAB_SIZE - ofs);
+    munmap(x,SLAB_SIZE - ofs);
+    munmap((char*)p + SLAB_SIZE,ofs);
+  }
+#endif
+  return p;
+}
+
+static void
+slab_page_free(struct slab * s)
+{
+  pages_free(s,SLAB_SIZE);
+}
+
+static void
+slab_unlink(struct slab * s)
+{
+  struct slab_cache * c = s->cache;
+  if ( s->prev ){
+    s->prev->next = s->next;
+  }
+  else {
+    c->head = s->next;
+  }
+  if ( s->next ){
+    s->next->prev = s->prev;
+  }
+  s->next = NULL;
+  s->prev = NULL;
+}
+
+static void
+slab_link(struct slab * s)
+{
+  struct slab_cache * c = s->cache;
+  s->prev = NULL;
+  s->next = c->head;
+  if ( c->head ){
+    c->head->prev = s;
+  }
+  c->head = s;
+}
+
+static void *
+slab_alloc(struct slab_cache * c)
+{
+  void * p;
+  struct slab * s = c->head;
+  if ( s == NULL ){
+    s = c->spare;
+    if ( s != NULL ){
+      c->spare = NULL;
+    }
+    else {
+      s = slab_page_alloc();
+      if ( s == NULL ){
+        return NULL;
+      }
+      s->cache = c;
+      ++c->n_slabs;
+    }
+    s->free = NULL;
+    s->n_used = 0;
+    s->n_carved = 0;
+    slab_link(s);
+  }
+  if ( s->free != NULL ){
+    p = s->free;
+    s->free = *(void **)p;
+  }
+  else {
+    p = (char*)s + SLAB_OBJ_START + (size_t)s->n_carved * c->obj_size;
+    ++s->n_carved;
+  }
+  ++s->n_used;
+  if ( s->n_used == c->per_slab ){
+    slab_unlink(s);
+  }
+  return p;
+}
+
+static void
+slab_free(void * p)
+{
+  struct slab * s = SLAB_OF(p);
+  struct slab_cache * c = s->cache;
+  assert(s->n_used > 0);
+  if ( s->n_used == c->per_slab ){
+    slab_link(s);
+  }
+  --s->n_used;
+  if ( s->n_used != 0 ){
+    *(void **)p = s->free;
+    s->free = p;
+  }
+  else {
+    slab_unlink(s);
+    if ( c->spare == NULL ){
+      c->spare = s;
+    }
+    else {
+      --c->n_slabs;
+      slab_page_free(s);
+    }
+  }
+}
+
+static void
+slab_cache_clean(struct slab_cache * c)
+{
+  if ( c->spare ){
+    --c->n_slabs;
+    slab_page_free(c->spare);
+    c->spare = NULL;
+  }
+}
+
+#endif /* HAVE_SLAB */
+
+static inline void *
+stack_elt_malloc(struct stack * s)
+{
+#ifdef HAVE_SLAB
+  if ( s->slab ){
+    return (slab_alloc(s->slab));
+  }
+#endif
+#ifdef HAVE_PAGE_ALLOC
+  if ( s->pages ){
+    return (pages_alloc(s->malloc_size));
+  }
+#endif
+  return (malloc(s->malloc_size));
+}
+
+static inline void
+stack_elt_free(struct stack * s, void * p)
+{
+#ifdef HAVE_SLAB
+  if ( s->slab ){
+    slab_free(p);
+    return;
+  }
+#endif
+#ifdef HAVE_PAGE_ALLOC
+  if ( s->pages ){
+    pages_free(p,s->malloc_size);
+    return;
+  }
+#endif
+  free(p);
+}
+
 static void
 stack_resize_add(struct stack * s,void *p)
 {
@@ -311,7 +739,7 @@ stack_resize_add(struct stack * s,void *p)
   ns = realloc(s->s,nsize * (sizeof(void*)));
   if (unlikely( !ns )){
     --s->created;
-    free(p);
+    stack_elt_free(s,p);
   }
   else {
     s->s = ns;
@@ -324,7 +752,11 @@ stack_resize_add(struct stack * s,void *p)
 static inline void
 mem_stack_free(struct stack * s, void *p)
 {
-  if (likely( s->pos < s->size )){
+  if (unlikely( s->high_wm != 0 && s->pos >= s->high_wm )){
+    --s->created;
+    stack_elt_free(s,p);
+  }
+  else if (likely( s->pos < s->size )){
     s->s[s->pos] = p;
     ++s->pos;
   }
@@ -338,16 +770,33 @@ mem_stack_pop(struct stack * x)
 {
   if (unlikely( x->pos == 0 )){
     ++x->created;
+    ++x->misses;
     x->pos_min = 0;
-    return (malloc(x->malloc_size));
+    return (stack_elt_malloc(x));
   }
   else {
     --x->pos;
+    ++x->hits;
     x->pos_min = UMIN(x->pos,x->pos_min);
     return (x->s[x->pos]);
   }
 }
 
+/* release cached elements until at most 'keep' elements are left */
+static unsigned int
+stack_trim(struct stack * s, unsigned int keep)
+{
+  unsigned int i = 0;
+  while ( s->pos > keep ){
+    --s->pos;
+    stack_elt_free(s,s->s[s->pos]);
+    ++i;
+  }
+  s->created -= i;
+  s->pos_min = UMIN(s->pos,s->pos_min);
+  return i;
+}
+
 /* TODO: better representation */
 union all_sockaddr {
     struct sockaddr addr;
@@ -389,6 +838,7 @@ struct ATTR_PACKED req {
     unsigned int cb_type : 2; /* 0: sync, 1: lwt, 2: normal callback */
     unsigned int buf_contains_ba: 1; /* used for other purpose, if buf not used */
     unsigned int in_cb: 1;
+    uint8_t req_type; /* uv_req_type of req, see malloc_struct_req */
 };
 
 #define Req_val(v)                              \
@@ -398,13 +848,39 @@ struct ATTR_PACKED handle {
     uv_handle_t * handle;
     struct loop * loop;
     void * ba_read; /* pointer to bigarray for reading */
+    struct req * cork_req; /* cork: the batch, that is not yet written */
+    struct sendfile_job * sf_job; /* Stream.sendfile in progress */
+    struct forward_job * fw_job; /* Stream.forward, source or destination */
+    struct recv_mmsg * rb_mmsg; /* Udp.recv_batch_start with recvmmsg */
+    struct sockaddr_storage * peer; /* Udp.connect */
     cb_t cb_listen;
     cb_t cb_listen_server;
     cb_t cb_read;
     cb_t cb_close;
     cb_t obuf;
+    cb_t cb_drain; /* wait_drained: (sleeper,waker) */
+    cb_t wq_tail; /* policy WQ_BLOCK: the last parked writer, see qsu_block */
     unsigned int obuf_offset; /* for read_own */
     unsigned int c_read_size; /* passed to the alloc function */
+    unsigned int read_size_min; /* bounds of c_read_size (read_start) */
+    unsigned int read_size_max;
+    unsigned int ring_pos; /* attach_ring: read cursor and */
+    unsigned int ring_fill; /* number of unread bytes */
+    int ring_err; /* EOF or error, reading has been stopped */
+    unsigned int cork_limit; /* cork: size of a batch */
+    unsigned int cork_idx; /* cork: position in cork_pending */
+    unsigned int wq_acc; /* outstanding write bytes, see write_queue_update */
+    unsigned int wq_low; /* write watermarks, wq_high = 0: no limit */
+    unsigned int wq_high;
+    unsigned int wq_blocked; /* number of writers parked in qsu_block */
+    unsigned int rb_fill; /* Udp.recv_batch_start: used slots */
+    unsigned int rb_slots;
+    unsigned int rb_idx; /* position in recv_batch_pending */
+    unsigned int read_gen; /* read_start_batched: changed by read_start/stop */
+    unsigned int eq_count_low; /* Udp.set_send_queue_limit, datagrams */
+    unsigned int eq_count_max;
+    uint64_t eq_dropped; /* policy WQ_DROP: datagrams and bytes */
+    uint64_t eq_dropped_bytes;
 #ifdef _WIN32
     int orig_fd; /* when converting to and back from Unix.file_descr, I have to
                     save the original crt fd in order to avoid descriptor
@@ -412,6 +888,7 @@ struct ATTR_PACKED handle {
 #endif
     uint16_t in_use_cnt;
     uint16_t in_callback_cnt;
+    uint8_t handle_type; /* uv_handle_type of handle */
 
     /* initialized doesn't mean _init() was called.
        Some handles contain only garbage after init was called
@@ -431,6 +908,18 @@ struct ATTR_PACKED handle {
     unsigned int use_read_ba: 1;
     unsigned int can_reuse_cb_read:1;
     unsigned int read_waiting: 1;
+    unsigned int read_lend: 1; /* read_start_ba */
+    unsigned int read_adaptive: 1; /* see read_size_adapt */
+    unsigned int read_short: 1; /* the last read was short */
+    unsigned int read_ring: 1; /* attach_ring */
+    unsigned int ring_paused: 1; /* ring is full, reading stopped */
+    unsigned int corked: 1;
+    unsigned int fw_splice: 1; /* Stream.forward splices into the socket */
+    unsigned int wq_policy: 2; /* WQ_BLOCK, WQ_FAIL or WQ_DROP (udp only) */
+    unsigned int wq_bypass: 1; /* the first parked writer retries */
+    unsigned int recv_batch: 1; /* Udp.recv_batch_start */
+    unsigned int rb_queued: 1; /* in recv_batch_pending */
+    unsigned int recv_no_addr: 1; /* Udp.recv_connected */
 };
 
 #ifdef Handle_val
@@ -538,24 +1027,88 @@ static struct custom_operations ops_uwt_loop = {
 };
 #pragma GCC diagnostic pop
 
-static struct stack stack_struct_req =
-  { NULL, 0, 0, sizeof(struct req), 0,0,0};
-static struct stack stack_struct_handle =
-  { NULL, 0, 0, sizeof(struct handle),0,0,0};
+/*
+  struct req and struct handle are allocated together with the libuv
+  struct, the uv_req_t/uv_handle_t is located directly behind the
+  wrapper. There is one pool per request and handle type.
+*/
+#define REQ_PAYLOAD_OFFSET ALIGN_UP(sizeof(struct req))
+#define HANDLE_PAYLOAD_OFFSET ALIGN_UP(sizeof(struct handle))
+
 static struct stack stacks_req_t[UV_REQ_TYPE_MAX];
 static struct stack stacks_handle_t[UV_HANDLE_TYPE_MAX];
+#ifdef HAVE_SLAB
+static struct slab_cache slabs_req_t[UV_REQ_TYPE_MAX];
+static struct slab_cache slabs_handle_t[UV_HANDLE_TYPE_MAX];
+#endif
 
+/*
+  Buffers are rounded up to the next power of two, 256 bytes - 4MB.
+  Buffers above 128KB are directly backed by pages (mmap / VirtualAlloc),
+  so they don't fragment the malloc heap.
+  stacks_mem_buf is only used by the Lwt loop (always inside the main
+  thread, sometimes without holding the OCaml runtime lock).
+  The other loop types are used by the synchronous functions (Uv_fs_sync),
+  which can be called from any thread. stacks_mem_buf_sync is therefore
+  protected by a mutex.
+*/
 #define MIN_BUCKET_SIZE_LOG2 8u
-#define MAX_BUCKET_SIZE_LOG2 17u
+#define MAX_BUCKET_SIZE_LOG2 22u
+#define PAGE_BUCKET_SIZE_LOG2 18u
 
 #define STACKS_MEM_BUF_SIZE \
   (MAX_BUCKET_SIZE_LOG2 - MIN_BUCKET_SIZE_LOG2 + 1u)
 static struct stack stacks_mem_buf[STACKS_MEM_BUF_SIZE];
+static struct stack stacks_mem_buf_sync[STACKS_MEM_BUF_SIZE];
+static uv_mutex_t stacks_mem_buf_sync_mutex;
+static char stacks_mem_buf_names[2][STACKS_MEM_BUF_SIZE][24];
+
+/* Every pool can be addressed by a stable id (used by the statistic
+   and configuration functions): first the request types, then the
+   handle types, then the buffer buckets. */
+#define POOL_ID_REQ_T 0u
+#define POOL_ID_HANDLE_T (POOL_ID_REQ_T + UV_REQ_TYPE_MAX)
+#define POOL_ID_MEM_BUF (POOL_ID_HANDLE_T + UV_HANDLE_TYPE_MAX)
+#define POOL_ID_MEM_BUF_SYNC (POOL_ID_MEM_BUF + STACKS_MEM_BUF_SIZE)
+#define POOL_ID_MAX (POOL_ID_MEM_BUF_SYNC + STACKS_MEM_BUF_SIZE)
+
+static struct stack *
+pool_of_id(unsigned int id)
+{
+  struct stack * s;
+  if ( id < POOL_ID_HANDLE_T ){
+    s = &stacks_req_t[id - POOL_ID_REQ_T];
+  }
+  else if ( id < POOL_ID_MEM_BUF ){
+    s = &stacks_handle_t[id - POOL_ID_HANDLE_T];
+  }
+  else if ( id < POOL_ID_MEM_BUF_SYNC ){
+    s = &stacks_mem_buf[id - POOL_ID_MEM_BUF];
+  }
+  else if ( id < POOL_ID_MAX ){
+    s = &stacks_mem_buf_sync[id - POOL_ID_MEM_BUF_SYNC];
+  }
+  else {
+    return NULL;
+  }
+  /* not all request and handle types are cached */
+  return ( s->malloc_size == 0 ? NULL : s );
+}
+
+/* By default, the cleaner keeps roughly 1 MB per pool, but at most
+   STACK_START_SIZE elements and at least one. */
+#define POOL_DEF_LOW_WM_BYTES (1u << 20)
+static unsigned int
+pool_default_low_wm(unsigned int malloc_size)
+{
+  unsigned int n = POOL_DEF_LOW_WM_BYTES / malloc_size;
+  return ( UMAX(1u, UMIN(n,(unsigned int)STACK_START_SIZE)) );
+}
 
 CAMLprim value
 uwt_init_stacks_na(value unit)
 {
-  unsigned int i,j;
+  unsigned int i,j,k;
   _Static_assert(UV_UNKNOWN_REQ == 0 , "macros changed");
   _Static_assert(UV_REQ_TYPE_MAX < 256, "macros changed");
 
@@ -565,14 +1118,20 @@ uwt_init_stacks_na(value unit)
   memset(&stacks_req_t,0,sizeof(stacks_req_t));
   memset(&stacks_handle_t,0,sizeof(stacks_handle_t));
 
-#define XX(t,d)                                 \
-  stacks_req_t[t].s = NULL;                     \
-  stacks_req_t[t].pos = 0;                      \
-  stacks_req_t[t].size = 0;                     \
-  stacks_req_t[t].created = 0;                  \
-  stacks_req_t[t].pos_min = 0;                  \
-  stacks_req_t[t].gc_n = 0;                     \
-  stacks_req_t[t].malloc_size = sizeof(d)
+#ifdef HAVE_SLAB
+#define SLAB_INIT(s,c,size)                     \
+  slab_cache_init(&(c),size);                   \
+  (s).slab = &(c)
+#else
+#define SLAB_INIT(s,c,size)
+#endif
+
+#define XX(t,d)                                                         \
+  stacks_req_t[t].malloc_size = REQ_PAYLOAD_OFFSET + sizeof(d);         \
+  stacks_req_t[t].low_wm =                                              \
+    pool_default_low_wm(stacks_req_t[t].malloc_size);                   \
+  stacks_req_t[t].name = #d;                                            \
+  SLAB_INIT(stacks_req_t[t],slabs_req_t[t],stacks_req_t[t].malloc_size)
 
   XX(UV_CONNECT,uv_connect_t);
   XX(UV_WRITE,uv_write_t);
@@ -583,14 +1142,13 @@ uwt_init_stacks_na(value unit)
   XX(UV_GETNAMEINFO,uv_getnameinfo_t);
   XX(UV_WORK,uv_work_t);
 #undef XX
-#define XX(t,d)                                 \
-  stacks_handle_t[t].s = NULL;                  \
-  stacks_handle_t[t].pos = 0;                   \
-  stacks_handle_t[t].size = 0;                  \
-  stacks_handle_t[t].created = 0;               \
-  stacks_handle_t[t].pos_min = 0;               \
-  stacks_handle_t[t].gc_n = 0;                  \
-  stacks_handle_t[t].malloc_size = sizeof(d)
+#define XX(t,d)                                                         \
+  stacks_handle_t[t].malloc_size = HANDLE_PAYLOAD_OFFSET + sizeof(d);   \
+  stacks_handle_t[t].low_wm =                                           \
+    pool_default_low_wm(stacks_handle_t[t].malloc_size);                \
+  stacks_handle_t[t].name = #d;                                         \
+  SLAB_INIT(stacks_handle_t[t],slabs_handle_t[t],                       \
+            stacks_handle_t[t].malloc_size)
 
   XX(UV_TIMER,uv_timer_t);
   XX(UV_TCP,uv_tcp_t);
@@ -604,17 +1162,29 @@ uwt_init_stacks_na(value unit)
   XX(UV_FS_POLL,uv_fs_poll_t);
   XX(UV_ASYNC,uv_async_t);
 #undef XX
+#undef SLAB_INIT
 
-  j = MIN_BUCKET_SIZE_LOG2;
-  for ( i = 0; i < STACKS_MEM_BUF_SIZE; ++i ){
-    stacks_mem_buf[i].s = NULL;
-    stacks_mem_buf[i].pos = 0;
-    stacks_mem_buf[i].size = 0;
-    stacks_mem_buf[i].malloc_size = 1u << j;
-    stacks_mem_buf[i].created = 0;
-    stacks_mem_buf[i].pos_min = 0;
-    stacks_mem_buf[i].gc_n = 0;
-    ++j;
+  if ( uv_mutex_init(&stacks_mem_buf_sync_mutex) != 0 ){
+    fputs("fatal error in uwt, can't initialize mutex\n",stderr);
+    exit(2);
+  }
+  for ( k = 0; k < 2; ++k ){
+    struct stack * ar = k == 0 ? stacks_mem_buf : stacks_mem_buf_sync;
+    j = MIN_BUCKET_SIZE_LOG2;
+    for ( i = 0; i < STACKS_MEM_BUF_SIZE; ++i ){
+      struct stack * s = &ar[i];
+      memset(s,0,sizeof *s);
+      s->malloc_size = 1u << j;
+      s->low_wm = pool_default_low_wm(s->malloc_size);
+#ifdef HAVE_PAGE_ALLOC
+      s->pages = j >= PAGE_BUCKET_SIZE_LOG2;
+#endif
+      s->mutex = k == 0 ? NULL : &stacks_mem_buf_sync_mutex;
+      snprintf(stacks_mem_buf_names[k][i],sizeof stacks_mem_buf_names[k][i],
+               k == 0 ? "buf_%u" : "buf_sync_%u",s->malloc_size);
+      s->name = stacks_mem_buf_names[k][i];
+      ++j;
+    }
   }
 
   return Val_unit;
@@ -645,14 +1215,18 @@ malloc_uv_buf_t(uv_buf_t * buf, unsigned int len, enum cb_type cb_type)
     buf->len = 0;
   }
   else {
-    unsigned int buck;
-    if ( cb_type != CB_LWT ||
-         (buck = which_buf(len)) == INVALID_BUF ){
+    const unsigned int buck = which_buf(len);
+    if ( buck == INVALID_BUF ){
       buf->base = malloc(len);
     }
-    else {
+    else if ( cb_type == CB_LWT ){
       buf->base = mem_stack_pop(&stacks_mem_buf[buck]);
     }
+    else {
+      uv_mutex_lock(&stacks_mem_buf_sync_mutex);
+      buf->base = mem_stack_pop(&stacks_mem_buf_sync[buck]);
+      uv_mutex_unlock(&stacks_mem_buf_sync_mutex);
+    }
     buf->len = buf->base ? len : 0;
   }
 }
@@ -661,14 +1235,18 @@ static void
 free_uv_buf_t_const(const uv_buf_t * buf, enum cb_type cb_type)
 {
   if ( buf->base != NULL && buf->len != 0 ){
-    unsigned int buck;
-    if ( cb_type != CB_LWT ||
-         (buck = which_buf(buf->len)) == INVALID_BUF ){
+    const unsigned int buck = which_buf(buf->len);
+    if ( buck == INVALID_BUF ){
       free(buf->base);
     }
-    else {
+    else if ( cb_type == CB_LWT ){
       mem_stack_free(&stacks_mem_buf[buck],buf->base);
     }
+    else {
+      uv_mutex_lock(&stacks_mem_buf_sync_mutex);
+      mem_stack_free(&stacks_mem_buf_sync[buck],buf->base);
+      uv_mutex_unlock(&stacks_mem_buf_sync_mutex);
+    }
   }
 }
 
@@ -680,86 +1258,205 @@ free_uv_buf_t(uv_buf_t * buf, enum cb_type cb_type)
   buf->base = NULL;
 }
 
+/*
+  Buffers for read_start_ba are lent to OCaml as bigarrays. They're taken
+  from the (malloc backed) buckets of stacks_mem_buf. The proxy of the
+  bigarray lives inside a small header in front of the data:
+
+  - if the buffer is released with uwt_ba_release_na, it's pushed back
+    to its bucket.
+  - otherwise the finalizer of the bigarray will call free(proxy), which
+    releases the whole buffer.
+*/
+struct lent_buf {
+    struct caml_ba_proxy proxy; /* must be the first member */
+    unsigned int buck;
+    unsigned int magic;
+};
+#define LENT_BUF_HDR ALIGN_UP(sizeof(struct lent_buf))
+#define LENT_BUF_MAGIC 0x6c656e74u
+#ifdef HAVE_PAGE_ALLOC
+#define LENT_BUF_MAX_LOG2 (PAGE_BUCKET_SIZE_LOG2 - 1u)
+#else
+#define LENT_BUF_MAX_LOG2 MAX_BUCKET_SIZE_LOG2
+#endif
+
+/* buf->base and buf->len only describe the payload, the header is in
+   front of buf->base. len selects the bucket, the payload is therefore
+   slightly smaller than len, if len is a power of two. */
 static void
-free_struct_req(struct req *r)
+lent_buf_alloc(uv_buf_t * buf, unsigned int len)
 {
-  if ( r->cb_type == CB_LWT ){
-    mem_stack_free(&stack_struct_req,r);
+  struct lent_buf * l;
+  unsigned int buck;
+  if ( len == 0 ){
+    buf->base = NULL;
+    buf->len = 0;
+    return;
+  }
+  buck = which_buf(UMIN(len,1u << LENT_BUF_MAX_LOG2));
+  l = mem_stack_pop(&stacks_mem_buf[buck]);
+  if ( l == NULL ){
+    buf->base = NULL;
+    buf->len = 0;
   }
   else {
-    free(r);
+    l->buck = buck;
+    l->magic = LENT_BUF_MAGIC;
+    buf->base = (char*)l + LENT_BUF_HDR;
+    buf->len = stacks_mem_buf[buck].malloc_size - LENT_BUF_HDR;
   }
 }
 
-static uv_req_t *
-malloc_uv_req_t(int type)
-{
-  struct stack * x;
-  assert(type > UV_UNKNOWN_REQ);
-  assert(type < UV_REQ_TYPE_MAX);
-  x = &stacks_req_t[type];
-  assert(x->malloc_size);
-  return (mem_stack_pop(x));
-}
-
 static void
-free_mem_uv_req_t(struct req * wp)
+lent_buf_free(const uv_buf_t * buf)
 {
-  uv_req_t * req;
-  if ( wp && ( req = wp->req ) != NULL ){
-    if ( wp->cb_type != CB_LWT ){
-      free(req);
-    }
-    else if ( req->type <= UV_UNKNOWN_REQ ||
-              req->type >= UV_REQ_TYPE_MAX ){
-      DEBUG_PF("unknown type");
-      free(req);
-    }
-    else {
-      mem_stack_free(&stacks_req_t[req->type],req);
-    }
-    wp->req = NULL;
+  if ( buf->base != NULL ){
+    struct lent_buf * l = (struct lent_buf *)(buf->base - LENT_BUF_HDR);
+    assert(l->magic == LENT_BUF_MAGIC);
+    mem_stack_free(&stacks_mem_buf[l->buck],l);
   }
 }
 
-int uwt_is_safe_string (value str)
+/* Transfers the ownership of the buffer to OCaml. The buffer no longer
+   counts as created by the pool, until it's released again. */
+static value
+lent_buf_to_ba(const uv_buf_t * buf, size_t nread)
 {
-  return ( caml_string_length(str) == strlen(String_val(str)) );
+  struct lent_buf * l = (struct lent_buf *)(buf->base - LENT_BUF_HDR);
+  struct caml_ba_array * ba;
+  value ret;
+  ret = caml_ba_alloc_dims(CAML_BA_UINT8 | CAML_BA_C_LAYOUT | CAML_BA_MANAGED,
+                           1, buf->base, (intnat)nread);
+  l->proxy.refcount = 1;
+  l->proxy.data = NULL; /* the finalizer must only free the proxy */
+  l->proxy.size = 0;
+  ba = Caml_ba_array_val(ret);
+  ba->proxy = &l->proxy;
+  --stacks_mem_buf[l->buck].created;
+  return ret;
 }
 
-#define malloc_struct_handle()                  \
-  mem_stack_pop(&stack_struct_handle)
-
-#define free_struct_handle(x)                   \
-  mem_stack_free(&stack_struct_handle,x)
+CAMLprim value
+uwt_ba_release_na(value o_ba)
+{
+  struct caml_ba_array * ba = Caml_ba_array_val(o_ba);
+  struct lent_buf * l;
+  struct stack * s;
+  if ( (ba->flags & CAML_BA_MANAGED_MASK) != CAML_BA_MANAGED ||
+       ba->proxy == NULL || ba->proxy->data != NULL ||
+       (char*)ba->data != (char*)ba->proxy + LENT_BUF_HDR ){
+    return Val_false;
+  }
+  l = (struct lent_buf *)ba->proxy;
+  if ( l->magic != LENT_BUF_MAGIC || l->proxy.refcount != 1 ){
+    /* not ours or still shared with sub arrays */
+    return Val_false;
+  }
+  ba->proxy = NULL;
+  ba->data = NULL;
+  ba->dim[0] = 0;
+  ba->flags = (ba->flags & ~CAML_BA_MANAGED_MASK) | CAML_BA_EXTERNAL;
+  s = &stacks_mem_buf[l->buck];
+  ++s->created;
+  mem_stack_free(s,l);
+  return Val_true;
+}
 
-static uv_handle_t *
-malloc_uv_handle_t(int type)
+static struct req *
+malloc_struct_req(uv_req_type typ, enum cb_type cb_type)
 {
+  struct req * wp;
   struct stack * x;
-  assert(type > UV_UNKNOWN_HANDLE);
-  assert(type < UV_HANDLE_TYPE_MAX);
-  x = &stacks_handle_t[type];
-  assert(x->malloc_size);
-  return (mem_stack_pop(x));
+  assert(typ > UV_UNKNOWN_REQ);
+  assert(typ < UV_REQ_TYPE_MAX);
+  x = &stacks_req_t[typ];
+  if (unlikely( x->malloc_size == 0 )){
+    assert(false);
+    caml_failwith("fatal: unsupported uv_req_t type");
+  }
+  if ( cb_type == CB_LWT ){
+    wp = mem_stack_pop(x);
+  }
+  else {
+    wp = malloc(x->malloc_size);
+  }
+  if ( wp ){
+    wp->req_type = typ;
+    wp->req = (uv_req_t*)((char*)wp + REQ_PAYLOAD_OFFSET);
+  }
+  return wp;
 }
 
 static void
-free_mem_uv_handle_t(struct handle * h)
+free_struct_req(struct req *r)
 {
-  uv_handle_t * handle;
-  if ( h && (handle = h->handle ) != NULL ){
-    if ( h->cb_type != CB_LWT ){
-      free(handle);
-    }
-    else if ( handle->type <= UV_UNKNOWN_HANDLE ||
-              handle->type >= UV_HANDLE_TYPE_MAX ){
-      DEBUG_PF("unknown type");
-      free(handle);
-    }
-    else {
-      mem_stack_free(&stacks_handle_t[handle->type],handle);
-    }
+  if ( r->cb_type == CB_LWT ){
+    mem_stack_free(&stacks_req_t[r->req_type],r);
+  }
+  else {
+    free(r);
+  }
+}
+
+/* The uv_req_t is part of struct req, it's not released until
+   free_struct_req is called */
+static void
+free_mem_uv_req_t(struct req * wp)
+{
+  if ( wp ){
+    wp->req = NULL;
+  }
+}
+
+int uwt_is_safe_string (value str)
+{
+  return ( caml_string_length(str) == strlen(String_val(str)) );
+}
+
+static struct handle *
+malloc_struct_handle(int type, enum cb_type cb_type)
+{
+  struct handle * wp;
+  struct stack * x;
+  assert(type > UV_UNKNOWN_HANDLE);
+  assert(type < UV_HANDLE_TYPE_MAX);
+  x = &stacks_handle_t[type];
+  assert(x->malloc_size);
+  if ( cb_type == CB_LWT ){
+    wp = mem_stack_pop(x);
+  }
+  else {
+    wp = malloc(x->malloc_size);
+  }
+  if ( wp ){
+    wp->cb_type = cb_type;
+    wp->handle_type = type;
+    wp->handle = (uv_handle_t*)((char*)wp + HANDLE_PAYLOAD_OFFSET);
+  }
+  return wp;
+}
+
+static void
+free_struct_handle(struct handle * h)
+{
+  if ( h->peer != NULL ){
+    free(h->peer);
+    h->peer = NULL;
+  }
+  if ( h->cb_type == CB_LWT ){
+    mem_stack_free(&stacks_handle_t[h->handle_type],h);
+  }
+  else {
+    free(h);
+  }
+}
+
+/* see free_mem_uv_req_t */
+static void
+free_mem_uv_handle_t(struct handle * h)
+{
+  if ( h ){
     h->handle = NULL;
   }
 }
@@ -821,27 +1518,18 @@ handle_create(int handle_type, struct loop *l)
   const enum cb_type cb_type = l->loop_type;
   res = caml_alloc_custom(&ops_uwt_handle, sizeof(intnat)*2, 0, 1);
   Field(res,1) = 0;
-  wp = malloc_struct_handle();
+  wp = malloc_struct_handle(handle_type,cb_type);
   if ( !wp ){
     caml_raise_out_of_memory();
   }
-  wp->cb_type = cb_type;
-  if ( cb_type == CB_LWT ){
-    wp->handle = malloc_uv_handle_t(handle_type);
-  }
-  else {
-    wp->handle = malloc(sizeof *wp->handle);
-  }
-  if ( !wp->handle ){
-    free_struct_handle(wp);
-    caml_raise_out_of_memory();
-  }
   wp->loop = l;
   wp->cb_listen = CB_INVALID;
   wp->cb_listen_server = CB_INVALID;
   wp->cb_read = CB_INVALID;
   wp->cb_close = CB_INVALID;
   wp->obuf = CB_INVALID;
+  wp->cb_drain = CB_INVALID;
+  wp->wq_tail = CB_INVALID;
   wp->ba_read = NULL;
   wp->handle->data = wp;
   wp->handle->type = handle_type;
@@ -853,18 +1541,68 @@ handle_create(int handle_type, struct loop *l)
   wp->in_use_cnt = 0;
   wp->in_callback_cnt = 0;
   wp->c_read_size = 0;
+  wp->read_gen = 0;
+  wp->read_size_min = DEF_ALLOC_SIZE;
+  wp->read_size_max = DEF_ALLOC_SIZE;
   wp->obuf_offset = 0;
   wp->finalize_called = 0;
   wp->close_called = 0;
   wp->close_executed = 0;
   wp->can_reuse_cb_read = 0;
   wp->use_read_ba = 0;
+  wp->read_lend = 0;
+  wp->read_adaptive = 0;
+  wp->read_short = 0;
+  wp->read_ring = 0;
+  wp->ring_paused = 0;
+  wp->ring_pos = 0;
+  wp->ring_fill = 0;
+  wp->ring_err = 0;
+  wp->cork_req = NULL;
+  wp->sf_job = NULL;
+  wp->fw_job = NULL;
+  wp->fw_splice = 0;
+  wp->rb_mmsg = NULL;
+  wp->peer = NULL;
+  wp->cork_limit = 0;
+  wp->cork_idx = 0;
+  wp->corked = 0;
+  wp->wq_acc = 0;
+  wp->wq_low = 0;
+  wp->wq_high = 0;
+  wp->wq_policy = 0;
+  wp->wq_blocked = 0;
+  wp->wq_bypass = 0;
+  wp->rb_fill = 0;
+  wp->rb_slots = 0;
+  wp->rb_idx = 0;
+  wp->eq_count_low = 0;
+  wp->eq_count_max = 0;
+  wp->eq_dropped = 0;
+  wp->eq_dropped_bytes = 0;
+  wp->recv_batch = 0;
+  wp->rb_queued = 0;
+  wp->recv_no_addr = 0;
   wp->read_waiting = 0;
   Field(res,1) = (intnat)wp;
   Field(res,2) = hcnt++;
   return res;
 }
 
+/* outstanding write bytes of all streams (see write_queue_update) and
+   the global limit (0: no limit) */
+static size_t write_bytes_total = 0;
+static size_t write_bytes_max = 0;
+
+/* the bytes of a closed handle must not count against write_bytes_max,
+   regardless of the callbacks, that are still registered */
+static void
+write_queue_release(struct handle * s)
+{
+  write_bytes_total -= s->wq_acc;
+  s->wq_acc = 0;
+}
+
 static void
 handle_free_common(struct handle *s)
 {
@@ -886,7 +1624,14 @@ handle_free_common(struct handle *s)
   if ( s->obuf != CB_INVALID ){
     gr_root_unregister(&s->obuf);
   }
+  if ( s->cb_drain != CB_INVALID ){
+    gr_root_unregister(&s->cb_drain);
+  }
+  if ( s->wq_tail != CB_INVALID ){
+    gr_root_unregister(&s->wq_tail);
+  }
   s->in_use_cnt = 0;
+  write_queue_release(s);
 }
 
 static void
@@ -895,11 +1640,14 @@ handle_finalize_close_cb(uv_handle_t *h)
   struct handle * s = h->data;
   free_mem_uv_handle_t(s);
   if ( s ){
+    write_queue_release(s);
     if ( s->cb_listen != CB_INVALID ||
          s->cb_listen_server != CB_INVALID ||
          s->cb_read != CB_INVALID ||
          s->cb_close != CB_INVALID ||
-         s->obuf != CB_INVALID ){
+         s->obuf != CB_INVALID ||
+         s->cb_drain != CB_INVALID ||
+         s->wq_tail != CB_INVALID ){
       GET_RUNTIME();
       handle_free_common(s);
     }
@@ -958,48 +1706,17 @@ handle_finalize(value p)
   }
 }
 
-static size_t get_req_t_size(uv_req_type typ)
-{
-  switch ( typ ){
-  case UV_CONNECT: return (sizeof(uv_connect_t));
-  case UV_WRITE: return (sizeof(uv_write_t));
-  case UV_UDP_SEND: return (sizeof(uv_udp_send_t));
-  case UV_SHUTDOWN: return (sizeof(uv_shutdown_t));
-  case UV_FS: return (sizeof(uv_fs_t));
-  case UV_GETADDRINFO: return (sizeof(uv_getaddrinfo_t));
-  case UV_GETNAMEINFO: return (sizeof(uv_getnameinfo_t));
-  case UV_WORK: return (sizeof(uv_work_t));
-  default:
-    assert(false);
-    caml_failwith("fatal: unsupported uv_req_t type");
-  }
-}
-
+/* returns NULL, if there is not enough memory */
 static struct req *
-req_create(uv_req_type typ, struct loop *l)
+req_create_na(uv_req_type typ, struct loop *l)
 {
   struct req * wp;
   const enum cb_type cb_type = l->loop_type;
-  if ( cb_type == CB_LWT ){
-    wp = mem_stack_pop(&stack_struct_req);
-  }
-  else {
-    wp = malloc(sizeof *wp);
-  }
+  wp = malloc_struct_req(typ,cb_type);
   if ( wp == NULL ){
-    caml_raise_out_of_memory();
+    return NULL;
   }
   wp->cb_type = cb_type;
-  if ( cb_type == CB_LWT ){
-    wp->req = malloc_uv_req_t(typ);
-  }
-  else {
-    wp->req = malloc(get_req_t_size(typ));
-  }
-  if ( wp->req == NULL ){
-    free_struct_req(wp);
-    caml_raise_out_of_memory();
-  }
 
   wp->c.p1 = NULL;
   wp->c.p2 = NULL;
@@ -1022,6 +1739,16 @@ req_create(uv_req_type typ, struct loop *l)
   return wp;
 }
 
+static struct req *
+req_create(uv_req_type typ, struct loop *l)
+{
+  struct req * wp = req_create_na(typ,l);
+  if ( wp == NULL ){
+    caml_raise_out_of_memory();
+  }
+  return wp;
+}
+
 #define VAL_UWT_UNIT_RESULT(x)                   \
   ( (x) < 0 ? Val_uwt_int_result(x) : Val_long(0) )
 
@@ -1410,6 +2137,22 @@ uwt_req_finalize_na(value res)
   CAMLreturn(o_ret);                                      \
 }
 
+#define RSTART_6(name,tz,a,b,c,d,e,code)                                \
+  CAMLprim value                                                        \
+  uwt_ ## name ## _byte(value *a, int argn)                             \
+  {                                                                     \
+    (void)argn;                                                         \
+    assert( argn == 8 );                                                \
+    return (uwt_ ## name ## _native(a[0],a[1],a[2],a[3],                \
+                                    a[4],a[5],a[6],a[7]));              \
+  }                                                                     \
+  CAMLprim value                                                        \
+  uwt_ ## name ## _native (value a, value b, value c,value d, value e,  \
+                           value o_loop, value o_req, value o_cb ){     \
+    CAMLparam5(a,b,o_loop,o_req,o_cb);                                  \
+    CAMLxparam3(c,d,e);                                                 \
+    R_WRAP(name,tz,code)
+
 #define RSTART_5(name,tz,a,b,c,d,code)                                  \
   CAMLprim value                                                        \
   uwt_ ## name ## _byte(value *a, int argn)                             \
@@ -1617,8 +2360,10 @@ fs_read_cb(uv_req_t * r)
 #define FD_VAL(x) (CRT_fd_val(x))
 #endif
 
-FSSTART(fs_read,o_file,o_buf,o_offset,o_len,{
+/* o_fpos: file position (pread), -1 for the current position */
+FSSTART(fs_read,o_file,o_buf,o_offset,o_len,o_fpos,{
   const size_t slen = (size_t)Long_val(o_len);
+  const int64_t fpos = Int64_val(o_fpos);
   struct req * wp = wp_req;
   const unsigned int offset = Long_val(o_offset);
   const int ba = slen && (Tag_val(o_buf) != String_tag);
@@ -1637,7 +2382,7 @@ FSSTART(fs_read,o_file,o_buf,o_offset,o_len,{
     wp->offset = offset;
     wp->buf_contains_ba = ba;
     BLOCK({
-        ret = uv_fs_read(loop, req, fd, &wp->buf, 1, -1, cb);
+        ret = uv_fs_read(loop, req, fd, &wp->buf, 1, fpos, cb);
         });
     if ( ret >= 0 ){
       gr_root_register(&wp->sbuf,o_buf);
@@ -1678,8 +2423,10 @@ FSSTART(fs_write,
         o_file,
         o_buf,
         o_pos,
-        o_len,{
+        o_len,
+        o_fpos,{
   const unsigned int slen = (size_t)Long_val(o_len);
+  const int64_t fpos = Int64_val(o_fpos);
   struct req * wp = wp_req;
   const int ba = slen && (Tag_val(o_buf) != String_tag);
   const int fd = FD_VAL(o_file);
@@ -1701,7 +2448,7 @@ FSSTART(fs_write,
     }
     wp->buf_contains_ba = ba;
     BLOCK({
-     ret = uv_fs_write(loop, req, fd, &wp->buf, 1, -1, cb);
+     ret = uv_fs_write(loop, req, fd, &wp->buf, 1, fpos, cb);
       });
     if ( ret >= 0 ){
       if ( ba ){
@@ -2057,6 +2804,21 @@ uwt_get_fs_result(value o_req)
   CAMLreturn(ret);
 }
 
+static int
+stat_kind(uint64_t mode)
+{
+  switch ( mode & S_IFMT ){
+  case S_IFREG: return 0;
+  case S_IFDIR: return 1;
+  case S_IFCHR: return 2;
+  case S_IFBLK: return 3;
+  case S_IFLNK: return 4;
+  case S_IFIFO: return 5;
+  case S_IFSOCK: return 6;
+  default: return 7;
+  }
+}
+
 static value
 uv_stat_to_value(const uv_stat_t * sb)
 {
@@ -2071,16 +2833,7 @@ uv_stat_to_value(const uv_stat_t * sb)
   octime = caml_copy_int64(sb->st_ctim.tv_sec);
   btime = caml_copy_int64(sb->st_birthtim.tv_sec);
 
-  switch ( sb->st_mode & S_IFMT ){
-  case S_IFREG: v = Val_long(0); break;
-  case S_IFDIR: v = Val_long(1); break;
-  case S_IFCHR: v = Val_long(2); break;
-  case S_IFBLK: v = Val_long(3); break;
-  case S_IFLNK: v = Val_long(4); break;
-  case S_IFIFO: v = Val_long(5); break;
-  case S_IFSOCK: v = Val_long(6); break;
-  default: v = Val_long(7);
-  }
+  v = Val_long(stat_kind(sb->st_mode));
   s = caml_alloc_small(21,0);
   Field(s,1) = v;
   Field(s,2) = Val_long(sb->st_mode & 07777);
@@ -2178,1955 +2931,5879 @@ uwt_fs_free(value o_req)
   }
   return Val_unit;
 }
-#undef FSSTART
-#undef UFSSTART
-/* }}} Fs end */
 
-/* {{{ Handle start */
-#define HANDLE_CB_INIT(x)                             \
-  struct handle *h_ = NULL;                           \
-  do {                                                \
-    uv_handle_t *x_ = (uv_handle_t*)(x);              \
-    if (unlikely( !x_ || (h_ = x_->data) == NULL )){  \
-      DEBUG_PF("data lost");                          \
-      return;                                         \
-    }                                                 \
-    if (unlikely( h_->close_called )){                \
-      DEBUG_PF("callback called after close!");       \
-      return;                                         \
-    }                                                 \
-    ++h_->in_callback_cnt;                            \
-    GET_RUNTIME();                                    \
-  } while (0)
+/*
+  o_iov is an array of Uwt_base.iovec, every segment is a (buf,pos,len)
+  triple. The bounds are checked in uwt.ml.
+*/
+#define Iovec_buf(v) Field((v),0)
+#define Iovec_pos(v) Long_val(Field((v),1))
+#define Iovec_len(v) Long_val(Field((v),2))
+#define IOVEC_IS_BA(v) (Tag_val(Iovec_buf(v)) != String_tag)
 
-#define HANDLE_CB_INIT_WITH_CLEAN(x)                  \
-  struct handle *h_ = NULL;                           \
-  do {                                                \
-    uv_handle_t *x_ = (uv_handle_t*)(x);              \
-    if (unlikely( !x_ || (h_ = x_->data) == NULL )){  \
-      DEBUG_PF("data lost");                          \
-      return;                                         \
-    }                                                 \
-    ++h_->in_callback_cnt;                            \
-    GET_RUNTIME();                                    \
-  } while (0)
+static void
+iovec_fill(value o_iov, uv_buf_t * bufs, char * copy)
+{
+  const size_t n = Wosize_val(o_iov);
+  size_t i;
+  for ( i = 0; i < n; ++i ){
+    value v = Field(o_iov,i);
+    const size_t len = Iovec_len(v);
+    if ( IOVEC_IS_BA(v) ){
+      bufs[i].base = Ba_buf_val(Iovec_buf(v)) + Iovec_pos(v);
+    }
+    else if ( copy == NULL ){
+      bufs[i].base = String_val(Iovec_buf(v)) + Iovec_pos(v);
+    }
+    else {
+      memcpy(copy, String_val(Iovec_buf(v)) + Iovec_pos(v), len);
+      bufs[i].base = copy;
+      copy += len;
+    }
+    bufs[i].len = len;
+  }
+}
 
+/*
+  Fs.readv and Fs.writev: all segments are passed to a single
+  uv_fs_read/uv_fs_write request. The uv_buf_t array and the string
+  segments share one pooled buffer (wp->buf), see also uwt_writev. readv
+  reads the string segments into this buffer, fs_readv_cb copies the
+  data into the OCaml strings.
+*/
+static size_t
+iovec_copy_len(value o_iov)
+{
+  const size_t n = Wosize_val(o_iov);
+  size_t i;
+  size_t copy_len = 0;
+  for ( i = 0; i < n; ++i ){
+    value v = Field(o_iov,i);
+    if ( !IOVEC_IS_BA(v) ){
+      copy_len += Iovec_len(v);
+    }
+  }
+  return copy_len;
+}
 
-#define MAYBE_CLOSE_HANDLE(s)                   \
-  do {                                          \
-    struct handle * h__  = s;                   \
-    if (unlikely( h__->in_use_cnt == 0 &&       \
-                  h__->in_callback_cnt == 0 &&  \
-                  h__->finalize_called == 1 &&  \
-                  h__->close_called == 0 )){    \
-      handle_finalize_close(h__);               \
-    }                                           \
-  } while (0)
+static value
+fs_readv_cb(uv_req_t * r)
+{
+  const uv_fs_t* req = (uv_fs_t*)r;
+  const ssize_t result = req->result;
+  struct req * wp = r->data;
+  value o_iov;
+  const uv_buf_t * bufs;
+  size_t i;
+  size_t n;
+  size_t rest;
+  if ( result == UV_EOF || result == 0 ){
+    return Val_long(0);
+  }
+  if ( result < 0 ){
+    return (Val_uwt_int_result(result));
+  }
+  if ( wp->buf.base == NULL || wp->sbuf == CB_INVALID ){
+    return VAL_UWT_INT_RESULT_UWT_EFATAL;
+  }
+  o_iov = GET_CB_VAL(wp->sbuf);
+  bufs = (const uv_buf_t *)wp->buf.base;
+  n = Wosize_val(o_iov);
+  rest = result;
+  for ( i = 0; i < n && rest > 0; ++i ){
+    value v = Field(o_iov,i);
+    const size_t len = UMIN(rest,(size_t)bufs[i].len);
+    if ( !IOVEC_IS_BA(v) ){
+      memcpy(String_val(Iovec_buf(v)) + Iovec_pos(v),bufs[i].base,len);
+    }
+    rest -= len;
+  }
+  return (Val_long(result));
+}
 
-#define MAYBE_SAVE_EXN(s)                       \
-  do {                                          \
-    value v__ = (s);                            \
-    if (unlikely( Is_exception_result(v__) )){  \
-      add_exception(h_->loop,v__);              \
-    }                                           \
-  } while(0)
+FSSTART(fs_readv,o_file,o_iov,o_fpos,{
+  struct req * wp = wp_req;
+  const size_t n = Wosize_val(o_iov);
+  const size_t copy_len = iovec_copy_len(o_iov);
+  const int fd = FD_VAL(o_file);
+  const int64_t fpos = Int64_val(o_fpos);
+  if ( n == 0 || n > UINT_MAX / sizeof(uv_buf_t) ||
+       copy_len > UINT_MAX - n * sizeof(uv_buf_t) ){
+    ret = UV_UWT_EINVAL;
+  }
+  else {
+    malloc_uv_buf_t(&wp->buf,n * sizeof(uv_buf_t) + copy_len,wp->cb_type);
+    if ( wp->buf.base == NULL ){
+      ret = UV_ENOMEM;
+    }
+    else {
+      uv_buf_t * bufs = (uv_buf_t *)wp->buf.base;
+      char * copy = wp->buf.base + n * sizeof(uv_buf_t);
+      size_t i;
+      for ( i = 0; i < n; ++i ){
+        value v = Field(o_iov,i);
+        const size_t len = Iovec_len(v);
+        if ( IOVEC_IS_BA(v) ){
+          bufs[i].base = Ba_buf_val(Iovec_buf(v)) + Iovec_pos(v);
+        }
+        else {
+          bufs[i].base = copy;
+          copy += len;
+        }
+        bufs[i].len = len;
+      }
+      wp->buf_contains_ba = 0;
+      BLOCK({
+          ret = uv_fs_read(loop, req, fd, bufs, n, fpos, cb);
+        });
+      if ( ret >= 0 ){
+        gr_root_register(&wp->sbuf,o_iov);
+      }
+      else {
+        free_uv_buf_t(&wp->buf,wp->cb_type);
+        wp->buf.base = NULL;
+        wp->buf.len = 0;
+      }
+    }
+  }
+})
 
-#define HANDLE_CB_RET(val)                      \
-  do {                                          \
-    value v_ = (val);                           \
-    MAYBE_SAVE_EXN(v_);                         \
-    --h_->in_callback_cnt;                      \
-    MAYBE_CLOSE_HANDLE(h_);                     \
-  } while (0)
+static value
+fs_writev_cb(uv_req_t * r)
+{
+  const uv_fs_t* req = (uv_fs_t*)r;
+  return (VAL_UWT_INT_RESULT(req->result));
+}
 
-#define HANDLE_IS_INVALID(_xs)                            \
-  (unlikely( !_xs || !_xs->handle || _xs->close_called ))
+FSSTART(fs_writev,o_file,o_iov,o_fpos,{
+  struct req * wp = wp_req;
+  const size_t n = Wosize_val(o_iov);
+  const size_t copy_len = iovec_copy_len(o_iov);
+  const int fd = FD_VAL(o_file);
+  const int64_t fpos = Int64_val(o_fpos);
+  if ( n == 0 || n > UINT_MAX / sizeof(uv_buf_t) ||
+       copy_len > UINT_MAX - n * sizeof(uv_buf_t) ){
+    ret = UV_UWT_EINVAL;
+  }
+  else {
+    malloc_uv_buf_t(&wp->buf,n * sizeof(uv_buf_t) + copy_len,wp->cb_type);
+    if ( wp->buf.base == NULL ){
+      ret = UV_ENOMEM;
+    }
+    else {
+      uv_buf_t * bufs = (uv_buf_t *)wp->buf.base;
+      iovec_fill(o_iov,bufs,wp->buf.base + n * sizeof(uv_buf_t));
+      wp->buf_contains_ba = 0;
+      BLOCK({
+          ret = uv_fs_write(loop, req, fd, bufs, n, fpos, cb);
+        });
+      if ( ret >= 0 ){
+        /* the array keeps the bigarrays alive */
+        gr_root_register(&wp->sbuf,o_iov);
+      }
+      else {
+        free_uv_buf_t(&wp->buf,wp->cb_type);
+        wp->buf.base = NULL;
+        wp->buf.len = 0;
+      }
+    }
+  }
+})
 
-#define HANDLE_IS_INVALID_UNINIT(_xs)                     \
-  (unlikely( !_xs || !_xs->handle || _xs->close_called || \
-             _xs->initialized == 0 ))
+/*
+  Fs.copy_file, the kernel side: dst is either cloned (FICLONE) or the
+  data extents of src (SEEK_DATA/SEEK_HOLE) are copied with
+  copy_file_range. Holes are skipped, uwt.ml has already truncated dst
+  to the size of src. The result is the logical size of the copy (holes
+  included), like the result of the pread/pwrite fallback. If nothing
+  could be copied this way, the result is ENOSYS and uwt.ml copies the
+  file with pread/pwrite.
+  The worker uses duplicates of the file descriptors.
+*/
+#if defined(__linux__) && defined(HAVE_COPY_FILE_RANGE)
+struct copy_job {
+  int64_t size;
+  int64_t copied; /* logical size */
+  int64_t moved; /* data bytes passed to copy_file_range */
+  int err;
+  int src;
+  int dst;
+};
 
-#define HANDLE_NINIT_END GR_ROOT_ENLARGE
-
-#define HANDLE_NCHECK(_xs)                      \
-  do {                                          \
-    if ( HANDLE_IS_INVALID(_xs) ){              \
-      return VAL_UWT_INT_RESULT_UWT_EBADF;      \
-    }                                           \
-  } while (0)
-
-#define HANDLE_NO_UNINIT_CLOSED_INT_RESULT(xs)            \
-  do {                                                    \
-    struct handle * p_ = Handle_val(xs);                  \
-    if ( HANDLE_IS_INVALID_UNINIT(p_) ){                  \
-      return VAL_UWT_INT_RESULT_UWT_EBADF;                \
-    }                                                     \
-  } while (0)
-
-#define HANDLE_NO_UNINIT_CLOSED_WRAP(xs)                  \
-  do {                                                    \
-    struct handle * p_ = Handle_val(xs);                  \
-    if ( HANDLE_IS_INVALID_UNINIT(p_) ){                  \
-      value ret = caml_alloc_small(1,Error_tag);          \
-      Field(ret,0) = VAL_UWT_ERROR_UWT_EBADF;             \
-      return ret;                                         \
-    }                                                     \
-  } while (0)
-
-#define HANDLE_NO_UNINIT_NA(_xs)                \
-  do {                                          \
-    if (unlikely( _xs->initialized == 0 )){     \
-      return VAL_UWT_INT_RESULT_UWT_EBADF;      \
-    }                                           \
-  } while (0)
-
-
-#define HANDLE_NINIT_XN(n,s,o_s,...)                  \
-  struct handle * s = Handle_val(o_s);                \
-  HANDLE_NCHECK(s);                                   \
-  CAMLparam ## n (o_s,__VA_ARGS__);                   \
-  HANDLE_NINIT_END()
-
-#define HANDLE_NINIT2(s1,o_s1,s2,o_s2,x,y)      \
-  struct handle * s1 = Handle_val(o_s1);        \
-  struct handle * s2 = Handle_val(o_s2);        \
-  HANDLE_NCHECK(s1);                            \
-  HANDLE_NCHECK(s2);                            \
-  CAMLparam4(o_s1,o_s2,x,y);                    \
-  HANDLE_NINIT_END()
-
-#define HANDLE_NINIT_X1(s,o_s)                  \
-  struct handle * s = Handle_val(o_s);          \
-  HANDLE_NCHECK(s);                             \
-  CAMLparam1(o_s);                              \
-  HANDLE_NINIT_END()
-
-#define HANDLE_NINIT_X2(...)                    \
-  HANDLE_NINIT_XN(2,__VA_ARGS__)
-
-#define HANDLE_NINIT_X3(...)                    \
-  HANDLE_NINIT_XN(3,__VA_ARGS__)
-
-#define HANDLE_NINIT_X4(...)                    \
-  HANDLE_NINIT_XN(4,__VA_ARGS__)
-
-#define HANDLE_NINIT_H2(x,n,...)                \
-  HANDLE_NINIT_X ## n (x, __VA_ARGS__ )
-
-#define HANDLE_NINIT_H1(x,n,...)                \
-  HANDLE_NINIT_H2(x,n,__VA_ARGS__)
-
-#define HANDLE_NINIT(x,...)                           \
-  HANDLE_NINIT_H1(x,PP_NARG(__VA_ARGS__),__VA_ARGS__)
-
-#define HANDLE_NINIT_NA(s,o_s)                  \
-  struct handle * s = Handle_val(o_s);          \
-  HANDLE_NCHECK(s)
+static bool
+copy_unsupported(int e)
+{
+  return ( e == ENOSYS || e == EXDEV || e == EINVAL || e == EOPNOTSUPP ||
+           e == ENOTSUP || e == EBADF );
+}
 
 static void
-close_cb(uv_handle_t* handle)
-{
-  struct handle *s = handle->data;
-  if (unlikely( !s || s->cb_close == CB_INVALID )){
-    DEBUG_PF("data lost");
+fs_copy_file_worker(uv_work_t * req)
+{
+  struct worker_params * w = req->data;
+  struct copy_job * j = w->p1;
+  int64_t pos = 0;
+#ifdef FICLONE
+  if ( ioctl(j->dst,FICLONE,j->src) == 0 ){
+    j->copied = j->size;
+    return;
   }
-  else {
-    value exn = Val_unit;
-    GET_RUNTIME();
-    ++s->in_callback_cnt;
-    exn = CAML_CALLBACK1(s,cb_close,Val_unit);
-    --s->in_callback_cnt;
-    handle_free_common(s);
-    s->close_executed = 1;
-    if (likely( s->in_callback_cnt == 0 )){
-      free_mem_uv_handle_t(s);
-      if ( s->finalize_called ){
-        free_struct_handle(s);
+#endif
+  while ( pos < j->size ){
+    off_t start = lseek(j->src,pos,SEEK_DATA);
+    off_t end;
+    if ( start == -1 ){
+      if ( errno == ENXIO ){ /* only a hole is left */
+        break;
       }
+      start = pos; /* SEEK_DATA is not supported */
+      end = j->size;
     }
     else {
-      DEBUG_PF("close_cb not the last callback?");
+      end = lseek(j->src,start,SEEK_HOLE);
+      if ( end == -1 || end > j->size ){
+        end = j->size;
+      }
     }
-    if (unlikely( Is_exception_result(exn) )){
-      add_exception(s->loop,exn);
+#ifdef HAVE_FALLOCATE
+    if ( end > start ){
+      (void) fallocate(j->dst,0,start,end - start);
     }
+#endif
+    while ( start < end ){
+      loff_t off_in = start;
+      loff_t off_out = start;
+      const ssize_t r = copy_file_range(j->src,&off_in,j->dst,&off_out,
+                                        end - start,0);
+      if ( r > 0 ){
+        start += r;
+        j->moved += r;
+      }
+      else if ( r == 0 ){ /* src was truncated in the meantime */
+        j->copied = start;
+        return;
+      }
+      else if ( errno != EINTR ){
+        if ( j->moved == 0 && copy_unsupported(errno) ){
+          j->err = UV_ENOSYS;
+        }
+        else {
+          j->err = -errno;
+        }
+        return;
+      }
+    }
+    pos = end;
   }
+  j->copied = j->size;
 }
 
-static void cancel_reader(struct handle *h);
-CAMLprim value
-uwt_close_wait(value o_stream,value o_cb)
+static void
+fs_copy_file_cleaner(uv_req_t * req)
 {
-  struct handle * s = Handle_val(o_stream);
-  if ( HANDLE_IS_INVALID(s) ){
-    return VAL_UWT_INT_RESULT_UWT_EBADF;
-  }
-  if (unlikely( s->cb_close != CB_INVALID )){
-    return VAL_UWT_INT_RESULT_UWT_EBUSY;
-  }
-  CAMLparam2(o_stream,o_cb);
-  GR_ROOT_ENLARGE();
-  ++s->in_use_cnt;
-  s->close_called = 1;
-  /* This way, we can't wrap uv_is_closing.
-     But otherwise we "leak" memory until
-     the ocaml grabage collector finalizes
-     the handle  */
-  Field(o_stream,1) = 0;
-  if ( s->read_waiting ){
-    cancel_reader(s);
+  struct worker_params * w = req->data;
+  struct copy_job * j = w->p1;
+  if ( j != NULL ){
+    close(j->src);
+    close(j->dst);
+    free(j);
+    w->p1 = NULL;
   }
-  gr_root_register(&s->cb_close,o_cb);
-  uv_close(s->handle,close_cb);
-  s->finalize_called = 1;
-  CAMLreturn(Val_long(0));
 }
 
-CAMLprim value
-uwt_close_nowait(value o_stream)
+static value
+fs_copy_file_value(uv_req_t * req)
 {
-  struct handle * s = Handle_val(o_stream);
-  value ret = VAL_UWT_INT_RESULT_UWT_EBADF;
-  if ( s && s->handle && s->close_called == 0 ){
-    s->close_called = 1;
-    Field(o_stream,1) = 0;
-    if ( s->read_waiting ){
-      cancel_reader(s);
-    }
-    s->finalize_called = 1;
-    handle_finalize_close(s);
-    ret = Val_unit;
+  struct worker_params * w = req->data;
+  struct copy_job * j = w->p1;
+  value ret;
+  if ( j->err < 0 ){
+    ret = caml_alloc_small(1,Error_tag);
+    Field(ret,0) = Val_uwt_error(j->err);
+  }
+  else {
+    value i = caml_copy_int64(j->copied);
+    Begin_roots1(i);
+    ret = caml_alloc_small(1,Ok_tag);
+    Field(ret,0) = i;
+    End_roots();
   }
   return ret;
 }
 
-#define UV_HANDLE_BOOL(type,fun,uninit_ok)                  \
-  CAMLprim value                                            \
-  uwt_ ## fun ## _na(value o_stream)                        \
-  {                                                         \
-    value ret = Val_long(0);                                \
-    struct handle * s = Handle_val(o_stream);               \
-    if ( s && s->handle && (uninit_ok || s->initialized )){ \
-      type* stream = (type*)s->handle;                      \
-      if ( uv_ ## fun(stream) ){                            \
-        ret = Val_long(1);                                  \
-      }                                                     \
-    }                                                       \
-    return ret;                                             \
+CAMLprim value
+uwt_fs_copy_file(value o_src, value o_dst, value o_size, value o_uwt)
+{
+  struct copy_job * j;
+  intnat erg;
+  const int64_t size = Int64_val(o_size);
+  if ( size < 0 ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
   }
-UV_HANDLE_BOOL(uv_handle_t,is_active,true)
-UV_HANDLE_BOOL(uv_handle_t,has_ref,true)
+  j = malloc(sizeof *j);
+  if ( j == NULL ){
+    return VAL_UWT_INT_RESULT_ENOMEM;
+  }
+  j->src = dup(FD_VAL(o_src));
+  j->dst = j->src < 0 ? -1 : dup(FD_VAL(o_dst));
+  if ( j->dst < 0 ){
+    erg = -errno;
+    if ( j->src >= 0 ){
+      close(j->src);
+    }
+    free(j);
+    return (Val_uwt_int_result(erg));
+  }
+  j->size = size;
+  j->copied = 0;
+  j->moved = 0;
+  j->err = 0;
+  erg = uwt_add_worker_result(o_uwt,
+                              fs_copy_file_cleaner,
+                              fs_copy_file_worker,
+                              fs_copy_file_value,
+                              j,
+                              NULL);
+  return erg;
+}
+#else
+CAMLprim value
+uwt_fs_copy_file(value o_src, value o_dst, value o_size, value o_uwt)
+{
+  (void) o_src;
+  (void) o_dst;
+  (void) o_size;
+  (void) o_uwt;
+  return VAL_UWT_INT_RESULT_ENOSYS;
+}
+#endif
+#if defined(__linux__) && defined(SYS_getdents64) && defined(HAVE_DIRENT_H)
+/*
+  Entries are repacked inside the threadpool, so that the main thread
+  only has to copy one buffer:
+  8 bytes inode (little endian), 1 byte file_kind, name, '\0'
+*/
+#define DIRENT_HEADER_SIZE 9
+#define DIRENT_SCRATCH_SIZE 32768
+
+struct uwt_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
 
+struct dir_job {
+  char * buf;
+  size_t len;
+  size_t size;
+  size_t n;
+  size_t batch;
+  int fd;
+  int err;
+};
 
-#define UV_HANDLE_VOID(name)                        \
-  CAMLprim value                                    \
-  uwt_ ## name ## _na(value o_stream)               \
-  {                                                 \
-    struct handle * s = Handle_val(o_stream);       \
-    if ( s && s->handle && s->close_called == 0 ){  \
-      uv_ ## name (s->handle);                      \
-    }                                               \
-    return Val_unit;                                \
+static unsigned char
+dirent_kind(unsigned char t)
+{
+  switch ( t ){
+  case DT_REG: return 0;
+  case DT_DIR: return 1;
+  case DT_CHR: return 2;
+  case DT_BLK: return 3;
+  case DT_LNK: return 4;
+  case DT_FIFO: return 5;
+  case DT_SOCK: return 6;
+  default: return 7;
   }
+}
 
-UV_HANDLE_VOID(ref)
-UV_HANDLE_VOID(unref)
-/* }}} Handle end */
-
-/* {{{ Handle ext start */
-CAMLprim value
-uwt_get_buffer_size_common_na(value o_stream, value o)
+static int
+dir_job_append(struct dir_job * j, const struct uwt_dirent64 * d)
 {
-  HANDLE_NINIT_NA(s,o_stream);
-  HANDLE_NO_UNINIT_NA(s);
-  int ret;
-  int x = 0;
-  if ( Long_val(o) == 0 ){
-    ret = uv_send_buffer_size(s->handle,&x);
+  const size_t nlen = strlen(d->d_name);
+  const size_t need = DIRENT_HEADER_SIZE + nlen + 1;
+  uint64_t ino = d->d_ino;
+  char * p;
+  unsigned int i;
+  if ( j->size - j->len < need ){
+    size_t nsize = j->size * 2;
+    char * nbuf;
+    while ( nsize - j->len < need ){
+      nsize *= 2;
+    }
+    nbuf = realloc(j->buf,nsize);
+    if ( nbuf == NULL ){
+      return UV_ENOMEM;
+    }
+    j->buf = nbuf;
+    j->size = nsize;
   }
-  else {
-    ret = uv_recv_buffer_size(s->handle,&x);
+  p = j->buf + j->len;
+  for ( i = 0 ; i < 8 ; ++i ){
+    p[i] = (char)(ino & 0xff);
+    ino >>= 8;
   }
-  return (VAL_UWT_INT_RESULT(ret));
+  p[8] = (char)dirent_kind(d->d_type);
+  memcpy(p + DIRENT_HEADER_SIZE, d->d_name, nlen + 1);
+  j->len += need;
+  j->n++;
+  return 0;
 }
 
-CAMLprim value
-uwt_set_buffer_size_common_na(value o_stream, value o_len, value o)
-{
-  HANDLE_NINIT_NA(s,o_stream);
-  HANDLE_NO_UNINIT_NA(s);
-  int ret;
-  int x = Long_val(o_len);
-  if ( Long_val(o) == 0 ){
-    ret = uv_send_buffer_size(s->handle,&x);
+static void
+fs_readdir_worker(uv_work_t * req)
+{
+  struct worker_params * w = req->data;
+  struct dir_job * j = w->p1;
+  char * scratch = malloc(DIRENT_SCRATCH_SIZE);
+  int64_t last_off = -1;
+  if ( scratch == NULL ){
+    j->err = UV_ENOMEM;
+    return;
   }
-  else {
-    ret = uv_recv_buffer_size(s->handle,&x);
+  while ( j->n < j->batch ){
+    long pos = 0;
+    long n;
+    do {
+      n = syscall(SYS_getdents64, j->fd, scratch, DIRENT_SCRATCH_SIZE);
+    } while ( n == -1 && errno == EINTR );
+    if ( n < 0 ){
+      j->err = -errno;
+      break;
+    }
+    if ( n == 0 ){
+      break;
+    }
+    while ( pos < n ){
+      const struct uwt_dirent64 * d = (void*)(scratch + pos);
+      const char * name = d->d_name;
+      if ( j->n == j->batch ){
+        /* rewind, the remaining entries are returned by the next call */
+        if ( last_off != -1 && lseek(j->fd,last_off,SEEK_SET) == -1 ){
+          j->err = -errno;
+        }
+        goto end;
+      }
+      if ( !(name[0] == '.' &&
+             (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) ){
+        int er = dir_job_append(j,d);
+        if ( er != 0 ){
+          j->err = er;
+          goto end;
+        }
+      }
+      last_off = d->d_off;
+      pos += d->d_reclen;
+    }
   }
-  return (VAL_UWT_UNIT_RESULT(ret));
+end:
+  free(scratch);
 }
-/* }}} Handle ext end */
 
-/* {{{ Timer start */
 static void
-timer_repeating_cb(uv_timer_t * handle)
+fs_readdir_cleaner(uv_req_t * req)
 {
-  HANDLE_CB_INIT(handle);
-  value exn = Val_unit;
-  struct handle * wp = handle->data;
-  if (unlikely( wp->cb_read == CB_INVALID ||
-                wp->cb_listen == CB_INVALID )){
-    DEBUG_PF("cb lost");
-  }
-  else {
-    value t = GET_CB_VAL(wp->cb_listen);
-    exn = GET_CB_VAL(wp->cb_read);
-    exn = caml_callback_exn(exn,t);
+  struct worker_params * w = req->data;
+  struct dir_job * j = w->p1;
+  if ( j != NULL ){
+    close(j->fd);
+    free(j->buf);
+    free(j);
+    w->p1 = NULL;
   }
-  HANDLE_CB_RET(exn);
 }
 
-static void
-timer_once_cb(uv_timer_t * handle)
+static value
+fs_readdir_value(uv_req_t * req)
 {
-  HANDLE_CB_INIT(handle);
-  value exn = Val_unit;
-  struct handle * wp = handle->data;
-  if (unlikely( wp->cb_read == CB_INVALID || wp->cb_listen == CB_INVALID )){
-    DEBUG_PF("cb lost");
+  struct worker_params * w = req->data;
+  struct dir_job * j = w->p1;
+  value ret;
+  if ( j->err < 0 ){
+    ret = caml_alloc_small(1,Error_tag);
+    Field(ret,0) = Val_uwt_error(j->err);
+    return ret;
   }
   else {
-    value timer = GET_CB_VAL(wp->cb_listen);
-    exn = GET_CB_VAL(wp->cb_read);
-    gr_root_unregister(&wp->cb_read);
-    if ( wp->in_use_cnt ){
-      wp->in_use_cnt--;
+    CAMLparam0();
+    CAMLlocal3(s,a,t);
+    size_t i;
+    size_t pos = 0;
+    s = caml_alloc_string(j->len);
+    memcpy(String_val(s),j->buf,j->len);
+    if ( j->n == 0 ){
+      a = Atom(0);
     }
-    exn = caml_callback_exn(exn,timer);
-    if ( wp->close_called == 0 ){
-      if ( wp->cb_listen != CB_INVALID ){
-        timer = GET_CB_VAL(wp->cb_listen); /* might have changed */
-        Field(timer,1) = 0;
+    else {
+      a = caml_alloc(j->n,0);
+      for ( i = 0 ; i < j->n ; ++i ){
+        Field(a,i) = Val_long(pos);
+        pos += DIRENT_HEADER_SIZE + strlen(j->buf + pos + DIRENT_HEADER_SIZE) + 1;
       }
-      wp->finalize_called = 1;
-      handle_finalize_close(wp);
     }
-    gr_root_unregister(&wp->cb_listen);
+    t = caml_alloc_small(2,0);
+    Field(t,0) = s;
+    Field(t,1) = a;
+    ret = caml_alloc_small(1,Ok_tag);
+    Field(ret,0) = t;
+    CAMLreturn(ret);
   }
-  HANDLE_CB_RET(exn);
 }
 
-#define INIT_LOOP_WRAP(x,y)                       \
-  struct loop * x = Loop_val(y);                  \
-  do {                                            \
-    if (unlikely( !x || x->init_called == 0 ) ){  \
-      value ret = caml_alloc_small(1,Error_tag);  \
-      Field(ret,0) = VAL_UWT_ERROR_UWT_EFATAL;    \
-      return ret;                                 \
-    }                                             \
-  } while(0)
-
 CAMLprim value
-uwt_timer_start(value o_loop, value o_cb,
-                value o_timeout, value o_repeat)
+uwt_fs_readdir(value o_dir, value o_batch, value o_uwt)
 {
-  INIT_LOOP_WRAP(l,o_loop);
-  CAMLparam2(o_loop,o_cb);
-  CAMLlocal2(ret,v);
-  const intnat l_timeout = Long_val(o_timeout);
-  const intnat l_repeat = Long_val(o_repeat);
-
-  GR_ROOT_ENLARGE();
-  v = handle_create(UV_TIMER,l);
-  struct handle * h = Handle_val(v);
-  h->close_executed = 1;
-  ret = caml_alloc_small(1,Ok_tag);
-  h->close_executed = 0;
-  Field(ret,0) = v;
-  uv_timer_t * t = (uv_timer_t *)h->handle;
-  int erg = uv_timer_init(&l->loop,t);
-  if ( erg < 0 ){
-    free_mem_uv_handle_t(h);
-    free_struct_handle(h);
-  }
-  else {
-    erg = uv_timer_start((uv_timer_t*)h->handle,
-                         l_repeat != 0 ? timer_repeating_cb : timer_once_cb,
-                         l_timeout,
-                         l_repeat);
-    if ( erg >= 0 ){
-      h->in_use_cnt++;
-      h->initialized = 1;
-      gr_root_register(&h->cb_read,o_cb);
-      gr_root_register(&h->cb_listen,v);
-    }
-    else {
-      h->finalize_called = 1;
-      handle_finalize_close(h);
-    }
-  }
-  if ( erg < 0 ){
-    Field(v,1) = 0;
-    Field(ret,0) = Val_uwt_error(erg);
-    Tag_val(ret) = Error_tag;
+  struct dir_job * j;
+  const intnat batch = Long_val(o_batch);
+  if ( batch <= 0 ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
   }
-  CAMLreturn(ret);
-}
-/* }}} Timer end */
-
-/* {{{ Stream start */
+  j = malloc(sizeof *j);
+  if ( j == NULL ){
+    return VAL_UWT_INT_RESULT_ENOMEM;
+  }
+  j->size = 4096;
+  j->buf = malloc(j->size);
+  if ( j->buf == NULL ){
+    free(j);
+    return VAL_UWT_INT_RESULT_ENOMEM;
+  }
+  /* the dup'ed descriptor shares the position, but keeps it open, even if
+     the directory is closed while the request is pending */
+  j->fd = dup(FD_VAL(o_dir));
+  if ( j->fd < 0 ){
+    const int er = -errno;
+    free(j->buf);
+    free(j);
+    return (Val_uwt_int_result(er));
+  }
+  j->len = 0;
+  j->n = 0;
+  j->batch = batch;
+  j->err = 0;
+  return (uwt_add_worker_result(o_uwt,
+                                fs_readdir_cleaner,
+                                fs_readdir_worker,
+                                fs_readdir_value,
+                                j,
+                                NULL));
+}
+#undef DIRENT_HEADER_SIZE
+#undef DIRENT_SCRATCH_SIZE
+#else
 CAMLprim value
-uwt_write_queue_size_na(value o_s)
+uwt_fs_readdir(value o_dir, value o_batch, value o_uwt)
 {
-  value ret;
-  struct handle * h = Handle_val(o_s);
-  if ( HANDLE_IS_INVALID_UNINIT(h) ){
-    ret = Val_long(0);
-  }
-  else {
-    uv_stream_t* s = (uv_stream_t*)h->handle;
-    ret = Val_long((intnat)s->write_queue_size);
-  }
-  return ret;
+  (void) o_dir;
+  (void) o_batch;
+  (void) o_uwt;
+  return VAL_UWT_INT_RESULT_ENOSYS;
 }
+#endif
+/*
+  stat_many: all paths are stat'ed inside one threadpool request. The
+  results are written into a flat int64 array, that is passed to OCaml
+  as bigarray without copying. Layout per path: the int_result of the
+  call, followed by the fields of Fs_types.stats in the same order.
+  The worker must not use the loop of the caller (uv_fs_* registers
+  the request there), stat/lstat (statx on Linux) are called directly.
+  Windows uses uv_fs_stat with a private loop instead.
+*/
+#define STAT_SLOTS 22
 
+#ifndef _WIN32
+#if defined(__APPLE__)
+#define ST_TIM(sb,x) (sb)->st_##x##timespec
+#else
+#define ST_TIM(sb,x) (sb)->st_##x##tim
+#endif
 static void
-shutdown_cb(uv_shutdown_t* req, int status)
-{
-  struct handle * s = req->handle->data;
-  struct req * r = req->data;
-  if ( !s || !r ){
-    DEBUG_PF("leaking data");
-  }
-  else {
-    ++s->in_callback_cnt;
-    --s->in_use_cnt;
-    r->c_param = status;
-    universal_callback((void*)req);
-    --s->in_callback_cnt;
-    MAYBE_CLOSE_HANDLE(s);
-  }
+stat_fill(int64_t * d, const struct stat * sb)
+{
+  d[0] = 0;
+  d[1] = sb->st_dev;
+  d[2] = stat_kind(sb->st_mode);
+  d[3] = sb->st_mode & 07777;
+  d[4] = sb->st_nlink;
+  d[5] = sb->st_uid;
+  d[6] = sb->st_gid;
+  d[7] = sb->st_rdev;
+  d[8] = sb->st_ino;
+  d[9] = sb->st_size;
+  d[10] = sb->st_blksize;
+  d[11] = sb->st_blocks;
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__DragonFly__) || \
+  defined(__NetBSD__) || defined(__OpenBSD__)
+  d[12] = sb->st_flags;
+  d[13] = sb->st_gen;
+#else
+  d[12] = 0;
+  d[13] = 0;
+#endif
+  d[14] = ST_TIM(sb,a).tv_sec;
+  d[15] = ST_TIM(sb,a).tv_nsec;
+  d[16] = ST_TIM(sb,m).tv_sec;
+  d[17] = ST_TIM(sb,m).tv_nsec;
+  d[18] = ST_TIM(sb,c).tv_sec;
+  d[19] = ST_TIM(sb,c).tv_nsec;
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__)
+  d[20] = ST_TIM(sb,birth).tv_sec;
+  d[21] = ST_TIM(sb,birth).tv_nsec;
+#else
+  /* like libuv without statx */
+  d[20] = d[18];
+  d[21] = d[19];
+#endif
 }
+#undef ST_TIM
 
-CAMLprim value
-uwt_shutdown(value o_stream,value o_cb)
-{
-  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
-  HANDLE_NINIT(s,o_stream,o_cb);
-  uv_stream_t* stream = (uv_stream_t*)s->handle;
-  struct req * wp = req_create(UV_SHUTDOWN,s->loop);
-  uv_shutdown_t * req = (uv_shutdown_t*)wp->req;
-  const int erg = uv_shutdown(req,stream,shutdown_cb);
-  value ret;
-  if ( erg < 0 ){
-    free_mem_uv_req_t(wp);
-    free_struct_req(wp);
-    ret = Val_uwt_int_result(erg);
-  }
-  else {
-    wp->c_cb = ret_unit_cparam;
-    gr_root_register(&wp->cb,o_cb);
-    wp->in_use = 1;
-    wp->finalize_called = 1;
-    ++s->in_use_cnt;
-    ret = Val_unit;
-  }
-  CAMLreturn(ret);
+#if defined(__linux__) && defined(HAVE_STATX)
+/* the same fields as libuv's uv__fs_statx */
+static int
+statx_fill(int64_t * d, const char * path, int lstat)
+{
+  struct statx sx;
+  const int flags = AT_STATX_SYNC_AS_STAT | (lstat ? AT_SYMLINK_NOFOLLOW : 0);
+  if ( statx(AT_FDCWD,path,flags,STATX_BASIC_STATS | STATX_BTIME,&sx) != 0 ){
+    return -errno;
+  }
+  d[0] = 0;
+  d[1] = makedev(sx.stx_dev_major,sx.stx_dev_minor);
+  d[2] = stat_kind(sx.stx_mode);
+  d[3] = sx.stx_mode & 07777;
+  d[4] = sx.stx_nlink;
+  d[5] = sx.stx_uid;
+  d[6] = sx.stx_gid;
+  d[7] = makedev(sx.stx_rdev_major,sx.stx_rdev_minor);
+  d[8] = sx.stx_ino;
+  d[9] = sx.stx_size;
+  d[10] = sx.stx_blksize;
+  d[11] = sx.stx_blocks;
+  d[12] = 0;
+  d[13] = 0;
+  d[14] = sx.stx_atime.tv_sec;
+  d[15] = sx.stx_atime.tv_nsec;
+  d[16] = sx.stx_mtime.tv_sec;
+  d[17] = sx.stx_mtime.tv_nsec;
+  d[18] = sx.stx_ctime.tv_sec;
+  d[19] = sx.stx_ctime.tv_nsec;
+  d[20] = sx.stx_btime.tv_sec;
+  d[21] = sx.stx_btime.tv_nsec;
+  return 0;
 }
+#endif
+#endif /* _WIN32 */
+
+struct stat_job {
+  char ** paths;
+  int64_t * data;
+  size_t n;
+  int lstat;
+};
 
 static void
-listen_cb(uv_stream_t *server,int status)
+stat_job_free(struct stat_job * j)
 {
-  HANDLE_CB_INIT(server);
-  value exn = Val_unit;
-  struct handle * h = server->data;
-  if (unlikely( h->cb_listen == CB_INVALID ||
-                h->cb_listen_server == CB_INVALID )){
-    DEBUG_PF("cb lost");
-  }
-  else {
-    value param = VAL_UWT_UNIT_RESULT(status);
-    value s = GET_CB_VAL(h->cb_listen_server);
-    exn = GET_CB_VAL(h->cb_listen);
-    exn = caml_callback2_exn(exn,s,param);
+  size_t i;
+  for ( i = 0 ; i < j->n ; ++i ){
+    free(j->paths[i]);
   }
-  HANDLE_CB_RET(exn);
+  free(j->paths);
+  free(j->data);
+  free(j);
 }
 
-CAMLprim value
-uwt_listen(value o_stream,value o_backlog,value o_cb)
+static void
+fs_stat_many_worker(uv_work_t * req)
 {
-  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
-  HANDLE_NINIT(s,o_stream,o_cb);
-  int ret;
-  if ( s->cb_listen_server != CB_INVALID ||
-       s->cb_listen != CB_INVALID ){
-    ret = UV_UWT_EBUSY;
-  }
-  else {
-    uv_stream_t* stream = (uv_stream_t*)s->handle;
-    ret = uv_listen(stream,Long_val(o_backlog),listen_cb);
-    if ( ret >= 0 ){
-      ++s->in_use_cnt;
-      gr_root_register(&s->cb_listen,o_cb);
-      gr_root_register(&s->cb_listen_server,o_stream);
+  struct worker_params * w = req->data;
+  struct stat_job * j = w->p1;
+  size_t i;
+#ifdef _WIN32
+  uv_loop_t loop;
+  const int lerr = uv_loop_init(&loop);
+#elif defined(__linux__) && defined(HAVE_STATX)
+  static volatile int no_statx = 0;
+#endif
+  for ( i = 0 ; i < j->n ; ++i ){
+    int64_t * d = j->data + i * STAT_SLOTS;
+    int er;
+#ifdef _WIN32
+    uv_fs_t r;
+    if ( lerr < 0 ){
+      er = lerr;
+    }
+    else {
+      if ( j->lstat ){
+        er = uv_fs_lstat(&loop,&r,j->paths[i],NULL);
+      }
+      else {
+        er = uv_fs_stat(&loop,&r,j->paths[i],NULL);
+      }
+      if ( er >= 0 ){
+        const uv_stat_t * sb = &r.statbuf;
+        d[0] = 0;
+        d[1] = sb->st_dev;
+        d[2] = stat_kind(sb->st_mode);
+        d[3] = sb->st_mode & 07777;
+        d[4] = sb->st_nlink;
+        d[5] = sb->st_uid;
+        d[6] = sb->st_gid;
+        d[7] = sb->st_rdev;
+        d[8] = sb->st_ino;
+        d[9] = sb->st_size;
+        d[10] = sb->st_blksize;
+        d[11] = sb->st_blocks;
+        d[12] = sb->st_flags;
+        d[13] = sb->st_gen;
+        d[14] = sb->st_atim.tv_sec;
+        d[15] = sb->st_atim.tv_nsec;
+        d[16] = sb->st_mtim.tv_sec;
+        d[17] = sb->st_mtim.tv_nsec;
+        d[18] = sb->st_ctim.tv_sec;
+        d[19] = sb->st_ctim.tv_nsec;
+        d[20] = sb->st_birthtim.tv_sec;
+        d[21] = sb->st_birthtim.tv_nsec;
+      }
+      uv_fs_req_cleanup(&r);
+    }
+#else
+    struct stat sb;
+    er = 1;
+#if defined(__linux__) && defined(HAVE_STATX)
+    if ( no_statx == 0 ){
+      er = statx_fill(d,j->paths[i],j->lstat);
+      if ( er == UV_ENOSYS ){ /* old kernel */
+        no_statx = 1;
+        er = 1;
+      }
+    }
+#endif
+    if ( er > 0 ){
+      if ( j->lstat ){
+        er = lstat(j->paths[i],&sb);
+      }
+      else {
+        er = stat(j->paths[i],&sb);
+      }
+      if ( er < 0 ){
+        er = -errno;
+      }
+      else {
+        stat_fill(d,&sb);
+      }
+    }
+#endif
+    if ( er < 0 ){
+      /* Val_uwt_int_result doesn't touch the OCaml heap */
+      d[0] = Long_val(Val_uwt_int_result(er));
     }
   }
-  CAMLreturn(VAL_UWT_UNIT_RESULT(ret));
+#ifdef _WIN32
+  if ( lerr == 0 ){
+    uv_loop_close(&loop);
+  }
+#endif
 }
 
-CAMLprim value
-uwt_accept_raw_na(value o_serv,
-                  value o_client)
+static void
+fs_stat_many_cleaner(uv_req_t * req)
 {
-  struct handle * serv = Handle_val(o_serv);
-  struct handle * client = Handle_val(o_client);
-  if ( HANDLE_IS_INVALID_UNINIT(serv) || HANDLE_IS_INVALID(client) ){
-    return VAL_UWT_INT_RESULT_UWT_EBADF;
-  }
-  int ret = uv_accept((uv_stream_t*)serv->handle,
-                      (uv_stream_t*)client->handle);
-  if ( ret >= 0 ){
-    client->initialized = 1;
+  struct worker_params * w = req->data;
+  struct stat_job * j = w->p1;
+  if ( j != NULL ){
+    stat_job_free(j);
+    w->p1 = NULL;
   }
-  return (VAL_UWT_UNIT_RESULT(ret));
 }
 
-static void
-read_start_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
+static value
+fs_stat_many_value(uv_req_t * req)
 {
-  if ( !handle || !handle->data ){
-    DEBUG_PF("no data");
-    buf->base = NULL;
-    buf->len = 0;
-  }
-  else {
-    const struct handle * h = handle->data;
-    const unsigned int len = UMIN(suggested_size,h->c_read_size);
-    malloc_uv_buf_t(buf,len,h->cb_type);
-  }
+  struct worker_params * w = req->data;
+  struct stat_job * j = w->p1;
+  value ba;
+  value ret;
+  ba = caml_ba_alloc_dims(CAML_BA_INT64 | CAML_BA_C_LAYOUT | CAML_BA_MANAGED,
+                          1, j->data, (intnat)(j->n * STAT_SLOTS));
+  j->data = NULL; /* owned by the bigarray now */
+  Begin_roots1(ba);
+  ret = caml_alloc_small(1,Ok_tag);
+  Field(ret,0) = ba;
+  End_roots();
+  return ret;
 }
 
-static void
-read_start_cb(uv_stream_t* stream,ssize_t nread, const uv_buf_t * buf)
+CAMLprim value
+uwt_fs_stat_many(value o_paths, value o_lstat, value o_uwt)
 {
-  HANDLE_CB_INIT_WITH_CLEAN(stream);
-  struct handle * h = stream->data;
-  value ret = Val_unit;
-  bool buf_not_cleaned = true;
-  /*
-    read zero: EAGAIN or EWOULDBLOCK / WSAEWOULDBLOCK (user not interested)
-    https://github.com/joyent/libuv/blob/52ae456b0d666f6f4dbb7f52675f4f131855bd22/src/unix/stream.c#L1116
-    https://github.com/joyent/libuv/blob/52ae456b0d666f6f4dbb7f52675f4f131855bd22/src/win/tcp.c#L973
-  */
-  if ( h->close_called == 0 && nread != 0 ){
-    if ( h->cb_read == CB_INVALID ){
-      DEBUG_PF("callbacks lost");
-    }
-    else {
-      value o;
-      value cb;
-      int finished;
-      int tag;
-      if ( nread < 0 ){
-        ret = Val_uwt_error(nread);
-        finished = 1;
-        tag = Error_tag;
-      }
-      else if ( (nread && !buf->base) || (size_t)nread > buf->len ){
-        ret = VAL_UWT_ERROR_UWT_EFATAL;
+  const size_t n = Wosize_val(o_paths);
+  struct stat_job * j;
+  size_t i;
+  for ( i = 0 ; i < n ; ++i ){
+    if ( !uwt_is_safe_string(Field(o_paths,i)) ){
+      return VAL_UWT_INT_RESULT_ECHARSET;
+    }
+  }
+  j = calloc(1,sizeof *j);
+  if ( j == NULL ){
+    return VAL_UWT_INT_RESULT_ENOMEM;
+  }
+  j->lstat = Long_val(o_lstat);
+  /* at least one slot, malloc(0) might return NULL */
+  j->data = malloc((n == 0 ? 1 : n) * STAT_SLOTS * sizeof(int64_t));
+  j->paths = calloc(n == 0 ? 1 : n, sizeof(char*));
+  if ( j->data == NULL || j->paths == NULL ){
+    stat_job_free(j);
+    return VAL_UWT_INT_RESULT_ENOMEM;
+  }
+  for ( i = 0 ; i < n ; ++i ){
+    j->paths[i] = s_strdup(String_val(Field(o_paths,i)));
+    if ( j->paths[i] == NULL ){
+      stat_job_free(j);
+      return VAL_UWT_INT_RESULT_ENOMEM;
+    }
+    j->n = i + 1;
+  }
+  return (uwt_add_worker_result(o_uwt,
+                                fs_stat_many_cleaner,
+                                fs_stat_many_worker,
+                                fs_stat_many_value,
+                                j,
+                                NULL));
+}
+#undef STAT_SLOTS
+#undef FSSTART
+#undef UFSSTART
+/* }}} Fs end */
+
+/* {{{ Handle start */
+#define HANDLE_CB_INIT(x)                             \
+  struct handle *h_ = NULL;                           \
+  do {                                                \
+    uv_handle_t *x_ = (uv_handle_t*)(x);              \
+    if (unlikely( !x_ || (h_ = x_->data) == NULL )){  \
+      DEBUG_PF("data lost");                          \
+      return;                                         \
+    }                                                 \
+    if (unlikely( h_->close_called )){                \
+      DEBUG_PF("callback called after close!");       \
+      return;                                         \
+    }                                                 \
+    ++h_->in_callback_cnt;                            \
+    GET_RUNTIME();                                    \
+  } while (0)
+
+#define HANDLE_CB_INIT_WITH_CLEAN(x)                  \
+  struct handle *h_ = NULL;                           \
+  do {                                                \
+    uv_handle_t *x_ = (uv_handle_t*)(x);              \
+    if (unlikely( !x_ || (h_ = x_->data) == NULL )){  \
+      DEBUG_PF("data lost");                          \
+      return;                                         \
+    }                                                 \
+    ++h_->in_callback_cnt;                            \
+    GET_RUNTIME();                                    \
+  } while (0)
+
+
+#define MAYBE_CLOSE_HANDLE(s)                   \
+  do {                                          \
+    struct handle * h__  = s;                   \
+    if (unlikely( h__->in_use_cnt == 0 &&       \
+                  h__->in_callback_cnt == 0 &&  \
+                  h__->finalize_called == 1 &&  \
+                  h__->close_called == 0 )){    \
+      handle_finalize_close(h__);               \
+    }                                           \
+  } while (0)
+
+#define MAYBE_SAVE_EXN(s)                       \
+  do {                                          \
+    value v__ = (s);                            \
+    if (unlikely( Is_exception_result(v__) )){  \
+      add_exception(h_->loop,v__);              \
+    }                                           \
+  } while(0)
+
+#define HANDLE_CB_RET(val)                      \
+  do {                                          \
+    value v_ = (val);                           \
+    MAYBE_SAVE_EXN(v_);                         \
+    --h_->in_callback_cnt;                      \
+    MAYBE_CLOSE_HANDLE(h_);                     \
+  } while (0)
+
+#define HANDLE_IS_INVALID(_xs)                            \
+  (unlikely( !_xs || !_xs->handle || _xs->close_called ))
+
+#define HANDLE_IS_INVALID_UNINIT(_xs)                     \
+  (unlikely( !_xs || !_xs->handle || _xs->close_called || \
+             _xs->initialized == 0 ))
+
+#define HANDLE_NINIT_END GR_ROOT_ENLARGE
+
+#define HANDLE_NCHECK(_xs)                      \
+  do {                                          \
+    if ( HANDLE_IS_INVALID(_xs) ){              \
+      return VAL_UWT_INT_RESULT_UWT_EBADF;      \
+    }                                           \
+  } while (0)
+
+#define HANDLE_NO_UNINIT_CLOSED_INT_RESULT(xs)            \
+  do {                                                    \
+    struct handle * p_ = Handle_val(xs);                  \
+    if ( HANDLE_IS_INVALID_UNINIT(p_) ){                  \
+      return VAL_UWT_INT_RESULT_UWT_EBADF;                \
+    }                                                     \
+  } while (0)
+
+#define HANDLE_NO_UNINIT_CLOSED_WRAP(xs)                  \
+  do {                                                    \
+    struct handle * p_ = Handle_val(xs);                  \
+    if ( HANDLE_IS_INVALID_UNINIT(p_) ){                  \
+      value ret = caml_alloc_small(1,Error_tag);          \
+      Field(ret,0) = VAL_UWT_ERROR_UWT_EBADF;             \
+      return ret;                                         \
+    }                                                     \
+  } while (0)
+
+#define HANDLE_NO_UNINIT_NA(_xs)                \
+  do {                                          \
+    if (unlikely( _xs->initialized == 0 )){     \
+      return VAL_UWT_INT_RESULT_UWT_EBADF;      \
+    }                                           \
+  } while (0)
+
+
+#define HANDLE_NINIT_XN(n,s,o_s,...)                  \
+  struct handle * s = Handle_val(o_s);                \
+  HANDLE_NCHECK(s);                                   \
+  CAMLparam ## n (o_s,__VA_ARGS__);                   \
+  HANDLE_NINIT_END()
+
+#define HANDLE_NINIT2(s1,o_s1,s2,o_s2,x,y)      \
+  struct handle * s1 = Handle_val(o_s1);        \
+  struct handle * s2 = Handle_val(o_s2);        \
+  HANDLE_NCHECK(s1);                            \
+  HANDLE_NCHECK(s2);                            \
+  CAMLparam4(o_s1,o_s2,x,y);                    \
+  HANDLE_NINIT_END()
+
+#define HANDLE_NINIT_X1(s,o_s)                  \
+  struct handle * s = Handle_val(o_s);          \
+  HANDLE_NCHECK(s);                             \
+  CAMLparam1(o_s);                              \
+  HANDLE_NINIT_END()
+
+#define HANDLE_NINIT_X2(...)                    \
+  HANDLE_NINIT_XN(2,__VA_ARGS__)
+
+#define HANDLE_NINIT_X3(...)                    \
+  HANDLE_NINIT_XN(3,__VA_ARGS__)
+
+#define HANDLE_NINIT_X4(...)                    \
+  HANDLE_NINIT_XN(4,__VA_ARGS__)
+
+#define HANDLE_NINIT_H2(x,n,...)                \
+  HANDLE_NINIT_X ## n (x, __VA_ARGS__ )
+
+#define HANDLE_NINIT_H1(x,n,...)                \
+  HANDLE_NINIT_H2(x,n,__VA_ARGS__)
+
+#define HANDLE_NINIT(x,...)                           \
+  HANDLE_NINIT_H1(x,PP_NARG(__VA_ARGS__),__VA_ARGS__)
+
+#define HANDLE_NINIT_NA(s,o_s)                  \
+  struct handle * s = Handle_val(o_s);          \
+  HANDLE_NCHECK(s)
+
+static void
+close_cb(uv_handle_t* handle)
+{
+  struct handle *s = handle->data;
+  if ( s ){
+    write_queue_release(s);
+  }
+  if (unlikely( !s || s->cb_close == CB_INVALID )){
+    DEBUG_PF("data lost");
+  }
+  else {
+    value exn = Val_unit;
+    GET_RUNTIME();
+    ++s->in_callback_cnt;
+    exn = CAML_CALLBACK1(s,cb_close,Val_unit);
+    --s->in_callback_cnt;
+    handle_free_common(s);
+    s->close_executed = 1;
+    if (likely( s->in_callback_cnt == 0 )){
+      free_mem_uv_handle_t(s);
+      if ( s->finalize_called ){
+        free_struct_handle(s);
+      }
+    }
+    else {
+      DEBUG_PF("close_cb not the last callback?");
+    }
+    if (unlikely( Is_exception_result(exn) )){
+      add_exception(s->loop,exn);
+    }
+  }
+}
+
+static void cancel_reader(struct handle *h);
+static void cork_flush(struct handle *h);
+static void write_queue_wake(struct handle *h);
+static void sendfile_stop(struct handle *h);
+static void forward_abort(struct handle *h);
+static void recv_batch_remove(struct handle *h);
+static void recv_mmsg_stop(struct handle *h);
+CAMLprim value
+uwt_close_wait(value o_stream,value o_cb)
+{
+  struct handle * s = Handle_val(o_stream);
+  if ( HANDLE_IS_INVALID(s) ){
+    return VAL_UWT_INT_RESULT_UWT_EBADF;
+  }
+  if (unlikely( s->cb_close != CB_INVALID )){
+    return VAL_UWT_INT_RESULT_UWT_EBUSY;
+  }
+  CAMLparam2(o_stream,o_cb);
+  GR_ROOT_ENLARGE();
+  cork_flush(s);
+  ++s->in_use_cnt;
+  s->close_called = 1;
+  /* This way, we can't wrap uv_is_closing.
+     But otherwise we "leak" memory until
+     the ocaml grabage collector finalizes
+     the handle  */
+  Field(o_stream,1) = 0;
+  if ( s->read_waiting ){
+    cancel_reader(s);
+  }
+  write_queue_wake(s);
+  sendfile_stop(s);
+  forward_abort(s);
+  recv_batch_remove(s);
+  recv_mmsg_stop(s);
+  gr_root_register(&s->cb_close,o_cb);
+  uv_close(s->handle,close_cb);
+  s->finalize_called = 1;
+  CAMLreturn(Val_long(0));
+}
+
+CAMLprim value
+uwt_close_nowait(value o_stream)
+{
+  struct handle * s = Handle_val(o_stream);
+  value ret = VAL_UWT_INT_RESULT_UWT_EBADF;
+  if ( s && s->handle && s->close_called == 0 ){
+    cork_flush(s);
+    s->close_called = 1;
+    Field(o_stream,1) = 0;
+    if ( s->read_waiting ){
+      cancel_reader(s);
+    }
+    write_queue_wake(s);
+    sendfile_stop(s);
+    forward_abort(s);
+    recv_batch_remove(s);
+    recv_mmsg_stop(s);
+    s->finalize_called = 1;
+    handle_finalize_close(s);
+    ret = Val_unit;
+  }
+  return ret;
+}
+
+#define UV_HANDLE_BOOL(type,fun,uninit_ok)                  \
+  CAMLprim value                                            \
+  uwt_ ## fun ## _na(value o_stream)                        \
+  {                                                         \
+    value ret = Val_long(0);                                \
+    struct handle * s = Handle_val(o_stream);               \
+    if ( s && s->handle && (uninit_ok || s->initialized )){ \
+      type* stream = (type*)s->handle;                      \
+      if ( uv_ ## fun(stream) ){                            \
+        ret = Val_long(1);                                  \
+      }                                                     \
+    }                                                       \
+    return ret;                                             \
+  }
+UV_HANDLE_BOOL(uv_handle_t,is_active,true)
+UV_HANDLE_BOOL(uv_handle_t,has_ref,true)
+
+
+#define UV_HANDLE_VOID(name)                        \
+  CAMLprim value                                    \
+  uwt_ ## name ## _na(value o_stream)               \
+  {                                                 \
+    struct handle * s = Handle_val(o_stream);       \
+    if ( s && s->handle && s->close_called == 0 ){  \
+      uv_ ## name (s->handle);                      \
+    }                                               \
+    return Val_unit;                                \
+  }
+
+UV_HANDLE_VOID(ref)
+UV_HANDLE_VOID(unref)
+/* }}} Handle end */
+
+/* {{{ Handle ext start */
+CAMLprim value
+uwt_get_buffer_size_common_na(value o_stream, value o)
+{
+  HANDLE_NINIT_NA(s,o_stream);
+  HANDLE_NO_UNINIT_NA(s);
+  int ret;
+  int x = 0;
+  if ( Long_val(o) == 0 ){
+    ret = uv_send_buffer_size(s->handle,&x);
+  }
+  else {
+    ret = uv_recv_buffer_size(s->handle,&x);
+  }
+  return (VAL_UWT_INT_RESULT(ret));
+}
+
+CAMLprim value
+uwt_set_buffer_size_common_na(value o_stream, value o_len, value o)
+{
+  HANDLE_NINIT_NA(s,o_stream);
+  HANDLE_NO_UNINIT_NA(s);
+  int ret;
+  int x = Long_val(o_len);
+  if ( Long_val(o) == 0 ){
+    ret = uv_send_buffer_size(s->handle,&x);
+  }
+  else {
+    ret = uv_recv_buffer_size(s->handle,&x);
+  }
+  return (VAL_UWT_UNIT_RESULT(ret));
+}
+/* }}} Handle ext end */
+
+/* {{{ Timer start */
+static void
+timer_repeating_cb(uv_timer_t * handle)
+{
+  HANDLE_CB_INIT(handle);
+  value exn = Val_unit;
+  struct handle * wp = handle->data;
+  if (unlikely( wp->cb_read == CB_INVALID ||
+                wp->cb_listen == CB_INVALID )){
+    DEBUG_PF("cb lost");
+  }
+  else {
+    value t = GET_CB_VAL(wp->cb_listen);
+    exn = GET_CB_VAL(wp->cb_read);
+    exn = caml_callback_exn(exn,t);
+  }
+  HANDLE_CB_RET(exn);
+}
+
+static void
+timer_once_cb(uv_timer_t * handle)
+{
+  HANDLE_CB_INIT(handle);
+  value exn = Val_unit;
+  struct handle * wp = handle->data;
+  if (unlikely( wp->cb_read == CB_INVALID || wp->cb_listen == CB_INVALID )){
+    DEBUG_PF("cb lost");
+  }
+  else {
+    value timer = GET_CB_VAL(wp->cb_listen);
+    exn = GET_CB_VAL(wp->cb_read);
+    gr_root_unregister(&wp->cb_read);
+    if ( wp->in_use_cnt ){
+      wp->in_use_cnt--;
+    }
+    exn = caml_callback_exn(exn,timer);
+    if ( wp->close_called == 0 ){
+      if ( wp->cb_listen != CB_INVALID ){
+        timer = GET_CB_VAL(wp->cb_listen); /* might have changed */
+        Field(timer,1) = 0;
+      }
+      wp->finalize_called = 1;
+      handle_finalize_close(wp);
+    }
+    gr_root_unregister(&wp->cb_listen);
+  }
+  HANDLE_CB_RET(exn);
+}
+
+#define INIT_LOOP_WRAP(x,y)                       \
+  struct loop * x = Loop_val(y);                  \
+  do {                                            \
+    if (unlikely( !x || x->init_called == 0 ) ){  \
+      value ret = caml_alloc_small(1,Error_tag);  \
+      Field(ret,0) = VAL_UWT_ERROR_UWT_EFATAL;    \
+      return ret;                                 \
+    }                                             \
+  } while(0)
+
+CAMLprim value
+uwt_timer_start(value o_loop, value o_cb,
+                value o_timeout, value o_repeat)
+{
+  INIT_LOOP_WRAP(l,o_loop);
+  CAMLparam2(o_loop,o_cb);
+  CAMLlocal2(ret,v);
+  const intnat l_timeout = Long_val(o_timeout);
+  const intnat l_repeat = Long_val(o_repeat);
+
+  GR_ROOT_ENLARGE();
+  v = handle_create(UV_TIMER,l);
+  struct handle * h = Handle_val(v);
+  h->close_executed = 1;
+  ret = caml_alloc_small(1,Ok_tag);
+  h->close_executed = 0;
+  Field(ret,0) = v;
+  uv_timer_t * t = (uv_timer_t *)h->handle;
+  int erg = uv_timer_init(&l->loop,t);
+  if ( erg < 0 ){
+    free_mem_uv_handle_t(h);
+    free_struct_handle(h);
+  }
+  else {
+    erg = uv_timer_start((uv_timer_t*)h->handle,
+                         l_repeat != 0 ? timer_repeating_cb : timer_once_cb,
+                         l_timeout,
+                         l_repeat);
+    if ( erg >= 0 ){
+      h->in_use_cnt++;
+      h->initialized = 1;
+      gr_root_register(&h->cb_read,o_cb);
+      gr_root_register(&h->cb_listen,v);
+    }
+    else {
+      h->finalize_called = 1;
+      handle_finalize_close(h);
+    }
+  }
+  if ( erg < 0 ){
+    Field(v,1) = 0;
+    Field(ret,0) = Val_uwt_error(erg);
+    Tag_val(ret) = Error_tag;
+  }
+  CAMLreturn(ret);
+}
+/* }}} Timer end */
+
+/* {{{ Stream start */
+CAMLprim value
+uwt_write_queue_size_na(value o_s)
+{
+  value ret;
+  struct handle * h = Handle_val(o_s);
+  if ( HANDLE_IS_INVALID_UNINIT(h) ){
+    ret = Val_long(0);
+  }
+  else {
+    uv_stream_t* s = (uv_stream_t*)h->handle;
+    ret = Val_long((intnat)s->write_queue_size);
+  }
+  return ret;
+}
+
+static void
+shutdown_cb(uv_shutdown_t* req, int status)
+{
+  struct handle * s = req->handle->data;
+  struct req * r = req->data;
+  if ( !s || !r ){
+    DEBUG_PF("leaking data");
+  }
+  else {
+    ++s->in_callback_cnt;
+    --s->in_use_cnt;
+    r->c_param = status;
+    universal_callback((void*)req);
+    --s->in_callback_cnt;
+    MAYBE_CLOSE_HANDLE(s);
+  }
+}
+
+CAMLprim value
+uwt_shutdown(value o_stream,value o_cb)
+{
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
+  HANDLE_NINIT(s,o_stream,o_cb);
+  uv_stream_t* stream = (uv_stream_t*)s->handle;
+  struct req * wp;
+  if ( s->sf_job != NULL || s->fw_splice == 1 ){
+    /* uwt.ml waits until Stream.sendfile or forward has finished */
+    CAMLreturn(VAL_UWT_INT_RESULT_EAGAIN);
+  }
+  cork_flush(s);
+  wp = req_create(UV_SHUTDOWN,s->loop);
+  uv_shutdown_t * req = (uv_shutdown_t*)wp->req;
+  const int erg = uv_shutdown(req,stream,shutdown_cb);
+  value ret;
+  if ( erg < 0 ){
+    free_mem_uv_req_t(wp);
+    free_struct_req(wp);
+    ret = Val_uwt_int_result(erg);
+  }
+  else {
+    wp->c_cb = ret_unit_cparam;
+    gr_root_register(&wp->cb,o_cb);
+    wp->in_use = 1;
+    wp->finalize_called = 1;
+    ++s->in_use_cnt;
+    ret = Val_unit;
+  }
+  CAMLreturn(ret);
+}
+
+static void
+listen_cb(uv_stream_t *server,int status)
+{
+  HANDLE_CB_INIT(server);
+  value exn = Val_unit;
+  struct handle * h = server->data;
+  if (unlikely( h->cb_listen == CB_INVALID ||
+                h->cb_listen_server == CB_INVALID )){
+    DEBUG_PF("cb lost");
+  }
+  else {
+    value param = VAL_UWT_UNIT_RESULT(status);
+    value s = GET_CB_VAL(h->cb_listen_server);
+    exn = GET_CB_VAL(h->cb_listen);
+    exn = caml_callback2_exn(exn,s,param);
+  }
+  HANDLE_CB_RET(exn);
+}
+
+CAMLprim value
+uwt_listen(value o_stream,value o_backlog,value o_cb)
+{
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
+  HANDLE_NINIT(s,o_stream,o_cb);
+  int ret;
+  if ( s->cb_listen_server != CB_INVALID ||
+       s->cb_listen != CB_INVALID ){
+    ret = UV_UWT_EBUSY;
+  }
+  else {
+    uv_stream_t* stream = (uv_stream_t*)s->handle;
+    ret = uv_listen(stream,Long_val(o_backlog),listen_cb);
+    if ( ret >= 0 ){
+      ++s->in_use_cnt;
+      gr_root_register(&s->cb_listen,o_cb);
+      gr_root_register(&s->cb_listen_server,o_stream);
+    }
+  }
+  CAMLreturn(VAL_UWT_UNIT_RESULT(ret));
+}
+
+CAMLprim value
+uwt_accept_raw_na(value o_serv,
+                  value o_client)
+{
+  struct handle * serv = Handle_val(o_serv);
+  struct handle * client = Handle_val(o_client);
+  if ( HANDLE_IS_INVALID_UNINIT(serv) || HANDLE_IS_INVALID(client) ){
+    return VAL_UWT_INT_RESULT_UWT_EBADF;
+  }
+  int ret = uv_accept((uv_stream_t*)serv->handle,
+                      (uv_stream_t*)client->handle);
+  if ( ret >= 0 ){
+    client->initialized = 1;
+  }
+  return (VAL_UWT_UNIT_RESULT(ret));
+}
+
+static void
+read_start_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
+{
+  if ( !handle || !handle->data ){
+    DEBUG_PF("no data");
+    buf->base = NULL;
+    buf->len = 0;
+  }
+  else {
+    const struct handle * h = handle->data;
+    (void) suggested_size; /* c_read_size is controlled by the policy */
+    malloc_uv_buf_t(buf,h->c_read_size,h->cb_type);
+  }
+}
+
+static void
+read_start_ba_alloc_cb(uv_handle_t* handle, size_t suggested_size,
+                       uv_buf_t* buf)
+{
+  if ( !handle || !handle->data ){
+    DEBUG_PF("no data");
+    buf->base = NULL;
+    buf->len = 0;
+  }
+  else {
+    const struct handle * h = handle->data;
+    (void) suggested_size;
+    lent_buf_alloc(buf,h->c_read_size);
+  }
+}
+
+/*
+  Adaptive read size: the buffer size is doubled after a read that
+  filled the whole buffer and halved after two reads in a row that used
+  less than a quarter of it. Chatty connections will end up with small
+  buffers, bulk transfers with large ones.
+*/
+static void
+read_size_adapt(struct handle * h, size_t nread, size_t len)
+{
+  const unsigned int cur = h->c_read_size;
+  if ( nread >= len ){
+    h->read_short = 0;
+    if ( cur < h->read_size_max ){
+      h->c_read_size = cur > h->read_size_max / 2 ? h->read_size_max : cur * 2;
+    }
+  }
+  else if ( nread <= len / 4 ){
+    if ( h->read_short == 0 ){
+      h->read_short = 1;
+    }
+    else {
+      h->read_short = 0;
+      h->c_read_size = UMAX(cur / 2, h->read_size_min);
+    }
+  }
+  else {
+    h->read_short = 0;
+  }
+}
+
+static void
+read_start_cb(uv_stream_t* stream,ssize_t nread, const uv_buf_t * buf)
+{
+  HANDLE_CB_INIT_WITH_CLEAN(stream);
+  struct handle * h = stream->data;
+  value ret = Val_unit;
+  bool buf_not_cleaned = true;
+  /*
+    read zero: EAGAIN or EWOULDBLOCK / WSAEWOULDBLOCK (user not interested)
+    https://github.com/joyent/libuv/blob/52ae456b0d666f6f4dbb7f52675f4f131855bd22/src/unix/stream.c#L1116
+    https://github.com/joyent/libuv/blob/52ae456b0d666f6f4dbb7f52675f4f131855bd22/src/win/tcp.c#L973
+  */
+  if ( h->close_called == 0 && nread != 0 ){
+    if ( h->cb_read == CB_INVALID ){
+      DEBUG_PF("callbacks lost");
+    }
+    else {
+      value o;
+      value cb;
+      int finished;
+      int tag;
+      if ( nread < 0 ){
+        ret = Val_uwt_error(nread);
+        finished = 1;
+        tag = Error_tag;
+      }
+      else if ( (nread && !buf->base) || (size_t)nread > buf->len ){
+        ret = VAL_UWT_ERROR_UWT_EFATAL;
         tag = Error_tag;
         finished = 1;
       }
-      else {
-        ret = caml_alloc_string(nread);
-        memcpy(String_val(ret), buf->base, nread);
-        finished = 0;
-        tag = Ok_tag;
+      else if ( h->read_lend == 1 ){
+        if ( h->read_adaptive == 1 ){
+          read_size_adapt(h,nread,buf->len);
+        }
+        ret = lent_buf_to_ba(buf,nread);
+        finished = 0;
+        tag = Ok_tag;
+        buf_not_cleaned = false;
+      }
+      else {
+        if ( h->read_adaptive == 1 ){
+          read_size_adapt(h,nread,buf->len);
+        }
+        ret = caml_alloc_string(nread);
+        memcpy(String_val(ret), buf->base, nread);
+        finished = 0;
+        tag = Ok_tag;
+      }
+      if ( buf_not_cleaned ){
+        buf_not_cleaned = false;
+        if ( h->read_lend == 1 ){
+          lent_buf_free(buf);
+        }
+        else {
+          free_uv_buf_t_const(buf,h->cb_type);
+        }
+      }
+      Begin_roots1(ret);
+      o = caml_alloc_small(1,tag);
+      Field(o,0) = ret;
+      cb = GET_CB_VAL(h->cb_read);
+      if ( finished == 1 ){
+        h->cb_read_removed_by_cb = 1;
+        gr_root_unregister(&h->cb_read);
+        if ( h->in_use_cnt ){
+          h->in_use_cnt--;
+        }
+      }
+      End_roots();
+      ret = caml_callback_exn(cb,o);
+    }
+  }
+  if ( buf_not_cleaned && buf->base ){
+    if ( h->read_lend == 1 ){
+      lent_buf_free(buf);
+    }
+    else {
+      free_uv_buf_t_const(buf,h->cb_type);
+    }
+  }
+  HANDLE_CB_RET(ret);
+}
+
+/*
+  Batched reading (read_start_batched): read_batch_cb only queues the
+  buffers. It doesn't need the OCaml runtime. The check handle passes
+  the data of all streams to OCaml at once (one call per loop iteration,
+  see read_batch in uwt.ml). Queued handles are protected by
+  in_callback_cnt.
+  The callbacks can stop reading or close other streams of the same batch.
+  Therefore uwt.ml checks every entry with uwt_read_batch_valid_na
+  before its callback is called.
+*/
+struct read_batch_entry {
+    struct handle * h;
+    char * base;
+    unsigned int len;
+    unsigned int gen;
+    ssize_t nread;
+};
+
+static struct read_batch_entry * read_batch = NULL;
+static unsigned int read_batch_n = 0;
+static unsigned int read_batch_size = 0;
+static unsigned int read_batch_delivered = 0; /* entries passed to OCaml */
+static uv_check_t read_batch_check;
+static bool read_batch_check_init = false;
+static value * read_batch_fun = NULL;
+
+static void
+read_batch_flush(uv_check_t * x)
+{
+  struct loop * l = x->loop->data;
+  const unsigned int n = read_batch_n;
+  unsigned int i, j;
+  value ret;
+  if ( n == 0 ){
+    uv_check_stop(x);
+    return;
+  }
+  GET_RUNTIME();
+  CAMLparam0();
+  CAMLlocal3(ar,x1,x2);
+  ar = caml_alloc(n,0);
+  for ( i = 0, j = 0; i < n; ++i ){
+    struct read_batch_entry * e = &read_batch[i];
+    struct handle * h = e->h;
+    const uv_buf_t buf = uv_buf_init(e->base,e->len);
+    if ( h->close_called == 1 || h->cb_read == CB_INVALID ||
+         e->gen != h->read_gen ){
+      /* read_stop (and perhaps read_start for a new reader) was called
+         after the entry was queued. An EOF or error of the old reader
+         must not tear down the current cb_read */
+      DEBUG_PF("read stopped, data discarded");
+    }
+    else {
+      int tag;
+      bool finished;
+      if ( e->nread < 0 ){
+        x1 = Val_uwt_error(e->nread);
+        tag = Error_tag;
+        finished = true;
+      }
+      else {
+        x1 = caml_alloc_string(e->nread);
+        memcpy(String_val(x1), e->base, e->nread);
+        tag = Ok_tag;
+        finished = false;
+      }
+      x2 = caml_alloc_small(1,tag);
+      Field(x2,0) = x1;
+      x1 = caml_alloc_small(3,0);
+      Field(x1,0) = GET_CB_VAL(h->cb_read);
+      Field(x1,1) = x2;
+      Field(x1,2) = Val_long(i);
+      Store_field(ar,j,x1);
+      ++j;
+      if ( finished ){
+        h->cb_read_removed_by_cb = 1;
+        gr_root_unregister(&h->cb_read);
+        if ( h->in_use_cnt ){
+          h->in_use_cnt--;
+        }
+      }
+    }
+    free_uv_buf_t_const(&buf,h->cb_type);
+  }
+  read_batch_n = 0;
+  uv_check_stop(x);
+  if ( j != 0 ){
+    read_batch_delivered = n;
+    ret = caml_callback2_exn(*read_batch_fun,ar,Val_long(j));
+    read_batch_delivered = 0;
+    if ( Is_exception_result(ret) ){
+      add_exception(l,ret);
+    }
+    else if ( Bool_val(ret) ){
+      /* exceptions of the callbacks have been passed to
+         Uwt.Exception.add_exception */
+      l->exn_caught = 1;
+    }
+  }
+  for ( i = 0; i < n; ++i ){
+    struct handle * h = read_batch[i].h;
+    --h->in_callback_cnt;
+    MAYBE_CLOSE_HANDLE(h);
+  }
+  CAMLreturn0;
+}
+
+static void
+read_batch_cb(uv_stream_t* stream,ssize_t nread, const uv_buf_t * buf)
+{
+  struct handle * h = stream->data;
+  struct read_batch_entry * e;
+  if ( nread == 0 || h == NULL || h->close_called == 1 ){
+    if ( buf->base ){
+      free_uv_buf_t_const(buf,h ? h->cb_type : CB_LWT);
+    }
+    return;
+  }
+  if ( nread > 0 ){
+    if (unlikely( !buf->base || (size_t)nread > buf->len )){
+      nread = UV_UWT_EFATAL;
+    }
+    else if ( h->read_adaptive == 1 ){
+      read_size_adapt(h,nread,buf->len);
+    }
+  }
+  if (unlikely( read_batch_n == read_batch_size )){
+    const unsigned int nsize =
+      read_batch_size == 0 ? STACK_START_SIZE : read_batch_size * 2;
+    e = realloc(read_batch,nsize * sizeof *e);
+    if ( e == NULL ){
+      /* deliver everything immediately, the order must be preserved */
+      read_batch_flush(&read_batch_check);
+      read_start_cb(stream,nread,buf);
+      return;
+    }
+    read_batch = e;
+    read_batch_size = nsize;
+  }
+  if ( read_batch_n == 0 ){
+    uv_check_start(&read_batch_check,read_batch_flush);
+  }
+  e = &read_batch[read_batch_n];
+  ++read_batch_n;
+  e->h = h;
+  e->base = buf->base;
+  e->len = buf->len;
+  e->gen = h->read_gen;
+  e->nread = nread;
+  ++h->in_callback_cnt;
+}
+
+CAMLprim value
+uwt_read_batch_valid_na(value o_idx)
+{
+  const intnat i = Long_val(o_idx);
+  const struct read_batch_entry * e;
+  if ( i < 0 || (uintnat)i >= read_batch_delivered ){
+    return Val_false;
+  }
+  e = &read_batch[i];
+  return (Val_bool(e->h->close_called == 0 && e->h->read_gen == e->gen));
+}
+
+static value
+read_start(value o_stream, value o_cb, uv_alloc_cb alloc_cb,
+           uv_read_cb read_cb)
+{
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
+  HANDLE_NINIT(s,o_stream,o_cb);
+  value ret;
+  if ( s->cb_read != CB_INVALID || s->read_ring == 1 || s->fw_job != NULL ){
+    ret = VAL_UWT_INT_RESULT_UWT_EBUSY;
+  }
+  else {
+    int erg = 0;
+    uv_stream_t* stream = (uv_stream_t*)s->handle;
+    if ( s->can_reuse_cb_read == 1 ){
+      s->can_reuse_cb_read = 0;
+      s->read_waiting = 0;
+      erg = uv_read_stop(stream);
+    }
+    if ( erg >= 0 ){
+      s->read_lend = alloc_cb == read_start_ba_alloc_cb;
+      erg = uv_read_start(stream,alloc_cb,read_cb);
+      if ( erg >= 0 ){
+        if ( s->read_adaptive == 0 ){
+          s->c_read_size = s->read_size_max;
+        }
+        else {
+          s->c_read_size = UMAX(s->read_size_min,
+                                UMIN(s->c_read_size,s->read_size_max));
+        }
+        s->read_short = 0;
+        s->cb_read_removed_by_cb = 0;
+        ++s->read_gen;
+        gr_root_register(&s->cb_read,o_cb);
+        ++s->in_use_cnt;
+      }
+    }
+    ret = VAL_UWT_UNIT_RESULT(erg);
+  }
+  CAMLreturn(ret);
+}
+
+CAMLprim value
+uwt_read_start(value o_stream, value o_cb)
+{
+  return (read_start(o_stream,o_cb,read_start_alloc_cb,read_start_cb));
+}
+
+CAMLprim value
+uwt_read_start_ba(value o_stream, value o_cb)
+{
+  return (read_start(o_stream,o_cb,read_start_ba_alloc_cb,read_start_cb));
+}
+
+CAMLprim value
+uwt_read_start_batched(value o_stream, value o_cb)
+{
+  struct handle * h = Handle_val(o_stream);
+  if ( read_batch_fun == NULL ){
+    read_batch_fun = caml_named_value(UWT_READ_BATCH_STRING);
+    if ( read_batch_fun == NULL ){
+      caml_failwith("uwt read batch callback not found");
+    }
+  }
+  if ( read_batch_check_init == false && !HANDLE_IS_INVALID(h) ){
+    if ( uv_check_init(&h->loop->loop,&read_batch_check) != 0 ){
+      return VAL_UWT_INT_RESULT_UWT_EFATAL;
+    }
+    uv_unref((uv_handle_t*)&read_batch_check);
+    read_batch_check_init = true;
+  }
+  return (read_start(o_stream,o_cb,read_start_alloc_cb,read_batch_cb));
+}
+
+CAMLprim value
+uwt_set_read_size_policy_na(value o_stream, value o_adaptive,
+                            value o_min, value o_max)
+{
+  HANDLE_NINIT_NA(s,o_stream);
+  const intnat min = Long_val(o_min);
+  const intnat max = Long_val(o_max);
+  if ( min < 1 || max < min || max > (1 << MAX_BUCKET_SIZE_LOG2) ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  s->read_size_min = min;
+  s->read_size_max = max;
+  s->read_adaptive = Long_val(o_adaptive) != 0;
+  s->read_short = 0;
+  /* c_read_size is the size of the user buffer during read_own.
+     read_start will apply the policy later. */
+  if ( s->cb_read == CB_INVALID || s->read_waiting == 1 ){
+    return Val_long(0);
+  }
+  if ( s->read_adaptive == 0 || s->c_read_size > (unsigned int)max ){
+    s->c_read_size = max;
+  }
+  else if ( s->c_read_size < (unsigned int)min ){
+    s->c_read_size = min;
+  }
+  return Val_long(0);
+}
+
+CAMLprim value
+uwt_read_size_na(value o_stream)
+{
+  struct handle * h = Handle_val(o_stream);
+  if ( HANDLE_IS_INVALID_UNINIT(h) ){
+    return Val_long(0);
+  }
+  return (Val_long(h->c_read_size));
+}
+
+CAMLprim value
+uwt_read_stop(value o_stream, value o_abort)
+{
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
+  HANDLE_NINIT(s,o_stream);
+  value ret;
+  if ( (s->read_waiting == 1 && Long_val(o_abort) == 0 ) ||
+       (s->cb_read == CB_INVALID && s->cb_read_removed_by_cb != 1) ){
+    ret = VAL_UWT_INT_RESULT_UWT_ENOTACTIVE;
+  }
+  else {
+    uv_stream_t* stream = (uv_stream_t*)s->handle;
+    int erg = uv_read_stop(stream);
+    if ( erg >= 0 ){
+      s->can_reuse_cb_read = 0;
+      ++s->read_gen;
+      if ( s->in_use_cnt && s->cb_read_removed_by_cb == 0 ){
+        --s->in_use_cnt;
+      }
+      if ( s->cb_read != CB_INVALID && s->cb_read_removed_by_cb != 1 ){
+        gr_root_unregister(&s->cb_read);
+      }
+      s->cb_read_removed_by_cb = 0;
+    }
+    ret = VAL_UWT_UNIT_RESULT(erg);
+  }
+  CAMLreturn(ret);
+}
+
+static void
+cancel_reader(struct handle *h)
+{
+  if ( h->read_waiting == 1 &&
+       h->cb_read != CB_INVALID &&
+       h->obuf != CB_INVALID ){
+    value exn;
+    value param;
+    if ( h->handle->type == UV_UDP ){
+      param = caml_alloc_small(1,Error_tag);
+      Field(param,0) = VAL_UWT_ERROR_ECANCELED;
+    }
+    else {
+      param = VAL_UWT_INT_RESULT_ECANCELED;
+    }
+    value cb = GET_CB_VAL(h->cb_read);
+    gr_root_unregister(&h->cb_read);
+    gr_root_unregister(&h->obuf);
+    ++h->in_callback_cnt;
+    ++h->in_use_cnt;
+    assert( h->close_called == 1 );
+    exn = caml_callback2_exn(*uwt_global_wakeup,cb,param);
+    --h->in_callback_cnt;
+    --h->in_use_cnt;
+    if ( h->in_use_cnt ){
+      /* yes twice, it was increased in either
+         uwt_read_own or uwt_udp_recv_own. It doesn't
+         matter currently, because close was already called.
+         But I should add debug code to the close callback, if the
+         reference count mechanism works as intended. */
+      --h->in_use_cnt;
+    }
+    if (unlikely( Is_exception_result(exn) )){
+      add_exception(h->loop,exn);
+    }
+  }
+}
+
+static void
+read_own_cb(uv_stream_t* stream,ssize_t nread, const uv_buf_t * buf)
+{
+  HANDLE_CB_INIT_WITH_CLEAN(stream);
+  struct handle * h = stream->data;
+  value ret = Val_unit;
+  const bool read_ba = h->use_read_ba == 1;
+  bool buf_not_cleaned = true;
+  if ( h->close_called == 0 && nread != 0 ){
+    if (unlikely( h->cb_read == CB_INVALID ||
+                  h->obuf == CB_INVALID )){
+      DEBUG_PF("callbacks lost");
+    }
+    else {
+      value o;
+      value cb;
+      bool finished;
+      h->read_waiting = 0;
+      if ( nread < 0 ){
+        if ( nread == UV_EOF ){
+          o = Val_long(0);
+        }
+        else {
+          o = Val_uwt_int_result(nread);
+        }
+        finished = true;
+      }
+      else {
+        assert(buf->len >= (size_t)nread);
+        assert((size_t)nread <= h->c_read_size);
+        finished = false;
+        o = Val_long(nread);
+        if ( read_ba == false ){
+          if (unlikely( !buf->base || (size_t)nread > buf->len )){
+            o = VAL_UWT_INT_RESULT_UWT_EFATAL;
+          }
+          else {
+            value tp = GET_CB_VAL(h->obuf);
+            memcpy(String_val(tp) + h->obuf_offset, buf->base, (size_t)nread);
+          }
+        }
+      }
+      if ( read_ba == false ){
+        buf_not_cleaned = false;
+        free_uv_buf_t_const(buf,h->cb_type);
+      }
+      cb = GET_CB_VAL(h->cb_read);
+      gr_root_unregister(&h->cb_read);
+      gr_root_unregister(&h->obuf);
+      h->can_reuse_cb_read = finished == false;
+      if ( h->in_use_cnt ){
+        h->in_use_cnt--;
+      }
+      ret = caml_callback2_exn(*uwt_global_wakeup,cb,o);
+      /* it's not clear in older versions, how to handle this case,...
+         https://github.com/joyent/libuv/issues/1534 */
+      if ( h->close_called == 0 &&
+           finished == false &&
+           h->can_reuse_cb_read == 1 ){
+        uv_read_stop(stream);
+      }
+      h->can_reuse_cb_read = 0;
+    }
+  }
+  if ( buf_not_cleaned && read_ba == false && buf->base ){
+    free_uv_buf_t_const(buf,h->cb_type);
+  }
+  HANDLE_CB_RET(ret);
+}
+
+static void
+alloc_read_own(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
+{
+  struct handle * h;
+  (void) suggested_size;
+  if (unlikely( !handle || (h = handle->data) == NULL )){
+    DEBUG_PF("no data");
+    buf->len = 0;
+    buf->base = NULL;
+  }
+  else if ( h->use_read_ba ){
+    buf->base = h->ba_read;
+    buf->len = h->c_read_size;
+  }
+  else {
+    unsigned int len;
+    len = UMIN(suggested_size,h->c_read_size);
+    malloc_uv_buf_t(buf,len,h->cb_type);
+  }
+}
+
+CAMLprim value
+uwt_read_own(value o_s,value o_buf,value o_offset,value o_len,value o_cb)
+{
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_s);
+  HANDLE_NINIT(s,o_s,o_buf,o_cb);
+  const int ba = Tag_val(o_buf) != String_tag;
+  value ret;
+  assert( s->cb_type == CB_LWT );
+  if ( s->cb_read != CB_INVALID || s->read_ring == 1 || s->fw_job != NULL ){
+    ret = VAL_UWT_INT_RESULT_UWT_EBUSY;
+  }
+  else {
+    int erg;
+    if ( s->can_reuse_cb_read == 1 ){
+      s->can_reuse_cb_read = 0;
+      erg = 0;
+    }
+    else {
+      uv_stream_t* stream = (uv_stream_t*)s->handle;
+      erg = uv_read_start(stream,alloc_read_own,read_own_cb);
+    }
+    if ( erg >= 0 ){
+      unsigned int len = Long_val(o_len);
+      unsigned int offset = Long_val(o_offset);
+      gr_root_register(&s->cb_read,o_cb);
+      gr_root_register(&s->obuf,o_buf);
+      ++s->in_use_cnt;
+      s->c_read_size = len;
+      s->read_waiting = 1;
+      s->use_read_ba = ba;
+      if ( ba == 0 ){
+        s->obuf_offset = Long_val(o_offset);
+      }
+      else {
+        s->ba_read = Ba_buf_val(o_buf) + offset;
+      }
+    }
+    ret = VAL_UWT_UNIT_RESULT(erg);
+  }
+  CAMLreturn(ret);
+}
+
+/*
+  attach_ring: the stream reads continuously into a bigarray supplied by
+  the user. Reading is only stopped, if the ring is full. obuf keeps the
+  bigarray alive, cb_read is the wakener of ring_wait (if any).
+*/
+static void
+alloc_ring_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
+{
+  struct handle * h;
+  (void) suggested_size;
+  if (unlikely( !handle || (h = handle->data) == NULL )){
+    DEBUG_PF("no data");
+    buf->len = 0;
+    buf->base = NULL;
+  }
+  else {
+    const unsigned int len = h->c_read_size;
+    unsigned int wpos = h->ring_pos + h->ring_fill;
+    if ( wpos >= len ){
+      wpos -= len;
+    }
+    buf->base = (char*)h->ba_read + wpos;
+    buf->len = UMIN(len - h->ring_fill, len - wpos);
+  }
+}
+
+static void
+ring_read_cb(uv_stream_t* stream,ssize_t nread, const uv_buf_t * buf)
+{
+  HANDLE_CB_INIT_WITH_CLEAN(stream);
+  struct handle * h = stream->data;
+  value ret = Val_unit;
+  (void) buf;
+  if ( h->close_called == 0 && nread != 0 && h->read_ring == 1 ){
+    if ( nread == UV_ENOBUFS ){
+      /* shouldn't happen, the ring is paused before */
+      uv_read_stop(stream);
+      h->ring_paused = 1;
+    }
+    else if ( nread < 0 ){
+      uv_read_stop(stream);
+      h->ring_err = nread;
+    }
+    else {
+      h->ring_fill += nread;
+      if ( h->ring_fill == h->c_read_size ){
+        uv_read_stop(stream);
+        h->ring_paused = 1;
+      }
+    }
+    if ( h->read_waiting == 1 && h->cb_read != CB_INVALID &&
+         (h->ring_fill != 0 || h->ring_err != 0) ){
+      value o;
+      value cb;
+      if ( h->ring_fill != 0 || h->ring_err == UV_EOF ){
+        o = Val_long(h->ring_fill);
+      }
+      else {
+        o = Val_uwt_int_result(h->ring_err);
+      }
+      cb = GET_CB_VAL(h->cb_read);
+      gr_root_unregister(&h->cb_read);
+      h->read_waiting = 0;
+      if ( h->in_use_cnt ){
+        h->in_use_cnt--;
+      }
+      ret = caml_callback2_exn(*uwt_global_wakeup,cb,o);
+    }
+  }
+  HANDLE_CB_RET(ret);
+}
+
+CAMLprim value
+uwt_ring_attach(value o_s, value o_ba)
+{
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_s);
+  HANDLE_NINIT(s,o_s,o_ba);
+  const intnat len = Caml_ba_array_val(o_ba)->dim[0];
+  value ret;
+  if ( s->cb_read != CB_INVALID || s->read_ring == 1 || s->fw_job != NULL ){
+    ret = VAL_UWT_INT_RESULT_UWT_EBUSY;
+  }
+  else if ( len <= 0 || (uintnat)len > (UINT_MAX / 2) ){
+    ret = VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  else {
+    int erg = 0;
+    uv_stream_t* stream = (uv_stream_t*)s->handle;
+    if ( s->can_reuse_cb_read == 1 ){
+      s->can_reuse_cb_read = 0;
+      s->read_waiting = 0;
+      erg = uv_read_stop(stream);
+    }
+    if ( erg >= 0 ){
+      s->ba_read = Ba_buf_val(o_ba);
+      s->c_read_size = len;
+      s->ring_pos = 0;
+      s->ring_fill = 0;
+      s->ring_err = 0;
+      s->ring_paused = 0;
+      erg = uv_read_start(stream,alloc_ring_cb,ring_read_cb);
+      if ( erg >= 0 ){
+        s->read_ring = 1;
+        s->read_waiting = 0;
+        gr_root_register(&s->obuf,o_ba);
+        ++s->in_use_cnt;
+      }
+    }
+    ret = VAL_UWT_UNIT_RESULT(erg);
+  }
+  CAMLreturn(ret);
+}
+
+CAMLprim value
+uwt_ring_detach_na(value o_s)
+{
+  HANDLE_NINIT_NA(s,o_s);
+  if ( s->read_ring == 0 ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  if ( s->cb_read != CB_INVALID ){
+    return VAL_UWT_INT_RESULT_UWT_EBUSY;
+  }
+  if ( s->ring_paused == 0 && s->ring_err == 0 ){
+    uv_read_stop((uv_stream_t*)s->handle);
+  }
+  s->read_ring = 0;
+  s->ring_paused = 0;
+  s->ba_read = NULL;
+  gr_root_unregister(&s->obuf);
+  if ( s->in_use_cnt ){
+    --s->in_use_cnt;
+  }
+  return Val_long(0);
+}
+
+/* the number of bytes, that can be read, starting at ring_pos */
+CAMLprim value
+uwt_ring_available_na(value o_s)
+{
+  struct handle * h = Handle_val(o_s);
+  if ( HANDLE_IS_INVALID(h) || h->read_ring == 0 ){
+    return Val_long(0);
+  }
+  return (Val_long(h->ring_fill));
+}
+
+CAMLprim value
+uwt_ring_pos_na(value o_s)
+{
+  struct handle * h = Handle_val(o_s);
+  if ( HANDLE_IS_INVALID(h) || h->read_ring == 0 ){
+    return Val_long(0);
+  }
+  return (Val_long(h->ring_pos));
+}
+
+CAMLprim value
+uwt_ring_consume_na(value o_s, value o_n)
+{
+  HANDLE_NINIT_NA(s,o_s);
+  const intnat n = Long_val(o_n);
+  int erg = 0;
+  if ( s->read_ring == 0 || n < 0 || (uintnat)n > s->ring_fill ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  s->ring_pos += n;
+  if ( s->ring_pos >= s->c_read_size ){
+    s->ring_pos -= s->c_read_size;
+  }
+  s->ring_fill -= n;
+  if ( s->ring_fill == 0 ){
+    /* larger contiguous reads */
+    s->ring_pos = 0;
+  }
+  if ( n > 0 && s->ring_paused == 1 && s->ring_err == 0 ){
+    erg = uv_read_start((uv_stream_t*)s->handle,alloc_ring_cb,ring_read_cb);
+    if ( erg >= 0 ){
+      s->ring_paused = 0;
+    }
+  }
+  return (VAL_UWT_UNIT_RESULT(erg));
+}
+
+/* Returns the number of available bytes, 0 at EOF, or UWT_EAGAIN, if
+   the wakener was registered */
+CAMLprim value
+uwt_ring_wait(value o_s, value o_cb)
+{
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_s);
+  HANDLE_NINIT(s,o_s,o_cb);
+  value ret;
+  if ( s->read_ring == 0 ){
+    ret = VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  else if ( s->cb_read != CB_INVALID ){
+    ret = VAL_UWT_INT_RESULT_UWT_EBUSY;
+  }
+  else if ( s->ring_fill != 0 || s->ring_err == UV_EOF ){
+    ret = Val_long(s->ring_fill);
+  }
+  else if ( s->ring_err != 0 ){
+    ret = Val_uwt_int_result(s->ring_err);
+  }
+  else {
+    gr_root_register(&s->cb_read,o_cb);
+    s->read_waiting = 1;
+    ++s->in_use_cnt;
+    ret = VAL_UWT_INT_RESULT_EAGAIN;
+  }
+  CAMLreturn(ret);
+}
+
+/*
+  Write backpressure: wq_acc is the number of bytes, that were accepted
+  by a write function, but not yet written (libuv's write queue and the
+  current cork batch). It's updated whenever the write queue changes.
+*/
+#define WQ_BLOCK 0u
+#define WQ_FAIL 1u
+#define WQ_DROP 2u
+
+static void
+write_queue_update(struct handle * h)
+{
+  unsigned int n = 0;
+  if ( h->handle != NULL ){
+    n = ((uv_stream_t*)h->handle)->write_queue_size;
+  }
+  if ( h->cork_req != NULL ){
+    n += h->cork_req->offset;
+  }
+  write_bytes_total = write_bytes_total - h->wq_acc + n;
+  h->wq_acc = n;
+}
+
+/* udp handles: libuv's send queue, see Udp.set_send_queue_limit */
+static bool
+write_queue_drained(const struct handle * h)
+{
+  if ( h->handle_type == UV_UDP ){
+    const uv_udp_t * u = (const uv_udp_t*)h->handle;
+    /* a limit of 0 is unset and must not hold back the waiters */
+    return ( u == NULL ||
+             ((h->wq_high == 0 || u->send_queue_size <= h->wq_low) &&
+              (h->eq_count_max == 0 ||
+               u->send_queue_count <= h->eq_count_low)) );
+  }
+  /* writes and shutdown are refused while Stream.sendfile is active
+     or Stream.forward splices into the socket */
+  return ( h->wq_acc <= h->wq_low && h->sf_job == NULL &&
+           h->fw_splice == 0 );
+}
+
+/* must be called with the runtime */
+static void
+write_queue_wake(struct handle * h)
+{
+  if ( h->cb_drain != CB_INVALID &&
+       (h->close_called == 1 || write_queue_drained(h)) ){
+    value exn = Field(GET_CB_VAL(h->cb_drain),1);
+    gr_root_unregister(&h->cb_drain);
+    exn = caml_callback2_exn(*uwt_global_wakeup,exn,Val_unit);
+    if (unlikely( Is_exception_result(exn) )){
+      add_exception(h->loop,exn);
+    }
+  }
+}
+
+#define XX(name,type,after)                                             \
+  static void name (type * req, int status)                             \
+  {                                                                     \
+    struct handle * s;                                                  \
+    if (unlikely( !req || !req->data || !req->handle ||                 \
+                  (s = req->handle->data) == NULL )){                   \
+      DEBUG_PF("leaking data");                                         \
+    }                                                                   \
+    else {                                                              \
+      struct req * r = req->data;                                       \
+      ++s->in_callback_cnt;                                             \
+      --s->in_use_cnt;                                                  \
+      r->c_param = status;                                              \
+      universal_callback((void*)req);                                   \
+      after;                                                            \
+      --s->in_callback_cnt;                                             \
+      MAYBE_CLOSE_HANDLE(s);                                            \
+    }                                                                   \
+  }
+
+/* TODO: check the alignment, if we can cast or not */
+XX(write_send_cb,uv_write_t,
+   write_queue_update(s); write_queue_wake(s))
+XX(udp_send_cb,uv_udp_send_t,write_queue_wake(s))
+#undef XX
+
+/*
+  Cork mode: small writes are copied into a batch (one pooled buffer,
+  one write request). The batch is written as soon as it is full, before
+  any other write, shutdown or close of the stream - or from the prepare
+  handle below, i.e. once per loop iteration. The wakers of all callers
+  are stored in struct cork_cbs (wp->c.p1).
+  Flushing doesn't require the OCaml runtime: cork_flush is called
+  while raw pointers into OCaml strings are in use (cork_append). If
+  uv_write fails, the batch is put into cork_failed and its wakers are
+  called from the prepare handle.
+*/
+struct cork_cbs {
+    unsigned int n;
+    unsigned int size;
+    cb_t cbs[];
+};
+
+#define CORK_DEF_LIMIT 65536u
+static struct handle ** cork_pending = NULL;
+static unsigned int cork_pending_n = 0;
+static unsigned int cork_pending_size = 0;
+static uv_prepare_t cork_prepare;
+static bool cork_prepare_init = false;
+static struct req * cork_failed = NULL; /* linked by c.p2 */
+
+static void
+cork_clean_cb(uv_req_t * req)
+{
+  struct req * wp = req->data;
+  struct cork_cbs * c = wp->c.p1;
+  if ( c ){
+    unsigned int i;
+    for ( i = 0; i < c->n; ++i ){
+      if ( c->cbs[i] != CB_INVALID ){
+        gr_root_unregister(&c->cbs[i]);
+      }
+    }
+    free(c);
+    wp->c.p1 = NULL;
+  }
+}
+
+static void
+cork_complete(struct req * wp, int status)
+{
+  struct cork_cbs * c = wp->c.p1;
+  unsigned int i;
+  GET_RUNTIME();
+  for ( i = 0; i < c->n; ++i ){
+    value exn = GET_CB_VAL(c->cbs[i]);
+    gr_root_unregister(&c->cbs[i]);
+    exn = caml_callback2_exn(*uwt_global_wakeup,exn,
+                             VAL_UWT_UNIT_RESULT(status));
+    if (unlikely( Is_exception_result(exn) )){
+      add_exception(wp->loop,exn);
+    }
+  }
+  req_free(wp);
+}
+
+static void
+cork_write_cb(uv_write_t* req, int status)
+{
+  struct handle * s;
+  if (unlikely( !req || !req->data || !req->handle ||
+                (s = req->handle->data) == NULL )){
+    DEBUG_PF("leaking data");
+  }
+  else {
+    ++s->in_callback_cnt;
+    --s->in_use_cnt;
+    cork_complete(req->data,status);
+    write_queue_update(s);
+    write_queue_wake(s);
+    --s->in_callback_cnt;
+    MAYBE_CLOSE_HANDLE(s);
+  }
+}
+
+static void cork_prepare_cb(uv_prepare_t * x);
+
+/* referenced while a batch is pending or failed, the loop must not stop
+   before it's written or its wakers are called */
+static void
+cork_prepare_update(bool was_active)
+{
+  const bool active = cork_pending_n != 0 || cork_failed != NULL;
+  if ( active == was_active ){
+    return;
+  }
+  if ( active ){
+    uv_ref((uv_handle_t*)&cork_prepare);
+    uv_prepare_start(&cork_prepare,cork_prepare_cb);
+  }
+  else {
+    uv_prepare_stop(&cork_prepare);
+    uv_unref((uv_handle_t*)&cork_prepare);
+  }
+}
+
+static void
+cork_pending_remove(struct handle * h)
+{
+  struct handle * last = cork_pending[--cork_pending_n];
+  cork_pending[h->cork_idx] = last;
+  last->cork_idx = h->cork_idx;
+  cork_prepare_update(true);
+}
+
+static void
+cork_flush(struct handle * h)
+{
+  struct req * wp = h->cork_req;
+  if ( wp != NULL ){
+    uv_buf_t buf = uv_buf_init(wp->buf.base,wp->offset);
+    int erg;
+    h->cork_req = NULL;
+    cork_pending_remove(h);
+    erg = uv_write((uv_write_t*)wp->req,(uv_stream_t*)h->handle,
+                   &buf,1,cork_write_cb);
+    if ( erg < 0 ){
+      const bool was_active = cork_pending_n != 0 || cork_failed != NULL;
+      --h->in_use_cnt;
+      wp->c_param = erg;
+      wp->c.p2 = cork_failed;
+      cork_failed = wp;
+      cork_prepare_update(was_active);
+    }
+    write_queue_update(h);
+  }
+}
+
+static void
+cork_prepare_cb(uv_prepare_t * x)
+{
+  (void) x;
+  while ( cork_pending_n != 0 ){
+    struct handle * h = cork_pending[cork_pending_n - 1];
+    cork_flush(h);
+    MAYBE_CLOSE_HANDLE(h);
+  }
+  while ( cork_failed != NULL ){
+    struct req * wp = cork_failed;
+    cork_failed = wp->c.p2;
+    wp->c.p2 = NULL;
+    if ( cork_failed == NULL ){
+      cork_prepare_update(true);
+    }
+    cork_complete(wp,wp->c_param);
+  }
+}
+
+/* Appends buf to the batch. Returns false, if buf must be written
+   directly (the current batch has already been flushed in this case) */
+static bool
+cork_append(struct handle * h, const char * buf, unsigned int len,
+            value o_cb)
+{
+  struct req * wp = h->cork_req;
+  struct cork_cbs * c;
+  if ( wp != NULL && wp->offset + len > wp->buf.len ){
+    cork_flush(h);
+    wp = NULL;
+  }
+  if ( len > h->cork_limit ){
+    return false;
+  }
+  if ( wp == NULL ){
+    if (unlikely( cork_pending_n == cork_pending_size )){
+      const unsigned int nsize =
+        cork_pending_size == 0 ? STACK_START_SIZE : cork_pending_size * 2;
+      struct handle ** n = realloc(cork_pending,nsize * sizeof *n);
+      if ( n == NULL ){
+        return false;
+      }
+      cork_pending = n;
+      cork_pending_size = nsize;
+    }
+    c = malloc(sizeof *c + 8 * sizeof(cb_t));
+    if ( c == NULL ){
+      return false;
+    }
+    c->n = 0;
+    c->size = 8;
+    wp = req_create(UV_WRITE,h->loop);
+    malloc_uv_buf_t(&wp->buf,h->cork_limit,wp->cb_type);
+    if ( wp->buf.base == NULL ){
+      free(c);
+      free_mem_uv_req_t(wp);
+      free_struct_req(wp);
+      return false;
+    }
+    wp->c.p1 = c;
+    wp->clean_cb = cork_clean_cb;
+    wp->in_use = 1;
+    wp->finalize_called = 1;
+    wp->offset = 0;
+    h->cork_req = wp;
+    h->cork_idx = cork_pending_n;
+    cork_pending[cork_pending_n] = h;
+    ++cork_pending_n;
+    cork_prepare_update(cork_pending_n > 1 || cork_failed != NULL);
+    ++h->in_use_cnt;
+  }
+  c = wp->c.p1;
+  if (unlikely( c->n == c->size )){
+    const unsigned int nsize = c->size * 2;
+    struct cork_cbs * n = realloc(c,sizeof *c + nsize * sizeof(cb_t));
+    if ( n == NULL ){
+      cork_flush(h);
+      return false;
+    }
+    n->size = nsize;
+    c = n;
+    wp->c.p1 = n;
+  }
+  memcpy(wp->buf.base + wp->offset,buf,len);
+  wp->offset += len;
+  /* GR_ROOT_ENLARGE was called by the caller */
+  gr_root_register__(&c->cbs[c->n],o_cb);
+  ++c->n;
+  if ( wp->offset == wp->buf.len ){
+    cork_flush(h);
+  }
+  else {
+    write_queue_update(h);
+  }
+  return true;
+}
+
+/* Returns 0, if len bytes can be queued. Otherwise UV_EAGAIN (the
+   caller should wait until the queue is drained) or UV_ENOBUFS.
+   Writes are always accepted below the low watermark (at least one
+   request can be queued), if the global limit allows it.
+   Admission is FIFO: as long as writers are parked in qsu_block, only
+   the first of them (wq_bypass) is admitted, other writes would overtake
+   them. */
+static int
+write_queue_admit(struct handle * h, size_t len)
+{
+  if ( h->sf_job != NULL || h->fw_splice == 1 ){
+    return UV_EBUSY;
+  }
+  if ( h->wq_blocked != 0 && h->wq_bypass == 0 ){
+    return UV_EAGAIN;
+  }
+  if ( write_bytes_max != 0 && write_bytes_total + len > write_bytes_max ){
+    return UV_ENOBUFS;
+  }
+  if ( h->wq_high == 0 || h->wq_acc <= h->wq_low ||
+       h->wq_acc + len <= h->wq_high ){
+    return 0;
+  }
+  if ( h->wq_policy == WQ_BLOCK ){
+    return UV_EAGAIN;
+  }
+  return UV_ENOBUFS;
+}
+
+/* Udp: like write_queue_admit, but for libuv's send queue. Returns 1,
+   if the datagram must be discarded silently (WQ_DROP). A datagram is
+   always accepted, if the queue is empty. */
+static int
+udp_queue_admit(struct handle * h, size_t len)
+{
+  const uv_udp_t * u = (uv_udp_t*)h->handle;
+  if ( u->send_queue_count == 0 ||
+       ((h->wq_high == 0 || u->send_queue_size + len <= h->wq_high) &&
+        (h->eq_count_max == 0 || u->send_queue_count < h->eq_count_max)) ){
+    return 0;
+  }
+  switch ( h->wq_policy ){
+  case WQ_BLOCK: return UV_EAGAIN;
+  case WQ_DROP:
+    ++h->eq_dropped;
+    h->eq_dropped_bytes += len;
+    return 1;
+  default: return UV_ENOBUFS;
+  }
+}
+
+CAMLprim value
+uwt_udp_send_queue_limit_na(value o_udp, value o_bytes, value o_count,
+                            value o_policy)
+{
+  HANDLE_NINIT_NA(s,o_udp);
+  const intnat bytes = Long_val(o_bytes);
+  const intnat count = Long_val(o_count);
+  if ( bytes < 0 || count < 0 || (uintnat)bytes > UINT_MAX ||
+       (uintnat)count > UINT_MAX ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  s->wq_high = bytes;
+  s->wq_low = bytes / 2;
+  s->eq_count_max = count;
+  s->eq_count_low = count / 2;
+  s->wq_policy = Long_val(o_policy);
+  return Val_long(0);
+}
+
+CAMLprim value
+uwt_udp_send_queue_dropped_na(value o_udp, value o_bytes)
+{
+  struct handle * s = Handle_val(o_udp);
+  if ( s == NULL ){
+    return Val_long(0);
+  }
+  if ( Long_val(o_bytes) ){
+    return Val_long((intnat)s->eq_dropped_bytes);
+  }
+  return Val_long((intnat)s->eq_dropped);
+}
+
+CAMLprim value
+uwt_write_watermarks_na(value o_stream, value o_low, value o_high,
+                        value o_policy)
+{
+  HANDLE_NINIT_NA(s,o_stream);
+  const intnat low = Long_val(o_low);
+  const intnat high = Long_val(o_high);
+  if ( low < 0 || high < 0 || (high != 0 && low > high) ||
+       (uintnat)high > UINT_MAX ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  if ( Long_val(o_policy) == WQ_DROP ){
+    /* discarding queued data would corrupt the byte stream */
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  s->wq_low = low;
+  s->wq_high = high;
+  s->wq_policy = Long_val(o_policy);
+  return Val_long(0);
+}
+
+/* qsu_block: [turn] is resolved, after the writer was admitted. The
+   previous tail is returned, the caller must wait for it. */
+CAMLprim value
+uwt_write_block_enter(value o_stream, value o_turn)
+{
+  struct handle * s = Handle_val(o_stream);
+  value ret = Val_long(0);
+  if ( HANDLE_IS_INVALID_UNINIT(s) ){
+    return ret;
+  }
+  CAMLparam1(o_turn);
+  CAMLlocal1(prev);
+  GR_ROOT_ENLARGE();
+  ++s->wq_blocked;
+  if ( s->wq_tail != CB_INVALID ){
+    prev = GET_CB_VAL(s->wq_tail);
+    gr_root_unregister(&s->wq_tail);
+    ret = caml_alloc_small(1,0);
+    Field(ret,0) = prev;
+  }
+  gr_root_register(&s->wq_tail,o_turn);
+  CAMLreturn(ret);
+}
+
+CAMLprim value
+uwt_write_block_leave_na(value o_stream, value o_turn)
+{
+  struct handle * s = Handle_val(o_stream);
+  if ( HANDLE_IS_INVALID_UNINIT(s) ){
+    /* wq_tail is released by handle_free_common */
+    return Val_unit;
+  }
+  if ( s->wq_blocked ){
+    --s->wq_blocked;
+  }
+  if ( s->wq_tail != CB_INVALID && GET_CB_VAL(s->wq_tail) == o_turn ){
+    gr_root_unregister(&s->wq_tail);
+  }
+  return Val_unit;
+}
+
+CAMLprim value
+uwt_write_bypass_na(value o_stream, value o_bypass)
+{
+  struct handle * s = Handle_val(o_stream);
+  if ( s != NULL ){
+    s->wq_bypass = Long_val(o_bypass) != 0;
+  }
+  return Val_unit;
+}
+
+CAMLprim value
+uwt_write_drain_wait(value o_stream, value o_pair)
+{
+  struct handle * s = Handle_val(o_stream);
+  value ret;
+  if ( HANDLE_IS_INVALID_UNINIT(s) || write_queue_drained(s) ){
+    return Val_long(0);
+  }
+  CAMLparam1(o_pair);
+  GR_ROOT_ENLARGE();
+  if ( s->cb_drain == CB_INVALID ){
+    gr_root_register(&s->cb_drain,o_pair);
+  }
+  else {
+    o_pair = GET_CB_VAL(s->cb_drain);
+  }
+  ret = caml_alloc_small(1,0);
+  Field(ret,0) = o_pair;
+  CAMLreturn(ret);
+}
+
+CAMLprim value
+uwt_write_limit_na(value o_max)
+{
+  const intnat max = Long_val(o_max);
+  if ( max >= 0 ){
+    write_bytes_max = max;
+  }
+  return (Val_long(write_bytes_total));
+}
+
+CAMLprim value
+uwt_cork(value o_stream, value o_enable, value o_limit)
+{
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
+  HANDLE_NINIT_NA(s,o_stream);
+  const intnat limit = Long_val(o_limit);
+  if ( limit < 0 || limit > (1 << MAX_BUCKET_SIZE_LOG2) ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  if ( cork_prepare_init == false ){
+    if ( uv_prepare_init(&s->loop->loop,&cork_prepare) != 0 ){
+      return VAL_UWT_INT_RESULT_UWT_EFATAL;
+    }
+    uv_unref((uv_handle_t*)&cork_prepare);
+    cork_prepare_init = true;
+  }
+  cork_flush(s);
+  s->corked = Long_val(o_enable) != 0;
+  s->cork_limit = limit == 0 ? CORK_DEF_LIMIT : (unsigned int)limit;
+  return Val_long(0);
+}
+
+CAMLprim value
+uwt_udp_send_native(value o_stream,value o_buf,value o_pos,value o_len,
+                    value o_sock,value o_cb)
+{
+  if ( o_sock == Val_unit ){
+    HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
+  }
+  HANDLE_NINIT(s,o_stream,o_buf,o_sock,o_cb);
+  const intnat len = Long_val(o_len);
+  const int ba = len > 0 && Tag_val(o_buf) != String_tag;
+  struct req * wp;
+  value ret = Val_unit;
+  assert( len >= 0 );
+  if ( o_sock == Val_unit ){
+    const int e = write_queue_admit(s,len);
+    if ( e < 0 ){
+      CAMLreturn(Val_uwt_int_result(e));
+    }
+  }
+  else {
+    const int e = udp_queue_admit(s,len);
+    if ( e < 0 ){
+      CAMLreturn(Val_uwt_int_result(e));
+    }
+    if ( e > 0 ){
+      /* dropped, uwt.ml doesn't wait for o_cb */
+      CAMLreturn(Val_long(1));
+    }
+  }
+  if ( s->corked == 1 && o_sock == Val_unit ){
+    const char * p = (ba ? Ba_buf_val(o_buf) : String_val(o_buf)) +
+      Long_val(o_pos);
+    if ( cork_append(s,p,len,o_cb) ){
+      CAMLreturn(Val_long(0));
+    }
+  }
+  wp = req_create( o_sock == Val_unit ? UV_WRITE : UV_UDP_SEND,
+                   s->loop );
+  if ( ba ){
+    wp->buf.base = Ba_buf_val(o_buf) + Long_val(o_pos);
+    wp->buf.len = len;
+  }
+  else if ( len == 0 ){
+    wp->buf.base = NULL;
+    wp->buf.len = 0;
+  }
+  else {
+    malloc_uv_buf_t(&wp->buf,len,wp->cb_type);
+    if ( wp->buf.base != NULL  ){
+      memcpy(wp->buf.base,
+             String_val(o_buf) + Long_val(o_pos),
+             len);
+    }
+    else {
+      ret = VAL_UWT_INT_RESULT_ENOMEM;
+      free_mem_uv_req_t(wp);
+      free_struct_req(wp);
+    }
+  }
+  if ( ret == Val_unit ){
+    int erg;
+    void * req = wp->req;
+    void * handle = s->handle;
+    if ( o_sock == Val_unit ){
+      erg = uv_write(req,handle,&wp->buf,1,write_send_cb);
+    }
+    else {
+      erg = uv_udp_send(req,handle,&wp->buf,1,SOCKADDR_VAL(o_sock),udp_send_cb);
+    }
+    if ( erg < 0 ){
+      if ( ba == 0 ){
+        free_uv_buf_t(&wp->buf,wp->cb_type);
+      }
+      free_mem_uv_req_t(wp);
+      free_struct_req(wp);
+    }
+    else {
+      wp->c_cb = ret_unit_cparam;
+      wp->cb_type = s->cb_type;
+      wp->in_use = 1;
+      s->initialized = 1;
+      gr_root_register(&wp->cb,o_cb);
+      wp->finalize_called = 1;
+      ++s->in_use_cnt;
+      wp->buf_contains_ba = ba;
+      if ( ba ){
+        gr_root_register(&wp->sbuf,o_buf);
+      }
+      if ( o_sock == Val_unit ){
+        write_queue_update(s);
+      }
+    }
+    ret = VAL_UWT_UNIT_RESULT(erg);
+  }
+  CAMLreturn(ret);
+}
+BYTE_WRAP6(uwt_udp_send)
+
+CAMLprim value
+uwt_write(value a,value b,value c,value d,value e){
+  return (uwt_udp_send_native(a,b,c,d,Val_unit,e));
+}
+
+/*
+  Vectored writes. Only strings are copied, bigarray segments are
+  written directly. The uv_buf_t array and the copies share one pooled
+  buffer (wp->buf).
+*/
+CAMLprim value
+uwt_writev(value o_stream, value o_iov, value o_cb)
+{
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
+  HANDLE_NINIT(s,o_stream,o_iov,o_cb);
+  const size_t n = Wosize_val(o_iov);
+  size_t i;
+  size_t copy_len = 0;
+  size_t ba_len = 0;
+  bool ba = false;
+  struct req * wp;
+  uv_buf_t * bufs;
+  value ret;
+  int erg;
+  if ( n == 0 || n > UINT_MAX / sizeof(uv_buf_t) ){
+    CAMLreturn(VAL_UWT_INT_RESULT_UWT_EINVAL);
+  }
+  for ( i = 0; i < n; ++i ){
+    value v = Field(o_iov,i);
+    if ( IOVEC_IS_BA(v) ){
+      ba = true;
+      ba_len += Iovec_len(v);
+    }
+    else {
+      copy_len += Iovec_len(v);
+    }
+  }
+  if ( copy_len > UINT_MAX - n * sizeof(uv_buf_t) ){
+    CAMLreturn(VAL_UWT_INT_RESULT_UWT_EINVAL);
+  }
+  erg = write_queue_admit(s,copy_len + ba_len);
+  if ( erg < 0 ){
+    CAMLreturn(Val_uwt_int_result(erg));
+  }
+  cork_flush(s);
+  wp = req_create(UV_WRITE,s->loop);
+  malloc_uv_buf_t(&wp->buf,n * sizeof(uv_buf_t) + copy_len,wp->cb_type);
+  if ( wp->buf.base == NULL ){
+    free_mem_uv_req_t(wp);
+    free_struct_req(wp);
+    CAMLreturn(VAL_UWT_INT_RESULT_ENOMEM);
+  }
+  bufs = (uv_buf_t *)wp->buf.base;
+  iovec_fill(o_iov,bufs,wp->buf.base + n * sizeof(uv_buf_t));
+  erg = uv_write((uv_write_t*)wp->req,(uv_stream_t*)s->handle,
+                 bufs,n,write_send_cb);
+  if ( erg < 0 ){
+    free_uv_buf_t(&wp->buf,wp->cb_type);
+    free_mem_uv_req_t(wp);
+    free_struct_req(wp);
+  }
+  else {
+    wp->c_cb = ret_unit_cparam;
+    wp->cb_type = s->cb_type;
+    wp->in_use = 1;
+    gr_root_register(&wp->cb,o_cb);
+    wp->finalize_called = 1;
+    ++s->in_use_cnt;
+    wp->buf_contains_ba = 0;
+    if ( ba ){
+      /* the array keeps the bigarrays alive */
+      gr_root_register(&wp->sbuf,o_iov);
+    }
+    write_queue_update(s);
+  }
+  ret = VAL_UWT_UNIT_RESULT(erg);
+  CAMLreturn(ret);
+}
+
+#define IOVEC_STACK_SIZE 64
+CAMLprim value
+uwt_try_writev_na(value o_stream, value o_iov)
+{
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
+  HANDLE_NINIT_NA(s,o_stream);
+  uv_buf_t bufs_stack[IOVEC_STACK_SIZE];
+  uv_buf_t * bufs;
+  const size_t n = Wosize_val(o_iov);
+  int ret;
+  if ( n == 0 ){
+    return Val_long(0);
+  }
+  if ( s->corked == 1 || s->sf_job != NULL || s->fw_splice == 1 ||
+       s->wq_blocked != 0 ){
+    return VAL_UWT_INT_RESULT_EAGAIN;
+  }
+  if ( n > UINT_MAX / sizeof(uv_buf_t) ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  if ( n <= IOVEC_STACK_SIZE ){
+    bufs = bufs_stack;
+  }
+  else {
+    bufs = malloc(n * sizeof(uv_buf_t));
+    if ( bufs == NULL ){
+      return VAL_UWT_INT_RESULT_ENOMEM;
+    }
+  }
+  iovec_fill(o_iov,bufs,NULL);
+  ret = uv_try_write((uv_stream_t*)s->handle,bufs,n);
+  if ( bufs != bufs_stack ){
+    free(bufs);
+  }
+  return (VAL_UWT_INT_RESULT(ret));
+}
+
+static void
+cb_uwt_write2(uv_write_t* req, int status)
+{
+  struct handle * s1 = req->handle->data;
+  struct handle * s2 = req->send_handle->data;
+  struct req * r = req->data;
+  if ( !s1 || !s2 || !r ){
+    DEBUG_PF("leaking data");
+  }
+  else {
+    ++s1->in_callback_cnt;
+    ++s2->in_callback_cnt;
+    --s1->in_use_cnt;
+    --s2->in_use_cnt;
+
+    r->c_param = status;
+    universal_callback((void*)req);
+    write_queue_update(s1);
+    write_queue_wake(s1);
+
+    --s1->in_callback_cnt;
+    --s2->in_callback_cnt;
+    MAYBE_CLOSE_HANDLE(s1);
+    MAYBE_CLOSE_HANDLE(s2);
+  }
+}
+
+CAMLprim value
+uwt_write2_native(value o_stream,
+                  value o_stream_send,
+                  value o_buf,
+                  value o_pos,
+                  value o_len,
+                  value o_cb)
+{
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream_send);
+  HANDLE_NINIT2(s1,o_stream,s2,o_stream_send,o_cb,o_buf);
+  value ret = Val_unit;
+  const intnat len = Long_val(o_len);
+  const int e = write_queue_admit(s1,len);
+  if ( e < 0 ){
+    CAMLreturn(Val_uwt_int_result(e));
+  }
+  cork_flush(s1);
+  struct req * wp = req_create(UV_WRITE,s1->loop);
+  uv_write_t* req = (uv_write_t*)wp->req;
+  const int ba = len > 0 && Tag_val(o_buf) != String_tag;
+  if ( ba ){
+    wp->buf.base = Ba_buf_val(o_buf) + Long_val(o_pos);
+    wp->buf.len = len;
+  }
+  else if ( len == 0 ){
+    wp->buf.base = NULL;
+    wp->buf.len = 0;
+  }
+  else {
+    malloc_uv_buf_t(&wp->buf,len,wp->cb_type);
+    if ( wp->buf.base != NULL ){
+      memcpy(wp->buf.base,
+             String_val(o_buf) + Long_val(o_pos),
+             len);
+    }
+    else {
+      ret = VAL_UWT_INT_RESULT_ENOMEM;
+      free_mem_uv_req_t(wp);
+      free_struct_req(wp);
+    }
+  }
+  if ( ret == Val_unit ){
+    int erg = 0;
+    uv_stream_t* stream = (uv_stream_t*)s1->handle;
+    uv_stream_t* stream_send = (uv_stream_t*)s2->handle;
+    assert(s1->cb_type == s2->cb_type);
+    erg = uv_write2(req,stream,&wp->buf,1,stream_send,cb_uwt_write2);
+    if ( erg < 0 ){
+      if ( ba == 0 ){
+        free_uv_buf_t(&wp->buf,wp->cb_type);
+      }
+      free_mem_uv_req_t(wp);
+      free_struct_req(wp);
+    }
+    else {
+      wp->c_cb = ret_unit_cparam;
+      wp->in_use = 1;
+      gr_root_register(&wp->cb,o_cb);
+      wp->finalize_called = 1;
+      ++s1->in_use_cnt;
+      ++s2->in_use_cnt;
+      wp->buf_contains_ba = ba;
+      if ( ba ){
+        gr_root_register(&wp->sbuf,o_buf);
+      }
+      write_queue_update(s1);
+    }
+    ret = VAL_UWT_UNIT_RESULT(erg);
+  }
+  CAMLreturn(ret);
+}
+BYTE_WRAP6(uwt_write2)
+
+CAMLprim value
+uwt_udp_try_send_na(value o_stream,value o_buf,value o_pos,
+                    value o_len,value o_sock)
+{
+  if ( o_sock == Val_unit ){
+    HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
+  }
+  HANDLE_NINIT_NA(s,o_stream);
+  uv_buf_t buf;
+  int ret;
+  buf.len = Long_val(o_len);
+  if ( Tag_val(o_buf) != String_tag ){
+    buf.base = Ba_buf_val(o_buf);
+  }
+  else {
+    buf.base = String_val(o_buf);
+  }
+  buf.base+= Long_val(o_pos);
+  if ( o_sock == Val_unit ){
+    /* the data must be appended to the current batch, Stream.sendfile
+       or forward is writing or other writers are waiting for the queue
+       to drain */
+    if ( s->corked == 1 || s->sf_job != NULL || s->fw_splice == 1 ||
+         s->wq_blocked != 0 ){
+      return VAL_UWT_INT_RESULT_EAGAIN;
+    }
+    ret = uv_try_write((uv_stream_t*)s->handle,&buf,1);
+  }
+  else {
+    ret = uv_udp_try_send((uv_udp_t*)s->handle,&buf,1,SOCKADDR_VAL(o_sock));
+    if ( ret >= 0 ){
+      s->initialized = 1;
+    }
+  }
+  return (VAL_UWT_INT_RESULT(ret));
+}
+
+CAMLprim value
+uwt_try_write_na(value o_stream,value o_buf,value o_pos,value o_len)
+{
+  return (uwt_udp_try_send_na(o_stream,o_buf,o_pos,o_len,Val_unit));
+}
+
+/*
+  Stream.write: uv_try_write and uv_write with a single call. The OCaml
+  type is:
+  type write_eager =
+    | Eager_done
+    | Eager_pending of Int_result.unit Lwt.t
+    | Eager_error of Int_result.unit
+  A sleeping thread is only created, if the data can't be written
+  instantly. Larger buffers are queued without trying.
+*/
+#define WRITE_EAGER_TRY_MAX 131072
+#define Eager_pending_tag 0
+#define Eager_error_tag 1
+
+static value * uwt_wait_fun = NULL;
+
+static value
+write_eager_queue(value o_stream, value o_buf, intnat pos, intnat len)
+{
+  CAMLparam2(o_stream,o_buf);
+  CAMLlocal1(pair);
+  value ret;
+  pair = caml_callback(*uwt_wait_fun,Val_unit);
+  ret = uwt_write(o_stream,o_buf,Val_long(pos),Val_long(len),Field(pair,1));
+  if ( ret == Val_long(0) ){
+    ret = caml_alloc_small(1,Eager_pending_tag);
+    Field(ret,0) = Field(pair,0);
+  }
+  else {
+    value t = caml_alloc_small(1,Eager_error_tag);
+    Field(t,0) = ret;
+    ret = t;
+  }
+  CAMLreturn(ret);
+}
+
+CAMLprim value
+uwt_write_eager(value o_stream, value o_buf, value o_pos, value o_len)
+{
+  struct handle * s = Handle_val(o_stream);
+  intnat pos = Long_val(o_pos);
+  intnat len = Long_val(o_len);
+  value ret = Val_long(0);
+  if ( uwt_wait_fun == NULL ){
+    uwt_wait_fun = caml_named_value(UWT_WAIT_STRING);
+    if ( uwt_wait_fun == NULL ){
+      caml_failwith("uwt wait function not found");
+    }
+  }
+  if ( HANDLE_IS_INVALID_UNINIT(s) ){
+    ret = VAL_UWT_INT_RESULT_UWT_EBADF;
+  }
+  else if ( len == 0 ){
+    return Val_long(0); /* Eager_done */
+  }
+  else {
+    /* checked before uv_try_write, the rest must not be rejected
+       after a partial write */
+    const int erg = write_queue_admit(s,len);
+    if ( erg < 0 ){
+      ret = Val_uwt_int_result(erg);
+    }
+    else if ( s->corked == 0 && len <= WRITE_EAGER_TRY_MAX ){
+      uv_buf_t buf;
+      int n;
+      buf.base = Tag_val(o_buf) != String_tag ? Ba_buf_val(o_buf) :
+        String_val(o_buf);
+      buf.base += pos;
+      buf.len = len;
+      n = uv_try_write((uv_stream_t*)s->handle,&buf,1);
+      if ( n == len ){
+        return Val_long(0); /* Eager_done */
+      }
+      if ( n >= 0 && n < len ){
+        pos += n;
+        len -= n;
+      }
+      else if ( n != UV_EAGAIN ){
+        ret = n < 0 ? Val_uwt_int_result(n) : VAL_UWT_INT_RESULT_UWT_EFATAL;
+      }
+    }
+  }
+  if ( ret != Val_long(0) ){
+    value t = caml_alloc_small(1,Eager_error_tag);
+    Field(t,0) = ret;
+    return t;
+  }
+  return (write_eager_queue(o_stream,o_buf,pos,len));
+}
+
+/*
+  Stream.sendfile: sendfile(2) (or pread and write, if it's not
+  available) is called inside a worker thread, the file can be slow.
+  The socket is non-blocking. If it's full, the worker returns and
+  the job waits with an uv_poll_t handle for writability inside the
+  loop thread. A pool thread is therefore only occupied while data is
+  actually transferred, at most SENDFILE_ROUND bytes per work request.
+  The job uses duplicates of both file descriptors, they must not be
+  closed behind its back. Stream.close sets 'stop'.
+*/
+#define SENDFILE_ROUND (16 * 1024 * 1024)
+#define SENDFILE_BUF 65536
+
+struct sendfile_job {
+  uv_work_t work;
+  uv_poll_t poll;
+  struct handle * h;
+  int64_t offset;
+  int64_t len;
+  int64_t sent;
+  int err;
+  int in_fd;
+  int out_fd;
+  cb_t cb; /* int64 result Lwt.u */
+  volatile int stop; /* read by the worker */
+  unsigned int in_work: 1; /* work request pending */
+  unsigned int eagain: 1; /* out_fd is full */
+};
+
+#ifndef _WIN32
+static void sendfile_finish(struct sendfile_job * j);
+static void sendfile_poll_cb(uv_poll_t * handle, int status, int events);
+
+static void
+sendfile_stop(struct handle * h)
+{
+  struct sendfile_job * j = h->sf_job;
+  if ( j != NULL ){
+    j->stop = 1;
+    if ( j->in_work == 0 ){
+      /* waiting for writability */
+      uv_poll_stop(&j->poll);
+      sendfile_finish(j);
+    }
+  }
+}
+
+/* returns the number of bytes written, or a negative error code */
+static int64_t
+sendfile_chunk(struct sendfile_job * j, size_t n)
+{
+  ssize_t r;
+#if defined(__linux__) && defined(HAVE_SYS_SENDFILE_H)
+  off_t off = j->offset;
+  do {
+    r = sendfile(j->out_fd,j->in_fd,&off,n);
+  } while ( r < 0 && errno == EINTR );
+  if ( r >= 0 ){
+    return r;
+  }
+  if ( errno != EINVAL && errno != ENOSYS ){
+    return -errno;
+  }
+  /* e.g. the file system doesn't support it */
+#endif
+  {
+    char buf[SENDFILE_BUF];
+    if ( n > sizeof buf ){
+      n = sizeof buf;
+    }
+    do {
+      r = pread(j->in_fd,buf,n,j->offset);
+    } while ( r < 0 && errno == EINTR );
+    if ( r <= 0 ){
+      return r < 0 ? -errno : 0;
+    }
+    n = r;
+    do {
+      r = write(j->out_fd,buf,n);
+    } while ( r < 0 && errno == EINTR );
+    return r < 0 ? -errno : r;
+  }
+}
+
+static void
+stream_sendfile_worker(uv_work_t * req)
+{
+  struct sendfile_job * j = req->data;
+  int64_t round = 0;
+  while ( j->len > 0 && j->stop == 0 && round < SENDFILE_ROUND ){
+    const size_t n = j->len > SENDFILE_ROUND ? SENDFILE_ROUND : j->len;
+    const int64_t r = sendfile_chunk(j,n);
+    if ( r > 0 ){
+      j->offset += r;
+      j->len -= r;
+      j->sent += r;
+      round += r;
+    }
+    else if ( r == 0 ){ /* end of file */
+      j->len = 0;
+    }
+    else if ( r == UV_EAGAIN ){
+      j->eagain = 1;
+      break;
+    }
+    else {
+      j->err = r;
+      break;
+    }
+  }
+}
+
+static void
+sendfile_poll_close_cb(uv_handle_t * handle)
+{
+  struct sendfile_job * j = handle->data;
+  close(j->out_fd);
+  free(j);
+}
+
+static void
+sendfile_finish(struct sendfile_job * j)
+{
+  struct handle * h = j->h;
+  value param;
+  value exn;
+  GET_RUNTIME();
+  h->sf_job = NULL;
+  ++h->in_callback_cnt;
+  if ( j->stop == 1 && j->len > 0 && j->err == 0 ){
+    j->err = UV_ECANCELED;
+  }
+  /* partial success is reported as success */
+  if ( j->err < 0 && j->sent == 0 ){
+    param = caml_alloc_small(1,Error_tag);
+    Field(param,0) = Val_uwt_error(j->err);
+  }
+  else {
+    value i = caml_copy_int64(j->sent);
+    Begin_roots1(i);
+    param = caml_alloc_small(1,Ok_tag);
+    Field(param,0) = i;
+    End_roots();
+  }
+  exn = GET_CB_VAL(j->cb);
+  gr_root_unregister(&j->cb);
+  close(j->in_fd);
+  uv_close((uv_handle_t*)&j->poll,sendfile_poll_close_cb);
+  exn = caml_callback2_exn(*uwt_global_wakeup,exn,param);
+  if (unlikely( Is_exception_result(exn) )){
+    add_exception(h->loop,exn);
+  }
+  write_queue_wake(h);
+  --h->in_use_cnt;
+  --h->in_callback_cnt;
+  MAYBE_CLOSE_HANDLE(h);
+}
+
+static void
+stream_sendfile_after_work(uv_work_t * req, int status)
+{
+  struct sendfile_job * j = req->data;
+  int erg;
+  j->in_work = 0;
+  if ( status < 0 && j->err == 0 ){
+    j->err = status;
+  }
+  if ( j->stop == 1 || j->len == 0 || j->err < 0 ){
+    sendfile_finish(j);
+    return;
+  }
+  if ( j->eagain == 1 ){
+    j->eagain = 0;
+    erg = uv_poll_start(&j->poll,UV_WRITABLE,sendfile_poll_cb);
+  }
+  else {
+    /* SENDFILE_ROUND reached, give other jobs a chance */
+    erg = uv_queue_work(j->poll.loop,&j->work,stream_sendfile_worker,
+                        stream_sendfile_after_work);
+    if ( erg == 0 ){
+      j->in_work = 1;
+    }
+  }
+  if ( erg < 0 ){
+    j->err = erg;
+    sendfile_finish(j);
+  }
+}
+
+static void
+sendfile_poll_cb(uv_poll_t * handle, int status, int events)
+{
+  struct sendfile_job * j = handle->data;
+  int erg;
+  (void) events;
+  uv_poll_stop(handle);
+  if ( status < 0 ){
+    j->err = status;
+    sendfile_finish(j);
+    return;
+  }
+  erg = uv_queue_work(handle->loop,&j->work,stream_sendfile_worker,
+                      stream_sendfile_after_work);
+  if ( erg < 0 ){
+    j->err = erg;
+    sendfile_finish(j);
+  }
+  else {
+    j->in_work = 1;
+  }
+}
+
+CAMLprim value
+uwt_stream_sendfile(value o_stream, value o_file, value o_offset,
+                    value o_len, value o_cb)
+{
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
+  struct handle * h = Handle_val(o_stream);
+  struct sendfile_job * j;
+  uv_os_fd_t fd;
+  intnat erg;
+  const int64_t offset = Int64_val(o_offset);
+  const int64_t len = Int64_val(o_len);
+  if ( offset < 0 || len < 0 ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  if ( h->sf_job != NULL || h->fw_job != NULL ){
+    return VAL_UWT_INT_RESULT_UWT_EBUSY;
+  }
+  cork_flush(h);
+  if ( ((uv_stream_t*)h->handle)->write_queue_size != 0 ){
+    /* uwt.ml waits until the previous write requests are finished */
+    return VAL_UWT_INT_RESULT_EAGAIN;
+  }
+  erg = uv_fileno(h->handle,&fd);
+  if ( erg < 0 ){
+    return (Val_uwt_int_result(erg));
+  }
+  j = malloc(sizeof *j);
+  if ( j == NULL ){
+    return VAL_UWT_INT_RESULT_ENOMEM;
+  }
+  j->out_fd = dup(fd);
+  if ( j->out_fd < 0 ){
+    erg = -errno;
+    free(j);
+    return (Val_uwt_int_result(erg));
+  }
+  j->in_fd = dup(FD_VAL(o_file));
+  if ( j->in_fd < 0 ){
+    erg = -errno;
+    close(j->out_fd);
+    free(j);
+    return (Val_uwt_int_result(erg));
+  }
+  erg = uv_poll_init(&h->loop->loop,&j->poll,j->out_fd);
+  if ( erg < 0 ){
+    close(j->in_fd);
+    close(j->out_fd);
+    free(j);
+    return (Val_uwt_int_result(erg));
+  }
+  j->poll.data = j;
+  j->work.data = j;
+  j->h = h;
+  j->offset = offset;
+  j->len = len;
+  j->sent = 0;
+  j->err = 0;
+  j->cb = CB_INVALID;
+  j->stop = 0;
+  j->in_work = 1;
+  j->eagain = 0;
+  erg = uv_queue_work(&h->loop->loop,&j->work,stream_sendfile_worker,
+                      stream_sendfile_after_work);
+  if ( erg < 0 ){
+    close(j->in_fd);
+    uv_close((uv_handle_t*)&j->poll,sendfile_poll_close_cb);
+    return (Val_uwt_int_result(erg));
+  }
+  CAMLparam1(o_cb);
+  GR_ROOT_ENLARGE();
+  gr_root_register(&j->cb,o_cb);
+  h->sf_job = j;
+  ++h->in_use_cnt;
+  CAMLreturn(Val_long(0));
+}
+#else
+static void
+sendfile_stop(struct handle * h)
+{
+  (void) h;
+}
+
+CAMLprim value
+uwt_stream_sendfile(value o_stream, value o_file, value o_offset,
+                    value o_len, value o_cb)
+{
+  (void) o_stream;
+  (void) o_file;
+  (void) o_offset;
+  (void) o_len;
+  (void) o_cb;
+  return VAL_UWT_INT_RESULT_ENOSYS;
+}
+#endif
+
+/*
+  Stream.forward: everything read from src is written to dst, without
+  passing the data to OCaml. The read buffers are taken from the pool
+  and passed directly to uv_write. Reading is paused, if the buffers
+  held by pending write requests exceed max_buffered, and resumed at
+  max_buffered / 2. The full buffer length is counted, not only the
+  bytes read into it: small reads would otherwise pin a lot of memory.
+  The job is finished, when src is at EOF (or an error occurred) and
+  all write requests have returned.
+
+  On Linux, splice(2) moves the data through a pipe from src to dst
+  without copying it to user space. Duplicates of both descriptors are
+  watched with uv_poll_t handles (like in Stream.sendfile); the stream
+  handles are idle meanwhile: src can't be read by others and writes
+  to dst are refused (fw_splice). The pipe limits the buffered data,
+  max_buffered is not used. If the descriptors don't support splice
+  (EINVAL before anything was transferred), the job falls back to
+  uv_read/uv_write.
+*/
+#define FORWARD_BUF_SIZE 65536
+
+#if defined(__linux__) && defined(HAVE_SPLICE) && defined(HAVE_PIPE2)
+#define HAVE_FORWARD_SPLICE 1
+#define FORWARD_SPLICE_ROUND (1024 * 1024)
+
+struct forward_splice {
+  uv_poll_t poll_in; /* in_fd readable */
+  uv_poll_t poll_out; /* out_fd writable */
+  struct forward_job * j;
+  int in_fd;
+  int out_fd;
+  int pipe_fd[2];
+  size_t in_pipe; /* bytes in the pipe, not yet written to dst */
+  unsigned int closing; /* poll handles, that are not yet closed */
+  unsigned int eof: 1;
+};
+#endif
+
+struct forward_job {
+  struct handle * src;
+  struct handle * dst;
+  uint64_t total; /* bytes written to dst */
+  size_t held; /* buffer memory of the pending write requests */
+  unsigned int max_buffered;
+  unsigned int writes; /* pending write requests */
+  int err;
+  unsigned int paused: 1; /* reading stopped because of dst */
+  unsigned int done: 1; /* reading stopped, no new write requests */
+  cb_t cb; /* int64 result Lwt.u */
+  struct forward_splice * sp; /* NULL: uv_read and uv_write are used */
+};
+
+static void
+forward_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
+{
+  struct handle * h;
+  (void) suggested_size;
+  if (unlikely( !handle || (h = handle->data) == NULL )){
+    DEBUG_PF("no data");
+    buf->len = 0;
+    buf->base = NULL;
+  }
+  else {
+    malloc_uv_buf_t(buf,FORWARD_BUF_SIZE,h->cb_type);
+  }
+}
+
+static void forward_read_cb(uv_stream_t*,ssize_t,const uv_buf_t *);
+
+#ifdef HAVE_FORWARD_SPLICE
+static void
+forward_splice_close_cb(uv_handle_t * handle)
+{
+  struct forward_splice * sp = handle->data;
+  if ( handle == (uv_handle_t*)&sp->poll_in ){
+    close(sp->in_fd);
+  }
+  else {
+    close(sp->out_fd);
+  }
+  if ( --sp->closing == 0 ){
+    free(sp);
+  }
+}
+
+/* Data inside the pipe is lost. uv_close stops the poll handles, their
+   callbacks won't access j anymore. */
+static void
+forward_splice_release(struct forward_job * j)
+{
+  struct forward_splice * sp = j->sp;
+  j->sp = NULL;
+  j->dst->fw_splice = 0;
+  close(sp->pipe_fd[0]);
+  close(sp->pipe_fd[1]);
+  sp->closing = 2;
+  uv_close((uv_handle_t*)&sp->poll_in,forward_splice_close_cb);
+  uv_close((uv_handle_t*)&sp->poll_out,forward_splice_close_cb);
+}
+#else
+static void
+forward_splice_release(struct forward_job * j)
+{
+  (void) j;
+}
+#endif
+
+static void
+forward_stop_reading(struct forward_job * j, int err)
+{
+  if ( j->done == 0 ){
+    j->done = 1;
+    if ( j->sp != NULL ){
+      forward_splice_release(j);
+    }
+    else if ( j->paused == 0 && j->src->close_called == 0 ){
+      uv_read_stop((uv_stream_t*)j->src->handle);
+    }
+  }
+  if ( j->err == 0 ){
+    j->err = err;
+  }
+}
+
+static void
+forward_maybe_finish(struct forward_job * j)
+{
+  struct handle * src = j->src;
+  struct handle * dst = j->dst;
+  value param;
+  value exn;
+  if ( j->done == 0 || j->writes != 0 ){
+    return;
+  }
+  GET_RUNTIME();
+  src->fw_job = NULL;
+  dst->fw_job = NULL;
+  ++src->in_callback_cnt;
+  ++dst->in_callback_cnt;
+  if ( j->err < 0 && j->err != UV_EOF ){
+    param = caml_alloc_small(1,Error_tag);
+    Field(param,0) = Val_uwt_error(j->err);
+  }
+  else {
+    value i = caml_copy_int64(j->total);
+    Begin_roots1(i);
+    param = caml_alloc_small(1,Ok_tag);
+    Field(param,0) = i;
+    End_roots();
+  }
+  exn = GET_CB_VAL(j->cb);
+  gr_root_unregister(&j->cb);
+  free(j);
+  exn = caml_callback2_exn(*uwt_global_wakeup,exn,param);
+  if (unlikely( Is_exception_result(exn) )){
+    add_exception(src->loop,exn);
+  }
+  /* shutdown waits, while the job splices into dst */
+  write_queue_wake(dst);
+  --src->in_use_cnt;
+  --src->in_callback_cnt;
+  if ( dst != src ){
+    --dst->in_use_cnt;
+  }
+  --dst->in_callback_cnt;
+  MAYBE_CLOSE_HANDLE(src);
+  if ( dst != src ){
+    MAYBE_CLOSE_HANDLE(dst);
+  }
+}
+
+static void
+forward_write_cb(uv_write_t * req, int status)
+{
+  struct req * wp = req->data;
+  struct forward_job * j = wp->c.p1;
+  struct handle * dst = j->dst;
+  if ( status < 0 ){
+    forward_stop_reading(j,status);
+  }
+  else {
+    j->total += wp->offset;
+  }
+  j->held -= wp->buf.len;
+  req_free(wp);
+  write_queue_update(dst);
+  if ( j->paused == 1 && j->done == 0 && j->held <= j->max_buffered / 2 ){
+    const int erg = uv_read_start((uv_stream_t*)j->src->handle,
+                                  forward_alloc_cb,forward_read_cb);
+    if ( erg < 0 ){
+      j->paused = 0; /* not reading */
+      forward_stop_reading(j,erg);
+    }
+    else {
+      j->paused = 0;
+    }
+  }
+  if ( dst->cb_drain != CB_INVALID ){
+    /* The woken thread can close src or dst. This request is still
+       counted in j->writes, forward_abort won't release j. */
+    GET_RUNTIME();
+    write_queue_wake(dst);
+  }
+  --j->writes;
+  forward_maybe_finish(j);
+}
+
+static void
+forward_read_cb(uv_stream_t* stream, ssize_t nread, const uv_buf_t * buf)
+{
+  struct handle * h = stream->data;
+  struct forward_job * j;
+  if (unlikely( h == NULL || (j = h->fw_job) == NULL || j->done == 1 )){
+    free_uv_buf_t_const(buf,h ? h->cb_type : CB_LWT);
+    return;
+  }
+  if ( nread > 0 ){
+    struct handle * dst = j->dst;
+    struct req * wp = req_create_na(UV_WRITE,dst->loop);
+    int erg;
+    uv_buf_t w;
+    if ( wp == NULL ){
+      free_uv_buf_t_const(buf,h->cb_type);
+      forward_stop_reading(j,UV_ENOMEM);
+      forward_maybe_finish(j);
+      return;
+    }
+    /* the pool needs the original length */
+    wp->buf = *buf;
+    wp->offset = nread;
+    wp->c.p1 = j;
+    w = uv_buf_init(buf->base,nread);
+    /* a cork batch of dst must be written first. The guard keeps j
+       alive, in case a handle is closed in the meantime. */
+    ++j->writes;
+    cork_flush(dst);
+    --j->writes;
+    if (unlikely( j->done == 1 )){
+      req_free(wp);
+      forward_maybe_finish(j);
+      return;
+    }
+    erg = uv_write((uv_write_t*)wp->req,(uv_stream_t*)dst->handle,&w,1,
+                   forward_write_cb);
+    if ( erg < 0 ){
+      req_free(wp);
+      forward_stop_reading(j,erg);
+      forward_maybe_finish(j);
+      return;
+    }
+    wp->in_use = 1;
+    ++j->writes;
+    j->held += buf->len;
+    write_queue_update(dst);
+    if ( j->held > j->max_buffered ){
+      uv_read_stop(stream);
+      j->paused = 1;
+    }
+  }
+  else {
+    free_uv_buf_t_const(buf,h->cb_type);
+    if ( nread < 0 ){
+      forward_stop_reading(j,nread);
+      forward_maybe_finish(j);
+    }
+  }
+}
+
+#ifdef HAVE_FORWARD_SPLICE
+static void forward_splice_poll_cb(uv_poll_t * handle, int status, int events);
+
+/* in_pipe > 0: wait until dst is writable, otherwise until src is
+   readable */
+static int
+forward_splice_wait(struct forward_splice * sp)
+{
+  if ( sp->in_pipe > 0 ){
+    uv_poll_stop(&sp->poll_in);
+    return (uv_poll_start(&sp->poll_out,UV_WRITABLE,forward_splice_poll_cb));
+  }
+  uv_poll_stop(&sp->poll_out);
+  return (uv_poll_start(&sp->poll_in,UV_READABLE,forward_splice_poll_cb));
+}
+
+/* The pipe is emptied, before the next chunk is read from src. EAGAIN
+   of the first splice therefore always refers to src. */
+static void
+forward_splice_run(struct forward_job * j)
+{
+  struct forward_splice * sp = j->sp;
+  size_t round = 0;
+  ssize_t n;
+  int erg;
+  for (;;){
+    if ( round >= FORWARD_SPLICE_ROUND ){
+      /* give other handles a chance */
+      erg = forward_splice_wait(sp);
+      if ( erg < 0 ){
+        forward_stop_reading(j,erg);
+      }
+      break;
+    }
+    if ( sp->in_pipe > 0 ){
+      n = splice(sp->pipe_fd[0],NULL,sp->out_fd,NULL,sp->in_pipe,
+                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if ( n > 0 ){
+        sp->in_pipe -= n;
+        j->total += n;
+        round += n;
+        continue;
       }
-      buf_not_cleaned = false;
-      free_uv_buf_t_const(buf,h->cb_type);
-      Begin_roots1(ret);
-      o = caml_alloc_small(1,tag);
-      Field(o,0) = ret;
-      cb = GET_CB_VAL(h->cb_read);
-      if ( finished == 1 ){
-        h->cb_read_removed_by_cb = 1;
-        gr_root_unregister(&h->cb_read);
-        if ( h->in_use_cnt ){
-          h->in_use_cnt--;
+      if ( n < 0 && errno == EINTR ){
+        continue;
+      }
+      if ( n < 0 && errno == EAGAIN ){
+        erg = forward_splice_wait(sp);
+        if ( erg < 0 ){
+          forward_stop_reading(j,erg);
         }
+        break;
       }
-      End_roots();
-      ret = caml_callback_exn(cb,o);
+      forward_stop_reading(j,n < 0 ? -errno : UV_EPIPE);
+      break;
+    }
+    if ( sp->eof == 1 ){
+      forward_stop_reading(j,UV_EOF);
+      break;
+    }
+    n = splice(sp->in_fd,NULL,sp->pipe_fd[1],NULL,FORWARD_BUF_SIZE,
+               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if ( n > 0 ){
+      sp->in_pipe = n;
+    }
+    else if ( n == 0 ){
+      sp->eof = 1;
+    }
+    else if ( errno == EINTR ){
+      continue;
+    }
+    else if ( errno == EAGAIN ){
+      erg = forward_splice_wait(sp);
+      if ( erg < 0 ){
+        forward_stop_reading(j,erg);
+      }
+      break;
+    }
+    else if ( errno == EINVAL && j->total == 0 ){
+      /* not supported for this kind of descriptor */
+      forward_splice_release(j);
+      erg = uv_read_start((uv_stream_t*)j->src->handle,
+                          forward_alloc_cb,forward_read_cb);
+      if ( erg < 0 ){
+        j->paused = 1; /* not reading */
+        forward_stop_reading(j,erg);
+      }
+      break;
+    }
+    else {
+      forward_stop_reading(j,-errno);
+      break;
     }
   }
-  if ( buf_not_cleaned && buf->base ){
-    free_uv_buf_t_const(buf,h->cb_type);
+  forward_maybe_finish(j);
+}
+
+static void
+forward_splice_poll_cb(uv_poll_t * handle, int status, int events)
+{
+  struct forward_splice * sp = handle->data;
+  struct forward_job * j = sp->j;
+  (void) events;
+  if ( status < 0 ){
+    forward_stop_reading(j,status);
+    forward_maybe_finish(j);
+  }
+  else {
+    forward_splice_run(j);
+  }
+}
+
+/* Returns 0, if the job can use splice. The write queue of dst must
+   be empty, the data would otherwise be reordered. */
+static int
+forward_splice_init(struct forward_job * j)
+{
+  struct handle * src = j->src;
+  struct handle * dst = j->dst;
+  struct forward_splice * sp;
+  uv_os_fd_t fd_in;
+  uv_os_fd_t fd_out;
+  int erg;
+  if ( (src->handle_type != UV_TCP && src->handle_type != UV_NAMED_PIPE) ||
+       (dst->handle_type != UV_TCP && dst->handle_type != UV_NAMED_PIPE) ){
+    return UV_ENOTSUP;
+  }
+  cork_flush(dst);
+  if ( ((uv_stream_t*)dst->handle)->write_queue_size != 0 ||
+       dst->wq_blocked != 0 || dst->corked == 1 ){
+    return UV_EBUSY;
+  }
+  if ( (erg = uv_fileno(src->handle,&fd_in)) < 0 ||
+       (erg = uv_fileno(dst->handle,&fd_out)) < 0 ){
+    return erg;
+  }
+  sp = malloc(sizeof *sp);
+  if ( sp == NULL ){
+    return UV_ENOMEM;
+  }
+  if ( pipe2(sp->pipe_fd,O_NONBLOCK | O_CLOEXEC) != 0 ){
+    erg = -errno;
+    free(sp);
+    return erg;
+  }
+  sp->in_fd = fcntl(fd_in,F_DUPFD_CLOEXEC,0);
+  sp->out_fd = sp->in_fd < 0 ? -1 : fcntl(fd_out,F_DUPFD_CLOEXEC,0);
+  if ( sp->out_fd < 0 ){
+    erg = -errno;
+    if ( sp->in_fd >= 0 ){
+      close(sp->in_fd);
+    }
+    goto error;
+  }
+  erg = uv_poll_init(&src->loop->loop,&sp->poll_in,sp->in_fd);
+  if ( erg < 0 ){
+    close(sp->in_fd);
+    close(sp->out_fd);
+    goto error;
+  }
+  sp->poll_in.data = sp;
+  erg = uv_poll_init(&dst->loop->loop,&sp->poll_out,sp->out_fd);
+  if ( erg < 0 ){
+    close(sp->out_fd);
+    close(sp->pipe_fd[0]);
+    close(sp->pipe_fd[1]);
+    sp->closing = 1;
+    uv_close((uv_handle_t*)&sp->poll_in,forward_splice_close_cb);
+    return erg;
+  }
+  sp->poll_out.data = sp;
+  sp->j = j;
+  sp->in_pipe = 0;
+  sp->eof = 0;
+  j->sp = sp;
+  dst->fw_splice = 1;
+  return 0;
+error:
+  close(sp->pipe_fd[0]);
+  close(sp->pipe_fd[1]);
+  free(sp);
+  return erg;
+}
+#endif
+
+static void
+forward_abort(struct handle * h)
+{
+  struct forward_job * j = h->fw_job;
+  if ( j != NULL ){
+    if ( j->done == 0 ){
+      j->done = 1;
+      /* src: uv_close stops reading, pending writes to dst
+         will fail with ECANCELED */
+      if ( j->sp != NULL ){
+        forward_splice_release(j);
+      }
+      else if ( j->paused == 0 && h != j->src &&
+                j->src->close_called == 0 ){
+        uv_read_stop((uv_stream_t*)j->src->handle);
+      }
+    }
+    if ( j->err == 0 ){
+      j->err = UV_ECANCELED;
+    }
+    forward_maybe_finish(j);
+  }
+}
+
+CAMLprim value
+uwt_forward(value o_src, value o_dst, value o_max, value o_cb)
+{
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_src);
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_dst);
+  HANDLE_NINIT(src,o_src,o_dst,o_cb);
+  struct handle * dst = Handle_val(o_dst);
+  const intnat max = Long_val(o_max);
+  struct forward_job * j;
+  value ret;
+  int erg = 0;
+  if ( max <= 0 || (uintnat)max > UINT_MAX ){
+    ret = VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  else if ( src->cb_read != CB_INVALID || src->read_ring == 1 ||
+            src->fw_job != NULL || dst->fw_job != NULL ||
+            dst->sf_job != NULL ){
+    ret = VAL_UWT_INT_RESULT_UWT_EBUSY;
+  }
+  else if ( (j = malloc(sizeof *j)) == NULL ){
+    ret = VAL_UWT_INT_RESULT_ENOMEM;
+  }
+  else {
+    uv_stream_t* stream = (uv_stream_t*)src->handle;
+    if ( src->can_reuse_cb_read == 1 ){
+      src->can_reuse_cb_read = 0;
+      src->read_waiting = 0;
+      erg = uv_read_stop(stream);
+    }
+    j->src = src;
+    j->dst = dst;
+    j->total = 0;
+    j->held = 0;
+    j->max_buffered = max;
+    j->writes = 0;
+    j->err = 0;
+    j->paused = 0;
+    j->done = 0;
+    j->cb = CB_INVALID;
+    j->sp = NULL;
+    if ( erg >= 0 ){
+      src->fw_job = j;
+      dst->fw_job = j;
+#ifdef HAVE_FORWARD_SPLICE
+      if ( forward_splice_init(j) == 0 ){
+        erg = forward_splice_wait(j->sp);
+        if ( erg < 0 ){
+          forward_splice_release(j);
+        }
+      }
+      else
+#endif
+      erg = uv_read_start(stream,forward_alloc_cb,forward_read_cb);
+    }
+    if ( erg < 0 ){
+      src->fw_job = NULL;
+      dst->fw_job = NULL;
+      free(j);
+    }
+    else {
+      gr_root_register(&j->cb,o_cb);
+      ++src->in_use_cnt;
+      if ( dst != src ){
+        ++dst->in_use_cnt;
+      }
+    }
+    ret = VAL_UWT_UNIT_RESULT(erg);
+  }
+  CAMLreturn(ret);
+}
+
+UV_HANDLE_BOOL(uv_stream_t,is_readable,false)
+UV_HANDLE_BOOL(uv_stream_t,is_writable,false)
+/* }}} Stream end */
+
+/* {{{ Tty start */
+CAMLprim value
+uwt_tty_init(value o_loop,value o_fd, value o_readable)
+{
+  INIT_LOOP_WRAP(l,o_loop);
+  CAMLparam1(o_loop);
+  CAMLlocal1(dc);
+  value ret;
+  const int fd = FD_VAL(o_fd);
+  dc = handle_create(UV_TTY,l);
+  struct handle * h =  Handle_val(dc);
+  h->close_executed = 1;
+  ret = caml_alloc_small(1,Ok_tag);
+  h->close_executed = 0;
+  h->initialized = 1;
+  Field(ret,0) = dc;
+
+  const int erg = uv_tty_init(&l->loop,
+                              (uv_tty_t*)h->handle,
+                              fd,
+                              Long_val(o_readable) == 1 );
+  if ( erg < 0 ){
+    free_mem_uv_handle_t(h);
+    free_struct_handle(h);
+    Field(dc,1) = 0;
+    Field(ret,0) = Val_uwt_error(erg);
+    Tag_val(ret) = Error_tag;
+  }
+  CAMLreturn(ret);
+}
+
+CAMLprim value
+uwt_tty_set_mode_na(value o_tty,value o_mode)
+{
+  HANDLE_NINIT_NA(s,o_tty);
+  HANDLE_NO_UNINIT_NA(s);
+#if HAVE_DECL_UV_TTY_MODE_IO && HAVE_DECL_UV_TTY_MODE_NORMAL && HAVE_DECL_UV_TTY_MODE_RAW
+  int mode ;
+  switch ( Long_val(o_mode) ){
+  case 2: mode = UV_TTY_MODE_IO; break;
+  case 1: mode = UV_TTY_MODE_RAW; break;
+  default: assert(false); /* fall */
+  case 0: mode = UV_TTY_MODE_NORMAL; break;
   }
-  HANDLE_CB_RET(ret);
+#else
+  int mode = Long_val(o_mode) == 0 ? 0 : 1;
+#endif
+  int ret = uv_tty_set_mode((uv_tty_t*)s->handle,mode);
+  return (VAL_UWT_UNIT_RESULT(ret));
 }
 
 CAMLprim value
-uwt_read_start(value o_stream,
-               value o_cb)
+uwt_tty_reset_mode_na(value unit)
 {
-  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
-  HANDLE_NINIT(s,o_stream,o_cb);
-  value ret;
-  if ( s->cb_read != CB_INVALID ){
-    ret = VAL_UWT_INT_RESULT_UWT_EBUSY;
-  }
-  else {
-    int erg = 0;
-    uv_stream_t* stream = (uv_stream_t*)s->handle;
-    if ( s->can_reuse_cb_read == 1 ){
-      s->can_reuse_cb_read = 0;
-      s->read_waiting = 0;
-      erg = uv_read_stop(stream);
-    }
-    if ( erg >= 0 ){
-      erg = uv_read_start(stream,read_start_alloc_cb,read_start_cb);
-      if ( erg >= 0 ){
-        s->c_read_size = DEF_ALLOC_SIZE;
-        s->cb_read_removed_by_cb = 0;
-        gr_root_register(&s->cb_read,o_cb);
-        ++s->in_use_cnt;
-      }
-    }
-    ret = VAL_UWT_UNIT_RESULT(erg);
-  }
-  CAMLreturn(ret);
+  (void) unit;
+  int x = uv_tty_reset_mode();
+  return (VAL_UWT_UNIT_RESULT(x));
 }
 
 CAMLprim value
-uwt_read_stop(value o_stream, value o_abort)
+uwt_tty_get_winsize(value o_tty)
 {
-  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
-  HANDLE_NINIT(s,o_stream);
+  HANDLE_NO_UNINIT_CLOSED_WRAP(o_tty);
+  CAMLparam1(o_tty);
+  CAMLlocal1(tup);
+  struct handle * s = Handle_val(o_tty);
   value ret;
-  if ( (s->read_waiting == 1 && Long_val(o_abort) == 0 ) ||
-       (s->cb_read == CB_INVALID && s->cb_read_removed_by_cb != 1) ){
-    ret = VAL_UWT_INT_RESULT_UWT_ENOTACTIVE;
+  int width;
+  int height;
+  const int erg = uv_tty_get_winsize((uv_tty_t*)s->handle,&width,&height);
+  if ( erg < 0 ){
+    ret = caml_alloc_small(1,Error_tag);
+    Field(ret,0) = Val_uwt_error(erg);
   }
   else {
-    uv_stream_t* stream = (uv_stream_t*)s->handle;
-    int erg = uv_read_stop(stream);
-    if ( erg >= 0 ){
-      s->can_reuse_cb_read = 0;
-      if ( s->in_use_cnt && s->cb_read_removed_by_cb == 0 ){
-        --s->in_use_cnt;
-      }
-      if ( s->cb_read != CB_INVALID && s->cb_read_removed_by_cb != 1 ){
-        gr_root_unregister(&s->cb_read);
-      }
-      s->cb_read_removed_by_cb = 0;
-    }
-    ret = VAL_UWT_UNIT_RESULT(erg);
+    tup = caml_alloc_small(2,0);
+    Field(tup,0) = Val_long(width);
+    Field(tup,1) = Val_long(height);
+    ret = caml_alloc_small(1,Ok_tag);
+    Field(ret,0) = tup;
   }
   CAMLreturn(ret);
 }
+/* }}} Tty end */
 
-static void
-cancel_reader(struct handle *h)
+#ifdef _WIN32
+static bool
+set_crt_fd(value o_fd)
 {
-  if ( h->read_waiting == 1 &&
-       h->cb_read != CB_INVALID &&
-       h->obuf != CB_INVALID ){
-    value exn;
-    value param;
-    if ( h->handle->type == UV_UDP ){
-      param = caml_alloc_small(1,Error_tag);
-      Field(param,0) = VAL_UWT_ERROR_ECANCELED;
+  bool ret = true;
+  if ( CRT_fd_val(o_fd) == NO_CRT_FD ){
+    const int fd = _open_osfhandle((intptr_t)Handle_val(o_fd), _O_BINARY);
+    if ( fd == -1 ){
+      ret = false;
     }
     else {
-      param = VAL_UWT_INT_RESULT_ECANCELED;
-    }
-    value cb = GET_CB_VAL(h->cb_read);
-    gr_root_unregister(&h->cb_read);
-    gr_root_unregister(&h->obuf);
-    ++h->in_callback_cnt;
-    ++h->in_use_cnt;
-    assert( h->close_called == 1 );
-    exn = caml_callback2_exn(*uwt_global_wakeup,cb,param);
-    --h->in_callback_cnt;
-    --h->in_use_cnt;
-    if ( h->in_use_cnt ){
-      /* yes twice, it was increased in either
-         uwt_read_own or uwt_udp_recv_own. It doesn't
-         matter currently, because close was already called.
-         But I should add debug code to the close callback, if the
-         reference count mechanism works as intended. */
-      --h->in_use_cnt;
-    }
-    if (unlikely( Is_exception_result(exn) )){
-      add_exception(h->loop,exn);
+      CRT_fd_val(o_fd) = fd;
     }
   }
+  return ret;
 }
+#endif
 
-static void
-read_own_cb(uv_stream_t* stream,ssize_t nread, const uv_buf_t * buf)
+/* {{{ Pipe start */
+#define FD_INVALID 2
+CAMLprim value
+uwt_pipe_open(value o_loop, value o_fd,value o_ipc)
 {
-  HANDLE_CB_INIT_WITH_CLEAN(stream);
-  struct handle * h = stream->data;
-  value ret = Val_unit;
-  const bool read_ba = h->use_read_ba == 1;
-  bool buf_not_cleaned = true;
-  if ( h->close_called == 0 && nread != 0 ){
-    if (unlikely( h->cb_read == CB_INVALID ||
-                  h->obuf == CB_INVALID )){
-      DEBUG_PF("callbacks lost");
-    }
-    else {
-      value o;
-      value cb;
-      bool finished;
-      h->read_waiting = 0;
-      if ( nread < 0 ){
-        if ( nread == UV_EOF ){
-          o = Val_long(0);
-        }
-        else {
-          o = Val_uwt_int_result(nread);
-        }
-        finished = true;
-      }
-      else {
-        assert(buf->len >= (size_t)nread);
-        assert((size_t)nread <= h->c_read_size);
-        finished = false;
-        o = Val_long(nread);
-        if ( read_ba == false ){
-          if (unlikely( !buf->base || (size_t)nread > buf->len )){
-            o = VAL_UWT_INT_RESULT_UWT_EFATAL;
-          }
-          else {
-            value tp = GET_CB_VAL(h->obuf);
-            memcpy(String_val(tp) + h->obuf_offset, buf->base, (size_t)nread);
-          }
-        }
-      }
-      if ( read_ba == false ){
-        buf_not_cleaned = false;
-        free_uv_buf_t_const(buf,h->cb_type);
-      }
-      cb = GET_CB_VAL(h->cb_read);
-      gr_root_unregister(&h->cb_read);
-      gr_root_unregister(&h->obuf);
-      h->can_reuse_cb_read = finished == false;
-      if ( h->in_use_cnt ){
-        h->in_use_cnt--;
-      }
-      ret = caml_callback2_exn(*uwt_global_wakeup,cb,o);
-      /* it's not clear in older versions, how to handle this case,...
-         https://github.com/joyent/libuv/issues/1534 */
-      if ( h->close_called == 0 &&
-           finished == false &&
-           h->can_reuse_cb_read == 1 ){
-        uv_read_stop(stream);
+  INIT_LOOP_WRAP(l,o_loop);
+#ifdef _WIN32
+  if ( o_fd != FD_INVALID && set_crt_fd(o_fd) == false ){
+    value ret = caml_alloc_small(1,Error_tag);
+    Field(ret,0) = VAL_UWT_ERROR_UWT_EBADF;
+    return ret;
+  }
+#endif
+  CAMLparam1(o_loop);
+  CAMLlocal1(dc);
+  value ret;
+  int erg;
+  int fd = -1;
+  if ( o_fd != FD_INVALID ){
+    fd = FD_VAL(o_fd);
+  }
+  dc = handle_create(UV_NAMED_PIPE,l);
+  struct handle * h = Handle_val(dc);
+  h->close_executed = 1;
+  ret = caml_alloc_small(1,Ok_tag);
+  Field(ret,0) = dc;
+  h->close_executed = 0;
+  uv_pipe_t * p = (uv_pipe_t*)h->handle;
+  erg = uv_pipe_init(&l->loop,
+                     p,
+                     Long_val(o_ipc) == 1);
+  if ( erg < 0 ){
+    free_mem_uv_handle_t(h);
+    free_struct_handle(h);
+  }
+  else {
+    if ( o_fd != FD_INVALID ){
+#ifdef _WIN32
+      h->orig_fd = fd;
+#endif
+      h->initialized = 1;
+      erg = uv_pipe_open(p,fd);
+      if ( erg < 0 ){
+        h->finalize_called = 1;
+        handle_finalize_close(h);
       }
-      h->can_reuse_cb_read = 0;
     }
   }
-  if ( buf_not_cleaned && read_ba == false && buf->base ){
-    free_uv_buf_t_const(buf,h->cb_type);
+  if ( erg < 0 ){
+    Field(dc,1) = 0;
+    Tag_val(ret) = Error_tag;
+    Field(ret,0) = Val_uwt_error(erg);
   }
-  HANDLE_CB_RET(ret);
+  CAMLreturn(ret);
 }
 
-static void
-alloc_read_own(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
+CAMLprim value
+uwt_pipe_init(value o_loop, value o_ipc)
 {
-  struct handle * h;
-  (void) suggested_size;
-  if (unlikely( !handle || (h = handle->data) == NULL )){
-    DEBUG_PF("no data");
-    buf->len = 0;
-    buf->base = NULL;
-  }
-  else if ( h->use_read_ba ){
-    buf->base = h->ba_read;
-    buf->len = h->c_read_size;
-  }
-  else {
-    unsigned int len;
-    len = UMIN(suggested_size,h->c_read_size);
-    malloc_uv_buf_t(buf,len,h->cb_type);
+  _Static_assert( Is_long(FD_INVALID) == 0 , "int representation has changed");
+  return (uwt_pipe_open(o_loop,FD_INVALID,o_ipc));
+}
+#undef FD_INVALID
+
+CAMLprim value
+uwt_pipe_bind_na(value o_pipe, value o_name)
+{
+  HANDLE_NINIT_NA(p,o_pipe);
+  if ( !uwt_is_safe_string(o_name) ){
+    return VAL_UWT_INT_RESULT_ECHARSET;
   }
+  /* string duplicated by libuv */
+  int ret = uv_pipe_bind((uv_pipe_t*)p->handle,String_val(o_name));
+  if ( ret >= 0 ){
+    p->initialized = 1;
+  }
+  return (VAL_UWT_UNIT_RESULT(ret));
 }
 
 CAMLprim value
-uwt_read_own(value o_s,value o_buf,value o_offset,value o_len,value o_cb)
+uwt_pipe_getsockname(value o_pipe)
 {
-  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_s);
-  HANDLE_NINIT(s,o_s,o_buf,o_cb);
-  const int ba = Tag_val(o_buf) != String_tag;
-  value ret;
-  assert( s->cb_type == CB_LWT );
-  if ( s->cb_read != CB_INVALID ){
-    ret = VAL_UWT_INT_RESULT_UWT_EBUSY;
-  }
-  else {
-    int erg;
-    if ( s->can_reuse_cb_read == 1 ){
-      s->can_reuse_cb_read = 0;
-      erg = 0;
+  HANDLE_NO_UNINIT_CLOSED_WRAP(o_pipe);
+  CAMLparam1(o_pipe);
+  CAMLlocal1(o_str);
+  struct handle * op = Handle_val(o_pipe);
+  size_t s = 1024;
+  char name[s];
+  char * lname = NULL;
+  uv_pipe_t* p = (uv_pipe_t*)op->handle;
+  int erg = uv_pipe_getsockname(p,name,&s);
+  int etag;
+  if ( erg == UV_ENOBUFS ){
+    ++s;
+    lname = malloc(s);
+    if ( lname == NULL ){
+      erg = UV_ENOMEM;
     }
     else {
-      uv_stream_t* stream = (uv_stream_t*)s->handle;
-      erg = uv_read_start(stream,alloc_read_own,read_own_cb);
-    }
-    if ( erg >= 0 ){
-      unsigned int len = Long_val(o_len);
-      unsigned int offset = Long_val(o_offset);
-      gr_root_register(&s->cb_read,o_cb);
-      gr_root_register(&s->obuf,o_buf);
-      ++s->in_use_cnt;
-      s->c_read_size = len;
-      s->read_waiting = 1;
-      s->use_read_ba = ba;
-      if ( ba == 0 ){
-        s->obuf_offset = Long_val(o_offset);
-      }
-      else {
-        s->ba_read = Ba_buf_val(o_buf) + offset;
-      }
+      erg = uv_pipe_getsockname(p,lname,&s);
     }
-    ret = VAL_UWT_UNIT_RESULT(erg);
   }
+  if ( erg < 0 ){
+    o_str = Val_uwt_error(erg);
+    etag = Error_tag;
+  }
+  else {
+    char * ms = lname ? lname : name;
+#if UV_VERSION_MAJOR < 1
+#error "libuv too old"
+#elif (UV_VERSION_MAJOR > 1) || ( UV_VERSION_MINOR > 2 )
+    o_str = caml_alloc_string(s);
+    memcpy(String_val(o_str),ms,s);
+#else
+    --s;
+    assert(ms[s] == '\0');
+    o_str =  caml_alloc_string(s);
+    memcpy(String_val(o_str),ms,s);
+#endif
+    etag = Ok_tag;
+  }
+  if ( lname ){
+    free(lname);
+  }
+  value ret = caml_alloc_small(1,etag);
+  Field(ret,0) = o_str;
   CAMLreturn(ret);
 }
 
-#define XX(name,type)                                                   \
-  static void name (type * req, int status)                             \
-  {                                                                     \
-    struct handle * s;                                                  \
-    if (unlikely( !req || !req->data || !req->handle ||                 \
-                  (s = req->handle->data) == NULL )){                   \
-      DEBUG_PF("leaking data");                                         \
-    }                                                                   \
-    else {                                                              \
-      struct req * r = req->data;                                       \
-      ++s->in_callback_cnt;                                             \
-      --s->in_use_cnt;                                                  \
-      r->c_param = status;                                              \
-      universal_callback((void*)req);                                   \
-      --s->in_callback_cnt;                                             \
-      MAYBE_CLOSE_HANDLE(s);                                            \
-    }                                                                   \
-  }
+CAMLprim value
+uwt_pipe_pending_instances_na(value o_pipe, value o_count)
+{
+  HANDLE_NINIT_NA(op,o_pipe);
+  HANDLE_NO_UNINIT_NA(op);
+  uv_pipe_t* p = (uv_pipe_t*)op->handle;
+  uv_pipe_pending_instances(p,Long_val(o_count));
+  return (Val_long(0));
+}
 
-/* TODO: check the alignment, if we can cast or not */
-XX(write_send_cb,uv_write_t)
-XX(udp_send_cb,uv_udp_send_t)
-#undef XX
+CAMLprim value
+uwt_pipe_pending_count_na(value o_pipe)
+{
+  HANDLE_NINIT_NA(op,o_pipe);
+  HANDLE_NO_UNINIT_NA(op);
+  uv_pipe_t* p = (uv_pipe_t*)op->handle;
+  int ret = uv_pipe_pending_count(p);
+  return (VAL_UWT_INT_RESULT(ret));
+}
 
 CAMLprim value
-uwt_udp_send_native(value o_stream,value o_buf,value o_pos,value o_len,
-                    value o_sock,value o_cb)
+uwt_pipe_pending_type_na(value o_pipe)
 {
-  if ( o_sock == Val_unit ){
-    HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
+  struct handle * h = Handle_val(o_pipe);
+  if ( HANDLE_IS_INVALID_UNINIT(h) ){
+    return (Val_long(0));
   }
-  HANDLE_NINIT(s,o_stream,o_buf,o_sock,o_cb);
-  const intnat len = Long_val(o_len);
-  const int ba = len > 0 && Tag_val(o_buf) != String_tag;
-  struct req * wp;
-  wp = req_create( o_sock == Val_unit ? UV_WRITE : UV_UDP_SEND,
-                   s->loop );
-  value ret = Val_unit;
-  assert( len >= 0 );
-  if ( ba ){
-    wp->buf.base = Ba_buf_val(o_buf) + Long_val(o_pos);
-    wp->buf.len = len;
+  uv_handle_type x = uv_pipe_pending_type((uv_pipe_t*)h->handle);
+  switch( x ){
+  case UV_UNKNOWN_HANDLE: /*fall */
+  default: return (Val_long(0));
+  case UV_TCP: return (Val_long(1));
+  case UV_UDP: return (Val_long(2));
+  case UV_NAMED_PIPE: return (Val_long(3));
   }
-  else if ( len == 0 ){
-    wp->buf.base = NULL;
-    wp->buf.len = 0;
+}
+
+static void
+pipe_tcp_connect_cb(uv_connect_t* req, int status)
+{
+  struct handle * s = req->handle->data;
+  struct req * r = req->data;
+  if ( !s || !r ){
+    DEBUG_PF("leaking data");
   }
   else {
-    malloc_uv_buf_t(&wp->buf,len,wp->cb_type);
-    if ( wp->buf.base != NULL  ){
-      memcpy(wp->buf.base,
-             String_val(o_buf) + Long_val(o_pos),
-             len);
-    }
-    else {
-      ret = VAL_UWT_INT_RESULT_ENOMEM;
-      free_mem_uv_req_t(wp);
-      free_struct_req(wp);
-    }
-  }
-  if ( ret == Val_unit ){
-    int erg;
-    void * req = wp->req;
-    void * handle = s->handle;
-    if ( o_sock == Val_unit ){
-      erg = uv_write(req,handle,&wp->buf,1,write_send_cb);
-    }
-    else {
-      erg = uv_udp_send(req,handle,&wp->buf,1,SOCKADDR_VAL(o_sock),udp_send_cb);
-    }
-    if ( erg < 0 ){
-      if ( ba == 0 ){
-        free_uv_buf_t(&wp->buf,wp->cb_type);
-      }
-      free_mem_uv_req_t(wp);
-      free_struct_req(wp);
-    }
-    else {
-      wp->c_cb = ret_unit_cparam;
-      wp->cb_type = s->cb_type;
-      wp->in_use = 1;
+    ++s->in_callback_cnt;
+    --s->in_use_cnt;
+    r->c_param = status;
+    if ( status >= 0 ){
       s->initialized = 1;
-      gr_root_register(&wp->cb,o_cb);
-      wp->finalize_called = 1;
-      ++s->in_use_cnt;
-      wp->buf_contains_ba = ba;
-      if ( ba ){
-        gr_root_register(&wp->sbuf,o_buf);
-      }
     }
-    ret = VAL_UWT_UNIT_RESULT(erg);
+    universal_callback((void*)req);
+    --s->in_callback_cnt;
+    MAYBE_CLOSE_HANDLE(s);
+  }
+}
+
+CAMLprim value
+uwt_pipe_connect(value o_pipe,value o_path,value o_cb)
+{
+  if ( !uwt_is_safe_string(o_path) ){
+    return VAL_UWT_INT_RESULT_ECHARSET;
+  }
+  HANDLE_NINIT(s,o_pipe,o_cb,o_path);
+  struct req * wp = req_create(UV_CONNECT,s->loop);
+  uv_pipe_t* tpipe = (uv_pipe_t*)s->handle;
+  uv_connect_t * req = (uv_connect_t*)wp->req;
+  /* pipe_connect is void in order to mimic the windows api,
+     the string won't be used internally, we don't need to create a copy */
+  uv_pipe_connect(req,tpipe,String_val(o_path),pipe_tcp_connect_cb);
+  wp->c_cb = ret_unit_cparam;
+  gr_root_register(&wp->cb,o_cb);
+  wp->in_use = 1;
+  wp->finalize_called = 1;
+  ++s->in_use_cnt;
+  CAMLreturn(Val_long(0));
+}
+/* }}} Pipe end */
+
+/* {{{ Tcp start */
+#define UDP_TCP_INIT(name,TYPE)                                         \
+  CAMLprim value                                                        \
+  uwt_ ## name ## _init(value o_loop)                                   \
+  {                                                                     \
+    INIT_LOOP_WRAP(l,o_loop);                                           \
+    CAMLparam1(o_loop);                                                 \
+    CAMLlocal1(v);                                                      \
+    v = handle_create(TYPE,l);                                          \
+    struct handle * h = Handle_val(v);                                  \
+    h->close_executed = 1;                                              \
+    value ret = caml_alloc_small(1,Ok_tag);                             \
+    Field(ret,0) = v;                                                   \
+    h->close_executed = 0;                                              \
+    int erg = uv_ ## name ## _init(&l->loop,                            \
+                                   (uv_ ## name ## _t*)h->handle);      \
+    if ( erg < 0 ){                                                     \
+      Field(v,1) = 0;                                                   \
+      Field(ret,0) = Val_uwt_error(erg);                                \
+      free_mem_uv_handle_t(h);                                          \
+      free_struct_handle(h);                                            \
+    }                                                                   \
+    CAMLreturn(ret);                                                    \
+  }
+
+UDP_TCP_INIT(tcp,UV_TCP)
+UDP_TCP_INIT(udp,UV_UDP)
+#undef UDP_TCP_INIT
+
+static value
+uwt_tcp_udp_open(value o_tcp, value o_fd, bool tcp)
+{
+  HANDLE_NINIT_NA(t,o_tcp);
+  int ret;
+#ifndef _WIN32
+  uv_os_sock_t s = Long_val(o_fd);
+#else
+  uv_os_sock_t s;
+  if ( Descr_kind_val(o_fd) != KIND_SOCKET ){
+    ret = UV_UWT_EBADF;
+    goto endp;
   }
-  CAMLreturn(ret);
+  s = Socket_val(o_fd);
+  t->orig_fd = CRT_fd_val(o_fd);
+#endif
+  if ( tcp ){
+    ret = uv_tcp_open((uv_tcp_t*)t->handle,s);
+  }
+  else {
+    ret = uv_udp_open((uv_udp_t*)t->handle,s);
+  }
+  if ( ret >= 0 ){
+    t->initialized = 1;
+  }
+#ifdef _WIN32
+ endp:
+#endif
+  return (VAL_UWT_UNIT_RESULT(ret));
 }
-BYTE_WRAP6(uwt_udp_send)
 
 CAMLprim value
-uwt_write(value a,value b,value c,value d,value e){
-  return (uwt_udp_send_native(a,b,c,d,Val_unit,e));
+uwt_tcp_open_na(value a, value b){
+  return (uwt_tcp_udp_open(a,b,true));
 }
 
-static void
-cb_uwt_write2(uv_write_t* req, int status)
+CAMLprim value
+uwt_udp_open_na(value a, value b){
+  return (uwt_tcp_udp_open(a,b,false));
+}
+
+CAMLprim value
+uwt_tcp_bind_na(value o_tcp, value o_sock, value o_flags)
 {
-  struct handle * s1 = req->handle->data;
-  struct handle * s2 = req->send_handle->data;
-  struct req * r = req->data;
-  if ( !s1 || !s2 || !r ){
-    DEBUG_PF("leaking data");
+  HANDLE_NINIT_NA(t,o_tcp);
+  struct sockaddr* addr = SOCKADDR_VAL(o_sock);
+  unsigned int flags = o_flags == Val_unit ? 0 : UV_TCP_IPV6ONLY;
+  int ret = uv_tcp_bind((uv_tcp_t *)t->handle,addr,flags);
+  if ( ret >= 0 ){
+    t->initialized = 1;
   }
-  else {
-    ++s1->in_callback_cnt;
-    ++s2->in_callback_cnt;
-    --s1->in_use_cnt;
-    --s2->in_use_cnt;
+  return (VAL_UWT_UNIT_RESULT(ret));
+}
 
-    r->c_param = status;
-    universal_callback((void*)req);
+CAMLprim value
+uwt_tcp_nodelay_na(value o_tcp,value o_enable)
+{
+  HANDLE_NINIT_NA(th,o_tcp);
+  /* uninit allowed */
+  uv_tcp_t * t = (uv_tcp_t *)th->handle;
+  int ret = uv_tcp_nodelay(t,Long_val(o_enable));
+  return (VAL_UWT_UNIT_RESULT(ret));
+}
 
-    --s1->in_callback_cnt;
-    --s2->in_callback_cnt;
-    MAYBE_CLOSE_HANDLE(s1);
-    MAYBE_CLOSE_HANDLE(s2);
-  }
+CAMLprim value
+uwt_tcp_keepalive_na(value o_tcp,value o_enable, value o_delay)
+{
+  HANDLE_NINIT_NA(th,o_tcp);
+  /* uninit allowed */
+  uv_tcp_t * t = (uv_tcp_t *)th->handle;
+  int ret = uv_tcp_keepalive(t,Long_val(o_enable),Long_val(o_delay));
+  return (VAL_UWT_UNIT_RESULT(ret));
 }
 
 CAMLprim value
-uwt_write2_native(value o_stream,
-                  value o_stream_send,
-                  value o_buf,
-                  value o_pos,
-                  value o_len,
-                  value o_cb)
+uwt_tcp_simultaneous_accepts_na(value o_tcp,value o_enable)
 {
-  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
-  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream_send);
-  HANDLE_NINIT2(s1,o_stream,s2,o_stream_send,o_cb,o_buf);
-  value ret = Val_unit;
-  const intnat len = Long_val(o_len);
-  struct req * wp = req_create(UV_WRITE,s1->loop);
-  uv_write_t* req = (uv_write_t*)wp->req;
-  const int ba = len > 0 && Tag_val(o_buf) != String_tag;
-  if ( ba ){
-    wp->buf.base = Ba_buf_val(o_buf) + Long_val(o_pos);
-    wp->buf.len = len;
-  }
-  else if ( len == 0 ){
-    wp->buf.base = NULL;
-    wp->buf.len = 0;
-  }
-  else {
-    malloc_uv_buf_t(&wp->buf,len,wp->cb_type);
-    if ( wp->buf.base != NULL ){
-      memcpy(wp->buf.base,
-             String_val(o_buf) + Long_val(o_pos),
-             len);
-    }
-    else {
-      ret = VAL_UWT_INT_RESULT_ENOMEM;
-      free_mem_uv_req_t(wp);
-      free_struct_req(wp);
-    }
-  }
-  if ( ret == Val_unit ){
-    int erg = 0;
-    uv_stream_t* stream = (uv_stream_t*)s1->handle;
-    uv_stream_t* stream_send = (uv_stream_t*)s2->handle;
-    assert(s1->cb_type == s2->cb_type);
-    erg = uv_write2(req,stream,&wp->buf,1,stream_send,cb_uwt_write2);
-    if ( erg < 0 ){
-      if ( ba == 0 ){
-        free_uv_buf_t(&wp->buf,wp->cb_type);
-      }
-      free_mem_uv_req_t(wp);
-      free_struct_req(wp);
-    }
-    else {
-      wp->c_cb = ret_unit_cparam;
-      wp->in_use = 1;
-      gr_root_register(&wp->cb,o_cb);
-      wp->finalize_called = 1;
-      ++s1->in_use_cnt;
-      ++s2->in_use_cnt;
-      wp->buf_contains_ba = ba;
-      if ( ba ){
-        gr_root_register(&wp->sbuf,o_buf);
-      }
-    }
-    ret = VAL_UWT_UNIT_RESULT(erg);
+  HANDLE_NINIT_NA(th,o_tcp);
+  /* uninit allowed */
+  uv_tcp_t * t = (uv_tcp_t *)th->handle;
+  int ret = uv_tcp_simultaneous_accepts(t,Long_val(o_enable));
+  return (VAL_UWT_UNIT_RESULT(ret));
+}
+
+typedef int (*getsock_f)(uv_handle_t *, struct sockaddr*, int *);
+static value
+uwt_tcp_getsockpeername(value o_tcp, getsock_f func)
+{
+  HANDLE_NO_UNINIT_CLOSED_WRAP(o_tcp);
+  CAMLparam1(o_tcp);
+  CAMLlocal1(sock);
+  value ret;
+  struct handle * th = Handle_val(o_tcp);
+  uv_handle_t * t = th->handle;
+  int s = sizeof(struct sockaddr_storage);
+  int r;
+  sock = uwt_alloc_sockaddr();
+  ret = caml_alloc_small(1,Ok_tag);
+  Field(ret,0) = sock;
+  r = func(t,SOCKADDR_VAL(sock),&s);
+  if ( r < 0 ){
+    Tag_val(ret) = Error_tag;
+    Field(ret,0) = Val_uwt_error(r);
   }
   CAMLreturn(ret);
 }
-BYTE_WRAP6(uwt_write2)
 
 CAMLprim value
-uwt_udp_try_send_na(value o_stream,value o_buf,value o_pos,
-                    value o_len,value o_sock)
+uwt_tcp_getsockname(value o_tcp)
 {
-  if ( o_sock == Val_unit ){
-    HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_stream);
-  }
-  HANDLE_NINIT_NA(s,o_stream);
-  uv_buf_t buf;
-  int ret;
-  buf.len = Long_val(o_len);
-  if ( Tag_val(o_buf) != String_tag ){
-    buf.base = Ba_buf_val(o_buf);
-  }
-  else {
-    buf.base = String_val(o_buf);
-  }
-  buf.base+= Long_val(o_pos);
-  if ( o_sock == Val_unit ){
-    ret = uv_try_write((uv_stream_t*)s->handle,&buf,1);
-  }
-  else {
-    ret = uv_udp_try_send((uv_udp_t*)s->handle,&buf,1,SOCKADDR_VAL(o_sock));
-    if ( ret >= 0 ){
-      s->initialized = 1;
-    }
-  }
-  return (VAL_UWT_INT_RESULT(ret));
+  return (uwt_tcp_getsockpeername(o_tcp,(getsock_f)uv_tcp_getsockname));
 }
 
 CAMLprim value
-uwt_try_write_na(value o_stream,value o_buf,value o_pos,value o_len)
+uwt_tcp_getpeername(value o_tcp)
 {
-  return (uwt_udp_try_send_na(o_stream,o_buf,o_pos,o_len,Val_unit));
+  return (uwt_tcp_getsockpeername(o_tcp,(getsock_f)uv_tcp_getpeername));
 }
 
-UV_HANDLE_BOOL(uv_stream_t,is_readable,false)
-UV_HANDLE_BOOL(uv_stream_t,is_writable,false)
-/* }}} Stream end */
+CAMLprim value
+uwt_udp_getsockname(value o_tcp)
+{
+  return (uwt_tcp_getsockpeername(o_tcp,(getsock_f)uv_udp_getsockname));
+}
 
-/* {{{ Tty start */
 CAMLprim value
-uwt_tty_init(value o_loop,value o_fd, value o_readable)
+uwt_tcp_connect(value o_tcp,value o_sock,value o_cb)
 {
-  INIT_LOOP_WRAP(l,o_loop);
-  CAMLparam1(o_loop);
-  CAMLlocal1(dc);
-  value ret;
-  const int fd = FD_VAL(o_fd);
-  dc = handle_create(UV_TTY,l);
-  struct handle * h =  Handle_val(dc);
-  h->close_executed = 1;
-  ret = caml_alloc_small(1,Ok_tag);
-  h->close_executed = 0;
-  h->initialized = 1;
-  Field(ret,0) = dc;
+  HANDLE_NINIT(s,o_tcp,o_sock,o_cb);
+  struct req * wp = req_create(UV_CONNECT,s->loop);
+  uv_tcp_t* tcp = (uv_tcp_t*)s->handle;
+  uv_connect_t * req = (uv_connect_t*)wp->req;
 
-  const int erg = uv_tty_init(&l->loop,
-                              (uv_tty_t*)h->handle,
-                              fd,
-                              Long_val(o_readable) == 1 );
-  if ( erg < 0 ){
-    free_mem_uv_handle_t(h);
-    free_struct_handle(h);
-    Field(dc,1) = 0;
-    Field(ret,0) = Val_uwt_error(erg);
-    Tag_val(ret) = Error_tag;
+  const int ret = uv_tcp_connect(req, tcp,
+                                 SOCKADDR_VAL(o_sock),
+                                 pipe_tcp_connect_cb);
+  if ( ret >= 0 ){
+    wp->c_cb = ret_unit_cparam;
+    gr_root_register(&wp->cb,o_cb);
+    wp->in_use = 1;
+    wp->finalize_called = 1;
+    ++s->in_use_cnt;
+  }
+  else {
+    free_mem_uv_req_t(wp);
+    free_struct_req(wp);
   }
-  CAMLreturn(ret);
+  CAMLreturn(VAL_UWT_UNIT_RESULT(ret));
 }
+/* }}} Tcp end */
+
+/* {{{ Udp start */
+/* some functions are defined together with tcp or stream! */
+static const int udp_bin_flag_table[2] = {
+  UV_UDP_IPV6ONLY, UV_UDP_REUSEADDR
+};
 
 CAMLprim value
-uwt_tty_set_mode_na(value o_tty,value o_mode)
-{
-  HANDLE_NINIT_NA(s,o_tty);
-  HANDLE_NO_UNINIT_NA(s);
-#if HAVE_DECL_UV_TTY_MODE_IO && HAVE_DECL_UV_TTY_MODE_NORMAL && HAVE_DECL_UV_TTY_MODE_RAW
-  int mode ;
-  switch ( Long_val(o_mode) ){
-  case 2: mode = UV_TTY_MODE_IO; break;
-  case 1: mode = UV_TTY_MODE_RAW; break;
-  default: assert(false); /* fall */
-  case 0: mode = UV_TTY_MODE_NORMAL; break;
+uwt_udp_bind_na(value o_udp, value o_sock, value o_flags){
+  HANDLE_NINIT_NA(t,o_udp);
+  struct sockaddr* addr = SOCKADDR_VAL(o_sock);
+  const unsigned int flags = SAFE_CONVERT_FLAG_LIST(o_flags,udp_bin_flag_table);
+  int ret = uv_udp_bind((uv_udp_t *)t->handle,addr,flags);
+  if ( ret >= 0 ){
+    t->initialized = 1;
   }
-#else
-  int mode = Long_val(o_mode) == 0 ? 0 : 1;
-#endif
-  int ret = uv_tty_set_mode((uv_tty_t*)s->handle,mode);
   return (VAL_UWT_UNIT_RESULT(ret));
 }
 
-CAMLprim value
-uwt_tty_reset_mode_na(value unit)
+static socklen_t
+sockaddr_len(const struct sockaddr * addr)
 {
-  (void) unit;
-  int x = uv_tty_reset_mode();
-  return (VAL_UWT_UNIT_RESULT(x));
+  switch ( addr->sa_family ){
+  case AF_INET: return sizeof(struct sockaddr_in);
+  case AF_INET6: return sizeof(struct sockaddr_in6);
+  default: return sizeof(struct sockaddr_storage);
+  }
 }
 
+/*
+  Udp.connect: connect(2) on the socket of the handle. The kernel
+  filters incoming datagrams and caches the route. libuv doesn't know
+  about it, the address is therefore kept for uv_udp_send (only Linux
+  accepts an address on a connected socket, the other systems report
+  EISCONN).
+*/
+#if defined(__linux__) && defined(HAVE_SYS_SOCKET_H)
 CAMLprim value
-uwt_tty_get_winsize(value o_tty)
+uwt_udp_connect_na(value o_udp, value o_sock)
 {
-  HANDLE_NO_UNINIT_CLOSED_WRAP(o_tty);
-  CAMLparam1(o_tty);
-  CAMLlocal1(tup);
-  struct handle * s = Handle_val(o_tty);
-  value ret;
-  int width;
-  int height;
-  const int erg = uv_tty_get_winsize((uv_tty_t*)s->handle,&width,&height);
-  if ( erg < 0 ){
-    ret = caml_alloc_small(1,Error_tag);
-    Field(ret,0) = Val_uwt_error(erg);
+  HANDLE_NINIT_NA(t,o_udp);
+  struct sockaddr * addr = SOCKADDR_VAL(o_sock);
+  const socklen_t len = sockaddr_len(addr);
+  struct sockaddr_storage * peer;
+  uv_os_fd_t fd;
+  int ret;
+  if ( addr->sa_family != AF_INET && addr->sa_family != AF_INET6 ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
   }
-  else {
-    tup = caml_alloc_small(2,0);
-    Field(tup,0) = Val_long(width);
-    Field(tup,1) = Val_long(height);
-    ret = caml_alloc_small(1,Ok_tag);
-    Field(ret,0) = tup;
+  if ( uv_fileno(t->handle,&fd) < 0 ){
+    /* the socket is created lazily */
+    struct sockaddr_storage any;
+    memset(&any,0,sizeof any);
+    any.ss_family = addr->sa_family;
+    ret = uv_udp_bind((uv_udp_t*)t->handle,(struct sockaddr*)&any,0);
+    if ( ret < 0 ){
+      return (VAL_UWT_INT_RESULT(ret));
+    }
+    t->initialized = 1;
+    ret = uv_fileno(t->handle,&fd);
+    if ( ret < 0 ){
+      return (VAL_UWT_INT_RESULT(ret));
+    }
   }
-  CAMLreturn(ret);
-}
-/* }}} Tty end */
-
-#ifdef _WIN32
-static bool
-set_crt_fd(value o_fd)
-{
-  bool ret = true;
-  if ( CRT_fd_val(o_fd) == NO_CRT_FD ){
-    const int fd = _open_osfhandle((intptr_t)Handle_val(o_fd), _O_BINARY);
-    if ( fd == -1 ){
-      ret = false;
+  if ( t->peer == NULL ){
+    peer = malloc(sizeof *peer);
+    if ( peer == NULL ){
+      return VAL_UWT_INT_RESULT_ENOMEM;
     }
-    else {
-      CRT_fd_val(o_fd) = fd;
+  }
+  else {
+    peer = t->peer;
+  }
+  do {
+    ret = connect(fd,addr,len);
+  } while ( ret == -1 && errno == EINTR );
+  if ( ret == -1 ){
+    ret = -errno;
+    if ( peer != t->peer ){
+      free(peer);
     }
+    return (VAL_UWT_INT_RESULT(ret));
   }
-  return ret;
+  memcpy(peer,addr,len);
+  t->peer = peer;
+  return Val_long(0);
 }
-#endif
 
-/* {{{ Pipe start */
-#define FD_INVALID 2
+/*
+  Udp.send_connected: send(2) without address, if nothing is queued.
+  Otherwise the datagram is queued like Udp.send. Returns 1, if the
+  datagram was sent immediately, 0 if o_cb will be called.
+*/
 CAMLprim value
-uwt_pipe_open(value o_loop, value o_fd,value o_ipc)
+uwt_udp_send_connected(value o_udp, value o_buf, value o_pos, value o_len,
+                       value o_cb)
 {
-  INIT_LOOP_WRAP(l,o_loop);
-#ifdef _WIN32
-  if ( o_fd != FD_INVALID && set_crt_fd(o_fd) == false ){
-    value ret = caml_alloc_small(1,Error_tag);
-    Field(ret,0) = VAL_UWT_ERROR_UWT_EBADF;
-    return ret;
-  }
-#endif
-  CAMLparam1(o_loop);
-  CAMLlocal1(dc);
-  value ret;
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_udp);
+  HANDLE_NINIT(s,o_udp,o_buf,o_cb);
+  const size_t len = Long_val(o_len);
+  const int ba = len > 0 && Tag_val(o_buf) != String_tag;
+  const char * base = (ba ? Ba_buf_val(o_buf) : String_val(o_buf)) +
+    Long_val(o_pos);
+  uv_os_fd_t fd;
+  struct req * wp;
   int erg;
-  int fd = -1;
-  if ( o_fd != FD_INVALID ){
-    fd = FD_VAL(o_fd);
+  if ( s->peer == NULL ){
+    CAMLreturn(VAL_UWT_INT_RESULT_ENOTCONN);
   }
-  dc = handle_create(UV_NAMED_PIPE,l);
-  struct handle * h = Handle_val(dc);
-  h->close_executed = 1;
-  ret = caml_alloc_small(1,Ok_tag);
-  Field(ret,0) = dc;
-  h->close_executed = 0;
-  uv_pipe_t * p = (uv_pipe_t*)h->handle;
-  erg = uv_pipe_init(&l->loop,
-                     p,
-                     Long_val(o_ipc) == 1);
+  if ( ((uv_udp_t*)s->handle)->send_queue_count == 0 &&
+       uv_fileno(s->handle,&fd) == 0 ){
+    ssize_t r;
+    do {
+      r = send(fd,base,len,0);
+    } while ( r == -1 && errno == EINTR );
+    if ( r >= 0 ){
+      CAMLreturn(Val_long(1));
+    }
+    if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS ){
+      CAMLreturn(Val_uwt_int_result(-errno));
+    }
+  }
+  erg = udp_queue_admit(s,len);
   if ( erg < 0 ){
-    free_mem_uv_handle_t(h);
-    free_struct_handle(h);
+    CAMLreturn(Val_uwt_int_result(erg));
+  }
+  if ( erg > 0 ){
+    CAMLreturn(Val_long(1));
+  }
+  wp = req_create(UV_UDP_SEND,s->loop);
+  if ( ba ){
+    wp->buf.base = (char *)base;
+    wp->buf.len = len;
+  }
+  else if ( len == 0 ){
+    wp->buf.base = NULL;
+    wp->buf.len = 0;
   }
   else {
-    if ( o_fd != FD_INVALID ){
-#ifdef _WIN32
-      h->orig_fd = fd;
-#endif
-      h->initialized = 1;
-      erg = uv_pipe_open(p,fd);
-      if ( erg < 0 ){
-        h->finalize_called = 1;
-        handle_finalize_close(h);
-      }
+    malloc_uv_buf_t(&wp->buf,len,wp->cb_type);
+    if ( wp->buf.base == NULL ){
+      free_mem_uv_req_t(wp);
+      free_struct_req(wp);
+      CAMLreturn(VAL_UWT_INT_RESULT_ENOMEM);
     }
+    memcpy(wp->buf.base,base,len);
   }
+  erg = uv_udp_send((uv_udp_send_t*)wp->req,(uv_udp_t*)s->handle,&wp->buf,1,
+                    (struct sockaddr*)s->peer,udp_send_cb);
   if ( erg < 0 ){
-    Field(dc,1) = 0;
-    Tag_val(ret) = Error_tag;
-    Field(ret,0) = Val_uwt_error(erg);
+    if ( ba == 0 ){
+      free_uv_buf_t(&wp->buf,wp->cb_type);
+    }
+    free_mem_uv_req_t(wp);
+    free_struct_req(wp);
+    CAMLreturn(Val_uwt_int_result(erg));
   }
-  CAMLreturn(ret);
+  wp->c_cb = ret_unit_cparam;
+  wp->cb_type = s->cb_type;
+  wp->in_use = 1;
+  gr_root_register(&wp->cb,o_cb);
+  wp->finalize_called = 1;
+  ++s->in_use_cnt;
+  wp->buf_contains_ba = ba;
+  if ( ba ){
+    gr_root_register(&wp->sbuf,o_buf);
+  }
+  CAMLreturn(Val_long(0));
 }
-
+#else
 CAMLprim value
-uwt_pipe_init(value o_loop, value o_ipc)
+uwt_udp_connect_na(value o_udp, value o_sock)
 {
-  _Static_assert( Is_long(FD_INVALID) == 0 , "int representation has changed");
-  return (uwt_pipe_open(o_loop,FD_INVALID,o_ipc));
+  (void) o_udp;
+  (void) o_sock;
+  return VAL_UWT_INT_RESULT_ENOSYS;
 }
-#undef FD_INVALID
 
 CAMLprim value
-uwt_pipe_bind_na(value o_pipe, value o_name)
+uwt_udp_send_connected(value o_udp, value o_buf, value o_pos, value o_len,
+                       value o_cb)
 {
-  HANDLE_NINIT_NA(p,o_pipe);
-  if ( !uwt_is_safe_string(o_name) ){
-    return VAL_UWT_INT_RESULT_ECHARSET;
-  }
-  /* string duplicated by libuv */
-  int ret = uv_pipe_bind((uv_pipe_t*)p->handle,String_val(o_name));
-  if ( ret >= 0 ){
-    p->initialized = 1;
-  }
-  return (VAL_UWT_UNIT_RESULT(ret));
+  (void) o_udp;
+  (void) o_buf;
+  (void) o_pos;
+  (void) o_len;
+  (void) o_cb;
+  return VAL_UWT_INT_RESULT_ENOSYS;
 }
-
-CAMLprim value
-uwt_pipe_getsockname(value o_pipe)
-{
-  HANDLE_NO_UNINIT_CLOSED_WRAP(o_pipe);
-  CAMLparam1(o_pipe);
-  CAMLlocal1(o_str);
-  struct handle * op = Handle_val(o_pipe);
-  size_t s = 1024;
-  char name[s];
-  char * lname = NULL;
-  uv_pipe_t* p = (uv_pipe_t*)op->handle;
-  int erg = uv_pipe_getsockname(p,name,&s);
-  int etag;
-  if ( erg == UV_ENOBUFS ){
-    ++s;
-    lname = malloc(s);
-    if ( lname == NULL ){
-      erg = UV_ENOMEM;
-    }
-    else {
-      erg = uv_pipe_getsockname(p,lname,&s);
-    }
-  }
-  if ( erg < 0 ){
-    o_str = Val_uwt_error(erg);
-    etag = Error_tag;
-  }
-  else {
-    char * ms = lname ? lname : name;
-#if UV_VERSION_MAJOR < 1
-#error "libuv too old"
-#elif (UV_VERSION_MAJOR > 1) || ( UV_VERSION_MINOR > 2 )
-    o_str = caml_alloc_string(s);
-    memcpy(String_val(o_str),ms,s);
-#else
-    --s;
-    assert(ms[s] == '\0');
-    o_str =  caml_alloc_string(s);
-    memcpy(String_val(o_str),ms,s);
 #endif
-    etag = Ok_tag;
-  }
-  if ( lname ){
-    free(lname);
-  }
-  value ret = caml_alloc_small(1,etag);
-  Field(ret,0) = o_str;
-  CAMLreturn(ret);
-}
 
 CAMLprim value
-uwt_pipe_pending_instances_na(value o_pipe, value o_count)
+uwt_udp_set_membership_na(value o_udp, value o_mul,
+                          value o_int, value o_mem)
 {
-  HANDLE_NINIT_NA(op,o_pipe);
-  HANDLE_NO_UNINIT_NA(op);
-  uv_pipe_t* p = (uv_pipe_t*)op->handle;
-  uv_pipe_pending_instances(p,Long_val(o_count));
-  return (Val_long(0));
+  HANDLE_NINIT_NA(u,o_udp);
+  HANDLE_NO_UNINIT_NA(u);
+  uv_membership membership = Long_val(o_mem) ? UV_JOIN_GROUP : UV_LEAVE_GROUP;
+  const char* multicast_addr = String_val(o_mul);
+  const char* interface_addr = String_val(o_int);
+  int ret = uv_udp_set_membership((uv_udp_t*)u->handle,
+                                  multicast_addr,
+                                  interface_addr,
+                                  membership);
+  return (VAL_UWT_UNIT_RESULT(ret));
 }
 
 CAMLprim value
-uwt_pipe_pending_count_na(value o_pipe)
+uwt_udp_set_multicast_loop_na(value o_udp, value o_b)
 {
-  HANDLE_NINIT_NA(op,o_pipe);
-  HANDLE_NO_UNINIT_NA(op);
-  uv_pipe_t* p = (uv_pipe_t*)op->handle;
-  int ret = uv_pipe_pending_count(p);
-  return (VAL_UWT_INT_RESULT(ret));
+  HANDLE_NINIT_NA(u,o_udp);
+  HANDLE_NO_UNINIT_NA(u);
+  int ret = uv_udp_set_multicast_loop((uv_udp_t*)u->handle,Long_val(o_b));
+  return (VAL_UWT_UNIT_RESULT(ret));
 }
 
 CAMLprim value
-uwt_pipe_pending_type_na(value o_pipe)
+uwt_udp_set_multicast_ttl_na(value o_udp, value o_ttl)
 {
-  struct handle * h = Handle_val(o_pipe);
-  if ( HANDLE_IS_INVALID_UNINIT(h) ){
-    return (Val_long(0));
-  }
-  uv_handle_type x = uv_pipe_pending_type((uv_pipe_t*)h->handle);
-  switch( x ){
-  case UV_UNKNOWN_HANDLE: /*fall */
-  default: return (Val_long(0));
-  case UV_TCP: return (Val_long(1));
-  case UV_UDP: return (Val_long(2));
-  case UV_NAMED_PIPE: return (Val_long(3));
+  HANDLE_NINIT_NA(u,o_udp);
+  HANDLE_NO_UNINIT_NA(u);
+  int ttl = Long_val(o_ttl);
+  if ( ttl < 1 || ttl > 255 ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
   }
+  int ret = uv_udp_set_multicast_ttl((uv_udp_t*)u->handle,ttl);
+  return (VAL_UWT_UNIT_RESULT(ret));
 }
 
-static void
-pipe_tcp_connect_cb(uv_connect_t* req, int status)
+CAMLprim value
+uwt_udp_set_multicast_interface_na(value o_udp, value o_inter)
 {
-  struct handle * s = req->handle->data;
-  struct req * r = req->data;
-  if ( !s || !r ){
-    DEBUG_PF("leaking data");
-  }
-  else {
-    ++s->in_callback_cnt;
-    --s->in_use_cnt;
-    r->c_param = status;
-    if ( status >= 0 ){
-      s->initialized = 1;
-    }
-    universal_callback((void*)req);
-    --s->in_callback_cnt;
-    MAYBE_CLOSE_HANDLE(s);
+  HANDLE_NINIT_NA(u,o_udp);
+  HANDLE_NO_UNINIT_NA(u);
+  if ( !uwt_is_safe_string(o_inter) ){
+    return VAL_UWT_INT_RESULT_ECHARSET;
   }
+  int ret = uv_udp_set_multicast_interface((uv_udp_t*)u->handle,
+                                           String_val(o_inter));
+  return (VAL_UWT_UNIT_RESULT(ret));
 }
 
 CAMLprim value
-uwt_pipe_connect(value o_pipe,value o_path,value o_cb)
+uwt_udp_set_broadcast_na(value o_udp, value o_b)
 {
-  if ( !uwt_is_safe_string(o_path) ){
-    return VAL_UWT_INT_RESULT_ECHARSET;
-  }
-  HANDLE_NINIT(s,o_pipe,o_cb,o_path);
-  struct req * wp = req_create(UV_CONNECT,s->loop);
-  uv_pipe_t* tpipe = (uv_pipe_t*)s->handle;
-  uv_connect_t * req = (uv_connect_t*)wp->req;
-  /* pipe_connect is void in order to mimic the windows api,
-     the string won't be used internally, we don't need to create a copy */
-  uv_pipe_connect(req,tpipe,String_val(o_path),pipe_tcp_connect_cb);
-  wp->c_cb = ret_unit_cparam;
-  gr_root_register(&wp->cb,o_cb);
-  wp->in_use = 1;
-  wp->finalize_called = 1;
-  ++s->in_use_cnt;
-  CAMLreturn(Val_long(0));
+  HANDLE_NINIT_NA(u,o_udp);
+  HANDLE_NO_UNINIT_NA(u);
+  int ret = uv_udp_set_broadcast((uv_udp_t*)u->handle,Long_val(o_b));
+  return (VAL_UWT_UNIT_RESULT(ret));
 }
-/* }}} Pipe end */
 
-/* {{{ Tcp start */
-#define UDP_TCP_INIT(name,TYPE)                                         \
-  CAMLprim value                                                        \
-  uwt_ ## name ## _init(value o_loop)                                   \
-  {                                                                     \
-    INIT_LOOP_WRAP(l,o_loop);                                           \
-    CAMLparam1(o_loop);                                                 \
-    CAMLlocal1(v);                                                      \
-    v = handle_create(TYPE,l);                                          \
-    struct handle * h = Handle_val(v);                                  \
-    h->close_executed = 1;                                              \
-    value ret = caml_alloc_small(1,Ok_tag);                             \
-    Field(ret,0) = v;                                                   \
-    h->close_executed = 0;                                              \
-    int erg = uv_ ## name ## _init(&l->loop,                            \
-                                   (uv_ ## name ## _t*)h->handle);      \
-    if ( erg < 0 ){                                                     \
-      Field(v,1) = 0;                                                   \
-      Field(ret,0) = Val_uwt_error(erg);                                \
-      free_mem_uv_handle_t(h);                                          \
-      free_struct_handle(h);                                            \
-    }                                                                   \
-    CAMLreturn(ret);                                                    \
+CAMLprim value
+uwt_udp_set_ttl_na(value o_udp, value o_ttl)
+{
+  HANDLE_NINIT_NA(u,o_udp);
+  HANDLE_NO_UNINIT_NA(u);
+  int ttl = Long_val(o_ttl);
+  int ret;
+  if ( ttl < 1 || ttl > 255 ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
   }
+  ret = uv_udp_set_ttl((uv_udp_t*)u->handle,ttl);
+  return (VAL_UWT_UNIT_RESULT(ret));
+}
 
-UDP_TCP_INIT(tcp,UV_TCP)
-UDP_TCP_INIT(udp,UV_UDP)
-#undef UDP_TCP_INIT
-
+/*
+| Data of ( Bytes.t * sockaddr option)
+| Partial_data of ( Bytes.t * sockaddr option)
+| Empty_from of sockaddr
+| Transmission_error of error
+*/
+#define Data_of 0
+#define Partial_data 1
+#define Empty_from 2
+#define Transmission_error 3
 static value
-uwt_tcp_udp_open(value o_tcp, value o_fd, bool tcp)
+alloc_recv_result(ssize_t nread,
+                  const uv_buf_t* buf,
+                  const struct sockaddr* addr,
+                  unsigned int flags)
 {
-  HANDLE_NINIT_NA(t,o_tcp);
-  int ret;
-#ifndef _WIN32
-  uv_os_sock_t s = Long_val(o_fd);
-#else
-  uv_os_sock_t s;
-  if ( Descr_kind_val(o_fd) != KIND_SOCKET ){
-    ret = UV_UWT_EBADF;
-    goto endp;
+  CAMLparam0();
+  CAMLlocal3(param,msock_addr,bytes_t);
+  if ( nread > 0 && buf->base && buf->len >= (size_t)nread ){
+    if ( (size_t)nread > buf->len ){
+      param = caml_alloc_small(1,Transmission_error);
+      Field(param,0) = VAL_UWT_ERROR_UWT_EFATAL;
+    }
+    else {
+      int tag;
+      bytes_t = caml_alloc_string(nread);
+      memcpy(String_val(bytes_t),buf->base,nread);
+      if ( addr == NULL ){
+        msock_addr = Val_unit;
+      }
+      else {
+        param = uwt_alloc_sockaddr();
+        memcpy(SOCKADDR_VAL(param),addr,sizeof(struct sockaddr_storage));
+        msock_addr = caml_alloc_small(1,Some_tag);
+        Field(msock_addr,0) = param;
+      }
+      if ( (flags & UV_UDP_PARTIAL ) != 0 ){
+        tag = Partial_data;
+      }
+      else {
+        tag = Data_of;
+      }
+      param = caml_alloc_small(2,tag);
+      Field(param,0) = bytes_t;
+      Field(param,1) = msock_addr;
+    }
   }
-  s = Socket_val(o_fd);
-  t->orig_fd = CRT_fd_val(o_fd);
-#endif
-  if ( tcp ){
-    ret = uv_tcp_open((uv_tcp_t*)t->handle,s);
+  else if ( nread == 0 ){
+    assert(addr != NULL);
+    msock_addr = uwt_alloc_sockaddr();
+    memcpy(SOCKADDR_VAL(msock_addr),addr,sizeof(struct sockaddr_storage));
+    param = caml_alloc_small(1,Empty_from);
+    Field(param,0) = msock_addr;
   }
   else {
-    ret = uv_udp_open((uv_udp_t*)t->handle,s);
-  }
-  if ( ret >= 0 ){
-    t->initialized = 1;
+    param = caml_alloc_small(1,Transmission_error);
+    Field(param,0) = Val_uwt_error(nread);
   }
-#ifdef _WIN32
- endp:
-#endif
-  return (VAL_UWT_UNIT_RESULT(ret));
-}
-
-CAMLprim value
-uwt_tcp_open_na(value a, value b){
-  return (uwt_tcp_udp_open(a,b,true));
+  CAMLreturn(param);
 }
+#undef Data_of
+#undef Partial_data
+#undef Empty_from
+#undef Transmission_error
 
-CAMLprim value
-uwt_udp_open_na(value a, value b){
-  return (uwt_tcp_udp_open(a,b,false));
+static void
+uwt_udp_recv_cb(uv_udp_t* handle,
+                ssize_t nread,
+                const uv_buf_t* buf,
+                const struct sockaddr* addr,
+                unsigned int flags)
+{
+  HANDLE_CB_INIT_WITH_CLEAN(handle);
+  value exn = Val_unit;
+  bool buf_not_cleaned = true;
+  struct handle * uh = handle->data;
+  if ( uh->close_called == 0 ){
+    if ( uh->cb_read == CB_INVALID ){
+      DEBUG_PF("callback lost");
+    }
+    else {
+      /* nread == 0 && addr == NULL only means we need to clear
+         the buffer */
+      if ( nread != 0 || addr != NULL ){
+        /* connected: the sender is known */
+        const struct sockaddr * a = nread > 0 && uh->peer ? NULL : addr;
+        value p = alloc_recv_result(nread,buf,a,flags);
+        if ( nread > 0 ){
+          buf_not_cleaned = false;
+          free_uv_buf_t_const(buf,uh->cb_type);
+        }
+        exn = GET_CB_VAL(uh->cb_read);
+        exn = caml_callback_exn(exn,p);
+      }
+    }
+  }
+  if ( buf_not_cleaned && buf->base ){
+    free_uv_buf_t_const(buf,uh->cb_type);
+  }
+  HANDLE_CB_RET(exn);
 }
 
 CAMLprim value
-uwt_tcp_bind_na(value o_tcp, value o_sock, value o_flags)
+uwt_udp_recv_start(value o_udp, value o_cb)
 {
-  HANDLE_NINIT_NA(t,o_tcp);
-  struct sockaddr* addr = SOCKADDR_VAL(o_sock);
-  unsigned int flags = o_flags == Val_unit ? 0 : UV_TCP_IPV6ONLY;
-  int ret = uv_tcp_bind((uv_tcp_t *)t->handle,addr,flags);
-  if ( ret >= 0 ){
-    t->initialized = 1;
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_udp);
+  HANDLE_NINIT(u,o_udp,o_cb);
+  value ret;
+  if ( u->cb_read != CB_INVALID ){
+    ret = VAL_UWT_INT_RESULT_UWT_EBUSY;
+  }
+  else {
+    int erg = 0;
+    uv_udp_t* ux = (uv_udp_t*)u->handle;
+    if ( u->can_reuse_cb_read == 1 ){
+      u->can_reuse_cb_read = 0;
+      u->read_waiting = 0;
+      erg = uv_udp_recv_stop(ux);
+    }
+    if ( erg >= 0 ){
+      erg = uv_udp_recv_start(ux,
+                              read_start_alloc_cb,
+                              uwt_udp_recv_cb);
+      if ( erg >= 0 ){
+        u->c_read_size = DEF_ALLOC_SIZE;
+        gr_root_register(&u->cb_read,o_cb);
+        ++u->in_use_cnt;
+      }
+    }
+    ret = VAL_UWT_UNIT_RESULT(erg);
   }
-  return (VAL_UWT_UNIT_RESULT(ret));
-}
-
-CAMLprim value
-uwt_tcp_nodelay_na(value o_tcp,value o_enable)
-{
-  HANDLE_NINIT_NA(th,o_tcp);
-  /* uninit allowed */
-  uv_tcp_t * t = (uv_tcp_t *)th->handle;
-  int ret = uv_tcp_nodelay(t,Long_val(o_enable));
-  return (VAL_UWT_UNIT_RESULT(ret));
+  CAMLreturn(ret);
 }
 
 CAMLprim value
-uwt_tcp_keepalive_na(value o_tcp,value o_enable, value o_delay)
+uwt_udp_recv_stop(value o_udp, value o_abort)
 {
-  HANDLE_NINIT_NA(th,o_tcp);
-  /* uninit allowed */
-  uv_tcp_t * t = (uv_tcp_t *)th->handle;
-  int ret = uv_tcp_keepalive(t,Long_val(o_enable),Long_val(o_delay));
-  return (VAL_UWT_UNIT_RESULT(ret));
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_udp);
+  HANDLE_NINIT(u,o_udp);
+  value ret;
+  if ( u->cb_read == CB_INVALID ||
+       (u->read_waiting == 1 && Long_val(o_abort) == 0 )){
+    ret = VAL_UWT_INT_RESULT_UWT_ENOTACTIVE;
+  }
+  else {
+    const int erg = uv_udp_recv_stop((uv_udp_t*)u->handle);
+    if ( erg >= 0 ){
+      u->can_reuse_cb_read = 0;
+      if ( u->in_use_cnt ){
+        --u->in_use_cnt;
+      }
+      gr_root_unregister(&u->cb_read);
+      if ( u->recv_batch == 1 ){
+        recv_batch_remove(u);
+        recv_mmsg_stop(u);
+        gr_root_unregister(&u->obuf);
+        u->recv_batch = 0;
+        u->rb_fill = 0;
+        u->ba_read = NULL;
+      }
+    }
+    ret = VAL_UWT_UNIT_RESULT(erg);
+  }
+  CAMLreturn(ret);
 }
 
-CAMLprim value
-uwt_tcp_simultaneous_accepts_na(value o_tcp,value o_enable)
+static void
+uwt_udp_recv_own_cb(uv_udp_t* handle,
+                    ssize_t nread,
+                    const uv_buf_t* buf,
+                    const struct sockaddr* addr,
+                    unsigned int flags)
 {
-  HANDLE_NINIT_NA(th,o_tcp);
-  /* uninit allowed */
-  uv_tcp_t * t = (uv_tcp_t *)th->handle;
-  int ret = uv_tcp_simultaneous_accepts(t,Long_val(o_enable));
-  return (VAL_UWT_UNIT_RESULT(ret));
+  HANDLE_CB_INIT_WITH_CLEAN(handle);
+  value exn = Val_unit;
+  bool buf_not_cleaned = true;
+  struct handle * uh = handle->data;
+  const int read_ba = uh->use_read_ba;
+  if ( uh->close_called == 0 ){
+    if (unlikely( uh->cb_read == CB_INVALID ||
+                  uh->obuf == CB_INVALID )){
+      DEBUG_PF("callback lost");
+    }
+    else {
+      /* nread == 0 && addr == NULL only means we need to clear
+         the buffer */
+      if ( nread != 0 || addr != NULL ){
+        value param;
+        uh->read_waiting = 0;
+        if ( nread < 0 ){
+          param = caml_alloc_small(1,Error_tag);
+          Field(param,0) = Val_uwt_error(nread);
+        }
+        else {
+          value triple = Val_unit;
+          value sockaddr = Val_unit;
+          value is_partial;
+          param = Val_unit;
+          Begin_roots3(triple,sockaddr,param);
+          if ( addr != NULL && uh->recv_no_addr == 0 ){
+            param = uwt_alloc_sockaddr();
+            memcpy(SOCKADDR_VAL(param),addr,sizeof(struct sockaddr_storage));
+            sockaddr = caml_alloc_small(1,Some_tag);
+            Field(sockaddr,0) = param;
+          }
+          if ( flags & UV_UDP_PARTIAL ){
+            is_partial = Val_long(1);
+          }
+          else {
+            is_partial = Val_long(0);
+          }
+          if ( nread != 0 && read_ba == 0 ){
+            value o = GET_CB_VAL(uh->obuf);
+            assert( Tag_val(o) == String_tag );
+            size_t len = UMIN(uh->c_read_size,(size_t)nread);
+            memcpy(String_val(o) + uh->obuf_offset,
+                   buf->base,
+                   len);
+            buf_not_cleaned = false;
+            free_uv_buf_t_const(buf,uh->cb_type);
+          }
+          triple = caml_alloc_small(3,0);
+          Field(triple,0) = Val_long(nread);
+          Field(triple,1) = is_partial;
+          Field(triple,2) = sockaddr;
+          param = caml_alloc_small(1,Ok_tag);
+          Field(param,0) = triple;
+          End_roots();
+        }
+        exn = GET_CB_VAL(uh->cb_read);
+        uh->can_reuse_cb_read = 1;
+        gr_root_unregister(&uh->cb_read);
+        gr_root_unregister(&uh->obuf);
+        if ( uh->in_use_cnt ){
+          uh->in_use_cnt--;
+        }
+        exn = caml_callback2_exn(*uwt_global_wakeup,exn,param);
+        if ( uh->close_called == 0 && uh->can_reuse_cb_read == 1 ){
+          uv_udp_recv_stop(handle);
+          uh->can_reuse_cb_read = 0;
+        }
+      }
+    }
+  }
+  if ( read_ba == 0 && buf_not_cleaned && buf->base ){
+    free_uv_buf_t_const(buf,uh->cb_type);
+  }
+  HANDLE_CB_RET(exn);
 }
 
-typedef int (*getsock_f)(uv_handle_t *, struct sockaddr*, int *);
 static value
-uwt_tcp_getsockpeername(value o_tcp, getsock_f func)
+udp_recv_own(value o_udp,value o_buf,value o_offset,value o_len,value o_cb,
+             bool with_addr)
 {
-  HANDLE_NO_UNINIT_CLOSED_WRAP(o_tcp);
-  CAMLparam1(o_tcp);
-  CAMLlocal1(sock);
+  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_udp);
+  HANDLE_NINIT(u,o_udp,o_buf,o_cb);
+  const int ba = Tag_val(o_buf) != String_tag;
   value ret;
-  struct handle * th = Handle_val(o_tcp);
-  uv_handle_t * t = th->handle;
-  int s = sizeof(struct sockaddr_storage);
-  int r;
-  sock = uwt_alloc_sockaddr();
-  ret = caml_alloc_small(1,Ok_tag);
-  Field(ret,0) = sock;
-  r = func(t,SOCKADDR_VAL(sock),&s);
-  if ( r < 0 ){
-    Tag_val(ret) = Error_tag;
-    Field(ret,0) = Val_uwt_error(r);
+  assert( u->cb_type == CB_LWT );
+  if ( u->cb_read != CB_INVALID ){
+    ret = VAL_UWT_INT_RESULT_UWT_EBUSY;
+  }
+  else {
+    int erg;
+    uv_udp_t* ux = (uv_udp_t*)u->handle;
+    if ( u->can_reuse_cb_read == 1 ){
+      u->can_reuse_cb_read = 0;
+      erg = 0;
+    }
+    else {
+      erg = uv_udp_recv_start(ux,alloc_read_own,uwt_udp_recv_own_cb);
+    }
+    if ( erg >= 0 ){
+      const unsigned int len = Long_val(o_len);
+      const unsigned int offset = Long_val(o_offset);
+      gr_root_register(&u->cb_read,o_cb);
+      gr_root_register(&u->obuf,o_buf);
+      ++u->in_use_cnt;
+      u->c_read_size = len;
+      u->use_read_ba = ba;
+      u->read_waiting = 1;
+      u->recv_no_addr = !with_addr;
+      if ( ba == 0 ){
+        u->obuf_offset = offset;
+      }
+      else {
+        u->ba_read = Ba_buf_val(o_buf) + offset;
+      }
+    }
+    ret = VAL_UWT_UNIT_RESULT(erg);
   }
   CAMLreturn(ret);
 }
 
 CAMLprim value
-uwt_tcp_getsockname(value o_tcp)
+uwt_udp_recv_own(value o_udp,value o_buf,value o_offset,value o_len,value o_cb)
 {
-  return (uwt_tcp_getsockpeername(o_tcp,(getsock_f)uv_tcp_getsockname));
+  return (udp_recv_own(o_udp,o_buf,o_offset,o_len,o_cb,true));
 }
 
+/* like uwt_udp_recv_own, but without sockaddr (Udp.recv_connected) */
 CAMLprim value
-uwt_tcp_getpeername(value o_tcp)
+uwt_udp_recv_connected(value o_udp,value o_buf,value o_offset,value o_len,
+                       value o_cb)
 {
-  return (uwt_tcp_getsockpeername(o_tcp,(getsock_f)uv_tcp_getpeername));
+  return (udp_recv_own(o_udp,o_buf,o_offset,o_len,o_cb,false));
 }
 
 CAMLprim value
-uwt_udp_getsockname(value o_tcp)
+uwt_udp_send_queue_size_na(value o_udp)
 {
-  return (uwt_tcp_getsockpeername(o_tcp,(getsock_f)uv_udp_getsockname));
+  value ret;
+  struct handle * h = Handle_val(o_udp);
+  if ( HANDLE_IS_INVALID_UNINIT(h) ){
+    ret = Val_long(0);
+  }
+  else {
+    uv_udp_t* u = (uv_udp_t*)h->handle;
+    ret = Val_long((intnat)u->send_queue_size);
+  }
+  return ret;
 }
 
 CAMLprim value
-uwt_tcp_connect(value o_tcp,value o_sock,value o_cb)
+uwt_udp_send_queue_count_na(value o_udp)
 {
-  HANDLE_NINIT(s,o_tcp,o_sock,o_cb);
-  struct req * wp = req_create(UV_CONNECT,s->loop);
-  uv_tcp_t* tcp = (uv_tcp_t*)s->handle;
-  uv_connect_t * req = (uv_connect_t*)wp->req;
-
-  const int ret = uv_tcp_connect(req, tcp,
-                                 SOCKADDR_VAL(o_sock),
-                                 pipe_tcp_connect_cb);
-  if ( ret >= 0 ){
-    wp->c_cb = ret_unit_cparam;
-    gr_root_register(&wp->cb,o_cb);
-    wp->in_use = 1;
-    wp->finalize_called = 1;
-    ++s->in_use_cnt;
+  value ret;
+  struct handle * h = Handle_val(o_udp);
+  if ( HANDLE_IS_INVALID_UNINIT(h) ){
+    ret = Val_long(0);
   }
   else {
-    free_mem_uv_req_t(wp);
-    free_struct_req(wp);
+    uv_udp_t* u = (uv_udp_t*)h->handle;
+    ret = Val_long((intnat)u->send_queue_count);
   }
-  CAMLreturn(VAL_UWT_UNIT_RESULT(ret));
+  return ret;
 }
-/* }}} Tcp end */
 
-/* {{{ Udp start */
-/* some functions are defined together with tcp or stream! */
-static const int udp_bin_flag_table[2] = {
-  UV_UDP_IPV6ONLY, UV_UDP_REUSEADDR
+/*
+  Udp.send_many: o_msgs is a (iovec * sockaddr) array. If the send queue
+  is empty, the datagrams are passed to sendmmsg(2) directly, chunk by
+  chunk. The remaining ones (the socket buffer is full, or sendmmsg is
+  not available) are queued with uv_udp_send. The status of every
+  message is stored in o_results (an int array, initialized with 0).
+  Returns the number of queued messages, o_cb is woken up, when all of
+  them have been sent.
+*/
+#define SEND_MANY_CHUNK 64
+
+struct send_many {
+  unsigned int pending;
+  cb_t cb;
+  cb_t results;
+  cb_t msgs; /* keeps the bigarrays alive */
 };
 
-CAMLprim value
-uwt_udp_bind_na(value o_udp, value o_sock, value o_flags){
-  HANDLE_NINIT_NA(t,o_udp);
-  struct sockaddr* addr = SOCKADDR_VAL(o_sock);
-  const unsigned int flags = SAFE_CONVERT_FLAG_LIST(o_flags,udp_bin_flag_table);
-  int ret = uv_udp_bind((uv_udp_t *)t->handle,addr,flags);
-  if ( ret >= 0 ){
-    t->initialized = 1;
+static void
+send_many_cb(uv_udp_send_t * req, int status)
+{
+  struct req * wp = req->data;
+  struct send_many * j = wp->c.p1;
+  const uintnat i = (uintnat)wp->c.p2;
+  struct handle * h = req->handle->data;
+  GET_RUNTIME();
+  if ( status < 0 ){
+    Field(GET_CB_VAL(j->results),i) = Val_uwt_int_result(status);
+  }
+  req_free(wp);
+  --h->in_use_cnt;
+  ++h->in_callback_cnt;
+  if ( --j->pending == 0 ){
+    value exn = GET_CB_VAL(j->cb);
+    gr_root_unregister(&j->cb);
+    gr_root_unregister(&j->results);
+    gr_root_unregister(&j->msgs);
+    free(j);
+    exn = caml_callback2_exn(*uwt_global_wakeup,exn,Val_long(0));
+    if (unlikely( Is_exception_result(exn) )){
+      add_exception(h->loop,exn);
+    }
+  }
+  write_queue_wake(h);
+  --h->in_callback_cnt;
+  MAYBE_CLOSE_HANDLE(h);
+}
+
+#if defined(HAVE_SENDMMSG) && !defined(_WIN32)
+/* returns the index of the first message, that must be queued */
+static size_t
+send_many_direct(struct handle * h, value o_msgs, value o_results)
+{
+  struct mmsghdr hdr[SEND_MANY_CHUNK];
+  struct iovec iov[SEND_MANY_CHUNK];
+  const size_t n = Wosize_val(o_msgs);
+  size_t i = 0;
+  uv_os_fd_t fd;
+  if ( ((uv_udp_t*)h->handle)->send_queue_count != 0 ||
+       uv_fileno(h->handle,&fd) < 0 ){
+    /* keep the order / not yet bound */
+    return 0;
+  }
+  while ( i < n ){
+    const size_t k = UMIN(n - i, (size_t)SEND_MANY_CHUNK);
+    size_t m;
+    int r;
+    for ( m = 0; m < k; ++m ){
+      value v = Field(o_msgs,i + m);
+      value o_iov = Field(v,0);
+      struct sockaddr * addr = SOCKADDR_VAL(Field(v,1));
+      value o_buf = Iovec_buf(o_iov);
+      iov[m].iov_base = (IOVEC_IS_BA(o_iov) ? Ba_buf_val(o_buf) :
+                         String_val(o_buf)) + Iovec_pos(o_iov);
+      iov[m].iov_len = Iovec_len(o_iov);
+      memset(&hdr[m],0,sizeof hdr[m]);
+      hdr[m].msg_hdr.msg_name = addr;
+      hdr[m].msg_hdr.msg_namelen = sockaddr_len(addr);
+      hdr[m].msg_hdr.msg_iov = &iov[m];
+      hdr[m].msg_hdr.msg_iovlen = 1;
+    }
+    r = sendmmsg(fd,hdr,k,0);
+    if ( r > 0 ){
+      i += r;
+    }
+    else if ( r == 0 ){
+      break;
+    }
+    else if ( errno == EINTR ){
+      continue;
+    }
+    else if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS ){
+      break;
+    }
+    else {
+      /* the first message of the chunk has failed */
+      Field(o_results,i) = Val_uwt_int_result(-errno);
+      ++i;
+    }
   }
-  return (VAL_UWT_UNIT_RESULT(ret));
+  return i;
 }
-
-CAMLprim value
-uwt_udp_set_membership_na(value o_udp, value o_mul,
-                          value o_int, value o_mem)
+#else
+static size_t
+send_many_direct(struct handle * h, value o_msgs, value o_results)
 {
-  HANDLE_NINIT_NA(u,o_udp);
-  HANDLE_NO_UNINIT_NA(u);
-  uv_membership membership = Long_val(o_mem) ? UV_JOIN_GROUP : UV_LEAVE_GROUP;
-  const char* multicast_addr = String_val(o_mul);
-  const char* interface_addr = String_val(o_int);
-  int ret = uv_udp_set_membership((uv_udp_t*)u->handle,
-                                  multicast_addr,
-                                  interface_addr,
-                                  membership);
-  return (VAL_UWT_UNIT_RESULT(ret));
+  (void) h;
+  (void) o_msgs;
+  (void) o_results;
+  return 0;
 }
+#endif
 
 CAMLprim value
-uwt_udp_set_multicast_loop_na(value o_udp, value o_b)
+uwt_udp_send_many(value o_udp, value o_msgs, value o_results, value o_cb)
 {
-  HANDLE_NINIT_NA(u,o_udp);
-  HANDLE_NO_UNINIT_NA(u);
-  int ret = uv_udp_set_multicast_loop((uv_udp_t*)u->handle,Long_val(o_b));
-  return (VAL_UWT_UNIT_RESULT(ret));
+  HANDLE_NINIT(s,o_udp,o_msgs,o_results,o_cb);
+  const size_t n = Wosize_val(o_msgs);
+  struct send_many * j;
+  size_t i;
+  if ( n == 0 ){
+    CAMLreturn(Val_long(0));
+  }
+  i = send_many_direct(s,o_msgs,o_results);
+  if ( i == n ){
+    s->initialized = 1;
+    CAMLreturn(Val_long(0));
+  }
+  j = malloc(sizeof *j);
+  if ( j == NULL ){
+    CAMLreturn(VAL_UWT_INT_RESULT_ENOMEM);
+  }
+  j->pending = 0;
+  j->cb = CB_INVALID;
+  j->results = CB_INVALID;
+  j->msgs = CB_INVALID;
+  for ( ; i < n ; ++i ){
+    value v = Field(o_msgs,i);
+    value o_iov = Field(v,0);
+    value o_buf = Iovec_buf(o_iov);
+    const size_t len = Iovec_len(o_iov);
+    const int ba = IOVEC_IS_BA(o_iov);
+    struct req * wp;
+    int erg = udp_queue_admit(s,len);
+    if ( erg != 0 ){
+      /* send_many doesn't wait, WQ_BLOCK is treated like WQ_FAIL */
+      if ( erg < 0 ){
+        Field(o_results,i) = VAL_UWT_INT_RESULT_ENOBUFS;
+      }
+      continue;
+    }
+    wp = req_create_na(UV_UDP_SEND,s->loop);
+    if ( wp == NULL ){
+      Field(o_results,i) = VAL_UWT_INT_RESULT_ENOMEM;
+      continue;
+    }
+    if ( ba ){
+      wp->buf.base = Ba_buf_val(o_buf) + Iovec_pos(o_iov);
+      wp->buf.len = len;
+      wp->buf_contains_ba = 1;
+    }
+    else if ( len != 0 ){
+      malloc_uv_buf_t(&wp->buf,len,wp->cb_type);
+      if ( wp->buf.base == NULL ){
+        req_free(wp);
+        Field(o_results,i) = VAL_UWT_INT_RESULT_ENOMEM;
+        continue;
+      }
+      memcpy(wp->buf.base,String_val(o_buf) + Iovec_pos(o_iov),len);
+    }
+    wp->c.p1 = j;
+    wp->c.p2 = (void*)(uintnat)i;
+    erg = uv_udp_send((uv_udp_send_t*)wp->req,(uv_udp_t*)s->handle,
+                      &wp->buf,1,SOCKADDR_VAL(Field(v,1)),send_many_cb);
+    if ( erg < 0 ){
+      req_free(wp);
+      Field(o_results,i) = Val_uwt_int_result(erg);
+    }
+    else {
+      wp->in_use = 1;
+      ++s->in_use_cnt;
+      ++j->pending;
+    }
+  }
+  s->initialized = 1;
+  if ( j->pending == 0 ){
+    free(j);
+    CAMLreturn(Val_long(0));
+  }
+  gr_root_register(&j->cb,o_cb);
+  gr_root_register(&j->results,o_results);
+  gr_root_register(&j->msgs,o_msgs);
+  CAMLreturn(Val_long(j->pending));
 }
 
+/*
+  Udp.send_gso: one sendmsg(2) call with an UDP_SEGMENT cmsg, the kernel
+  splits the buffer into datagrams of o_seg bytes. Returns the number of
+  bytes sent, UWT_EAGAIN (try again later / use the fallback, e.g.
+  the send queue isn't empty) or ENOSYS, if the kernel doesn't support
+  it. uwt.ml sends the rest with send_many in these cases.
+*/
+#if defined(__linux__) && defined(HAVE_NETINET_IN_H)
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#define GSO_MAX_SEGMENTS 64
+#define GSO_MAX_PAYLOAD 65507
+
+static bool gso_unsupported = false;
+
 CAMLprim value
-uwt_udp_set_multicast_ttl_na(value o_udp, value o_ttl)
-{
-  HANDLE_NINIT_NA(u,o_udp);
-  HANDLE_NO_UNINIT_NA(u);
-  int ttl = Long_val(o_ttl);
-  if ( ttl < 1 || ttl > 255 ){
-    return VAL_UWT_INT_RESULT_UWT_EINVAL;
+uwt_udp_try_send_gso_native(value o_udp, value o_buf, value o_pos, value o_len,
+                        value o_seg, value o_sock)
+{
+  HANDLE_NINIT_NA(s,o_udp);
+  struct sockaddr * addr = SOCKADDR_VAL(o_sock);
+  const char * base = (Tag_val(o_buf) != String_tag ? Ba_buf_val(o_buf) :
+                       String_val(o_buf)) + Long_val(o_pos);
+  const size_t len = Long_val(o_len);
+  const uint16_t seg = Long_val(o_seg);
+  /* the whole super-datagram must fit into one UDP packet */
+  const size_t chunk = UMIN((size_t)seg * GSO_MAX_SEGMENTS,
+                            (size_t)(GSO_MAX_PAYLOAD / seg) * seg);
+  size_t sent = 0;
+  uv_os_fd_t fd;
+  if ( gso_unsupported ){
+    return VAL_UWT_INT_RESULT_ENOSYS;
+  }
+  if ( ((uv_udp_t*)s->handle)->send_queue_count != 0 ||
+       uv_fileno(s->handle,&fd) < 0 ){
+    return VAL_UWT_INT_RESULT_EAGAIN;
+  }
+  while ( sent < len ){
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr * cm;
+    ssize_t r;
+    iov.iov_base = (char*)base + sent;
+    iov.iov_len = UMIN(len - sent, chunk);
+    memset(&msg,0,sizeof msg);
+    memset(control,0,sizeof control);
+    msg.msg_name = addr;
+    msg.msg_namelen = sockaddr_len(addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cm),&seg,sizeof seg);
+    r = sendmsg(fd,&msg,0);
+    if ( r >= 0 ){
+      sent += r;
+    }
+    else if ( errno == EINTR ){
+      continue;
+    }
+    else if ( errno == EINVAL || errno == ENOPROTOOPT || errno == EIO ||
+              errno == EOPNOTSUPP ){
+      /* EIO: no checksum offload for the device */
+      if ( errno != EINVAL ){
+        gso_unsupported = true;
+      }
+      return (sent > 0 ? Val_long(sent) : VAL_UWT_INT_RESULT_ENOSYS);
+    }
+    else if ( sent > 0 ){
+      break;
+    }
+    else if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS ){
+      return VAL_UWT_INT_RESULT_EAGAIN;
+    }
+    else {
+      return (Val_uwt_int_result(-errno));
+    }
   }
-  int ret = uv_udp_set_multicast_ttl((uv_udp_t*)u->handle,ttl);
-  return (VAL_UWT_UNIT_RESULT(ret));
+  return (Val_long(sent));
 }
-
+#undef GSO_MAX_SEGMENTS
+#undef GSO_MAX_PAYLOAD
+#else
 CAMLprim value
-uwt_udp_set_multicast_interface_na(value o_udp, value o_inter)
+uwt_udp_try_send_gso_native(value o_udp, value o_buf, value o_pos, value o_len,
+                        value o_seg, value o_sock)
+{
+  (void) o_udp;
+  (void) o_buf;
+  (void) o_pos;
+  (void) o_len;
+  (void) o_seg;
+  (void) o_sock;
+  return VAL_UWT_INT_RESULT_ENOSYS;
+}
+#endif
+BYTE_WRAP6(uwt_udp_try_send_gso)
+
+/*
+  Udp.recv_batch_start: the datagrams are received into the slots of a
+  bigarray, one datagram per slot. obuf roots the OCaml record:
+  type recv_batch = {
+    rb_buf: buf;
+    rb_slot_size: int;
+    rb_lens: Int_result.int array;
+    rb_flags: int array;
+    rb_addrs: sockaddr array;
+    rb_segs: int array;
+  }
+  The callback (cb_read) is called once per loop iteration with the
+  number of used slots - or earlier, if all slots are used.
+
+  libuv calls recvmsg once per datagram. On Linux, a duplicate of the
+  socket is therefore watched with an uv_poll_t handle instead, and
+  the free slots are filled with a single recvmmsg call. libuv's own
+  receive function is not started meanwhile. This path also supports
+  UDP_GRO: a slot can then contain several datagrams of rb_segs.(i)
+  bytes, that the kernel has coalesced.
+*/
+#define RB_BUF 0
+#define RB_LENS 2
+#define RB_FLAGS 3
+#define RB_ADDRS 4
+#define RB_SEGS 5
+#define RB_FLAG_PARTIAL 1
+
+static struct handle ** recv_batch_pending = NULL;
+static unsigned int recv_batch_pending_n = 0;
+static unsigned int recv_batch_pending_size = 0;
+static uv_check_t recv_batch_check;
+static bool recv_batch_check_init = false;
+
+static void
+recv_batch_remove(struct handle * h)
 {
-  HANDLE_NINIT_NA(u,o_udp);
-  HANDLE_NO_UNINIT_NA(u);
-  if ( !uwt_is_safe_string(o_inter) ){
-    return VAL_UWT_INT_RESULT_ECHARSET;
+  if ( h->rb_queued == 1 ){
+    struct handle * last = recv_batch_pending[--recv_batch_pending_n];
+    recv_batch_pending[h->rb_idx] = last;
+    last->rb_idx = h->rb_idx;
+    h->rb_queued = 0;
+    if ( recv_batch_pending_n == 0 ){
+      uv_check_stop(&recv_batch_check);
+    }
   }
-  int ret = uv_udp_set_multicast_interface((uv_udp_t*)u->handle,
-                                           String_val(o_inter));
-  return (VAL_UWT_UNIT_RESULT(ret));
 }
 
-CAMLprim value
-uwt_udp_set_broadcast_na(value o_udp, value o_b)
+/* must be called with the runtime */
+static value
+recv_batch_deliver(struct handle * h)
 {
-  HANDLE_NINIT_NA(u,o_udp);
-  HANDLE_NO_UNINIT_NA(u);
-  int ret = uv_udp_set_broadcast((uv_udp_t*)u->handle,Long_val(o_b));
-  return (VAL_UWT_UNIT_RESULT(ret));
+  const unsigned int n = h->rb_fill;
+  value ret = Val_unit;
+  recv_batch_remove(h);
+  h->rb_fill = 0;
+  if ( n != 0 && h->cb_read != CB_INVALID ){
+    ret = caml_callback_exn(GET_CB_VAL(h->cb_read),Val_long(n));
+  }
+  return ret;
 }
 
-CAMLprim value
-uwt_udp_set_ttl_na(value o_udp, value o_ttl)
+static void
+recv_batch_check_cb(uv_check_t * x)
 {
-  HANDLE_NINIT_NA(u,o_udp);
-  HANDLE_NO_UNINIT_NA(u);
-  int ttl = Long_val(o_ttl);
-  int ret;
-  if ( ttl < 1 || ttl > 255 ){
-    return VAL_UWT_INT_RESULT_UWT_EINVAL;
+  (void) x;
+  GET_RUNTIME();
+  while ( recv_batch_pending_n > 0 ){
+    struct handle * h = recv_batch_pending[recv_batch_pending_n - 1];
+    value exn;
+    ++h->in_callback_cnt;
+    exn = recv_batch_deliver(h);
+    if (unlikely( Is_exception_result(exn) )){
+      add_exception(h->loop,exn);
+    }
+    --h->in_callback_cnt;
+    MAYBE_CLOSE_HANDLE(h);
   }
-  ret = uv_udp_set_ttl((uv_udp_t*)u->handle,ttl);
-  return (VAL_UWT_UNIT_RESULT(ret));
 }
 
-/*
-| Data of ( Bytes.t * sockaddr option)
-| Partial_data of ( Bytes.t * sockaddr option)
-| Empty_from of sockaddr
-| Transmission_error of error
-*/
-#define Data_of 0
-#define Partial_data 1
-#define Empty_from 2
-#define Transmission_error 3
+/* rb_fill was increased. Must be called with the runtime */
 static value
-alloc_recv_result(ssize_t nread,
-                  const uv_buf_t* buf,
-                  const struct sockaddr* addr,
-                  unsigned int flags)
-{
-  CAMLparam0();
-  CAMLlocal3(param,msock_addr,bytes_t);
-  if ( nread > 0 && buf->base && buf->len >= (size_t)nread ){
-    if ( (size_t)nread > buf->len ){
-      param = caml_alloc_small(1,Transmission_error);
-      Field(param,0) = VAL_UWT_ERROR_UWT_EFATAL;
-    }
-    else {
-      int tag;
-      bytes_t = caml_alloc_string(nread);
-      memcpy(String_val(bytes_t),buf->base,nread);
-      if ( addr == NULL ){
-        msock_addr = Val_unit;
-      }
-      else {
-        param = uwt_alloc_sockaddr();
-        memcpy(SOCKADDR_VAL(param),addr,sizeof(struct sockaddr_storage));
-        msock_addr = caml_alloc_small(1,Some_tag);
-        Field(msock_addr,0) = param;
+recv_batch_filled(struct handle * h)
+{
+  if ( h->rb_fill == h->rb_slots ){
+    return (recv_batch_deliver(h));
+  }
+  if ( h->rb_queued == 0 ){
+    if (unlikely( recv_batch_pending_n == recv_batch_pending_size )){
+      const unsigned int nsize = recv_batch_pending_size == 0 ?
+        STACK_START_SIZE : recv_batch_pending_size * 2;
+      struct handle ** p = realloc(recv_batch_pending,nsize * sizeof *p);
+      if ( p == NULL ){
+        return (recv_batch_deliver(h));
       }
-      if ( (flags & UV_UDP_PARTIAL ) != 0 ){
-        tag = Partial_data;
-      }
-      else {
-        tag = Data_of;
-      }
-      param = caml_alloc_small(2,tag);
-      Field(param,0) = bytes_t;
-      Field(param,1) = msock_addr;
+      recv_batch_pending = p;
+      recv_batch_pending_size = nsize;
+    }
+    if ( recv_batch_pending_n == 0 ){
+      uv_check_start(&recv_batch_check,recv_batch_check_cb);
     }
+    h->rb_idx = recv_batch_pending_n;
+    recv_batch_pending[recv_batch_pending_n++] = h;
+    h->rb_queued = 1;
   }
-  else if ( nread == 0 ){
-    assert(addr != NULL);
-    msock_addr = uwt_alloc_sockaddr();
-    memcpy(SOCKADDR_VAL(msock_addr),addr,sizeof(struct sockaddr_storage));
-    param = caml_alloc_small(1,Empty_from);
-    Field(param,0) = msock_addr;
+  return Val_unit;
+}
+
+static void
+recv_batch_alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
+{
+  struct handle * h;
+  (void) suggested_size;
+  if (unlikely( !handle || (h = handle->data) == NULL ||
+                h->rb_fill >= h->rb_slots )){
+    buf->len = 0;
+    buf->base = NULL;
   }
   else {
-    param = caml_alloc_small(1,Transmission_error);
-    Field(param,0) = Val_uwt_error(nread);
+    buf->base = (char*)h->ba_read + (size_t)h->rb_fill * h->c_read_size;
+    buf->len = h->c_read_size;
   }
-  CAMLreturn(param);
 }
-#undef Data_of
-#undef Partial_data
-#undef Empty_from
-#undef Transmission_error
 
 static void
-uwt_udp_recv_cb(uv_udp_t* handle,
-                ssize_t nread,
-                const uv_buf_t* buf,
-                const struct sockaddr* addr,
-                unsigned int flags)
+recv_batch_recv_cb(uv_udp_t* handle,
+                   ssize_t nread,
+                   const uv_buf_t* buf,
+                   const struct sockaddr* addr,
+                   unsigned int flags)
 {
   HANDLE_CB_INIT_WITH_CLEAN(handle);
   value exn = Val_unit;
-  bool buf_not_cleaned = true;
-  struct handle * uh = handle->data;
-  if ( uh->close_called == 0 ){
-    if ( uh->cb_read == CB_INVALID ){
-      DEBUG_PF("callback lost");
+  struct handle * h = handle->data;
+  (void) buf;
+  if ( h->close_called == 0 && h->recv_batch == 1 &&
+       (nread != 0 || addr != NULL) && h->rb_fill < h->rb_slots ){
+    value rb = GET_CB_VAL(h->obuf);
+    const unsigned int i = h->rb_fill;
+    intnat fl = 0;
+    if ( nread < 0 ){
+      Field(Field(rb,RB_LENS),i) = Val_uwt_int_result(nread);
     }
     else {
-      /* nread == 0 && addr == NULL only means we need to clear
-         the buffer */
-      if ( nread != 0 || addr != NULL ){
-        value p = alloc_recv_result(nread,buf,addr,flags);
-        if ( nread > 0 ){
-          buf_not_cleaned = false;
-          free_uv_buf_t_const(buf,uh->cb_type);
-        }
-        exn = GET_CB_VAL(uh->cb_read);
-        exn = caml_callback_exn(exn,p);
+      Field(Field(rb,RB_LENS),i) = Val_long(nread);
+      if ( (flags & UV_UDP_PARTIAL) != 0 ){
+        fl |= RB_FLAG_PARTIAL;
+      }
+      if ( addr != NULL ){
+        memcpy(SOCKADDR_VAL(Field(Field(rb,RB_ADDRS),i)),addr,
+               sizeof(struct sockaddr_storage));
       }
     }
-  }
-  if ( buf_not_cleaned && buf->base ){
-    free_uv_buf_t_const(buf,uh->cb_type);
+    Field(Field(rb,RB_FLAGS),i) = Val_long(fl);
+    Field(Field(rb,RB_SEGS),i) = Val_long(0);
+    ++h->rb_fill;
+    exn = recv_batch_filled(h);
   }
   HANDLE_CB_RET(exn);
 }
 
-CAMLprim value
-uwt_udp_recv_start(value o_udp, value o_cb)
-{
-  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_udp);
-  HANDLE_NINIT(u,o_udp,o_cb);
-  value ret;
-  if ( u->cb_read != CB_INVALID ){
-    ret = VAL_UWT_INT_RESULT_UWT_EBUSY;
-  }
-  else {
-    int erg = 0;
-    uv_udp_t* ux = (uv_udp_t*)u->handle;
-    if ( u->can_reuse_cb_read == 1 ){
-      u->can_reuse_cb_read = 0;
-      u->read_waiting = 0;
-      erg = uv_udp_recv_stop(ux);
-    }
-    if ( erg >= 0 ){
-      erg = uv_udp_recv_start(ux,
-                              read_start_alloc_cb,
-                              uwt_udp_recv_cb);
-      if ( erg >= 0 ){
-        u->c_read_size = DEF_ALLOC_SIZE;
-        gr_root_register(&u->cb_read,o_cb);
-        ++u->in_use_cnt;
-      }
-    }
-    ret = VAL_UWT_UNIT_RESULT(erg);
-  }
-  CAMLreturn(ret);
-}
+#if defined(__linux__) && defined(HAVE_RECVMMSG)
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#define RM_CTL_SIZE CMSG_SPACE(sizeof(int))
 
-CAMLprim value
-uwt_udp_recv_stop(value o_udp, value o_abort)
-{
-  HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_udp);
-  HANDLE_NINIT(u,o_udp);
-  value ret;
-  if ( u->cb_read == CB_INVALID ||
-       (u->read_waiting == 1 && Long_val(o_abort) == 0 )){
-    ret = VAL_UWT_INT_RESULT_UWT_ENOTACTIVE;
-  }
-  else {
-    const int erg = uv_udp_recv_stop((uv_udp_t*)u->handle);
-    if ( erg >= 0 ){
-      u->can_reuse_cb_read = 0;
-      if ( u->in_use_cnt ){
-        --u->in_use_cnt;
-      }
-      gr_root_unregister(&u->cb_read);
-    }
-    ret = VAL_UWT_UNIT_RESULT(erg);
+struct recv_mmsg {
+  uv_poll_t poll;
+  struct handle * h;
+  int fd; /* duplicate of the socket */
+  int gro; /* UDP_GRO enabled */
+  struct sockaddr_storage * addrs; /* rb_slots elements each */
+  struct mmsghdr * msgs;
+  struct iovec * iov;
+  char * ctl; /* RM_CTL_SIZE bytes per slot */
+};
+
+static void
+recv_mmsg_free(struct recv_mmsg * rm)
+{
+  if ( rm->gro ){
+    /* the socket is shared, recv_start must get single datagrams */
+    const int off = 0;
+    setsockopt(rm->fd,SOL_UDP,UDP_GRO,&off,sizeof off);
   }
-  CAMLreturn(ret);
+  close(rm->fd);
+  free(rm);
 }
 
 static void
-uwt_udp_recv_own_cb(uv_udp_t* handle,
-                    ssize_t nread,
-                    const uv_buf_t* buf,
-                    const struct sockaddr* addr,
-                    unsigned int flags)
+recv_mmsg_close_cb(uv_handle_t * handle)
 {
-  HANDLE_CB_INIT_WITH_CLEAN(handle);
+  recv_mmsg_free(handle->data);
+}
+
+static void
+recv_mmsg_stop(struct handle * h)
+{
+  struct recv_mmsg * rm = h->rb_mmsg;
+  if ( rm != NULL ){
+    h->rb_mmsg = NULL;
+    uv_close((uv_handle_t*)&rm->poll,recv_mmsg_close_cb);
+  }
+}
+
+static void
+recv_mmsg_poll_cb(uv_poll_t * handle, int status, int events)
+{
+  struct recv_mmsg * rm = handle->data;
+  struct handle * h = rm->h;
   value exn = Val_unit;
-  bool buf_not_cleaned = true;
-  struct handle * uh = handle->data;
-  const int read_ba = uh->use_read_ba;
-  if ( uh->close_called == 0 ){
-    if (unlikely( uh->cb_read == CB_INVALID ||
-                  uh->obuf == CB_INVALID )){
-      DEBUG_PF("callback lost");
-    }
-    else {
-      /* nread == 0 && addr == NULL only means we need to clear
-         the buffer */
-      if ( nread != 0 || addr != NULL ){
-        value param;
-        uh->read_waiting = 0;
-        if ( nread < 0 ){
-          param = caml_alloc_small(1,Error_tag);
-          Field(param,0) = Val_uwt_error(nread);
+  (void) events;
+  GET_RUNTIME();
+  ++h->in_callback_cnt;
+  if ( h->close_called == 0 && h->recv_batch == 1 ){
+    value rb = GET_CB_VAL(h->obuf);
+    const unsigned int start = h->rb_fill;
+    const unsigned int n = h->rb_slots - start;
+    unsigned int i;
+    int r = status;
+    if ( status >= 0 ){
+      for ( i = 0 ; i < n ; ++i ){
+        struct msghdr * m = &rm->msgs[i].msg_hdr;
+        rm->iov[i].iov_base = (char*)h->ba_read +
+          (size_t)(start + i) * h->c_read_size;
+        rm->iov[i].iov_len = h->c_read_size;
+        m->msg_name = &rm->addrs[i];
+        m->msg_namelen = sizeof(struct sockaddr_storage);
+        m->msg_iov = &rm->iov[i];
+        m->msg_iovlen = 1;
+        if ( rm->gro ){
+          m->msg_control = rm->ctl + (size_t)i * RM_CTL_SIZE;
+          m->msg_controllen = RM_CTL_SIZE;
         }
         else {
-          value triple = Val_unit;
-          value sockaddr = Val_unit;
-          value is_partial;
-          param = Val_unit;
-          Begin_roots3(triple,sockaddr,param);
-          if ( addr != NULL ){
-            param = uwt_alloc_sockaddr();
-            memcpy(SOCKADDR_VAL(param),addr,sizeof(struct sockaddr_storage));
-            sockaddr = caml_alloc_small(1,Some_tag);
-            Field(sockaddr,0) = param;
-          }
-          if ( flags & UV_UDP_PARTIAL ){
-            is_partial = Val_long(1);
-          }
-          else {
-            is_partial = Val_long(0);
-          }
-          if ( nread != 0 && read_ba == 0 ){
-            value o = GET_CB_VAL(uh->obuf);
-            assert( Tag_val(o) == String_tag );
-            size_t len = UMIN(uh->c_read_size,(size_t)nread);
-            memcpy(String_val(o) + uh->obuf_offset,
-                   buf->base,
-                   len);
-            buf_not_cleaned = false;
-            free_uv_buf_t_const(buf,uh->cb_type);
-          }
-          triple = caml_alloc_small(3,0);
-          Field(triple,0) = Val_long(nread);
-          Field(triple,1) = is_partial;
-          Field(triple,2) = sockaddr;
-          param = caml_alloc_small(1,Ok_tag);
-          Field(param,0) = triple;
-          End_roots();
+          m->msg_control = NULL;
+          m->msg_controllen = 0;
         }
-        exn = GET_CB_VAL(uh->cb_read);
-        uh->can_reuse_cb_read = 1;
-        gr_root_unregister(&uh->cb_read);
-        gr_root_unregister(&uh->obuf);
-        if ( uh->in_use_cnt ){
-          uh->in_use_cnt--;
-        }
-        exn = caml_callback2_exn(*uwt_global_wakeup,exn,param);
-        if ( uh->close_called == 0 && uh->can_reuse_cb_read == 1 ){
-          uv_udp_recv_stop(handle);
-          uh->can_reuse_cb_read = 0;
+        m->msg_flags = 0;
+      }
+      do {
+        r = recvmmsg(rm->fd,rm->msgs,n,MSG_DONTWAIT,NULL);
+      } while ( r < 0 && errno == EINTR );
+      if ( r < 0 ){
+        r = errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -errno;
+      }
+    }
+    if ( r < 0 ){
+      Field(Field(rb,RB_LENS),start) = Val_uwt_int_result(r);
+      Field(Field(rb,RB_FLAGS),start) = Val_long(0);
+      Field(Field(rb,RB_SEGS),start) = Val_long(0);
+      ++h->rb_fill;
+    }
+    else {
+      for ( i = 0 ; i < (unsigned int)r ; ++i ){
+        const unsigned int k = start + i;
+        intnat seg = 0;
+        if ( rm->gro ){
+          struct msghdr * m = &rm->msgs[i].msg_hdr;
+          struct cmsghdr * cm;
+          for ( cm = CMSG_FIRSTHDR(m) ; cm != NULL ; cm = CMSG_NXTHDR(m,cm) ){
+            if ( cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO ){
+              int x;
+              memcpy(&x,CMSG_DATA(cm),sizeof x);
+              seg = x;
+            }
+          }
         }
+        Field(Field(rb,RB_SEGS),k) = Val_long(seg);
+        Field(Field(rb,RB_LENS),k) = Val_long(rm->msgs[i].msg_len);
+        Field(Field(rb,RB_FLAGS),k) =
+          Val_long((rm->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0 ?
+                   RB_FLAG_PARTIAL : 0);
+        memcpy(SOCKADDR_VAL(Field(Field(rb,RB_ADDRS),k)),&rm->addrs[i],
+               sizeof(struct sockaddr_storage));
       }
+      h->rb_fill += r;
+    }
+    if ( h->rb_fill != start ){
+      exn = recv_batch_filled(h);
     }
   }
-  if ( read_ba == 0 && buf_not_cleaned && buf->base ){
-    free_uv_buf_t_const(buf,uh->cb_type);
+  if (unlikely( Is_exception_result(exn) )){
+    add_exception(h->loop,exn);
   }
-  HANDLE_CB_RET(exn);
+  --h->in_callback_cnt;
+  MAYBE_CLOSE_HANDLE(h);
+}
+
+/* Returns 0, if the datagrams are received with recvmmsg. */
+static int
+recv_mmsg_start(struct handle * h, bool gro)
+{
+  const size_t slots = h->rb_slots;
+  struct recv_mmsg * rm;
+  uv_os_fd_t fd;
+  int erg = uv_fileno(h->handle,&fd);
+  if ( erg < 0 ){
+    return erg;
+  }
+  if ( slots > (SIZE_MAX - sizeof *rm) /
+       (sizeof(struct sockaddr_storage) + sizeof(struct mmsghdr) +
+        sizeof(struct iovec) + RM_CTL_SIZE) ){
+    return UV_ENOMEM;
+  }
+  /* the arrays are ordered by their alignment */
+  rm = malloc(sizeof *rm + slots * (sizeof(struct sockaddr_storage) +
+                                    sizeof(struct mmsghdr) +
+                                    sizeof(struct iovec) + RM_CTL_SIZE));
+  if ( rm == NULL ){
+    return UV_ENOMEM;
+  }
+  rm->addrs = (struct sockaddr_storage *)(rm + 1);
+  rm->msgs = (struct mmsghdr *)(rm->addrs + slots);
+  rm->iov = (struct iovec *)(rm->msgs + slots);
+  rm->ctl = (char *)(rm->iov + slots);
+  rm->h = h;
+  rm->gro = 0;
+  rm->fd = fcntl(fd,F_DUPFD_CLOEXEC,0);
+  if ( rm->fd < 0 ){
+    erg = -errno;
+    free(rm);
+    return erg;
+  }
+  if ( gro ){
+    const int on = 1;
+    if ( setsockopt(rm->fd,SOL_UDP,UDP_GRO,&on,sizeof on) != 0 ){
+      /* linux < 5.0 */
+      close(rm->fd);
+      free(rm);
+      return UV_ENOSYS;
+    }
+    rm->gro = 1;
+  }
+  erg = uv_poll_init(&h->loop->loop,&rm->poll,rm->fd);
+  if ( erg < 0 ){
+    recv_mmsg_free(rm);
+    return erg;
+  }
+  rm->poll.data = rm;
+  erg = uv_poll_start(&rm->poll,UV_READABLE,recv_mmsg_poll_cb);
+  if ( erg < 0 ){
+    uv_close((uv_handle_t*)&rm->poll,recv_mmsg_close_cb);
+    return erg;
+  }
+  h->rb_mmsg = rm;
+  return 0;
+}
+#else
+static void
+recv_mmsg_stop(struct handle * h)
+{
+  (void) h;
 }
+#endif
 
 CAMLprim value
-uwt_udp_recv_own(value o_udp,value o_buf,value o_offset,value o_len,value o_cb)
+uwt_udp_recv_batch_start(value o_udp, value o_rb, value o_gro, value o_cb)
 {
   HANDLE_NO_UNINIT_CLOSED_INT_RESULT(o_udp);
-  HANDLE_NINIT(u,o_udp,o_buf,o_cb);
-  const int ba = Tag_val(o_buf) != String_tag;
+  HANDLE_NINIT(u,o_udp,o_rb,o_cb);
+  const bool gro = Long_val(o_gro) == 1;
+  const intnat slot_size = Long_val(Field(o_rb,1));
+  const size_t slots = Wosize_val(Field(o_rb,RB_LENS));
   value ret;
-  assert( u->cb_type == CB_LWT );
   if ( u->cb_read != CB_INVALID ){
     ret = VAL_UWT_INT_RESULT_UWT_EBUSY;
   }
+  else if ( slot_size <= 0 || (uintnat)slot_size > UINT_MAX || slots == 0 ||
+            slots > UINT_MAX ||
+            Wosize_val(Field(o_rb,RB_FLAGS)) != slots ||
+            Wosize_val(Field(o_rb,RB_ADDRS)) != slots ||
+            Wosize_val(Field(o_rb,RB_SEGS)) != slots ||
+            (uintnat)Caml_ba_array_val(Field(o_rb,RB_BUF))->dim[0] / slots <
+            (uintnat)slot_size ){
+    ret = VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+#if !defined(__linux__) || !defined(HAVE_RECVMMSG)
+  else if ( gro ){
+    ret = VAL_UWT_INT_RESULT_ENOSYS;
+  }
+#endif
   else {
-    int erg;
+    int erg = 0;
     uv_udp_t* ux = (uv_udp_t*)u->handle;
-    if ( u->can_reuse_cb_read == 1 ){
-      u->can_reuse_cb_read = 0;
-      erg = 0;
+    if ( recv_batch_check_init == false ){
+      erg = uv_check_init(&u->loop->loop,&recv_batch_check);
+      if ( erg >= 0 ){
+        uv_unref((uv_handle_t*)&recv_batch_check);
+        recv_batch_check_init = true;
+      }
     }
-    else {
-      erg = uv_udp_recv_start(ux,alloc_read_own,uwt_udp_recv_own_cb);
+    if ( erg >= 0 && u->can_reuse_cb_read == 1 ){
+      u->can_reuse_cb_read = 0;
+      u->read_waiting = 0;
+      erg = uv_udp_recv_stop(ux);
     }
     if ( erg >= 0 ){
-      const unsigned int len = Long_val(o_len);
-      const unsigned int offset = Long_val(o_offset);
-      gr_root_register(&u->cb_read,o_cb);
-      gr_root_register(&u->obuf,o_buf);
-      ++u->in_use_cnt;
-      u->c_read_size = len;
-      u->use_read_ba = ba;
-      u->read_waiting = 1;
-      if ( ba == 0 ){
-        u->obuf_offset = offset;
+      u->ba_read = Ba_buf_val(Field(o_rb,RB_BUF));
+      u->c_read_size = slot_size;
+      u->rb_slots = slots;
+      u->rb_fill = 0;
+#if defined(__linux__) && defined(HAVE_RECVMMSG)
+      erg = recv_mmsg_start(u,gro);
+      /* GRO needs the cmsg of every read, libuv doesn't pass them */
+      if ( erg < 0 && gro == false )
+#endif
+      erg = uv_udp_recv_start(ux,recv_batch_alloc_cb,recv_batch_recv_cb);
+      if ( erg >= 0 ){
+        u->recv_batch = 1;
+        gr_root_register(&u->cb_read,o_cb);
+        gr_root_register(&u->obuf,o_rb);
+        ++u->in_use_cnt;
       }
       else {
-        u->ba_read = Ba_buf_val(o_buf) + offset;
+        u->ba_read = NULL;
       }
     }
     ret = VAL_UWT_UNIT_RESULT(erg);
   }
   CAMLreturn(ret);
 }
-
-CAMLprim value
-uwt_udp_send_queue_size_na(value o_udp)
-{
-  value ret;
-  struct handle * h = Handle_val(o_udp);
-  if ( HANDLE_IS_INVALID_UNINIT(h) ){
-    ret = Val_long(0);
-  }
-  else {
-    uv_udp_t* u = (uv_udp_t*)h->handle;
-    ret = Val_long((intnat)u->send_queue_size);
-  }
-  return ret;
-}
-
-CAMLprim value
-uwt_udp_send_queue_count_na(value o_udp)
-{
-  value ret;
-  struct handle * h = Handle_val(o_udp);
-  if ( HANDLE_IS_INVALID_UNINIT(h) ){
-    ret = Val_long(0);
-  }
-  else {
-    uv_udp_t* u = (uv_udp_t*)h->handle;
-    ret = Val_long((intnat)u->send_queue_count);
-  }
-  return ret;
-}
+#undef RB_BUF
+#undef RB_LENS
+#undef RB_FLAGS
+#undef RB_ADDRS
+#undef RB_SEGS
+#undef RB_FLAG_PARTIAL
 /* }}} Udp end */
 
 /* {{{ Signal start */
@@ -6147,7 +10824,7 @@ stack_clean (struct stack *s){
   if ( s->s && s->size > 0 ){
     unsigned int i;
     for ( i = 0; i < s->pos; ++i ){
-      free(s->s[i]);
+      stack_elt_free(s,s->s[i]);
     }
     free(s->s);
     s->s = NULL;
@@ -6165,37 +10842,67 @@ uwt_free_all_memory(value unit)
 {
   unsigned int i;
   (void) unit;
-  if ( uwt_global_caml_root != Val_unit ){
-    unsigned int found = 0;
-    for ( i = 0; i < uwt_global_caml_root_size; ++i ){
-      if ( Field(uwt_global_caml_root,i) != Val_unit ){
-        ++found;
+  if ( gr_live == 0 ){
+    for ( i = 0; i < gr_dir_n; ++i ){
+      if ( gr_dir[i] != NULL ){
+        gr_chunk_release(gr_dir[i]);
       }
     }
-    assert(found == uwt_global_caml_root_n);
-    if ( !found ){
-      uwt_global_caml_root_size = 0;
-      uwt_global_caml_root_n = 0;
-      caml_remove_generational_global_root(&uwt_global_caml_root);
-      uwt_global_caml_root = Val_unit;
-      free(uwt_global_caml_root_free_pos);
-      uwt_global_caml_root_free_pos = NULL;
-    }
-    else {
-      DEBUG_PF("uwt_global_caml_root still in use, found %d elements\n",found);
-    }
+    assert(gr_chunks == 0);
+    assert(gr_partial == NULL);
+    free(gr_dir);
+    free(gr_dir_free);
+    gr_dir = NULL;
+    gr_dir_free = NULL;
+    gr_dir_free_n = 0;
+    gr_dir_n = 0;
+    gr_dir_size = 0;
+  }
+  else {
+    DEBUG_PF("global roots still in use, found %u elements\n",gr_live);
   }
 
-  stack_clean(&stack_struct_req);
-  stack_clean(&stack_struct_handle);
   for ( i = 0; i < UV_REQ_TYPE_MAX; ++i ){
     stack_clean(&stacks_req_t[i]);
+#ifdef HAVE_SLAB
+    slab_cache_clean(&slabs_req_t[i]);
+#endif
   }
   for ( i = 0; i < UV_HANDLE_TYPE_MAX; ++i ){
     stack_clean(&stacks_handle_t[i]);
+#ifdef HAVE_SLAB
+    slab_cache_clean(&slabs_handle_t[i]);
+#endif
   }
   for ( i = 0; i < STACKS_MEM_BUF_SIZE; ++i ){
     stack_clean(&stacks_mem_buf[i]);
+    POOL_LOCK(&stacks_mem_buf_sync[i]);
+    stack_clean(&stacks_mem_buf_sync[i]);
+    POOL_UNLOCK(&stacks_mem_buf_sync[i]);
+  }
+
+  if ( cork_pending_n == 0 ){
+    free(cork_pending);
+    cork_pending = NULL;
+    cork_pending_size = 0;
+  }
+  if ( read_batch_check_init == true ){
+    uv_close((uv_handle_t*)&read_batch_check,NULL);
+    read_batch_check_init = false;
+  }
+  if ( cork_prepare_init == true ){
+    uv_close((uv_handle_t*)&cork_prepare,NULL);
+    cork_prepare_init = false;
+  }
+  if ( read_batch_n == 0 ){
+    free(read_batch);
+    read_batch = NULL;
+    read_batch_size = 0;
+  }
+  if ( recv_batch_pending_n == 0 ){
+    free(recv_batch_pending);
+    recv_batch_pending = NULL;
+    recv_batch_pending_size = 0;
   }
 
   for ( i = 0; i < CB_MAX; ++i ){
@@ -6212,31 +10919,49 @@ uwt_free_all_memory(value unit)
 }
 
 /*
- TODO:
-  - find a real algorithm when to release memory
-  - document it
-  - make it configurable for the user
+  The cleaner runs every pool_trim_interval milliseconds. pos_min is the
+  minimal number of cached elements during the last window, these
+  elements were not needed at all. If there were idle elements in two
+  windows in a row, half of them (but not more than the low watermark
+  allows) are released. The pool shrinks slowly, so bursty workloads
+  don't thrash malloc. If the resident set size exceeds pool_rss_limit,
+  all idle elements above the low watermark are released at once.
 */
+static unsigned int pool_trim_interval = 90000;
+static uint64_t pool_rss_limit = 0;
+
 static void
-clean_cache(struct stack * s)
+clean_cache(struct stack * s, bool pressure)
 {
-  if ( s->pos < 256 || s->pos_min < ( s->created / 2 ) ){
+  const unsigned int idle = s->pos_min;
+  if ( idle <= s->low_wm || s->pos <= s->low_wm ){
+    s->gc_n = 0;
+  }
+  else if ( pressure == true ){
+    stack_trim(s,UMAX(s->low_wm,s->pos - idle));
     s->gc_n = 0;
-    s->pos_min = s->pos;
   }
-  else if ( s->gc_n < 10 ){
+  else if ( s->gc_n == 0 ){
     ++s->gc_n;
   }
   else {
-    unsigned int i;
-    for ( i = 0; i < ( s->created / 3 ); ++i ){
-     --s->pos;
-      free(s->s[s->pos]);
-    }
-    s->created = s->created - i;
-    s->gc_n = 0;
-    s->pos_min = s->pos;
+    const unsigned int excess = idle - s->low_wm;
+    stack_trim(s,s->pos - CEIL(excess,2));
+  }
+  s->pos_min = s->pos;
+}
+
+static bool
+pool_rss_pressure(void)
+{
+  size_t rss;
+  if ( pool_rss_limit == 0 ){
+    return false;
+  }
+  if ( uv_resident_set_memory(&rss) != 0 ){
+    return false;
   }
+  return ( (uint64_t)rss > pool_rss_limit );
 }
 
 static void
@@ -6247,27 +10972,39 @@ clean_caches(uv_timer_t* handle)
      prepare handles. */
   GET_RUNTIME();
   unsigned int i;
-  clean_cache(&stack_struct_req);
-  clean_cache(&stack_struct_handle);
-  for ( i = 0; i < UV_REQ_TYPE_MAX; ++i ){
-    clean_cache(&stacks_req_t[i]);
-  }
-  for ( i = 0; i < UV_HANDLE_TYPE_MAX; ++i ){
-    clean_cache(&stacks_handle_t[i]);
-  }
-  for ( i = 0; i < STACKS_MEM_BUF_SIZE; ++i ){
-    clean_cache(&stacks_mem_buf[i]);
+  const bool pressure = pool_rss_pressure();
+  for ( i = 0; i < POOL_ID_MAX; ++i ){
+    struct stack * s = pool_of_id(i);
+    if ( s ){
+      POOL_LOCK(s);
+      clean_cache(s,pressure);
+      POOL_UNLOCK(s);
+    }
   }
+  gr_root_trim();
 }
 
 static uv_timer_t timer_cache_cleaner;
+static bool timer_cache_cleaner_init = false;
+
+static int
+cache_cleaner_start(void)
+{
+  const unsigned int t = pool_trim_interval;
+  if ( t == 0 ){
+    return (uv_timer_stop(&timer_cache_cleaner));
+  }
+  return (uv_timer_start(&timer_cache_cleaner,clean_caches,t,t));
+}
+
 static void
 cache_cleaner_init(uv_loop_t * l)
 {
   bool do_abort = true;
   if ( uv_timer_init(l,&timer_cache_cleaner) == 0 ){
-    if ( uv_timer_start(&timer_cache_cleaner,clean_caches,90000,90000) == 0 ){
+    if ( cache_cleaner_start() == 0 ){
       uv_unref((uv_handle_t*)&timer_cache_cleaner);
+      timer_cache_cleaner_init = true;
       do_abort = false;
     }
   }
@@ -6277,6 +11014,161 @@ cache_cleaner_init(uv_loop_t * l)
   }
 }
 
+CAMLprim value
+uwt_pool_config_na(value o_interval, value o_rss_limit, value o_huge)
+{
+  const intnat interval = Long_val(o_interval);
+  const intnat rss_limit = Long_val(o_rss_limit);
+  const intnat huge = Long_val(o_huge);
+  if ( interval > 0 && (uintnat)interval > UINT_MAX ){
+    return Val_false;
+  }
+  if ( rss_limit >= 0 ){
+    pool_rss_limit = rss_limit;
+  }
+#ifdef HAVE_PAGE_ALLOC
+  if ( huge >= 0 ){
+    pool_huge_pages = huge != 0;
+  }
+#else
+  (void) huge;
+#endif
+  if ( interval >= 0 ){
+    pool_trim_interval = interval;
+    if ( timer_cache_cleaner_init == true ){
+      cache_cleaner_start();
+    }
+  }
+  return Val_true;
+}
+
+CAMLprim value
+uwt_pool_set_watermarks_na(value o_id, value o_low, value o_high)
+{
+  const intnat id = Long_val(o_id);
+  const intnat low = Long_val(o_low);
+  const intnat high = Long_val(o_high);
+  struct stack * s;
+  unsigned int nlow;
+  unsigned int nhigh;
+  if ( id < 0 || (s = pool_of_id(id)) == NULL ||
+       low > UINT_MAX || high > UINT_MAX ){
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  POOL_LOCK(s);
+  nlow = low >= 0 ? (unsigned int)low : s->low_wm;
+  nhigh = high >= 0 ? (unsigned int)high : s->high_wm;
+  /* the cleaner would trim below low_wm otherwise */
+  if ( nhigh != 0 && nlow > nhigh ){
+    POOL_UNLOCK(s);
+    return VAL_UWT_INT_RESULT_UWT_EINVAL;
+  }
+  s->low_wm = nlow;
+  s->high_wm = nhigh;
+  if ( high > 0 ){
+    stack_trim(s,nhigh);
+  }
+  POOL_UNLOCK(s);
+  return Val_long(0);
+}
+
+/*
+  Releases cached memory until the pools hold at most target bytes.
+  The watermarks are ignored. Large elements are released first.
+*/
+CAMLprim value
+uwt_trim_pools_na(value o_target)
+{
+  const intnat t = Long_val(o_target);
+  const uint64_t target = t < 0 ? 0 : t;
+  uint64_t cached = 0;
+  unsigned int i;
+  for ( i = 0; i < POOL_ID_MAX; ++i ){
+    struct stack * s = pool_of_id(i);
+    if ( s ){
+      POOL_LOCK(s);
+      cached += (uint64_t)s->pos * s->malloc_size;
+      POOL_UNLOCK(s);
+    }
+  }
+  i = POOL_ID_MAX;
+  while ( i && cached > target ){
+    struct stack * s = pool_of_id(--i);
+    if ( s ){
+      POOL_LOCK(s);
+      if ( s->pos ){
+        const uint64_t over = cached - target;
+        const uint64_t n = CEIL(over,s->malloc_size);
+        const unsigned int keep = n >= s->pos ? 0 : s->pos - n;
+        const unsigned int freed = stack_trim(s,keep);
+        cached -= UMIN(cached,(uint64_t)freed * s->malloc_size);
+      }
+      POOL_UNLOCK(s);
+    }
+  }
+  gr_root_trim();
+  return Val_unit;
+}
+
+CAMLprim value
+uwt_pool_stats(value unit)
+{
+  CAMLparam0();
+  CAMLlocal3(ar,tup,tmp);
+  unsigned int i;
+  unsigned int n = 0;
+  (void) unit;
+  for ( i = 0; i < POOL_ID_MAX; ++i ){
+    if ( pool_of_id(i) ){
+      ++n;
+    }
+  }
+  if ( n == 0 ){
+    CAMLreturn(Atom(0));
+  }
+  ar = caml_alloc(n,0);
+  n = 0;
+  for ( i = 0; i < POOL_ID_MAX; ++i ){
+    struct stack * s = pool_of_id(i);
+    struct stack c;
+    if ( s == NULL ){
+      continue;
+    }
+    /* don't allocate while the lock is held, finalizers might
+       release buffers */
+    POOL_LOCK(s);
+    c = *s;
+    POOL_UNLOCK(s);
+    tmp = caml_copy_string(c.name);
+    tup = caml_alloc_small(10,0);
+    Field(tup,0) = Val_long(i);
+    Field(tup,1) = tmp;
+    Field(tup,2) = Val_long(c.malloc_size);
+    Field(tup,3) = Val_long(c.created);
+    Field(tup,4) = Val_long(c.pos);
+    Field(tup,5) = Val_long(c.pos_min);
+    Field(tup,6) = Val_long(c.hits);
+    Field(tup,7) = Val_long(c.misses);
+    Field(tup,8) = Val_long(c.low_wm);
+    Field(tup,9) = Val_long(c.high_wm);
+    Store_field(ar,n,tup);
+    ++n;
+  }
+  CAMLreturn(ar);
+}
+
+CAMLprim value
+uwt_root_stats(value unit)
+{
+  value ret;
+  (void) unit;
+  ret = caml_alloc_small(3,0);
+  Field(ret,0) = Val_long(gr_live);
+  Field(ret,1) = Val_long(gr_peak);
+  Field(ret,2) = Val_long(gr_chunks * GR_CHUNK_SIZE);
+  return ret;
+}
+
 static void
 my_enter_blocking_section(uv_prepare_t *x)
 {
@@ -6313,7 +11205,7 @@ help_cleanup(struct stack * s)
   unsigned int i = s->pos;
   while ( i ){
     --i;
-    free(s->s[i]);
+    stack_elt_free(s,s->s[i]);
   }
   s->created -= s->pos;
   s->pos = 0;
@@ -6326,16 +11218,24 @@ uwt_cleanup_na(value o_unit)
 {
   (void)o_unit;
   unsigned int i;
-  help_cleanup(&stack_struct_req);
-  help_cleanup(&stack_struct_handle);
   for ( i = 0; i < UV_REQ_TYPE_MAX; ++i ){
     help_cleanup(&stacks_req_t[i]);
+#ifdef HAVE_SLAB
+    slab_cache_clean(&slabs_req_t[i]);
+#endif
   }
   for ( i = 0; i < UV_HANDLE_TYPE_MAX; ++i ){
     help_cleanup(&stacks_handle_t[i]);
+#ifdef HAVE_SLAB
+    slab_cache_clean(&slabs_handle_t[i]);
+#endif
   }
   for ( i = 0; i < STACKS_MEM_BUF_SIZE; ++i ){
     help_cleanup(&stacks_mem_buf[i]);
+    POOL_LOCK(&stacks_mem_buf_sync[i]);
+    help_cleanup(&stacks_mem_buf_sync[i]);
+    POOL_UNLOCK(&stacks_mem_buf_sync[i]);
   }
+  gr_root_trim();
   return Val_unit;
 }
@@ -19,6 +19,9 @@
 #define P7(x)                                                   \
   CAMLextern value x(value,value,value,value,value,value,value)
 
+#define P8(x)                                                         \
+  CAMLextern value x(value,value,value,value,value,value,value,value)
+
 #define BY(x)                                   \
   CAMLextern value x(value*,int)
 
@@ -38,10 +41,17 @@ P1(uwt_fs_free);
 P1(uwt_get_fs_result);
 P6(uwt_fs_open_native);
 BY(uwt_fs_open_byte);
-P7(uwt_fs_read_native);
+P8(uwt_fs_read_native);
 BY(uwt_fs_read_byte);
-P7(uwt_fs_write_native);
+P8(uwt_fs_write_native);
 BY(uwt_fs_write_byte);
+P6(uwt_fs_readv_native);
+BY(uwt_fs_readv_byte);
+P6(uwt_fs_writev_native);
+BY(uwt_fs_writev_byte);
+P4(uwt_fs_copy_file);
+P3(uwt_fs_readdir);
+P3(uwt_fs_stat_many);
 P4(uwt_fs_close);
 P4(uwt_fs_unlink);
 P5(uwt_fs_mkdir);
@@ -94,8 +104,29 @@ P3(uwt_listen);
 P1(uwt_accept);
 P2(uwt_accept_raw_na);
 P2(uwt_read_start);
+P2(uwt_read_start_ba);
+P2(uwt_read_start_batched);
+P1(uwt_read_batch_valid_na);
+P1(uwt_ba_release_na);
+P4(uwt_set_read_size_policy_na);
+P1(uwt_read_size_na);
 P2(uwt_read_stop);
 P5(uwt_read_own);
+P2(uwt_ring_attach);
+P1(uwt_ring_detach_na);
+P1(uwt_ring_available_na);
+P1(uwt_ring_pos_na);
+P2(uwt_ring_consume_na);
+P2(uwt_ring_wait);
+P3(uwt_writev);
+P2(uwt_try_writev_na);
+P3(uwt_cork);
+P4(uwt_write_watermarks_na);
+P2(uwt_write_drain_wait);
+P2(uwt_write_block_enter);
+P2(uwt_write_block_leave_na);
+P2(uwt_write_bypass_na);
+P1(uwt_write_limit_na);
 P6(uwt_udp_send_native);
 BY(uwt_udp_send_byte);
 P5(uwt_write);
@@ -103,6 +134,13 @@ P6(uwt_write2_native);
 BY(uwt_write2_byte);
 P5(uwt_udp_try_send_na);
 P4(uwt_try_write_na);
+P4(uwt_write_eager);
+P5(uwt_stream_sendfile);
+P4(uwt_forward);
+P4(uwt_udp_send_many);
+P4(uwt_udp_recv_batch_start);
+P6(uwt_udp_try_send_gso_native);
+BY(uwt_udp_try_send_gso_byte);
 
 P3(uwt_tty_init);
 P2(uwt_tty_set_mode_na);
@@ -124,6 +162,8 @@ P2(uwt_tcp_open_na);
 P2(uwt_udp_open_na);
 P3(uwt_tcp_bind_na);
 P3(uwt_udp_bind_na);
+P2(uwt_udp_connect_na);
+P5(uwt_udp_send_connected);
 P2(uwt_tcp_nodelay_na);
 P3(uwt_tcp_keepalive_na);
 P2(uwt_tcp_simultaneous_accepts_na);
@@ -141,8 +181,11 @@ P2(uwt_udp_set_ttl_na);
 P2(uwt_udp_recv_start);
 P2(uwt_udp_recv_stop);
 P5(uwt_udp_recv_own);
+P5(uwt_udp_recv_connected);
 P1(uwt_udp_send_queue_size_na);
 P1(uwt_udp_send_queue_count_na);
+P4(uwt_udp_send_queue_limit_na);
+P2(uwt_udp_send_queue_dropped_na);
 
 P4(uwt_timer_start);
 /* P1(uwt_timer_stop); */
@@ -202,6 +245,11 @@ P6(uwt_lseek_native);
 BY(uwt_lseek_byte);
 
 P1(uwt_cleanup_na);
+P1(uwt_trim_pools_na);
+P1(uwt_pool_stats);
+P1(uwt_root_stats);
+P3(uwt_pool_config_na);
+P3(uwt_pool_set_watermarks_na);
 /* valgrind */
 P1(uwt_free_all_memory);
 
@@ -212,4 +260,5 @@ P1(uwt_free_all_memory);
 #undef P5
 #undef P6
 #undef P7
+#undef P8
 #undef BY
@@ -3,6 +3,11 @@ let () =
   if Sys.unix then Sys.set_signal Sys.sigpipe Sys.Signal_ignore;
   Uwt.Process.disable_stdio_inheritance ()
 
+let () =
+  if Array.length Sys.argv = 2 && Sys.argv.(1) = "--cork-helper" then (
+    T_tcp.cork_helper ();
+    exit 0 )
+
 open OUnit2
 
 let tests =
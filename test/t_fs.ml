@@ -126,6 +126,80 @@ let l = [
      and dst = tmpdir () // "d" in
      let t = copy_sendfile ~src ~dst >>= fun () -> file_to_bytes dst in
      m_equal random_bytes t);
+  ("copy_file">::
+   fun _ctx ->
+     let src = tmpdir () // "a"
+     and dst = tmpdir () // "cf" in
+     let t =
+       copy_file ~chunk:10_000 ~parallelism:3 ~src ~dst () >>= fun n ->
+       assert (n = Int64.of_int random_bytes_length);
+       file_to_bytes dst
+     in
+     m_equal random_bytes t;
+     assert_raises (Invalid_argument "Uwt.Fs.copy_file")
+       (fun () -> Uwt.Main.run (copy_file ~chunk:0 ~src ~dst ()));
+     m_equal () (unlink dst);
+     (* pread/pwrite fallback *)
+     let t =
+       copy_file ~in_kernel:false ~chunk:10_000 ~parallelism:3 ~src ~dst ()
+       >>= fun n ->
+       assert (n = Int64.of_int random_bytes_length);
+       file_to_bytes dst
+     in
+     m_equal random_bytes t;
+     m_equal () (unlink dst);
+     (* src must not be truncated *)
+     let hl = tmpdir () // "cf_link" in
+     m_equal () (link ~target:src ~link_name:hl);
+     m_raises (Uwt.EINVAL,"copy_file",src) (copy_file ~src ~dst:src ());
+     m_raises (Uwt.EINVAL,"copy_file",hl) (copy_file ~src ~dst:hl ());
+     m_equal () (unlink hl);
+     m_equal random_bytes (file_to_bytes src));
+  ("pread/pwrite">::
+   fun _ctx ->
+     let fln = tmpdir () // "pw" in
+     let chunk = 16_384 in
+     let n = (random_bytes_length + chunk - 1) / chunk in
+     let chunks = Array.to_list (Array.init n (fun i -> i * chunk)) in
+     let len pos = min chunk (random_bytes_length - pos) in
+     let t =
+       with_file ~mode:[ O_RDWR ; O_CREAT ; O_TRUNC ] fln @@ fun fd ->
+       Lwt_list.iter_p ( fun pos ->
+           let fd_offset = Int64.of_int pos in
+           pwrite fd ~fd_offset ~buf:random_bytes ~pos ~len:(len pos)
+           >|= fun n -> assert (n = len pos) ) (List.rev chunks) >>= fun () ->
+       let buf = Bytes.create random_bytes_length in
+       Lwt_list.iter_p ( fun pos ->
+           let fd_offset = Int64.of_int pos in
+           pread fd ~fd_offset ~buf ~pos ~len:(len pos)
+           >|= fun n -> assert (n = len pos) ) chunks >>= fun () ->
+       Uwt.Unix.lseek fd 0L Unix.SEEK_CUR >|= fun cur ->
+       cur = 0L && buf = random_bytes
+     in
+     m_true t;
+     m_equal random_bytes (file_to_bytes fln);
+     m_equal () (unlink fln));
+  ("readv/writev">::
+   fun _ctx ->
+     let fln = tmpdir () // "rv" in
+     let t =
+       with_file ~mode:[ O_RDWR ; O_CREAT ; O_TRUNC ] fln @@ fun fd ->
+       let payload = Uwt_bytes.of_string "payload" in
+       let iov = [| Uwt.Iovec_string("xheader",1,6);
+                    Uwt.Iovec_ba(payload,0,Uwt_bytes.length payload);
+                    Uwt.Iovec_bytes(Bytes.of_string "crc",0,3) |] in
+       writev fd iov >>= fun n1 ->
+       writev ~fd_offset:100L fd iov >>= fun n2 ->
+       let b1 = Bytes.make 8 'x' in
+       let b2 = Uwt_bytes.create 8 in
+       readv ~fd_offset:100L fd [| Uwt.Iovec_bytes(b1,2,6);
+                                   Uwt.Iovec_ba(b2,0,8) |] >|= fun n3 ->
+       n1 = 16 && n2 = 16 && n3 = 14 &&
+       Bytes.to_string b1 = "xxheader" &&
+       Uwt_bytes.to_string (Uwt_bytes.proxy b2 0 8) = "payloadc"
+     in
+     m_true t;
+     m_equal () (unlink fln));
   ("stat">::
    fun _ctx ->
      let fln = tmpdir () // "d" in
@@ -149,6 +223,93 @@ let l = [
         https://github.com/libuv/libuv/issues/196 *)
      let files = [| S_REG, "a" ; S_REG, "b" ; S_REG, "c" |] in
      m_equal files (scandir (tmpdir()) >|= fun s -> Array.sort compare s ; s));
+  ("opendir/readdir">::
+   fun ctx ->
+     skip_if_not_all ctx (Uwt.Sys_info.os <> Uwt.Sys_info.Linux)
+       "readdir is only available on linux";
+     let dir = tmpdir () // "rd" in
+     let names = Array.init 100 (fun i -> Printf.sprintf "f%03d" i) in
+     let t =
+       mkdir dir >>= fun () ->
+       Lwt_list.iter_p ( fun n ->
+           with_file ~mode:[ O_WRONLY ; O_CREAT ] (dir // n) @@ fun _ ->
+           Lwt.return_unit ) (Array.to_list names) >>= fun () ->
+       opendir dir >>= fun d ->
+       Lwt.finalize ( fun () ->
+           let rec iter accu =
+             readdir ~batch:7 d >>= fun b ->
+             let len = Dirents.length b in
+             if len = 0 then
+               Lwt.return accu
+             else (
+               assert (len <= 7);
+               let rec check accu i =
+                 if i = len then
+                   Lwt.return accu
+                 else
+                   let name = Dirents.name b i in
+                   stat (dir // name) >>= fun st ->
+                   assert (Dirents.kind b i = S_REG);
+                   assert (Dirents.ino b i = Int64.of_int st.st_ino);
+                   check (name :: accu) (succ i)
+               in
+               check accu 0 >>= iter )
+           in
+           iter [] ) ( fun () -> closedir d ) >>= fun l ->
+       Lwt_list.iter_s (fun n -> unlink (dir // n)) (Array.to_list names)
+       >>= fun () ->
+       rmdir dir >|= fun () ->
+       let a = Array.of_list l in
+       Array.sort compare a;
+       a
+     in
+     m_equal names t);
+  ("walk">::
+   fun _ctx ->
+     let root = tmpdir () // "wk" in
+     let dirs = [ "s" ; "s" // "t" ; "u" ] in
+     let files = [ "a" ; "s" // "b" ; "s" // "t" // "c" ; "u" // "d" ] in
+     let all = List.sort compare (dirs @ files) in
+     let t =
+       mkdir root >>= fun () ->
+       Lwt_list.iter_s (fun d -> mkdir (root // d)) dirs >>= fun () ->
+       Lwt_list.iter_s ( fun n ->
+           with_file ~mode:[ O_WRONLY ; O_CREAT ] (root // n) @@ fun _ ->
+           Lwt.return_unit ) files >>= fun () ->
+       let found = ref [] in
+       let prefix = String.length root + 1 in
+       walk ~max_parallel:2 ~with_stat:true root ( fun e ->
+           let n = String.sub e.e_path prefix
+               (String.length e.e_path - prefix) in
+           let kind = if List.mem n dirs then S_DIR else S_REG in
+           (match e.e_stats with
+           | None -> assert false
+           | Some s -> assert (s.st_kind = kind && e.e_kind = kind));
+           found := n :: !found;
+           Lwt.return_unit ) >>= fun () ->
+       Lwt_list.iter_s (fun n -> unlink (root // n)) files >>= fun () ->
+       Lwt_list.iter_s (fun d -> rmdir (root // d)) (List.rev dirs)
+       >>= fun () ->
+       rmdir root >|= fun () ->
+       List.sort compare !found
+     in
+     m_equal all t);
+  ("stat_many">::
+   fun _ctx ->
+     let a = tmpdir () // "a"
+     and x = tmpdir () // "x-does-not-exist" in
+     let t =
+       stat_many [| a ; x ; tmpdir () |] >>= fun sa ->
+       stat a >|= fun st ->
+       Stats_array.length sa = 3 &&
+       Stats_array.get sa 0 = Uwt.Ok st &&
+       Stats_array.size sa 0 = Int64.of_int random_bytes_length &&
+       Stats_array.is_ok sa 1 = false &&
+       Stats_array.error sa 1 = Some Uwt.ENOENT &&
+       Stats_array.kind sa 2 = S_DIR
+     in
+     m_true t;
+     m_equal 0 (stat_many [||] >|= Stats_array.length));
   ("symlink/lstat">::
    fun ctx ->
      no_win ctx;
@@ -159,6 +159,19 @@ let l = [
      let fln2 = tmpdir () // "c" in
      m_equal random_bytes ( fun () -> copy ~src:fln ~dst:fln2 >>= fun () ->
                             file_to_bytes fln2));
+  ("pooled buffers">::
+   fun _ctx ->
+     let fln = tmpdir () // "e" in
+     let buf = Bytes.make 1_000_000 'x' in
+     m_equal () ( fun () ->
+         with_file ~mode:[ O_WRONLY ; O_CREAT ; O_TRUNC ] fln @@ fun fd ->
+         really_write buf fd );
+     let open Uwt.Main in
+     let p =
+       pool_stats () |> Array.to_list |>
+       List.find ( fun p -> p.pool_name = "buf_sync_1048576" )
+     in
+     assert_equal true ( p.hits + p.misses > 0 ));
   ("sendfile">::
    fun _ctx ->
      let fln = tmpdir () // "a" in
@@ -13,7 +13,47 @@ let l = [
            Uwt.Tcp.keepalive_exn t true;
        ));
      ignore (Array.init n ( fun _i -> Uwt.Pipe.init () ));
-     assert_equal true true)
+     assert_equal true true);
+  ("pool_stats">::
+   fun _ctx ->
+     let open Uwt.Main in
+     ignore ( Array.init 64 ( fun _i -> Uwt.Tcp.init () ));
+     Gc.full_major ();
+     let s = pool_stats () in
+     assert_equal true (Array.length s > 0);
+     Array.iter ( fun s ->
+         assert_equal true (s.cached <= s.created);
+         assert_equal true (s.min_cached <= s.cached);
+         assert_equal true (s.elt_size > 0) ) s;
+     trim_pools ();
+     let s = pool_stats () in
+     Array.iter ( fun s -> assert_equal 0 s.cached ) s;
+     let p = s.(0) in
+     set_pool_watermarks ~low:p.low_watermark ~high:0 p.pool_id;
+     assert_raises (Invalid_argument "Uwt.Main.set_pool_watermarks")
+       (fun () -> set_pool_watermarks ~low:1 (-1));
+     assert_raises (Invalid_argument "Uwt.Main.set_pool_watermarks")
+       (fun () -> set_pool_watermarks ~low:10 ~high:5 p.pool_id);
+     if Sys.word_size = 64 then
+       assert_raises
+         (Invalid_argument "Uwt.Main.set_pool_policy: trim_interval")
+         (fun () -> set_pool_policy ~trim_interval:(1 lsl 40) ()));
+  ("root_stats">::
+   fun _ctx ->
+     let open Uwt.Main in
+     let n = 4096 in
+     let timers = Array.init n ( fun _i ->
+         Uwt.Timer.start_exn ~repeat:0 ~timeout:100_000 ~cb:ignore ) in
+     let s = root_stats () in
+     assert_equal true (s.roots_live >= n);
+     assert_equal true (s.roots_peak >= s.roots_live);
+     assert_equal true (s.roots_capacity >= s.roots_live);
+     Array.iter Uwt.Timer.close_noerr timers;
+     run (yield ());
+     trim_pools ();
+     let s' = root_stats () in
+     assert_equal true (s'.roots_live < s.roots_live);
+     assert_equal true (s'.roots_capacity < s.roots_capacity))
 ]
 
 let l = "Gc">:::l
@@ -164,9 +164,35 @@ let with_client_c4 f =
   let t = with_connect ~addr:Server.sockaddr @@ fun t -> f t in
   m_true t
 
+(* called by main.ml in a process without other handles: the pending
+   batch alone must keep the loop alive *)
+let cork_helper () =
+  let ls = Unix.socket Unix.PF_INET Unix.SOCK_STREAM 0 in
+  let cs = Unix.socket Unix.PF_INET Unix.SOCK_STREAM 0 in
+  Unix.bind ls (Unix.ADDR_INET(Unix.inet_addr_loopback,0));
+  Unix.listen ls 1;
+  Unix.connect cs (Unix.getsockname ls);
+  let (ss,_) = Unix.accept ls in
+  let client = opentcp_exn cs in
+  cork_exn client;
+  Uwt.Main.run (write_string client ~buf:"corked");
+  close_noerr client;
+  let b = Bytes.create 16 in
+  let n = Unix.read ss b 0 16 in
+  Unix.close ss;
+  Unix.close ls;
+  if Bytes.sub_string b 0 n <> "corked" then
+    failwith "cork_helper"
+
 open OUnit2
 let test_port = 8931
 let l = [
+  ("cork_no_other_handle">::
+   fun _ctx ->
+     (* the servers of the other tests keep the loop alive, the check
+        runs inside a fresh process, see main.ml *)
+     let cmd = Filename.quote Sys.executable_name ^ " --cork-helper" in
+     assert_equal 0 (Sys.command cmd));
   ("echo_server">::
    fun ctx ->
      server_init ();
@@ -251,6 +277,398 @@ let l = [
      m_true (l Server.sockaddr);
      ip6_only ctx;
      m_true (l Server6.sockaddr));
+  ("read_start_ba">::
+   fun _ctx ->
+     let l addr = with_client @@ fun client ->
+       connect client ~addr >>= fun () ->
+       let buf_len = 65_536 in
+       let buf_cnt = 16 in
+       let bytes_read = ref 0 in
+       let released = ref true in
+       let buf = Uwt_bytes.create buf_len in
+       for i = 0 to pred buf_len do
+         buf.{i} <- Char.chr (i land 255);
+       done;
+       let sleeper,waker = Lwt.task () in
+       let cb_read = function
+       | Uwt.Ok b ->
+         for i = 0 to Uwt_bytes.length b - 1 do
+           if b.{i} <> Char.chr (!bytes_read land 255) then
+             Lwt.wakeup_exn waker (Failure "read wrong content");
+           incr bytes_read;
+         done;
+         if release_ba b = false || Uwt_bytes.length b <> 0 ||
+            release_ba b = true then
+           released := false
+       | Uwt.Error Uwt.EOF -> Lwt.wakeup waker ()
+       | Uwt.Error _ -> Lwt.wakeup_exn waker (Failure "fatal error!")
+       in
+       for _i = 1 to buf_cnt do
+         ignore ( write_ba client ~buf );
+       done;
+       read_start_ba_exn client ~cb:cb_read;
+       Lwt.join [ shutdown client ; sleeper ] >>= fun () ->
+       close_wait client >|= fun () ->
+       !released && !bytes_read = buf_len * buf_cnt &&
+       release_ba buf = false
+     in
+     m_true (l Server.sockaddr));
+  ("read_start_batched">::
+   fun _ctx ->
+     let l addr = with_client @@ fun client ->
+       connect client ~addr >>= fun () ->
+       let buf_len = 65_536 in
+       let buf_cnt = 16 in
+       let bytes_read = ref 0 in
+       let buf = Uwt_bytes.create buf_len in
+       for i = 0 to pred buf_len do
+         buf.{i} <- Char.chr (i land 255);
+       done;
+       let sleeper,waker = Lwt.task () in
+       let cb_read = function
+       | Uwt.Ok b ->
+         for i = 0 to Bytes.length b - 1 do
+           if Bytes.unsafe_get b i <> Char.chr (!bytes_read land 255) then
+             Lwt.wakeup_exn waker (Failure "read wrong content");
+           incr bytes_read;
+         done
+       | Uwt.Error Uwt.EOF -> Lwt.wakeup waker ()
+       | Uwt.Error _ -> Lwt.wakeup_exn waker (Failure "fatal error!")
+       in
+       for _i = 1 to buf_cnt do
+         ignore ( write_ba client ~buf );
+       done;
+       read_start_batched_exn client ~cb:cb_read;
+       Lwt.join [ shutdown client ; sleeper ] >|= fun () ->
+       !bytes_read = buf_len * buf_cnt
+     in
+     m_true (l Server.sockaddr));
+  ("read_start_batched/read_stop">::
+   fun _ctx ->
+     let l addr = with_client @@ fun client ->
+       connect client ~addr >>= fun () ->
+       let buf = Uwt_bytes.create 65_536 in
+       Uwt_bytes.fill buf 0 65_536 'x';
+       let calls = ref 0 in
+       let sleeper,waker = Lwt.wait () in
+       let received = Buffer.create 65_536 in
+       let marker = "END!" in
+       let cb_new = function
+       | Uwt.Ok b ->
+         Buffer.add_bytes received b;
+         let len = Buffer.length received in
+         if len >= 4 && Buffer.sub received (len - 4) 4 = marker then
+           Lwt.wakeup waker ()
+       | Uwt.Error _ -> Lwt.wakeup_exn waker (Failure "fatal error!")
+       in
+       let cb_read _ =
+         incr calls;
+         (* the remaining chunks of this batch must be discarded, they
+            must neither reach cb_read nor stop the new reader *)
+         read_stop_exn client;
+         read_start_batched_exn client ~cb:cb_new;
+         (* echoed after everything else *)
+         ignore ( write_string client ~buf:marker )
+       in
+       for _i = 1 to 16 do
+         ignore ( write_ba client ~buf );
+       done;
+       read_start_batched_exn client ~cb:cb_read;
+       sleeper >|= fun () ->
+       !calls = 1
+     in
+     m_true (l Server.sockaddr));
+  ("attach_ring">::
+   fun _ctx ->
+     let l addr = with_client @@ fun client ->
+       connect client ~addr >>= fun () ->
+       let buf_len = 65_536 in
+       let buf_cnt = 16 in
+       let buf = Uwt_bytes.create buf_len in
+       for i = 0 to pred buf_len do
+         buf.{i} <- Char.chr (i land 255);
+       done;
+       let ring = Uwt_bytes.create 4_000 in
+       let rec read_ring bytes_read =
+         ring_wait client >>= function
+         | 0 -> Lwt.return bytes_read
+         | n ->
+           let pos = ring_pos client in
+           for i = 0 to n - 1 do
+             let c = ring.{(pos + i) mod Uwt_bytes.length ring} in
+             if c <> Char.chr ((bytes_read + i) land 255) then
+               failwith "read wrong content";
+           done;
+           ring_consume_exn client n;
+           read_ring (bytes_read + n)
+       in
+       for _i = 1 to buf_cnt do
+         ignore ( write_ba client ~buf );
+       done;
+       attach_ring_exn client ring;
+       let t_read = read_ring 0 in
+       Lwt.join [ shutdown client ; (t_read >|= fun _ -> ()) ] >>= fun () ->
+       t_read >|= fun bytes_read ->
+       bytes_read = buf_len * buf_cnt &&
+       Uwt.Int_result.is_ok (detach_ring client)
+     in
+     m_true (l Server.sockaddr));
+  ("writev">::
+   fun _ctx ->
+     let l addr = with_client @@ fun client ->
+       connect client ~addr >>= fun () ->
+       let ba = Uwt_bytes.of_string "body" in
+       let iov = [| Uwt.Iovec_string("xheader",1,6) ;
+                    Uwt.Iovec_ba(ba,0,4) ;
+                    Uwt.Iovec_bytes(Bytes.of_string "trailer",0,7) |] in
+       let expected = "headerbodyheaderbodytrailer" in
+       let buf = Buffer.create 32 in
+       let sleeper,waker = Lwt.task () in
+       let cb_read = function
+       | Uwt.Ok b -> Buffer.add_bytes buf b
+       | Uwt.Error Uwt.EOF -> Lwt.wakeup waker ()
+       | Uwt.Error _ -> Lwt.wakeup_exn waker (Failure "fatal error!")
+       in
+       let n = try_writev client (Array.sub iov 0 2) in
+       if (n :> int) <> 10 then
+         Lwt.fail (Failure "try_writev failed")
+       else
+       writev client iov >>= fun () ->
+       read_start_exn client ~cb:cb_read;
+       Lwt.join [ shutdown client ; sleeper ] >|= fun () ->
+       Buffer.contents buf = expected
+     in
+     m_true (l Server.sockaddr));
+  ("cork">::
+   fun _ctx ->
+     let l addr = with_client @@ fun client ->
+       connect client ~addr >>= fun () ->
+       cork_exn ~limit:1024 client;
+       let x = try_write_string client ~buf:"x" in
+       if x <> Uwt.Int_result.eagain then
+         Lwt.fail (Failure "try_write while corked")
+       else
+       let expected = Buffer.create 4096 in
+       let writes = Array.init 300 ( fun i ->
+           let s = string_of_int i in
+           Buffer.add_string expected s;
+           write_string client ~buf:s ) |> Array.to_list
+       in
+       let buf = Buffer.create 4096 in
+       let sleeper,waker = Lwt.task () in
+       let cb_read = function
+       | Uwt.Ok b -> Buffer.add_bytes buf b
+       | Uwt.Error Uwt.EOF -> Lwt.wakeup waker ()
+       | Uwt.Error _ -> Lwt.wakeup_exn waker (Failure "fatal error!")
+       in
+       Lwt.join writes >>= fun () ->
+       uncork_exn client;
+       read_start_exn client ~cb:cb_read;
+       Lwt.join [ shutdown client ; sleeper ] >|= fun () ->
+       Buffer.contents buf = Buffer.contents expected
+     in
+     m_true (l Server.sockaddr));
+  ("sendfile">::
+   fun ctx ->
+     no_win ctx;
+     let content = rstring_create 300_000 in
+     let fln = Filename.concat (tmpdir ()) "sendfile" in
+     let offset = 1_000 and len = 200_000 in
+     let l addr =
+       Uwt.Fs.(openfile ~mode:[ O_RDWR ; O_CREAT ; O_TRUNC ] fln) >>= fun fd ->
+       Lwt.finalize ( fun () ->
+           Uwt.Fs.write_string fd ~buf:content >>= fun _ ->
+           with_client @@ fun client ->
+           connect client ~addr >>= fun () ->
+           let buf = Buffer.create len in
+           let sleeper,waker = Lwt.task () in
+           let cb_read = function
+           | Uwt.Ok b -> Buffer.add_bytes buf b
+           | Uwt.Error Uwt.EOF -> Lwt.wakeup waker ()
+           | Uwt.Error _ -> Lwt.wakeup_exn waker (Failure "fatal error!")
+           in
+           read_start_exn client ~cb:cb_read;
+           write_string client ~buf:"x" >>= fun () ->
+           sendfile ~offset:(Int64.of_int offset) ~len:(Int64.of_int len)
+             client fd >>= fun n ->
+           Lwt.join [ shutdown client ; sleeper ] >|= fun () ->
+           n = Int64.of_int len &&
+           Buffer.contents buf = "x" ^ String.sub content offset len
+         ) ( fun () -> Uwt.Fs.close fd )
+     in
+     m_true (l Server.sockaddr));
+  ("sendfile_shutdown">::
+   fun ctx ->
+     no_win ctx;
+     let content = rstring_create 1_000_000 in
+     let fln = Filename.concat (tmpdir ()) "sendfile_shutdown" in
+     let l addr =
+       Uwt.Fs.(openfile ~mode:[ O_RDWR ; O_CREAT ; O_TRUNC ] fln) >>= fun fd ->
+       Lwt.finalize ( fun () ->
+           Uwt.Fs.write_string fd ~buf:content >>= fun _ ->
+           with_client @@ fun client ->
+           connect client ~addr >>= fun () ->
+           let buf = Buffer.create 1_000_000 in
+           let sleeper,waker = Lwt.task () in
+           let cb_read = function
+           | Uwt.Ok b -> Buffer.add_bytes buf b
+           | Uwt.Error Uwt.EOF -> Lwt.wakeup waker ()
+           | Uwt.Error _ -> Lwt.wakeup_exn waker (Failure "fatal error!")
+           in
+           read_start_exn client ~cb:cb_read;
+           (* shutdown must not overtake the running sendfile *)
+           let t = sendfile ~len:1_000_000L client fd in
+           Lwt.join [ shutdown client ; sleeper ] >>= fun () ->
+           t >|= fun n ->
+           n = 1_000_000L && Buffer.contents buf = content
+         ) ( fun () -> Uwt.Fs.close fd )
+     in
+     m_true (l Server.sockaddr));
+  ("forward">::
+   fun _ctx ->
+     let l addr =
+       with_client @@ fun a ->
+       with_client @@ fun b ->
+       connect a ~addr >>= fun () ->
+       connect b ~addr >>= fun () ->
+       (* a -> echo server -> a -> forward -> b -> echo server -> b *)
+       let buf = Buffer.create 65_536 in
+       let sleeper,waker = Lwt.task () in
+       let cb_read = function
+       | Uwt.Ok x -> Buffer.add_bytes buf x
+       | Uwt.Error Uwt.EOF -> Lwt.wakeup waker ()
+       | Uwt.Error _ -> Lwt.wakeup_exn waker (Failure "fatal error!")
+       in
+       read_start_exn b ~cb:cb_read;
+       let t = forward ~src:a ~dst:b ~max_buffered:4_096 () in
+       let content = rstring_create 500_000 in
+       write_string a ~buf:content >>= fun () ->
+       shutdown a >>= fun () ->
+       t >>= fun n ->
+       shutdown b >>= fun () ->
+       sleeper >|= fun () ->
+       n = Int64.of_int (String.length content) &&
+       Buffer.contents buf = content
+     in
+     m_true (l Server.sockaddr));
+  ("forward_corked">::
+   fun _ctx ->
+     let l addr =
+       with_client @@ fun a ->
+       with_client @@ fun b ->
+       connect a ~addr >>= fun () ->
+       connect b ~addr >>= fun () ->
+       let buf = Buffer.create 65_536 in
+       let sleeper,waker = Lwt.task () in
+       let cb_read = function
+       | Uwt.Ok x -> Buffer.add_bytes buf x
+       | Uwt.Error Uwt.EOF -> Lwt.wakeup waker ()
+       | Uwt.Error _ -> Lwt.wakeup_exn waker (Failure "fatal error!")
+       in
+       read_start_exn b ~cb:cb_read;
+       (* the cork batch of b must be written before the forwarded data *)
+       cork_exn b;
+       let head = write_string b ~buf:"head" in
+       let t = forward ~src:a ~dst:b () in
+       let content = rstring_create 100_000 in
+       write_string a ~buf:content >>= fun () ->
+       shutdown a >>= fun () ->
+       Lwt.join [ head ; t >|= ignore ] >>= fun () ->
+       shutdown b >>= fun () ->
+       sleeper >|= fun () ->
+       Buffer.contents buf = "head" ^ content
+     in
+     m_true (l Server.sockaddr));
+  ("write_watermarks">::
+   fun _ctx ->
+     let l addr = with_client @@ fun client ->
+       connect client ~addr >>= fun () ->
+       let low = 65_536 and high = 262_144 in
+       if not (Uwt.Int_result.is_error
+                 (set_write_watermarks client ~low:high ~high:low)) then
+         Lwt.fail (Failure "invalid watermarks accepted")
+       else
+       let () = set_write_watermarks_exn client ~low ~high in
+       let chunk = String.make 65_536 'x' in
+       let cnt = 64 in
+       let bytes_read = ref 0 in
+       let sleeper,waker = Lwt.task () in
+       let cb_read = function
+       | Uwt.Ok b -> bytes_read := !bytes_read + Bytes.length b
+       | Uwt.Error Uwt.EOF -> Lwt.wakeup waker ()
+       | Uwt.Error _ -> Lwt.wakeup_exn waker (Failure "fatal error!")
+       in
+       read_start_exn client ~cb:cb_read;
+       let max_queued = ref 0 in
+       let writes = Array.init cnt ( fun _ ->
+           let t = write_raw_string client ~buf:chunk in
+           max_queued := max !max_queued (write_queue_size client);
+           t ) |> Array.to_list
+       in
+       Lwt.join writes >>= fun () ->
+       Lwt.join [ shutdown client ; sleeper ] >|= fun () ->
+       !max_queued <= high && !bytes_read = cnt * String.length chunk
+     in
+     m_true (l Server.sockaddr));
+  ("write_watermarks_fifo">::
+   fun _ctx ->
+     let l addr = with_client @@ fun client ->
+       connect client ~addr >>= fun () ->
+       let () = set_write_watermarks_exn client ~low:16_384 ~high:65_536 in
+       (* large blocked writes alternate with small ones, that would fit
+          into the queue. The echo must arrive in the order of the calls *)
+       let chunks = Array.init 64 ( fun i ->
+           let len = if i mod 2 = 0 then 200_000 else 100 in
+           String.make len (Char.chr (Char.code 'a' + i mod 26)) )
+       in
+       let expected = String.concat "" (Array.to_list chunks) in
+       let buf = Buffer.create (String.length expected) in
+       let sleeper,waker = Lwt.task () in
+       let cb_read = function
+       | Uwt.Ok b -> Buffer.add_bytes buf b
+       | Uwt.Error Uwt.EOF -> Lwt.wakeup waker ()
+       | Uwt.Error _ -> Lwt.wakeup_exn waker (Failure "fatal error!")
+       in
+       read_start_exn client ~cb:cb_read;
+       let writes = Array.map (fun buf -> write_string client ~buf) chunks in
+       Lwt.join (Array.to_list writes) >>= fun () ->
+       Lwt.join [ shutdown client ; sleeper ] >|= fun () ->
+       Buffer.contents buf = expected
+     in
+     m_true (l Server.sockaddr));
+  ("read_size_policy">::
+   fun _ctx ->
+     let l addr = with_client @@ fun client ->
+       connect client ~addr >>= fun () ->
+       let einval = Uwt.Int_result.is_error in
+       if not (einval (set_read_size_policy client (`Fixed 0))) ||
+          not (einval (set_read_size_policy client (`Adaptive(512,256)))) ||
+          not (einval (set_read_size_policy client (`Fixed 8_388_608))) then
+         Lwt.fail (Failure "invalid policy accepted")
+       else
+       let buf_len = 65_536 in
+       let buf_cnt = 16 in
+       let bytes_read = ref 0 in
+       let max_size = ref 0 in
+       let buf = Uwt_bytes.create buf_len in
+       let sleeper,waker = Lwt.task () in
+       let cb_read = function
+       | Uwt.Ok b ->
+         bytes_read := !bytes_read + Bytes.length b;
+         max_size := max !max_size (read_size client)
+       | Uwt.Error Uwt.EOF -> Lwt.wakeup waker ()
+       | Uwt.Error _ -> Lwt.wakeup_exn waker (Failure "fatal error!")
+       in
+       set_read_size_policy_exn client (`Adaptive(256,1_048_576));
+       for _i = 1 to buf_cnt do
+         ignore ( write_ba client ~buf );
+       done;
+       read_start_exn client ~cb:cb_read;
+       Lwt.join [ shutdown client ; sleeper ] >|= fun () ->
+       !bytes_read = buf_len * buf_cnt &&
+       !max_size > 256 && !max_size <= 1_048_576
+     in
+     m_true (l Server.sockaddr));
   ("write_abort">::
    fun _ctx ->
      with_client_c4 @@ fun client ->
@@ -136,6 +136,294 @@ let l = [
      f sockaddr4;
      ip6_only ctx;
      f sockaddr6);
+  ("send_many">::
+   fun _ctx ->
+     let l addr =
+       let server = start_iter_server_bytes addr in
+       let client = init () in
+       Lwt.finalize ( fun () ->
+           let cnt = 20 in
+           let payload i = Printf.sprintf "datagram %d" i in
+           let ba = Uwt_bytes.of_string "xxxdatagram 0" in
+           let msgs = Array.init cnt ( fun i ->
+               if i = 0 then
+                 Uwt.Iovec_ba(ba,3,Uwt_bytes.length ba - 3), addr
+               else
+                 let s = "-" ^ payload i in
+                 Uwt.Iovec_string(s,1,String.length s - 1), addr )
+           in
+           send_many client msgs >>= fun res ->
+           let buf = Bytes.create 128 in
+           let rec iter i acc =
+             if i = 0 then
+               Lwt.return acc
+             else
+               recv ~buf client >>= fun x ->
+               iter (pred i) (Bytes.sub_string buf 0 x.recv_len :: acc)
+           in
+           iter cnt [] >|= fun l ->
+           Array.length res = cnt &&
+           Array.fold_left (fun a x -> a && (x :> int) = 0) true res &&
+           List.sort compare l =
+           List.sort compare (Array.to_list (Array.init cnt payload))
+         ) ( fun () -> close_noerr client; Lwt.cancel server; Lwt.return_unit )
+     in
+     m_true (l sockaddr4));
+  ("connect">::
+   fun _ctx ->
+     let server = start_iter_server_bytes sockaddr4 in
+     let client = init () in
+     m_true (Lwt.finalize ( fun () ->
+         let x = connect client ~addr:sockaddr4 in
+         if (x :> int) = Uwt.Int_result.enosys then
+           Lwt.return_true
+         else if Uwt.Int_result.is_error x then
+           Uwt.Int_result.raise_exn ~name:"udp_connect" x
+         else
+           let buf = Bytes.create 128 in
+           let rec iter i =
+             if i = 10 then
+               Lwt.return_true
+             else
+               let s = Printf.sprintf "connected %d" i in
+               send_connected_string ~buf:s client >>= fun () ->
+               recv_connected ~buf client >>= fun x ->
+               if x.sockaddr <> None ||
+                  Bytes.sub_string buf 0 x.recv_len <> s then
+                 Lwt.return_false
+               else
+                 iter (succ i)
+           in
+           iter 0
+       ) ( fun () -> close_noerr client; Lwt.cancel server; Lwt.return_unit )));
+  ("send_queue_limit">::
+   fun _ctx ->
+     let server = start_iter_server_bytes sockaddr4 in
+     let client = init () in
+     m_true (Lwt.finalize ( fun () ->
+         let einval = set_send_queue_limit client ~bytes:(-1) ~count:0 in
+         if (einval :> int) <> Uwt.Int_result.uwt_einval then
+           Lwt.return_false
+         else
+           let () = set_send_queue_limit_exn ~policy:`Drop client
+               ~bytes:4096 ~count:4 in
+           let buf = Bytes.create 128 in
+           send_string ~buf:"limit" client sockaddr4 >>= fun () ->
+           recv ~buf client >>= fun x ->
+           Lwt.return (Bytes.sub_string buf 0 x.recv_len = "limit" &&
+                       send_queue_dropped client = 0 &&
+                       send_queue_dropped_bytes client = 0)
+       ) ( fun () -> close_noerr client; Lwt.cancel server; Lwt.return_unit )));
+  ("send_queue_drop">::
+   fun ctx ->
+     no_win ctx;
+     let server = start_iter_server_bytes sockaddr4 in
+     let client = init () in
+     m_true (Lwt.finalize ( fun () ->
+         set_send_queue_limit_exn ~policy:`Drop client ~bytes:0 ~count:4;
+         send_raw_string ~buf:"start" client sockaddr4 >>= fun () ->
+         (* send_raw doesn't try to send immediately, and inside the send
+            callback libuv queues new datagrams instead of writing them at
+            once *)
+         let buf = String.make 100 'd' in
+         let l = Array.init 10 ( fun _ ->
+             send_raw_string ~buf client sockaddr4 ) in
+         let queued = send_queue_count client in
+         (* dropped datagrams are reported as sent at once *)
+         let finished = Array.fold_left ( fun a t ->
+             if Lwt.state t = Lwt.Return () then succ a else a ) 0 l in
+         Lwt.join (Array.to_list l) >|= fun () ->
+         let dropped = send_queue_dropped client in
+         queued = 4 && finished = 6 && dropped = 6 && send_queue_dropped_bytes client = 600
+       ) ( fun () -> close_noerr client; Lwt.cancel server; Lwt.return_unit )));
+  ("send_queue_fail">::
+   fun ctx ->
+     no_win ctx;
+     let server = start_iter_server_bytes sockaddr4 in
+     let client = init () in
+     m_true (Lwt.finalize ( fun () ->
+         set_send_queue_limit_exn ~policy:`Fail client ~bytes:250 ~count:0;
+         send_raw_string ~buf:"start" client sockaddr4 >>= fun () ->
+         let buf = String.make 100 'f' in
+         let l = Array.init 10 ( fun _ ->
+             Lwt.catch ( fun () ->
+                 send_raw_string ~buf client sockaddr4 >|= fun () -> true )
+               ( function
+               | Uwt.Uwt_error(Uwt.ENOBUFS,_,_) -> Lwt.return_false
+               | x -> Lwt.fail x ) )
+         in
+         Lwt_list.map_s (fun x -> x) (Array.to_list l) >|= fun l ->
+         (* the third datagram exceeds 250 bytes *)
+         l = [true;true;false;false;false;false;false;false;false;false] &&
+         send_queue_dropped client = 0
+       ) ( fun () -> close_noerr client; Lwt.cancel server; Lwt.return_unit )));
+  ("send_queue_block">::
+   fun ctx ->
+     no_win ctx;
+     let server = start_iter_server_bytes sockaddr4 in
+     let client = init () in
+     m_true (Lwt.finalize ( fun () ->
+         set_send_queue_limit_exn ~policy:`Block client ~bytes:0 ~count:4;
+         send_raw_string ~buf:"start" client sockaddr4 >>= fun () ->
+         let buf = String.make 100 'b' in
+         let first = Array.init 2 ( fun _ ->
+             send_raw_string ~buf client sockaddr4 ) in
+         (* the byte limit is unset: two queued datagrams are drained *)
+         let drained = Lwt.state (wait_drained client) = Lwt.Return () in
+         let l = Array.init 8 ( fun _ ->
+             send_raw_string ~buf client sockaddr4 ) in
+         (* six of them must wait *)
+         let queued = send_queue_count client in
+         Lwt.join (Array.to_list first @ Array.to_list l) >|= fun () ->
+         drained && queued = 4 && send_queue_count client = 0 &&
+         send_queue_dropped client = 0
+       ) ( fun () -> close_noerr client; Lwt.cancel server; Lwt.return_unit )));
+  ("send_gso">::
+   fun _ctx ->
+     let l addr =
+       let server = start_iter_server_bytes addr in
+       let client = init () in
+       Lwt.finalize ( fun () ->
+           let segment_size = 100 in
+           let s = String.init 350 (fun i -> Char.chr (i mod 256)) in
+           let buf = Bytes.of_string ("xx" ^ s) in
+           send_gso ~pos:2 ~buf ~segment_size client addr >>= fun () ->
+           let buf = Bytes.create 1024 in
+           let rec iter i acc =
+             if i = 0 then
+               Lwt.return acc
+             else
+               recv ~buf client >>= fun x ->
+               iter (pred i) (Bytes.sub_string buf 0 x.recv_len :: acc)
+           in
+           iter 4 [] >|= fun l ->
+           List.sort compare l =
+           List.sort compare [String.sub s 0 100; String.sub s 100 100;
+                              String.sub s 200 100; String.sub s 300 50]
+         ) ( fun () -> close_noerr client; Lwt.cancel server; Lwt.return_unit )
+     in
+     m_true (l sockaddr4));
+  ("send_gso_large">::
+   fun _ctx ->
+     let l addr =
+       let server = start_iter_server_bytes addr in
+       let client = init () in
+       Lwt.finalize ( fun () ->
+           (* more than 64KB: the buffer must be split into several
+              sendmsg calls, 46 segments each *)
+           let segment_size = 1400 in
+           let len = 100_000 in
+           let s = String.init len (fun i -> Char.chr (i mod 251)) in
+           send_gso_string ~buf:s ~segment_size client addr >>= fun () ->
+           let buf = Bytes.create 2048 in
+           let n = (len + segment_size - 1) / segment_size in
+           let rec iter i acc =
+             if i = 0 then
+               Lwt.return acc
+             else
+               recv ~buf client >>= fun x ->
+               iter (pred i) (Bytes.sub_string buf 0 x.recv_len :: acc)
+           in
+           iter n [] >|= fun l ->
+           let rec expected i acc =
+             if i < 0 then acc
+             else
+               let p = i * segment_size in
+               let sub = String.sub s p (min segment_size (len - p)) in
+               expected (pred i) (sub :: acc)
+           in
+           List.sort compare l = List.sort compare (expected (n - 1) [])
+         ) ( fun () -> close_noerr client; Lwt.cancel server; Lwt.return_unit )
+     in
+     m_true (l sockaddr4));
+  ("recv_batch">::
+   fun _ctx ->
+     let l addr =
+       let server = start_iter_server_bytes addr in
+       let client = init () in
+       Lwt.finalize ( fun () ->
+           let cnt = 20 in
+           let payload i = Printf.sprintf "batch %d" i in
+           let msgs = Array.init cnt ( fun i ->
+               let s = payload i in
+               Uwt.Iovec_string(s,0,String.length s), addr )
+           in
+           send_many client msgs >>= fun _ ->
+           let received = ref [] in
+           let sleeper,waker = Lwt.task () in
+           let cb rb n =
+             for i = 0 to n - 1 do
+               let len = (rb.rb_lens.(i) :> int) in
+               if len < 0 || rb.rb_flags.(i) land rb_partial <> 0 then
+                 Lwt.wakeup_exn waker (Failure "recv error")
+               else
+                 let s = Uwt_bytes.to_string
+                     (Uwt_bytes.proxy rb.rb_buf (i * rb.rb_slot_size) len) in
+                 received := s :: !received
+             done;
+             if List.length !received = cnt && Lwt.state sleeper = Lwt.Sleep then
+               Lwt.wakeup waker ()
+           in
+           recv_batch_start_exn ~slots:4 ~slot_size:256 client ~cb;
+           sleeper >|= fun () ->
+           List.sort compare !received =
+           List.sort compare (Array.to_list (Array.init cnt payload))
+         ) ( fun () -> close_noerr client; Lwt.cancel server; Lwt.return_unit )
+     in
+     m_true (l sockaddr4));
+  ("recv_batch_gro">::
+   fun _ctx ->
+     let receiver = init () in
+     let client = init () in
+     let l =
+       Lwt.finalize ( fun () ->
+           let () = bind_exn receiver (Uwt_base.Misc.ip4_addr_exn server_ip 0) in
+           let addr = getsockname_exn receiver in
+           let segment_size = 1000 in
+           let len = 20_000 in
+           let s = String.init len (fun i -> Char.chr (i mod 251)) in
+           let received = ref [] in
+           let n_received = ref 0 in
+           let sleeper,waker = Lwt.task () in
+           let cb rb n =
+             for i = 0 to n - 1 do
+               let len = (rb.rb_lens.(i) :> int) in
+               let seg = if rb.rb_segs.(i) > 0 then rb.rb_segs.(i) else len in
+               if len < 0 || rb.rb_flags.(i) land rb_partial <> 0 then
+                 Lwt.wakeup_exn waker (Failure "recv error")
+               else
+                 let p = ref 0 in
+                 while !p < len do
+                   let l = min seg (len - !p) in
+                   let off = i * rb.rb_slot_size + !p in
+                   let x = Uwt_bytes.to_string (Uwt_bytes.proxy rb.rb_buf off l) in
+                   received := x :: !received;
+                   n_received := !n_received + l;
+                   p := !p + l;
+                 done
+             done;
+             if !n_received = len && Lwt.state sleeper = Lwt.Sleep then
+               Lwt.wakeup waker ()
+           in
+           let x = recv_batch_start ~slots:4 ~gro:true receiver ~cb in
+           if (x :> int) = Uwt.Int_result.enosys then
+             Lwt.return_true (* not linux or kernel too old *)
+           else if Uwt.Int_result.is_error x then
+             Lwt.fail (Uwt.Int_result.to_exn ~name:"recv_batch_start" x)
+           else
+             send_gso_string ~buf:s ~segment_size client addr >>= fun () ->
+             sleeper >|= fun () ->
+             let rec expected i acc =
+               if i < 0 then acc
+               else
+                 let p = i * segment_size in
+                 expected (pred i) (String.sub s p (min segment_size (len - p)) :: acc)
+             in
+             let n = (len + segment_size - 1) / segment_size in
+             List.sort compare !received = List.sort compare (expected (n - 1) [])
+         ) ( fun () -> close_noerr client; close_noerr receiver; Lwt.return_unit )
+     in
+     m_true l);
   ("read_abort">::
    fun _ctx ->
      let server = start_iter_server_ba sockaddr4 in